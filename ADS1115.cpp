@@ -31,15 +31,29 @@ THE SOFTWARE.
 */
 
 #include "I2CdevPi.h"
+#include "I2Cstats.h"
 #include "ADS1115.h"
+#include "vimon_trace.h"
 #include <stdio.h>
 
+// nominal data rates of the ADS1115_RATE_xxx settings
+static const unsigned samplesPerSec[8] = { 8, 16, 32, 64, 128, 250, 475, 860 };
+// wait after a mux switch [ms], at least one conversion
+static const unsigned settleMs[8] = { 128, 64, 32, 16, 8, 4, 3, 2 };
+
 /** Default constructor, uses default I2C address.
  * @see ADS1115_DEFAULT_ADDRESS
  */
 ADS1115::ADS1115() {
     devAddr = ADS1115_DEFAULT_ADDRESS;
+    devMode = ADS1115_MODE_SINGLESHOT;
+    muxMode = ADS1115_MUX_P0_N1;
+    pgaMode = ADS1115_PGA_2P048;
+    rateMode = ADS1115_RATE_128;
     conversionTime = 8;
+    conversionNs = 1000000000UL / 128;
+    conversionMidNs = 0;
+    errorBase = 0;
 }
 
 /** Specific address constructor.
@@ -52,6 +66,14 @@ ADS1115::ADS1115() {
  */
 ADS1115::ADS1115(uint8_t address) {
     devAddr = address;
+    devMode = ADS1115_MODE_SINGLESHOT;
+    muxMode = ADS1115_MUX_P0_N1;
+    pgaMode = ADS1115_PGA_2P048;
+    rateMode = ADS1115_RATE_128;
+    conversionTime = 8;
+    conversionNs = 1000000000UL / 128;
+    conversionMidNs = 0;
+    errorBase = 0;
 }
 
 /** Power on and prepare for general usage.
@@ -62,14 +84,49 @@ ADS1115::ADS1115(uint8_t address) {
  */
 void ADS1115::initialize() {
     //printf ("%s - devAddr:0x%2x\n", __FUNCTION__, devAddr);
-  setMultiplexer(ADS1115_MUX_P0_N1);
-  setGain(ADS1115_PGA_2P048);
-  setMode(ADS1115_MODE_SINGLESHOT);
-  setRate(ADS1115_RATE_128);
-  setComparatorMode(ADS1115_COMP_MODE_HYSTERESIS);
-  setComparatorPolarity(ADS1115_COMP_POL_ACTIVE_LOW);
-  setComparatorLatchEnabled(ADS1115_COMP_LAT_NON_LATCHING);
-  setComparatorQueueMode(ADS1115_COMP_QUE_DISABLE);
+    configure(ADS1115_MUX_P0_N1, ADS1115_PGA_2P048, ADS1115_RATE_128);
+}
+
+/** Probe the device and set up single-shot operation.
+ * The complete CONFIG word (single-shot mode, comparator disabled with its
+ * power-on settings) is built locally and written in one transaction, or
+ * not at all when the register already holds it apart from the mux, which
+ * every conversion sets anyway (a restart finds it on the last channel
+ * scanned). No conversion is started.
+ * @param mux Multiplexer connection setting, unless the write is skipped
+ * @param gain Programmable gain amplifier level
+ * @param rate Data rate
+ * @return True if the device answered and holds the configuration
+ * @see initialize()
+ */
+bool ADS1115::configure(uint8_t mux, uint8_t gain, uint8_t rate) {
+    uint16_t config, muxMask;
+
+    config = (uint16_t)((mux << (ADS1115_CFG_MUX_BIT - ADS1115_CFG_MUX_LENGTH + 1)) |
+        (gain << (ADS1115_CFG_PGA_BIT - ADS1115_CFG_PGA_LENGTH + 1)) |
+        (ADS1115_MODE_SINGLESHOT << ADS1115_CFG_MODE_BIT) |
+        (rate << (ADS1115_CFG_DR_BIT - ADS1115_CFG_DR_LENGTH + 1)) |
+        (ADS1115_COMP_MODE_HYSTERESIS << ADS1115_CFG_COMP_MODE_BIT) |
+        (ADS1115_COMP_POL_ACTIVE_LOW << ADS1115_CFG_COMP_POL_BIT) |
+        (ADS1115_COMP_LAT_NON_LATCHING << ADS1115_CFG_COMP_LAT_BIT) |
+        (ADS1115_COMP_QUE_DISABLE << (ADS1115_CFG_COMP_QUE_BIT - ADS1115_CFG_COMP_QUE_LENGTH + 1)));
+
+    muxMask = (uint16_t)(((1 << ADS1115_CFG_MUX_LENGTH) - 1) << (ADS1115_CFG_MUX_BIT - ADS1115_CFG_MUX_LENGTH + 1));
+
+    // the readback doubles as the connection test, OS reads as status
+    if (I2Cdev::readWord(devAddr, ADS1115_RA_CONFIG, buffer) <= 0 || buffer[0] == 0xFFFF)
+        return false;
+    if ((buffer[0] & 0x7FFF & ~muxMask) == (config & ~muxMask)) {
+        mux = (uint8_t)((buffer[0] & muxMask) >> (ADS1115_CFG_MUX_BIT - ADS1115_CFG_MUX_LENGTH + 1));
+    } else if (!I2Cdev::writeWord(devAddr, ADS1115_RA_CONFIG, config)) {
+        return false;
+    }
+
+    devMode = ADS1115_MODE_SINGLESHOT;
+    muxMode = mux;
+    pgaMode = gain;
+    rateChanged(rate);
+    return true;
 }
 
 /** Verify the I2C connection.
@@ -77,7 +134,8 @@ void ADS1115::initialize() {
  * @return True if connection is valid, false otherwise
  */
 bool ADS1115::testConnection() {
-    I2Cdev::readWord(devAddr, ADS1115_RA_CONFIG, buffer);
+    if (I2Cdev::readWord(devAddr, ADS1115_RA_CONFIG, buffer) <= 0)
+        return false;               // no acknowledge
     //printf("%s - CONFIG:<%04x>\n", __PRETTY_FUNCTION__, buffer[0]);
 
     if (buffer[0] != 0xFFFF)        // 0xFFFF = device not connected
@@ -86,15 +144,42 @@ bool ADS1115::testConnection() {
     return false;
 }
 
+/** Track I2C errors of this device.
+ * Failed transactions are counted per thread by I2Cdev, hasError() reports
+ * whether any transaction of the calling thread failed since clearError().
+ * Call both from the thread which drives the device.
+ */
+void ADS1115::clearError() {
+    errorBase = I2Cdev::getErrorCount();
+}
+
+/** Check for I2C errors since clearError().
+ * @return True if a transaction failed
+ */
+bool ADS1115::hasError() {
+    return I2Cdev::getErrorCount() != errorBase;
+}
+
 /** Wait until the single-shot conversion is finished
  * Retry at most 'max_retries' times
  * conversion is finished, then return;
+ * Polling stops at the first failed status read, a device which dropped
+ * off the bus does not keep the caller busy for 'max_retries' reads.
+ * @return True if the conversion finished, false on error or timeout
  * @see ADS1115_OS_INACTIVE
  */
-void ADS1115::waitBusy(uint16_t max_retries) {  
-  for(uint16_t i = 0; i < max_retries; i++) {
-    if (getOpStatus()==ADS1115_OS_INACTIVE) break;    
+bool ADS1115::waitBusy(uint16_t max_retries) {  
+  uint16_t i;
+  uint32_t errors = I2Cdev::getErrorCount();
+  VIMON_TRACE_SPAN("waitBusy");
+  for(i = 0; i < max_retries; i++) {
+    VIMON_TRACE_SPAN("poll");
+    // OS reads 1 when no conversion is in progress
+    if (getOpStatus() != 0) break;
+    if (I2Cdev::getErrorCount() != errors) break;
   }
+  I2Cstats::recordPolls(I2Cdev::getBus(), devAddr, (i < max_retries) ? i + 1 : i);
+  return (i < max_retries) && (I2Cdev::getErrorCount() == errors);
 }
 
 /** Read differential value based on current MUX configuration.
@@ -112,7 +197,7 @@ void ADS1115::waitBusy(uint16_t max_retries) {
  * effortless, but it has enormous potential to save power by only running the
  * comparison circuitry when needed.
  *
- * @return 16-bit signed differential value
+ * @return 16-bit signed differential value, 0 on error (see hasError())
  * @see getConversionP0N1();
  * @see getConversionPON3();
  * @see getConversionP1N3();
@@ -133,17 +218,71 @@ void ADS1115::waitBusy(uint16_t max_retries) {
  * @see ADS1115_MUX_P3_NG
  */
 int16_t ADS1115::getConversion() {
-    uint16_t value;
+    uint16_t value = 0;
+    uint32_t errors = I2Cdev::getErrorCount();
+    uint64_t start, done;
     if (devMode == ADS1115_MODE_SINGLESHOT) 
     {
         //printf("%s - reading single shot\n", __PRETTY_FUNCTION__);
-      setOpStatus(ADS1115_OS_ACTIVE);
-      ADS1115::waitBusy(I2CDEV_DEFAULT_READ_TIMEOUT);
+      {
+        VIMON_TRACE_SPAN("trigger");
+        setOpStatus(ADS1115_OS_ACTIVE);
+      }
+      // the conversion starts when the trigger write completes
+      start = I2Cstats::now();
+      // do not poll a device which did not take the trigger
+      if (I2Cdev::getErrorCount() != errors || !ADS1115::waitBusy(I2CDEV_DEFAULT_READ_TIMEOUT))
+        return 0;
+      // nominal mid-point, but not later than the poll which saw it finished
+      done = I2Cstats::now();
+      if (start + conversionNs > done)
+        conversionMidNs = start + (done - start) / 2;
+      else
+        conversionMidNs = start + conversionNs / 2;
+    } else {
+      // continuous: the register holds the last finished conversion
+      conversionMidNs = I2Cstats::now() - conversionNs / 2;
     }
+    VIMON_TRACE_SPAN("readConversion");
     I2Cdev::readWord(devAddr, ADS1115_RA_CONVERSION, &value);
     //printf("%s - raw value:<%04x>\n", __PRETTY_FUNCTION__, value);
     return value;
 }
+/** Time of the last conversion.
+ * Single-shot: estimated mid-point from the trigger and the nominal
+ * conversion time of the data rate, bounded by the status poll which saw
+ * the conversion finished. Continuous: half a conversion time before the
+ * result was read.
+ * @return I2Cclock::now() [ns], 0 before the first conversion
+ */
+uint64_t ADS1115::getConversionTimestamp() {
+    return conversionMidNs;
+}
+
+/** Get a conversion of any input at any gain.
+ * This changes the MUX and PGA settings if necessary (in one register
+ * update), triggers a new measurement, then gets the value currently in
+ * the CONVERSION register.
+ * @param mux Multiplexer connection (ADS1115_MUX_xxx)
+ * @param gain Programmable gain amplifier level (ADS1115_PGA_xxx)
+ * @return 16-bit signed value at "gain", 0 on error (see hasError())
+ * @see getConversion()
+ * @see getMvPerCount(uint8_t)
+ */
+int16_t ADS1115::getConversion(uint8_t mux, uint8_t gain) {
+    return getConversion(mux, gain, rateMode);
+}
+/** Get a conversion of any input at any gain and data rate.
+ * Like getConversion(mux, gain), the data rate is changed in the same
+ * register update.
+ * @param rate Data rate (ADS1115_RATE_xxx)
+ * @return 16-bit signed value at "gain", 0 on error (see hasError())
+ */
+int16_t ADS1115::getConversion(uint8_t mux, uint8_t gain, uint8_t rate) {
+    if (muxMode != mux || pgaMode != gain || rateMode != rate) setMultiplexer(mux, gain, rate);
+    return getConversion();
+}
+
 /** Get AIN0/N1 differential.
  * This changes the MUX setting to AIN0/N1 if necessary, triggers a new
  * measurement (also only if necessary), then gets the differential value
@@ -320,7 +459,15 @@ float ADS1115::getMilliVoltsP3GND() {
  */
  
 float ADS1115::getMvPerCount() {
-  switch (pgaMode) {
+  return getMvPerCount(pgaMode);
+}
+
+/**
+ * Return the multiplier of a PGA setting.
+ * @param gain Programmable gain amplifier level (ADS1115_PGA_xxx)
+ */
+float ADS1115::getMvPerCount(uint8_t gain) {
+  switch (gain) {
     case ADS1115_PGA_6P144:
       return ADS1115_MV_6P144;
       break;    
@@ -356,7 +503,8 @@ float ADS1115::getMvPerCount() {
  */
 uint8_t ADS1115::getOpStatus() {
     I2Cdev::readBitW(devAddr, ADS1115_RA_CONFIG, ADS1115_CFG_OS_BIT, buffer);
-    return (uint8_t)buffer[0];
+    // readBitW returns the bit in place (0x8000), not right aligned
+    return (buffer[0] != 0) ? 1 : 0;
 }
 /** Set operational status.
  * This bit can only be written while in power-down mode (no conversions active).
@@ -380,7 +528,11 @@ uint8_t ADS1115::getMultiplexer() {
 }
 /** Set multiplexer connection.  Continous mode may fill the conversion register
  * with data before the MUX setting has taken effect.  A stop/start of the conversion
- * is done to reset the values.
+ * is done to reset the values, followed by a wait for one conversion (see
+ * getSettleNs()). In single-shot mode the next conversion is started after the
+ * switch and converts the new input, there is no wait. An input which settles
+ * slowly behind the mux (high source impedance) is handled by the caller, see
+ * VImon::measureSettling().
  * @param mux New multiplexer connection setting
  * @see ADS1115_MUX_P0_N1
  * @see ADS1115_MUX_P0_N3
@@ -395,23 +547,57 @@ uint8_t ADS1115::getMultiplexer() {
  * @see ADS1115_CFG_MUX_LENGTH
  */
 void ADS1115::setMultiplexer(uint8_t mux) {
-    if (I2Cdev::writeBitsW(devAddr, ADS1115_RA_CONFIG, ADS1115_CFG_MUX_BIT, ADS1115_CFG_MUX_LENGTH, mux)) {
+    setMultiplexer(mux, pgaMode);
+}
+/** Set multiplexer connection and programmable gain amplifier level.
+ * MUX and PGA are adjacent fields of the CONFIG register and are changed
+ * together, a gain change costs no transaction beyond the mux switch.
+ * @param mux New multiplexer connection setting
+ * @param gain New programmable gain amplifier level
+ * @see setMultiplexer(uint8_t)
+ * @see setGain()
+ */
+void ADS1115::setMultiplexer(uint8_t mux, uint8_t gain) {
+    setMultiplexer(mux, gain, rateMode);
+}
+/** Set multiplexer connection, gain and data rate.
+ * MUX, PGA, MODE and DR span bits 14 to 5 of the CONFIG register and are
+ * changed in one register update.
+ * @param mux New multiplexer connection setting
+ * @param gain New programmable gain amplifier level
+ * @param rate New data rate
+ * @see setMultiplexer(uint8_t)
+ * @see setRate()
+ */
+void ADS1115::setMultiplexer(uint8_t mux, uint8_t gain, uint8_t rate) {
+    bool ok;
+    VIMON_TRACE_SPAN("setMultiplexer");
+    if (rate == rateMode)
+        ok = I2Cdev::writeBitsW(devAddr, ADS1115_RA_CONFIG, ADS1115_CFG_MUX_BIT,
+            ADS1115_CFG_MUX_LENGTH + ADS1115_CFG_PGA_LENGTH, (uint16_t)((mux << 3) | gain));
+    else
+        ok = I2Cdev::writeBitsW(devAddr, ADS1115_RA_CONFIG, ADS1115_CFG_MUX_BIT,
+            ADS1115_CFG_MUX_BIT - ADS1115_CFG_DR_BIT + ADS1115_CFG_DR_LENGTH,
+            (uint16_t)((mux << 7) | (gain << 4) | (devMode << 3) | rate));
+    if (ok) {
         muxMode = mux;
+        pgaMode = gain;
+        rateChanged(rate);
 
-        // Force new mux setting is used for next reading
-        setOpStatus(ADS1115_OS_ACTIVE);
+        // single-shot: the next trigger converts the new input, nothing to wait for
         if (devMode == ADS1115_MODE_CONTINUOUS) {
+            // Force new mux setting is used for next reading
+            setOpStatus(ADS1115_OS_ACTIVE);
             setMode(ADS1115_MODE_SINGLESHOT);
             setOpStatus(ADS1115_OS_ACTIVE);
             setMode(ADS1115_MODE_CONTINUOUS);
-        } else {
-            setOpStatus(ADS1115_OS_ACTIVE);
+
+            // need to wait for at least one conversion
+            VIMON_TRACE_SPAN("settle");
+            I2Cdev::delay(conversionTime);
         }
-        
-        // need to wait for at least one conversion
-        I2Cdev::delay(conversionTime);
     }
-    
+
 }
 /** Get programmable gain amplifier level.
  * @return Current programmable gain amplifier level
@@ -499,36 +685,42 @@ uint8_t ADS1115::getRate() {
  * @see ADS1115_CFG_DR_LENGTH
  */
 void ADS1115::setRate(uint8_t rate) {
-    I2Cdev::writeBitsW(devAddr, ADS1115_RA_CONFIG, ADS1115_CFG_DR_BIT, ADS1115_CFG_DR_LENGTH, rate);
-    switch (rate) {
-        case ADS1115_RATE_8:
-            conversionTime = 128;
-            break;
-        case ADS1115_RATE_16:
-            conversionTime = 64;
-            break;
-        case ADS1115_RATE_32:
-            conversionTime = 32;
-            break;
-        case ADS1115_RATE_64:
-            conversionTime = 16;
-            break;
-        case ADS1115_RATE_128:
-            conversionTime = 8;
-            break;
-        case ADS1115_RATE_250:
-            conversionTime = 4;
-            break;
-        case ADS1115_RATE_475:
-            conversionTime = 3;
-            break;
-        case ADS1115_RATE_860:
-            conversionTime = 2;
-            break;
-            
-        default:
-            break;
-    }
+    if (I2Cdev::writeBitsW(devAddr, ADS1115_RA_CONFIG, ADS1115_CFG_DR_BIT, ADS1115_CFG_DR_LENGTH, rate))
+        rateChanged(rate);
+}
+/** Track the timing of a new data rate.
+ * @param rate New data rate
+ */
+void ADS1115::rateChanged(uint8_t rate) {
+    rateMode = rate & 0x07;
+    conversionTime = settleMs[rateMode];
+    conversionNs = getConversionNs(rateMode);
+}
+/** Nominal conversion time of a data rate.
+ * @param rate Data rate (ADS1115_RATE_xxx)
+ * @return Conversion time [ns]
+ */
+uint32_t ADS1115::getConversionNs(uint8_t rate) {
+    return 1000000000UL / samplesPerSec[rate & 0x07];
+}
+/** Data rate setting for a number of samples per second.
+ * @param sps Samples per second
+ * @return Slowest ADS1115_RATE_xxx with at least "sps", ADS1115_RATE_860 above
+ */
+uint8_t ADS1115::getRateSetting(unsigned sps) {
+    uint8_t i;
+    for (i = 0; i < 7; i++)
+        if (sps <= samplesPerSec[i]) break;
+    return i;
+}
+/** Time a mux switch waits before the conversion of the new input.
+ * Continuous mode only, single-shot mode does not wait.
+ * @param rate Data rate (ADS1115_RATE_xxx)
+ * @return Settle time [ns]
+ * @see setMultiplexer()
+ */
+uint32_t ADS1115::getSettleNs(uint8_t rate) {
+    return settleMs[rate & 0x07] * 1000000UL;
 }
 /** Get comparator mode.
  * @return Current comparator mode
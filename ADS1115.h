@@ -135,13 +135,21 @@ class ADS1115 {
         ADS1115(uint8_t address);
         
         void initialize();
+        bool configure(uint8_t mux, uint8_t gain, uint8_t rate);
         bool testConnection();
         
+        // I2C error tracking
+        void clearError();
+        bool hasError();
+
         // SINGLE SHOT utilities
-        void waitBusy(uint16_t max_retries);
+        bool waitBusy(uint16_t max_retries);
 
         // Read the current CONVERSION register
         int16_t getConversion();
+        int16_t getConversion(uint8_t mux, uint8_t gain);
+        int16_t getConversion(uint8_t mux, uint8_t gain, uint8_t rate);
+        uint64_t getConversionTimestamp();
         
         // Differential
         int16_t getConversionP0N1();
@@ -158,6 +166,7 @@ class ADS1115 {
         // Utility
         float getMilliVolts(); 
         float getMvPerCount();
+        static float getMvPerCount(uint8_t gain);
     float getMilliVoltsP0N1();
     float getMilliVoltsP0N3();
     float getMilliVoltsP1N3();
@@ -173,12 +182,17 @@ class ADS1115 {
         void setOpStatus(uint8_t op);
         uint8_t getMultiplexer();
         void setMultiplexer(uint8_t mux);
+        void setMultiplexer(uint8_t mux, uint8_t gain);
+        void setMultiplexer(uint8_t mux, uint8_t gain, uint8_t rate);
         uint8_t getGain();
         void setGain(uint8_t gain);
         uint8_t getMode();
         void setMode(uint8_t mode);
         uint8_t getRate();
         void setRate(uint8_t rate);
+        static uint32_t getConversionNs(uint8_t rate);
+        static uint8_t getRateSetting(unsigned sps);
+        static uint32_t getSettleNs(uint8_t rate);
         uint8_t getComparatorMode();
         void setComparatorMode(uint8_t mode);
         uint8_t getComparatorPolarity();
@@ -203,7 +217,13 @@ class ADS1115 {
         uint8_t devMode;
         uint8_t muxMode;
         uint8_t pgaMode;
+        uint8_t rateMode;
     unsigned int conversionTime;
+        uint32_t conversionNs;
+        uint64_t conversionMidNs;
+        uint32_t errorBase;
+
+        void rateChanged(uint8_t rate);
 };
 
 #endif /* _ADS1115_H_ */
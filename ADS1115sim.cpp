@@ -0,0 +1,245 @@
+// I2Cdev library collection - simulated I2C bus and ADS1115 device
+//
+
+#include <string.h>
+
+#include "ADS1115sim.h"
+#include "I2Cclock.h"
+
+/*********************************************************************
+ I2CbusSim
+ *********************************************************************/
+
+I2CbusSim::I2CbusSim(uint32_t clockHz) {
+    clock = clockHz;
+    memset(devices, 0, sizeof(devices));
+    resetCounters();
+}
+
+void I2CbusSim::attach(uint8_t devAddr, I2CsimDevice *device) {
+    devices[devAddr & 0x7F] = device;
+}
+
+void I2CbusSim::detach(uint8_t devAddr) {
+    devices[devAddr & 0x7F] = NULL;
+}
+
+void I2CbusSim::resetCounters() {
+    memset(&counters, 0, sizeof(counters));
+}
+
+/** Occupy the bus for the duration of a transfer.
+ * Every byte takes 9 clocks (8 data + ACK), start/stop conditions are
+ * not accounted for.
+ */
+void I2CbusSim::transfer(unsigned bytes) {
+    uint64_t ns;
+
+    if (clock == 0) return;
+    ns = (uint64_t)bytes * 9 * 1000000000ULL / clock;
+    counters.busyNs += ns;
+    I2Cclock::sleepNs(ns);
+}
+
+int I2CbusSim::readReg8(uint8_t devAddr, uint8_t regAddr) {
+    int value = readReg16(devAddr, regAddr);
+    return (value < 0) ? value : (value >> 8);
+}
+
+int I2CbusSim::readReg16(uint8_t devAddr, uint8_t regAddr) {
+    I2CsimDevice *dev = devices[devAddr & 0x7F];
+    counters.reads++;
+    if (dev == NULL) {
+        transfer(1);        // address byte, not acknowledged
+        counters.naks++;
+        return -1;
+    }
+    // address+W, register, address+R, 2 data bytes
+    transfer(5);
+    return dev->readReg(regAddr);
+}
+
+int I2CbusSim::writeReg8(uint8_t devAddr, uint8_t regAddr, uint8_t data) {
+    return writeReg16(devAddr, regAddr, (uint16_t)data << 8);
+}
+
+int I2CbusSim::writeReg16(uint8_t devAddr, uint8_t regAddr, uint16_t data) {
+    I2CsimDevice *dev = devices[devAddr & 0x7F];
+    counters.writes++;
+    if (dev == NULL) {
+        transfer(1);
+        counters.naks++;
+        return -1;
+    }
+    // address+W, register, 2 data bytes
+    transfer(4);
+    return dev->writeReg(regAddr, data);
+}
+
+/*********************************************************************
+ ADS1115sim
+ *********************************************************************/
+
+#define CFG_OS          (1 << ADS1115_CFG_OS_BIT)
+#define CFG_MODE        (1 << ADS1115_CFG_MODE_BIT)
+#define CFG_MUX(c)      (((c) >> 12) & 0x07)
+#define CFG_PGA(c)      (((c) >> 9) & 0x07)
+#define CFG_DR(c)       (((c) >> 5) & 0x07)
+
+static const float fullScaleMv[8] = { 6144.0, 4096.0, 2048.0, 1024.0, 512.0, 256.0, 256.0, 256.0 };
+static const unsigned samplesPerSec[8] = { 8, 16, 32, 64, 128, 250, 475, 860 };
+
+ADS1115sim::ADS1115sim() {
+    reset();
+    memset(input, 0, sizeof(input));
+    memset(settling, 0, sizeof(settling));
+    noise = 0.0;
+    lastMux = 0xFF;
+    lastMv = 0.0;
+    residual = 0.0;
+    rng = 0x12345678;
+    signal = NULL;
+    signalContext = NULL;
+    conversions = 0;
+}
+
+void ADS1115sim::reset() {
+    config = 0x8583;        // power-on default
+    conversion = 0;
+    loThresh = (int16_t)0x8000;
+    hiThresh = 0x7FFF;
+    busy = false;
+    convEnd = 0;
+}
+
+/** Conversion time for a data rate setting.
+ * @param rate ADS1115_RATE_xxx
+ * @return Conversion time [ns]
+ */
+uint64_t ADS1115sim::conversionNs(uint8_t rate) {
+    return 1000000000ULL / samplesPerSec[rate & 0x07];
+}
+
+void ADS1115sim::setInput(int pin, float mv) {
+    if (pin >= 0 && pin < 4)
+        input[pin] = mv;
+}
+
+void ADS1115sim::setSettling(int pin, float share) {
+    if (pin >= 0 && pin < 4)
+        settling[pin] = share;
+}
+
+void ADS1115sim::setSignal(ADS1115simSignal fn, void *context) {
+    signal = fn;
+    signalContext = context;
+}
+
+float ADS1115sim::pin(int n, uint64_t ns) {
+    if (signal != NULL)
+        return signal(n, ns, signalContext);
+    return input[n];
+}
+
+/** Produce the conversion result for the current MUX and PGA settings.
+ */
+int16_t ADS1115sim::convert(uint64_t ns) {
+    float vp, vn, mv, code;
+    int p;
+
+    switch (CFG_MUX(config)) {
+        case ADS1115_MUX_P0_N1: p = 0; vp = pin(0, ns); vn = pin(1, ns); break;
+        case ADS1115_MUX_P0_N3: p = 0; vp = pin(0, ns); vn = pin(3, ns); break;
+        case ADS1115_MUX_P1_N3: p = 1; vp = pin(1, ns); vn = pin(3, ns); break;
+        case ADS1115_MUX_P2_N3: p = 2; vp = pin(2, ns); vn = pin(3, ns); break;
+        case ADS1115_MUX_P0_NG: p = 0; vp = pin(0, ns); vn = 0.0; break;
+        case ADS1115_MUX_P1_NG: p = 1; vp = pin(1, ns); vn = 0.0; break;
+        case ADS1115_MUX_P2_NG: p = 2; vp = pin(2, ns); vn = 0.0; break;
+        default:                p = 3; vp = pin(3, ns); vn = 0.0; break;
+    }
+    mv = vp - vn;
+    // part of the previous input still on the sampling capacitor
+    if (CFG_MUX(config) != lastMux)
+        residual = (lastMv - mv) * settling[p];
+    else
+        residual *= settling[p];
+    lastMux = CFG_MUX(config);
+    mv += residual;
+    lastMv = mv;
+    if (noise > 0.0) {
+        // xorshift32, deterministic for repeatable runs
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        mv += noise * (((float)(rng & 0xFFFF) / 32768.0f) - 1.0f);
+    }
+    code = mv * 32768.0f / fullScaleMv[CFG_PGA(config)];
+    if (code > 32767.0f) return 32767;
+    if (code < -32768.0f) return -32768;
+    return (int16_t)code;
+}
+
+/** Advance the conversion state to "now".
+ */
+void ADS1115sim::update(uint64_t now) {
+    uint64_t period;
+
+    if (!busy || now < convEnd)
+        return;
+    if (config & CFG_MODE) {
+        // single-shot: result latched, back to power-down
+        conversion = convert(convEnd);
+        busy = false;
+    } else {
+        // continuous: skip to the most recent completed conversion
+        period = conversionNs(CFG_DR(config));
+        convEnd += ((now - convEnd) / period) * period;
+        conversion = convert(convEnd);
+        conversions++;
+        convEnd += period;
+    }
+}
+
+int ADS1115sim::readReg(uint8_t regAddr) {
+    update(I2Cclock::now());
+    switch (regAddr) {
+        case ADS1115_RA_CONVERSION:
+            return (uint16_t)conversion;
+        case ADS1115_RA_CONFIG:
+            // OS reads 0 while a conversion is in progress
+            return (config & ~CFG_OS) | (busy ? 0 : CFG_OS);
+        case ADS1115_RA_LO_THRESH:
+            return (uint16_t)loThresh;
+        case ADS1115_RA_HI_THRESH:
+            return (uint16_t)hiThresh;
+    }
+    return -1;
+}
+
+int ADS1115sim::writeReg(uint8_t regAddr, uint16_t data) {
+    uint64_t now = I2Cclock::now();
+    update(now);
+    switch (regAddr) {
+        case ADS1115_RA_CONFIG:
+            config = data & ~CFG_OS;
+            if (!(config & CFG_MODE)) {
+                // continuous mode, (re)start conversions with the new setting
+                busy = true;
+                convEnd = now + conversionNs(CFG_DR(config));
+                conversions++;
+            } else if ((data & CFG_OS) && !busy) {
+                // single-shot start, ignored while a conversion is running
+                busy = true;
+                convEnd = now + conversionNs(CFG_DR(config));
+                conversions++;
+            }
+            return 0;
+        case ADS1115_RA_LO_THRESH:
+            loThresh = (int16_t)data;
+            return 0;
+        case ADS1115_RA_HI_THRESH:
+            hiThresh = (int16_t)data;
+            return 0;
+    }
+    return -1;
+}
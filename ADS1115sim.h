@@ -0,0 +1,125 @@
+// I2Cdev library collection - simulated I2C bus and ADS1115 device
+//
+// I2CbusSim is an I2Cbus backend which serves register access from
+// simulated devices instead of hardware. It models the time a transaction
+// occupies the bus and counts every transaction.
+//
+// ADS1115sim models the ADS1115 register set: single-shot and continuous
+// conversions with the configured data rate, the OS busy bit, MUX and PGA
+// settings including clipping at full scale. Input voltages are set per
+// AIN pin, optionally through a signal function.
+//
+// Both follow the clock of the process (I2Cclock.h). Under virtual time
+// the transaction time model is what moves the clock while a driver polls
+// for the end of a conversion, keep the bus clock above 0 there.
+//
+
+#ifndef _ADS1115SIM_H_
+#define _ADS1115SIM_H_
+
+#include <stdint.h>
+
+#include "I2CdevPi.h"
+#include "ADS1115.h"
+
+#define I2CSIM_DEFAULT_CLOCK    100000  // bus clock [Hz]
+
+/** A device attached to I2CbusSim.
+ * Register values are in host byte order, return < 0 to NAK.
+ */
+class I2CsimDevice {
+public:
+    virtual ~I2CsimDevice() {}
+    virtual int readReg(uint8_t regAddr) = 0;
+    virtual int writeReg(uint8_t regAddr, uint16_t data) = 0;
+};
+
+/** Transaction counters of a simulated bus.
+ */
+struct I2CsimCounters {
+    uint64_t reads;         // read transactions
+    uint64_t writes;        // write transactions
+    uint64_t naks;          // transactions to an absent device
+    uint64_t busyNs;        // time the bus was occupied
+};
+
+class I2CbusSim : public I2Cbus {
+public:
+    // clockHz = 0 disables the transaction time model
+    I2CbusSim(uint32_t clockHz = I2CSIM_DEFAULT_CLOCK);
+
+    void attach(uint8_t devAddr, I2CsimDevice *device);
+    void detach(uint8_t devAddr);
+
+    int readReg8(uint8_t devAddr, uint8_t regAddr);
+    int readReg16(uint8_t devAddr, uint8_t regAddr);
+    int writeReg8(uint8_t devAddr, uint8_t regAddr, uint8_t data);
+    int writeReg16(uint8_t devAddr, uint8_t regAddr, uint16_t data);
+
+    void setClock(uint32_t clockHz) { clock = clockHz; }
+    uint32_t getClock() { return clock; }
+
+    I2CsimCounters counters;
+    void resetCounters();
+
+private:
+    void transfer(unsigned bytes);
+
+    uint32_t clock;
+    I2CsimDevice *devices[128];
+};
+
+// signal source: returns the voltage [mV] on "pin" at monotonic time "ns"
+typedef float (*ADS1115simSignal)(int pin, uint64_t ns, void *context);
+
+class ADS1115sim : public I2CsimDevice {
+public:
+    ADS1115sim();
+
+    // power cycle: registers return to their power-on defaults
+    void reset();
+
+    int readReg(uint8_t regAddr);
+    int writeReg(uint8_t regAddr, uint16_t data);
+
+    // AIN pin voltages against GND [mV]
+    void setInput(int pin, float mv);
+    void setSignal(ADS1115simSignal signal, void *context);
+    // peak amplitude of uniform noise added to every conversion [mV]
+    void setNoise(float mv) { noise = mv; }
+    /* settling behind the mux: share of the previous input left on the
+     * sampling capacitor by the first conversion after a switch to "pin",
+     * each further conversion leaves the same share of the rest. Grows
+     * with the source impedance, 0 (the default) settles at once */
+    void setSettling(int pin, float share);
+
+    // number of conversions started
+    uint64_t conversions;
+
+    static uint64_t conversionNs(uint8_t rate);
+
+private:
+    void update(uint64_t now);
+    int16_t convert(uint64_t ns);
+    float pin(int n, uint64_t ns);
+
+    uint16_t config;
+    int16_t conversion;
+    int16_t loThresh;
+    int16_t hiThresh;
+
+    bool busy;
+    uint64_t convEnd;       // end of current conversion [ns]
+
+    float input[4];
+    float settling[4];
+    float noise;
+    uint8_t lastMux;        // of the previous conversion
+    float lastMv;
+    float residual;         // of the previous input [mV]
+    uint32_t rng;
+    ADS1115simSignal signal;
+    void *signalContext;
+};
+
+#endif /* _ADS1115SIM_H_ */
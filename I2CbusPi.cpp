@@ -0,0 +1,100 @@
+// I2Cdev for Raspberry Pi library collection - wiringPi I2C bus backend
+// Copyright 2015-07-23 Erwin Bejsta
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <wiringPi.h>
+#include <wiringPiI2C.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <byteswap.h>
+#include <sys/ioctl.h>
+
+#include "I2CdevPi.h"
+
+// I2C definitions
+#define I2C_SLAVE	0x0703
+
+/** Constructor.
+ * @param busNumber I2C adapter number, < 0 selects the default bus
+ *        for the board revision (/dev/i2c-0 on rev 1, /dev/i2c-1 otherwise)
+ */
+I2CbusPi::I2CbusPi(int busNumber) {
+    if (busNumber < 0)
+        busNumber = (piBoardRev() == 1) ? 0 : 1;
+    snprintf(deviceName, sizeof(deviceName), "/dev/i2c-%d", busNumber);
+    handle = -1;
+    currentDevAddr = 0;
+    // Initialize WiringPi, have it return errors instead of exiting the
+    // process when the device can not be opened
+    setenv ("WIRINGPI_CODES", "1", 0) ;
+    wiringPiSetupSys () ;
+    //fprintf(stderr, "%s - using %s\n", __FUNCTION__, deviceName );
+}
+
+I2CbusPi::~I2CbusPi() {
+    if (handle >= 0)
+        close(handle);
+}
+
+/**
+ * Open the I2C device if required
+ * Change device address if required
+ * The device file stays open for the duration, different devices are accessed by changing
+ * the address only.
+ */
+bool I2CbusPi::openDevice (uint8_t devAddr) {
+    // is the device already open?
+    if (handle < 0) {
+        // not open -> open device
+        handle = wiringPiI2CSetupInterface (deviceName, (int) devAddr);
+        //fprintf(stderr, "%s - Device <0x%02x> handle is %d\n", __PRETTY_FUNCTION__, devAddr, handle);
+        // all done
+        if (handle >= 0) {
+            currentDevAddr = devAddr;
+            return true;
+        }
+        return false;
+    } else {
+        // device is already open, check if device address is current
+        if (currentDevAddr != devAddr) {
+            //fprintf(stderr, "%s - Changing Device <0x%02x> to <0x%02x>\n", __PRETTY_FUNCTION__, currentDevAddr, devAddr);
+            // not the same, need to change device address
+            if (ioctl (handle, I2C_SLAVE, devAddr) < 0) {
+                fprintf(stderr, "%s - Unable to select I2C device <0x%02x>: %s\n", __FUNCTION__, devAddr, strerror (errno)) ;
+                return false;
+            } else {
+                currentDevAddr = devAddr;
+            }
+        }
+    }
+    return true;
+}
+
+int I2CbusPi::readReg8(uint8_t devAddr, uint8_t regAddr) {
+    if (!openDevice(devAddr)) return -1;
+    return wiringPiI2CReadReg8(handle, regAddr);
+}
+
+/** Read a 16-bit register.
+ * SMBus transfers the low byte first, the ADS1115 sends MSB first.
+ */
+int I2CbusPi::readReg16(uint8_t devAddr, uint8_t regAddr) {
+    int value;
+    if (!openDevice(devAddr)) return -1;
+    value = wiringPiI2CReadReg16(handle, regAddr);
+    if (value < 0) return value;
+    return __bswap_16 ((uint16_t)value);
+}
+
+int I2CbusPi::writeReg8(uint8_t devAddr, uint8_t regAddr, uint8_t data) {
+    if (!openDevice(devAddr)) return -1;
+    return wiringPiI2CWriteReg8(handle, regAddr, data);
+}
+
+int I2CbusPi::writeReg16(uint8_t devAddr, uint8_t regAddr, uint16_t data) {
+    if (!openDevice(devAddr)) return -1;
+    return wiringPiI2CWriteReg16(handle, regAddr, __bswap_16 (data));
+}
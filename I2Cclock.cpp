@@ -0,0 +1,60 @@
+// I2Cdev library collection - clock
+//
+
+#include <errno.h>
+#include <time.h>
+
+#include "I2Cclock.h"
+
+static I2CclockSystem systemClock;
+
+I2Cclock *I2Cclock::current = &systemClock;
+
+void I2Cclock::set(I2Cclock *clock) {
+    current = (clock != NULL) ? clock : &systemClock;
+}
+
+uint64_t I2Cclock::systemNs() {
+    return systemClock.monotonic();
+}
+
+/*********************************************************************
+ I2CclockSystem
+ *********************************************************************/
+
+uint64_t I2CclockSystem::monotonic() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t I2CclockSystem::realtime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void I2CclockSystem::sleepUntil(uint64_t monotonicNs) {
+    struct timespec ts;
+
+    ts.tv_sec = monotonicNs / 1000000000ULL;
+    ts.tv_nsec = monotonicNs % 1000000000ULL;
+    // an absolute deadline, a signal only interrupts the wait
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) ;
+}
+
+/*********************************************************************
+ I2CclockVirtual
+ *********************************************************************/
+
+I2CclockVirtual::I2CclockVirtual(uint64_t epoch) : time(I2CCLOCK_VIRTUAL_START) {
+    this->epoch = epoch;
+}
+
+void I2CclockVirtual::sleepUntil(uint64_t monotonicNs) {
+    uint64_t t = time.load(std::memory_order_relaxed);
+
+    // never back, a thread waking earlier finds the time already passed
+    while (t < monotonicNs && !time.compare_exchange_weak(t, monotonicNs, std::memory_order_acq_rel))
+        ;
+}
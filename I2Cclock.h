@@ -0,0 +1,79 @@
+// I2Cdev library collection - clock
+//
+// The time base of the drivers and everything timed by conversions:
+// bus delays, conversion timestamps, the simulated ADS1115, the channel
+// scheduler and the sample timestamps. By default it is the system clock
+// (CLOCK_MONOTONIC, CLOCK_REALTIME).
+//
+// I2CclockVirtual replaces it for simulations: time stands still while
+// the code runs and jumps ahead when it sleeps, so a day of acquisition
+// against ADS1115sim runs at CPU speed and gives the same result on every
+// run. It is meant for one thread doing the timed work, other threads see
+// the time that thread has reached. Socket, file and signal handling
+// threads keep the system clock.
+//
+// Usage:
+//  I2CclockVirtual virtualTime;
+//  I2Cclock::set(&virtualTime);       // before the first reading
+//  ...
+//  I2Cclock::set(NULL);                // back to the system clock
+//
+
+#ifndef _I2CCLOCK_H_
+#define _I2CCLOCK_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+#define I2CCLOCK_VIRTUAL_START  1000000000ULL           // monotonic [ns], 0 reads as "never"
+#define I2CCLOCK_VIRTUAL_EPOCH  1704067200000000000ULL  // 2024-01-01 00:00:00 UTC [ns]
+
+class I2Cclock {
+public:
+    virtual ~I2Cclock() {}
+
+    virtual uint64_t monotonic() = 0;
+    virtual uint64_t realtime() = 0;
+    virtual void sleepUntil(uint64_t monotonicNs) = 0;
+
+    // the clock of the process, NULL selects the system clock
+    static void set(I2Cclock *clock);
+    static I2Cclock *get() { return current; }
+
+    static uint64_t now() { return current->monotonic(); }
+    static uint64_t wallNs() { return current->realtime(); }
+    static void sleepUntilNs(uint64_t ns) { current->sleepUntil(ns); }
+    static void sleepNs(uint64_t ns) { current->sleepUntil(current->monotonic() + ns); }
+
+    // CLOCK_MONOTONIC whichever clock is set, for the socket, file and
+    // signal handling threads
+    static uint64_t systemNs();
+
+private:
+    static I2Cclock *current;
+};
+
+class I2CclockSystem : public I2Cclock {
+public:
+    uint64_t monotonic();
+    uint64_t realtime();
+    void sleepUntil(uint64_t monotonicNs);
+};
+
+class I2CclockVirtual : public I2Cclock {
+public:
+    // "epoch" is the real time at the monotonic I2CCLOCK_VIRTUAL_START
+    I2CclockVirtual(uint64_t epoch = I2CCLOCK_VIRTUAL_EPOCH);
+
+    uint64_t monotonic() { return time.load(std::memory_order_acquire); }
+    uint64_t realtime() { return epoch + monotonic() - I2CCLOCK_VIRTUAL_START; }
+    // returns at once, the time has reached "monotonicNs"
+    void sleepUntil(uint64_t monotonicNs);
+
+private:
+    std::atomic<uint64_t> time;
+    uint64_t epoch;
+};
+
+#endif /* _I2CCLOCK_H_ */
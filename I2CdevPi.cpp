@@ -5,89 +5,77 @@
 //
 
 #include <stdio.h>
-//#include <new>
 #include <stdlib.h>
-#include <wiringPi.h>
-#include <wiringPiI2C.h>
 #include <errno.h>
 #include <string.h>
 #include <time.h>
-#include <sys/ioctl.h>
 
-#include "I2CdevPi.h"
+#include <atomic>
 
-// I2C definitions
-#define I2C_SLAVE	0x0703
+#include "I2CdevPi.h"
+#include "I2Cclock.h"
+#include "I2Cstats.h"
 
 /** Default timeout value for read operations.
  * Set this to 0 to disable timeout detection.
  */
 uint16_t I2Cdev::readTimeout = I2CDEV_DEFAULT_READ_TIMEOUT;     // not used for Pi
 
-int I2Cdev::handle = -1;
-uint8_t I2Cdev::currentDevAddr = 0;
-char *I2Cdev::deviceName = NULL;
-/** Default constructor.
+/** Number of immediate retries of a failed transaction.
+ * A single retry rides out a glitch on the bus, a device which is gone
+ * fails fast instead of stalling the caller.
  */
-I2Cdev::I2Cdev() {
-    int rev ;
-    if (I2Cdev::deviceName == NULL) {
-        I2Cdev::deviceName = new char[20];
-    }
-    rev = piBoardRev () ;
-    //I2Cdev::deviceName = new char[20];
-    if (rev == 1)
-        strcpy(I2Cdev::deviceName, "/dev/i2c-0");
-    else
-        strcpy(I2Cdev::deviceName, "/dev/i2c-1");
-    // Initialize WiringPi
-    wiringPiSetupSys () ;
-    //fprintf(stderr, "%s - using %s\n", __FUNCTION__,I2Cdev::deviceName );
-    
+uint8_t I2Cdev::retries = I2CDEV_DEFAULT_RETRIES;
+
+static std::atomic<uint16_t> nextBusId(0);
+
+/** Bus constructor, assigns the bus number reported by I2Cstats.
+ */
+I2Cbus::I2Cbus() {
+    id = nextBusId++;
+    lastAddr = 0xFF;
 }
 
-/**
- * Open the I2C device if required
- * Change device address if required
- * The device file stays open for the duration, different devices are accessed by changing
- * the address only.
+I2Cbus *I2Cdev::defaultBus = NULL;
+thread_local I2Cbus *I2Cdev::threadBus = NULL;
+thread_local uint32_t I2Cdev::errors = 0;
+
+/** Select the bus used by the calling thread.
+ * @param bus Bus backend, NULL reverts to the default bus
  */
+void I2Cdev::setBus(I2Cbus *bus) {
+    I2Cdev::threadBus = bus;
+}
 
-bool I2Cdev::openDevice (uint8_t devAddr) {
-    // is the device already open?
-    if (I2Cdev::handle < 0) {
-        // not open -> open device
-        I2Cdev::handle = wiringPiI2CSetup ((int) devAddr);
-        //fprintf(stderr, "%s - Device <0x%02x> handle is %d\n", __PRETTY_FUNCTION__, devAddr, I2Cdev::handle);
-        // all done
-        if (I2Cdev::handle >= 0) {
-            I2Cdev::currentDevAddr = devAddr;
-            return true;
-        }
-    } else {
-        // device is already open, check if device address is current
-        if (I2Cdev::currentDevAddr != devAddr) {
-            //fprintf(stderr, "%s - Changing Device <0x%02x> to <0x%02x>\n", __PRETTY_FUNCTION__, currentDevAddr, devAddr);
-            // not the same, need to change device address
-            if (ioctl (handle, I2C_SLAVE, devAddr) < 0) {
-                wiringPiFailure (WPI_ALMOST, "Unable to select I2C device: %s\n", strerror (errno)) ;
-                return false;
-            } else {
-                I2Cdev::currentDevAddr = devAddr;
-            }
-        }
-    }
-    return true;
+/** Select the bus used by threads which have not called setBus().
+ * @param bus Bus backend
+ */
+void I2Cdev::setDefaultBus(I2Cbus *bus) {
+    I2Cdev::defaultBus = bus;
+}
+
+/** Get the bus used by the calling thread.
+ * @return Bus backend, NULL if none has been configured
+ */
+I2Cbus *I2Cdev::getBus() {
+    return (I2Cdev::threadBus != NULL) ? I2Cdev::threadBus : I2Cdev::defaultBus;
 }
 
+/** Number of failed transactions (after retries) of the calling thread.
+ * Drivers compare the count before and after a sequence of register
+ * accesses to find out if any of them failed.
+ * @return Error count, wraps around
+ */
+uint32_t I2Cdev::getErrorCount() {
+    return I2Cdev::errors;
+}
+
+/** Sleep on the clock of the process (I2Cclock.h).
+ * @param howLong Time [ms]
+ */
 void I2Cdev::delay (unsigned int howLong)
 {
-    struct timespec sleeper, dummy ;
-    
-    sleeper.tv_sec  = (time_t)(howLong / 1000) ;    // seconds
-    sleeper.tv_nsec = (long)(howLong % 1000) * 1000000 ; // nanoseconds
-    
-    nanosleep (&sleeper, &dummy) ;
+    I2Cclock::sleepNs((uint64_t)howLong * 1000000ULL);
 }
 
 /** Read a single bit from an 8-bit device register.
@@ -100,8 +88,8 @@ void I2Cdev::delay (unsigned int howLong)
  */
 int8_t I2Cdev::readBit(uint8_t devAddr, uint8_t regAddr, uint8_t bitNum, uint8_t *data, uint16_t timeout) {
     uint8_t b;
-    uint8_t count = readByte(devAddr, regAddr, &b, timeout);
-    *data = b & (1 << bitNum);
+    int8_t count = readByte(devAddr, regAddr, &b, timeout);
+    if (count > 0) *data = b & (1 << bitNum);
     return count;
 }
 
@@ -115,8 +103,8 @@ int8_t I2Cdev::readBit(uint8_t devAddr, uint8_t regAddr, uint8_t bitNum, uint8_t
  */
 int8_t I2Cdev::readBitW(uint8_t devAddr, uint8_t regAddr, uint8_t bitNum, uint16_t *data, uint16_t timeout) {
     uint16_t b;
-    uint8_t count = readWord(devAddr, regAddr, &b, timeout);
-    *data = b & (1 << bitNum);
+    int8_t count = readWord(devAddr, regAddr, &b, timeout);
+    if (count > 0) *data = b & (1 << bitNum);
     return count;
 }
 
@@ -135,8 +123,9 @@ int8_t I2Cdev::readBits(uint8_t devAddr, uint8_t regAddr, uint8_t bitStart, uint
     //    xxx   args: bitStart=4, length=3
     //    010   masked
     //   -> 010 shifted
-    uint8_t count, b;
-    if ((count = readByte(devAddr, regAddr, &b, timeout)) != 0) {
+    int8_t count;
+    uint8_t b;
+    if ((count = readByte(devAddr, regAddr, &b, timeout)) > 0) {
         uint8_t mask = ((1 << length) - 1) << (bitStart - length + 1);
         b &= mask;
         b >>= (bitStart - length + 1);
@@ -160,9 +149,9 @@ int8_t I2Cdev::readBitsW(uint8_t devAddr, uint8_t regAddr, uint8_t bitStart, uin
     //    xxx           args: bitStart=12, length=3
     //    010           masked
     //           -> 010 shifted
-    uint8_t count;
+    int8_t count;
     uint16_t w;
-    if ((count = readWord(devAddr, regAddr, &w, timeout)) != 0) {
+    if ((count = readWord(devAddr, regAddr, &w, timeout)) > 0) {
         uint16_t mask = ((1 << length) - 1) << (bitStart - length + 1);
         w &= mask;
         w >>= (bitStart - length + 1);
@@ -202,15 +191,27 @@ int8_t I2Cdev::readWord(uint8_t devAddr, uint8_t regAddr, uint16_t *data, uint16
  * @return Number of bytes read (-1 indicates failure)
  */
 int8_t I2Cdev::readBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data, uint16_t timeout) {
+    I2Cbus *bus = getBus();
+    if (bus == NULL) return -1;
 
-    if (devAddr != currentDevAddr) {
-        openDevice (devAddr);
-    }
-    
     int8_t count = 0;
     
+    int value;
+    uint8_t attempt;
+    uint64_t t0;
+
     for (count = 0; count < length; count ++) {
-        data[count] = (uint8_t)wiringPiI2CReadReg8(I2Cdev::handle, regAddr + count);
+        for (attempt = 0; ; attempt ++) {
+            t0 = I2Cstats::now();
+            value = bus->readReg8(devAddr, regAddr + count);
+            I2Cstats::record(bus, devAddr, I2CSTATS_READ, 1, value < 0, t0);
+            if (value >= 0 || attempt >= retries) break;
+        }
+        if (value < 0) {
+            errors++;
+            return -1;
+        }
+        data[count] = (uint8_t)value;
     }
     return count;
 }
@@ -224,16 +225,28 @@ int8_t I2Cdev::readBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8
  * @return Number of words read (-1 indicates failure)
  */
 int8_t I2Cdev::readWords(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint16_t *data, uint16_t timeout) {
-    if (devAddr != currentDevAddr) {
-        openDevice (devAddr);
-    }
-    
+    I2Cbus *bus = getBus();
+    if (bus == NULL) return -1;
+
     int8_t count = 0;
     
+    int value;
+    uint8_t attempt;
+    uint64_t t0;
+
     for (count = 0; count < length; count ++) {
-        data[count] = (uint16_t)wiringPiI2CReadReg16(I2Cdev::handle, regAddr + count);
-        data[count] = __bswap_16 (data[count]);
-        //fprintf(stderr, "%s  - handle:<%d> devAddr:<0x%02x> reg:<0x%02x> data:<0x%04x>\n", __FUNCTION__, I2Cdev::handle, devAddr, regAddr+count, data[count]);
+        for (attempt = 0; ; attempt ++) {
+            t0 = I2Cstats::now();
+            value = bus->readReg16(devAddr, regAddr + count);
+            I2Cstats::record(bus, devAddr, I2CSTATS_READ, 2, value < 0, t0);
+            if (value >= 0 || attempt >= retries) break;
+        }
+        if (value < 0) {
+            errors++;
+            return -1;
+        }
+        data[count] = (uint16_t)value;
+        //fprintf(stderr, "%s  - devAddr:<0x%02x> reg:<0x%02x> data:<0x%04x>\n", __FUNCTION__, devAddr, regAddr+count, data[count]);
     }
     return count;
 }
@@ -247,7 +260,7 @@ int8_t I2Cdev::readWords(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint1
  */
 bool I2Cdev::writeBit(uint8_t devAddr, uint8_t regAddr, uint8_t bitNum, uint8_t data) {
     uint8_t b;
-    readByte(devAddr, regAddr, &b);
+    if (readByte(devAddr, regAddr, &b) <= 0) return false;
     b = (data != 0) ? (b | (1 << bitNum)) : (b & ~(1 << bitNum));
     return writeByte(devAddr, regAddr, b);
 }
@@ -261,7 +274,7 @@ bool I2Cdev::writeBit(uint8_t devAddr, uint8_t regAddr, uint8_t bitNum, uint8_t
  */
 bool I2Cdev::writeBitW(uint8_t devAddr, uint8_t regAddr, uint8_t bitNum, uint16_t data) {
     uint16_t w;
-    readWord(devAddr, regAddr, &w);
+    if (readWord(devAddr, regAddr, &w) <= 0) return false;
     w = (data != 0) ? (w | (1 << bitNum)) : (w & ~(1 << bitNum));
     return writeWord(devAddr, regAddr, w);
 }
@@ -283,7 +296,7 @@ bool I2Cdev::writeBits(uint8_t devAddr, uint8_t regAddr, uint8_t bitStart, uint8
     // 10100011 original & ~mask
     // 10101011 masked | value
     uint8_t b;
-    if (readByte(devAddr, regAddr, &b) != 0) {
+    if (readByte(devAddr, regAddr, &b) > 0) {
         uint8_t mask = ((1 << length) - 1) << (bitStart - length + 1);
         data <<= (bitStart - length + 1); // shift data into correct position
         data &= mask; // zero all non-important bits in data
@@ -312,7 +325,7 @@ bool I2Cdev::writeBitsW(uint8_t devAddr, uint8_t regAddr, uint8_t bitStart, uint
     // 1010001110010110 original & ~mask
     // 1010101110010110 masked | value
     uint16_t w;
-    if (readWord(devAddr, regAddr, &w) != 0) {
+    if (readWord(devAddr, regAddr, &w) > 0) {
         uint16_t mask = ((1 << length) - 1) << (bitStart - length + 1);
         data <<= (bitStart - length + 1); // shift data into correct position
         data &= mask; // zero all non-important bits in data
@@ -352,15 +365,26 @@ bool I2Cdev::writeWord(uint8_t devAddr, uint8_t regAddr, uint16_t data) {
  * @return Status of operation (true = success)
  */
 bool I2Cdev::writeBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t* data) {
+    I2Cbus *bus = getBus();
+    if (bus == NULL) return false;
 
-    if (devAddr != currentDevAddr) {
-        openDevice (devAddr);
-    }
-    
     int8_t count = 0;
     
+    int ret;
+    uint8_t attempt;
+    uint64_t t0;
+
     for (count = 0; count < length; count ++) {
-        wiringPiI2CWriteReg8(I2Cdev::handle, regAddr + count, data[count]);
+        for (attempt = 0; ; attempt ++) {
+            t0 = I2Cstats::now();
+            ret = bus->writeReg8(devAddr, regAddr + count, data[count]);
+            I2Cstats::record(bus, devAddr, I2CSTATS_WRITE, 1, ret < 0, t0);
+            if (ret >= 0 || attempt >= retries) break;
+        }
+        if (ret < 0) {
+            errors++;
+            return false;
+        }
     }
     return true;
 }
@@ -373,17 +397,27 @@ bool I2Cdev::writeBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_
  * @return Status of operation (true = success)
  */
 bool I2Cdev::writeWords(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint16_t* data) {
-    uint16_t value;
-    if (devAddr != currentDevAddr) {
-        openDevice (devAddr);
-    }
-    
+    I2Cbus *bus = getBus();
+    if (bus == NULL) return false;
+
     int8_t count = 0;
     
+    int ret;
+    uint8_t attempt;
+    uint64_t t0;
+
     for (count = 0; count < length; count ++) {
-        value = __bswap_16 (data[count]);
-        wiringPiI2CWriteReg16(I2Cdev::handle, regAddr + count, value);
-        //fprintf(stderr, "%s - handle:<%d> devAddr:<0x%02x> reg:<0x%02x> data:<0x%04x>\n", __FUNCTION__, I2Cdev::handle, devAddr, regAddr+count, value);
+        for (attempt = 0; ; attempt ++) {
+            t0 = I2Cstats::now();
+            ret = bus->writeReg16(devAddr, regAddr + count, data[count]);
+            I2Cstats::record(bus, devAddr, I2CSTATS_WRITE, 2, ret < 0, t0);
+            if (ret >= 0 || attempt >= retries) break;
+        }
+        if (ret < 0) {
+            errors++;
+            return false;
+        }
+        //fprintf(stderr, "%s - devAddr:<0x%02x> reg:<0x%02x> data:<0x%04x>\n", __FUNCTION__, devAddr, regAddr+count, data[count]);
     }
     return true;
 }
@@ -15,12 +15,77 @@
 
 // 1000ms default read timeout (modify with "I2Cdev::readTimeout = [ms];")
 #define I2CDEV_DEFAULT_READ_TIMEOUT     1000
+// immediate retries of a failed transaction (modify with "I2Cdev::retries = [n];")
+#define I2CDEV_DEFAULT_RETRIES          1
+
+/** I2C bus backend.
+ * I2Cdev routes all register access through an I2Cbus. I2CbusPi talks to a
+ * Raspberry Pi I2C adapter through wiringPi, I2CbusSim (ADS1115sim.h) provides
+ * simulated devices for benchmarks without hardware.
+ * Register values are passed in host byte order, negative return values
+ * indicate failure.
+ */
+class I2Cbus {
+public:
+    I2Cbus();
+    virtual ~I2Cbus() {}
+
+    // unique bus number used by I2Cstats
+    uint16_t getId() { return id; }
+    // slave address of the last transaction, maintained by I2Cstats
+    uint8_t lastAddr;
+
+    virtual int readReg8(uint8_t devAddr, uint8_t regAddr) = 0;
+    virtual int readReg16(uint8_t devAddr, uint8_t regAddr) = 0;
+    virtual int writeReg8(uint8_t devAddr, uint8_t regAddr, uint8_t data) = 0;
+    virtual int writeReg16(uint8_t devAddr, uint8_t regAddr, uint16_t data) = 0;
+
+private:
+    uint16_t id;
+};
+
+/** Raspberry Pi I2C adapter (/dev/i2c-N) accessed through wiringPi.
+ * The device file stays open for the lifetime of the object, different
+ * slaves are accessed by changing the address only.
+ */
+class I2CbusPi : public I2Cbus {
+public:
+    // busNumber < 0 selects the default bus for the board revision
+    I2CbusPi(int busNumber = -1);
+    ~I2CbusPi();
+
+    int readReg8(uint8_t devAddr, uint8_t regAddr);
+    int readReg16(uint8_t devAddr, uint8_t regAddr);
+    int writeReg8(uint8_t devAddr, uint8_t regAddr, uint8_t data);
+    int writeReg16(uint8_t devAddr, uint8_t regAddr, uint16_t data);
+
+    const char *getDeviceName() { return deviceName; }
+
+private:
+    bool openDevice(uint8_t devAddr);
+
+    char deviceName[20];
+    int handle;
+    uint8_t currentDevAddr;
+};
 
 class I2Cdev {
 public:
-    I2Cdev();
-    
     static void delay (unsigned int howLong);
+
+    /** Bus used by the calling thread.
+     * Each thread may drive its own bus, threads which have not selected
+     * one use the default bus.
+     */
+    static void setBus(I2Cbus *bus);
+    static void setDefaultBus(I2Cbus *bus);
+    static I2Cbus *getBus();
+
+    /** Failed transactions of the calling thread.
+     * Read functions return -1 and write functions false when a transaction
+     * still fails after I2Cdev::retries retries.
+     */
+    static uint32_t getErrorCount();
     
     static int8_t readBit(uint8_t devAddr, uint8_t regAddr, uint8_t bitNum, uint8_t *data, uint16_t timeout=I2Cdev::readTimeout);
     static int8_t readBitW(uint8_t devAddr, uint8_t regAddr, uint8_t bitNum, uint16_t *data, uint16_t timeout=I2Cdev::readTimeout);
@@ -41,13 +106,12 @@ public:
     static bool writeWords(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint16_t *data);
 
     static uint16_t readTimeout;
-    
-    static char *deviceName;
+    static uint8_t retries;
 
 private:
-    static int handle;
-    static uint8_t currentDevAddr;
-    static bool openDevice(uint8_t devAddr);
+    static I2Cbus *defaultBus;
+    static thread_local I2Cbus *threadBus;
+    static thread_local uint32_t errors;
 };
 
 #endif /* _I2CDEVPI_H_ */
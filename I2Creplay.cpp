@@ -0,0 +1,219 @@
+// I2Cdev library collection - I2C transaction record and replay
+//
+
+#include <string.h>
+
+#include "I2Cclock.h"
+#include "I2Creplay.h"
+
+static const char *opName(uint8_t op) {
+    static const char *name[] = { "read8", "read16", "write8", "write16" };
+    return (op <= I2CTRACE_WRITE16) ? name[op] : "?";
+}
+
+/*********************************************************************
+ I2CbusRecorder
+ *********************************************************************/
+
+I2CbusRecorder::I2CbusRecorder(I2Cbus *bus) {
+    this->bus = bus;
+    file = NULL;
+    lastNs = 0;
+    flushNs = 0;
+    count = 0;
+    errors = 0;
+}
+
+I2CbusRecorder::~I2CbusRecorder() {
+    close();
+}
+
+bool I2CbusRecorder::open(const char *path) {
+    I2CtraceHeader header;
+
+    close();
+    file = fopen(path, "wb");
+    if (file == NULL)
+        return false;
+    memset(&header, 0, sizeof(header));
+    header.magic = I2CTRACE_MAGIC;
+    header.version = I2CTRACE_VERSION;
+    header.recordSize = sizeof(I2CtraceRecord);
+    header.startNs = I2Cclock::wallNs();
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        close();
+        return false;
+    }
+    lastNs = I2Cclock::now();
+    flushNs = lastNs + I2CTRACE_FLUSH_NS;
+    count = 0;
+    errors = 0;
+    return true;
+}
+
+void I2CbusRecorder::close() {
+    if (file != NULL) {
+        fclose(file);
+        file = NULL;
+    }
+}
+
+/** Append one transaction, the buffer is written through once a second
+ * so a killed process loses little.
+ * @return The result of the transaction
+ */
+int I2CbusRecorder::record(uint8_t op, uint8_t devAddr, uint8_t regAddr, uint16_t data, int result, uint64_t startNs) {
+    I2CtraceRecord r;
+    uint64_t now, delta, duration;
+
+    if (file == NULL)
+        return result;
+    now = I2Cclock::now();
+    delta = (startNs - lastNs) / 1000;
+    duration = (now - startNs) / 1000;
+    lastNs = startNs;
+
+    r.deltaUs = (delta > UINT32_MAX) ? UINT32_MAX : (uint32_t)delta;
+    r.durationUs = (duration > UINT16_MAX) ? UINT16_MAX : (uint16_t)duration;
+    r.op = op;
+    r.devAddr = devAddr;
+    r.regAddr = regAddr;
+    r.reserved = 0;
+    r.data = data;
+    r.result = result;
+    if (fwrite(&r, sizeof(r), 1, file) != 1)
+        errors++;
+    count++;
+    if (now >= flushNs) {
+        fflush(file);
+        flushNs = now + I2CTRACE_FLUSH_NS;
+    }
+    return result;
+}
+
+int I2CbusRecorder::readReg8(uint8_t devAddr, uint8_t regAddr) {
+    uint64_t t0 = I2Cclock::now();
+    return record(I2CTRACE_READ8, devAddr, regAddr, 0, bus->readReg8(devAddr, regAddr), t0);
+}
+
+int I2CbusRecorder::readReg16(uint8_t devAddr, uint8_t regAddr) {
+    uint64_t t0 = I2Cclock::now();
+    return record(I2CTRACE_READ16, devAddr, regAddr, 0, bus->readReg16(devAddr, regAddr), t0);
+}
+
+int I2CbusRecorder::writeReg8(uint8_t devAddr, uint8_t regAddr, uint8_t data) {
+    uint64_t t0 = I2Cclock::now();
+    return record(I2CTRACE_WRITE8, devAddr, regAddr, data, bus->writeReg8(devAddr, regAddr, data), t0);
+}
+
+int I2CbusRecorder::writeReg16(uint8_t devAddr, uint8_t regAddr, uint16_t data) {
+    uint64_t t0 = I2Cclock::now();
+    return record(I2CTRACE_WRITE16, devAddr, regAddr, data, bus->writeReg16(devAddr, regAddr, data), t0);
+}
+
+/*********************************************************************
+ I2CbusReplay
+ *********************************************************************/
+
+I2CbusReplay::I2CbusReplay() {
+    memset(&header, 0, sizeof(header));
+    realTime = false;
+    rewind();
+}
+
+bool I2CbusReplay::load(const char *path) {
+    I2CtraceRecord r;
+    FILE *f;
+    bool ok;
+
+    records.clear();
+    rewind();
+    f = fopen(path, "rb");
+    if (f == NULL)
+        return false;
+    ok = fread(&header, sizeof(header), 1, f) == 1 && header.magic == I2CTRACE_MAGIC &&
+        header.version == I2CTRACE_VERSION && header.recordSize == sizeof(I2CtraceRecord);
+    // a record cut short by a killed recorder is dropped
+    while (ok && fread(&r, sizeof(r), 1, f) == 1)
+        records.push_back(r);
+    fclose(f);
+    if (!ok)
+        records.clear();
+    return ok;
+}
+
+void I2CbusReplay::rewind() {
+    position = 0;
+    startNs = 0;
+    offsetNs = 0;
+    divergences = 0;
+    firstPosition = 0;
+    memset(&firstRequest, 0, sizeof(firstRequest));
+}
+
+/** Answer a request from the next record.
+ * @return The recorded result, -1 on a divergence
+ */
+int I2CbusReplay::replay(uint8_t op, uint8_t devAddr, uint8_t regAddr, uint16_t data) {
+    const I2CtraceRecord *r;
+    bool match;
+
+    r = (position < records.size()) ? &records[position] : NULL;
+    match = r != NULL && r->op == op && r->devAddr == devAddr && r->regAddr == regAddr;
+    if (!match || r->data != data) {
+        if (divergences++ == 0) {
+            firstPosition = position;
+            firstRequest.op = op;
+            firstRequest.devAddr = devAddr;
+            firstRequest.regAddr = regAddr;
+            firstRequest.data = data;
+        }
+        if (!match)
+            return -1;
+    }
+
+    if (realTime) {
+        // the trace time starts with the first request
+        if (position == 0)
+            startNs = I2Cclock::now();
+        else
+            offsetNs += (uint64_t)r->deltaUs * 1000;
+        I2Cclock::sleepUntilNs(startNs + offsetNs + (uint64_t)r->durationUs * 1000);
+    }
+    position++;
+    return r->result;
+}
+
+int I2CbusReplay::readReg8(uint8_t devAddr, uint8_t regAddr) {
+    return replay(I2CTRACE_READ8, devAddr, regAddr, 0);
+}
+
+int I2CbusReplay::readReg16(uint8_t devAddr, uint8_t regAddr) {
+    return replay(I2CTRACE_READ16, devAddr, regAddr, 0);
+}
+
+int I2CbusReplay::writeReg8(uint8_t devAddr, uint8_t regAddr, uint8_t data) {
+    return replay(I2CTRACE_WRITE8, devAddr, regAddr, data);
+}
+
+int I2CbusReplay::writeReg16(uint8_t devAddr, uint8_t regAddr, uint16_t data) {
+    return replay(I2CTRACE_WRITE16, devAddr, regAddr, data);
+}
+
+void I2CbusReplay::report(FILE *f) {
+    const I2CtraceRecord *r;
+
+    fprintf(f, "replay: %zu of %zu transactions, %llu divergences\n",
+        position, records.size(), (unsigned long long)divergences);
+    if (divergences == 0)
+        return;
+    fprintf(f, "replay: first divergence at transaction %zu: %s 0x%02x reg %u data 0x%04x",
+        firstPosition, opName(firstRequest.op), firstRequest.devAddr, firstRequest.regAddr, firstRequest.data);
+    if (firstPosition < records.size()) {
+        r = &records[firstPosition];
+        fprintf(f, ", recorded %s 0x%02x reg %u data 0x%04x\n",
+            opName(r->op), r->devAddr, r->regAddr, r->data);
+    } else {
+        fprintf(f, ", past the end of the trace\n");
+    }
+}
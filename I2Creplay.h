@@ -0,0 +1,153 @@
+// I2Cdev library collection - I2C transaction record and replay
+//
+// I2CbusRecorder wraps another I2Cbus backend (usually I2CbusPi) and
+// logs every transaction to a binary trace file: direction and width,
+// slave and register address, the data written, the value returned, the
+// start time and the duration. Nothing else changes, the wrapped bus
+// answers as before.
+//
+// I2CbusReplay serves a trace back: each transaction returns exactly the
+// value it returned when it was recorded, either as fast as possible or
+// at the original timing. The driver must ask for the same transactions
+// in the same order, a request which does not match the next record is a
+// divergence:
+// - another direction, width, slave or register: the request fails (-1)
+//   and the record stays next, so one additional request costs one
+//   divergence only
+// - a write of other data: the recorded result is returned
+// - a request past the end of the trace fails
+// This makes a trace captured in the field a regression test of the
+// driver, and the transaction counts of two driver versions comparable.
+//
+// Trace file: a header (I2CtraceHeader) followed by fixed size records
+// (I2CtraceRecord), host byte order. Like the other backends a recorder
+// or replay is driven by one thread at a time.
+//
+// Usage:
+//  I2CbusPi pi;
+//  I2CbusRecorder recorder(&pi);
+//  recorder.open("field.i2c");
+//  I2Cdev::setDefaultBus(&recorder);
+//  ...
+//  I2CbusReplay replay;
+//  replay.load("field.i2c");
+//  I2Cdev::setDefaultBus(&replay);
+//  ...
+//  replay.report(stderr);
+//
+
+#ifndef _I2CREPLAY_H_
+#define _I2CREPLAY_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include "I2CdevPi.h"
+
+#define I2CTRACE_MAGIC          0x54433249      // "I2CT" in a little endian file
+#define I2CTRACE_VERSION        1
+#define I2CTRACE_FLUSH_NS       1000000000ULL   // recorder writes through at least every second
+
+// I2CtraceRecord.op
+#define I2CTRACE_READ8          0
+#define I2CTRACE_READ16         1
+#define I2CTRACE_WRITE8         2
+#define I2CTRACE_WRITE16        3
+
+struct I2CtraceHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;        // sizeof(I2CtraceRecord)
+    uint64_t startNs;           // CLOCK_REALTIME at the start of the recording
+};
+
+struct I2CtraceRecord {
+    uint32_t deltaUs;           // start since the start of the previous transaction, saturated
+    uint16_t durationUs;        // saturated
+    uint8_t op;                 // I2CTRACE_xxx
+    uint8_t devAddr;
+    uint8_t regAddr;
+    uint8_t reserved;
+    uint16_t data;              // written data, 0 for reads
+    int32_t result;             // returned value
+};
+
+class I2CbusRecorder : public I2Cbus {
+public:
+    I2CbusRecorder(I2Cbus *bus);
+    ~I2CbusRecorder();
+
+    /** Start a new trace file.
+     * @return false if the file can not be created
+     */
+    bool open(const char *path);
+    // write the buffered records and close the file
+    void close();
+
+    int readReg8(uint8_t devAddr, uint8_t regAddr);
+    int readReg16(uint8_t devAddr, uint8_t regAddr);
+    int writeReg8(uint8_t devAddr, uint8_t regAddr, uint8_t data);
+    int writeReg16(uint8_t devAddr, uint8_t regAddr, uint16_t data);
+
+    // transactions recorded, failed writes to the file
+    uint64_t getCount() { return count; }
+    uint64_t getErrors() { return errors; }
+
+private:
+    int record(uint8_t op, uint8_t devAddr, uint8_t regAddr, uint16_t data, int result, uint64_t startNs);
+
+    I2Cbus *bus;
+    FILE *file;
+    uint64_t lastNs;            // start of the previous transaction
+    uint64_t flushNs;
+    uint64_t count;
+    uint64_t errors;
+};
+
+class I2CbusReplay : public I2Cbus {
+public:
+    I2CbusReplay();
+
+    /** Read a trace file and rewind.
+     * @return false if the file can not be read or is no trace
+     */
+    bool load(const char *path);
+    // replay from the first record
+    void rewind();
+    // true: return each transaction at its original time and duration
+    void setRealTime(bool on) { realTime = on; }
+
+    int readReg8(uint8_t devAddr, uint8_t regAddr);
+    int readReg16(uint8_t devAddr, uint8_t regAddr);
+    int writeReg8(uint8_t devAddr, uint8_t regAddr, uint8_t data);
+    int writeReg16(uint8_t devAddr, uint8_t regAddr, uint16_t data);
+
+    size_t getCount() { return records.size(); }
+    // records replayed
+    size_t getPosition() { return position; }
+    bool finished() { return position >= records.size(); }
+    uint64_t getDivergences() { return divergences; }
+    // CLOCK_REALTIME at the start of the recording
+    uint64_t getStartNs() { return header.startNs; }
+
+    // position, divergences and the first one
+    void report(FILE *f);
+
+private:
+    int replay(uint8_t op, uint8_t devAddr, uint8_t regAddr, uint16_t data);
+
+    I2CtraceHeader header;
+    std::vector<I2CtraceRecord> records;
+    size_t position;
+    bool realTime;
+    uint64_t startNs;           // replay start, monotonic
+    uint64_t offsetNs;          // start of the current record in the trace
+
+    uint64_t divergences;
+    size_t firstPosition;       // of the first divergence
+    I2CtraceRecord firstRequest;
+};
+
+#endif /* _I2CREPLAY_H_ */
@@ -0,0 +1,298 @@
+// I2Cdev for Raspberry Pi library collection - transaction statistics
+//
+
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+
+#include <atomic>
+#include <mutex>
+
+#include "I2CdevPi.h"
+#include "I2Cclock.h"
+#include "I2Cstats.h"
+
+// relaxed single writer counter
+typedef std::atomic<uint64_t> Counter;
+
+static inline void inc(Counter& c, uint64_t n = 1) {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+struct SlotCounters {
+    std::atomic<uint32_t> key;          // (bus << 8 | devAddr) + 1, 0 = unused
+    Counter reads;
+    Counter writes;
+    Counter bytesRead;
+    Counter bytesWritten;
+    Counter errors;
+    Counter addrSwitches;
+    Counter latencyNs[I2CSTATS_OPS];
+    Counter latency[I2CSTATS_OPS][I2CSTATS_BUCKETS];
+    Counter conversions;
+    Counter polls[I2CSTATS_POLL_BUCKETS];
+};
+
+/** Counter block of one thread.
+ * Blocks are never freed: when a thread exits its block is released and
+ * handed to the next new thread, so totals stay cumulative.
+ */
+struct ThreadBlock {
+    ThreadBlock *next;
+    std::atomic<bool> inUse;
+    int lastSlot;
+    SlotCounters slot[I2CSTATS_THREAD_SLOTS + 1];  // the last one for all other devices
+};
+
+#define OTHER_KEY   (((uint32_t)I2CSTATS_OTHER_BUS << 8) + 1)
+
+static std::atomic<ThreadBlock *> blocks(NULL);
+static std::mutex blocksMutex;
+static volatile sig_atomic_t dumpRequest = 0;
+
+static ThreadBlock *acquireBlock() {
+    std::lock_guard<std::mutex> lock(blocksMutex);
+    ThreadBlock *b;
+
+    for (b = blocks.load(); b != NULL; b = b->next) {
+        if (!b->inUse.load()) {
+            b->inUse = true;
+            return b;
+        }
+    }
+    b = new ThreadBlock();
+    b->inUse = true;
+    b->lastSlot = 0;
+    b->next = blocks.load();
+    blocks.store(b, std::memory_order_release);
+    return b;
+}
+
+struct ThreadBlockRef {
+    ThreadBlock *block;
+    ThreadBlockRef() : block(NULL) {}
+    ~ThreadBlockRef() {
+        if (block != NULL) block->inUse = false;
+    }
+};
+
+static thread_local ThreadBlockRef threadBlock;
+
+static SlotCounters *findSlot(I2Cbus *bus, uint8_t devAddr) {
+    ThreadBlock *b = threadBlock.block;
+    uint32_t key = (((uint32_t)bus->getId() << 8) | devAddr) + 1;
+    uint32_t k;
+    int i;
+
+    if (b == NULL)
+        b = threadBlock.block = acquireBlock();
+    if (b->slot[b->lastSlot].key.load(std::memory_order_relaxed) == key)
+        return &b->slot[b->lastSlot];
+    for (i = 0; i < I2CSTATS_THREAD_SLOTS; i++) {
+        k = b->slot[i].key.load(std::memory_order_relaxed);
+        if (k == 0)
+            b->slot[i].key.store(key, std::memory_order_release);
+        if (k == 0 || k == key) {
+            b->lastSlot = i;
+            return &b->slot[i];
+        }
+    }
+    // table full, counted apart and reported as other devices
+    b->slot[I2CSTATS_THREAD_SLOTS].key.store(OTHER_KEY, std::memory_order_release);
+    return &b->slot[I2CSTATS_THREAD_SLOTS];
+}
+
+void I2Cstats::attachThread() {
+    if (threadBlock.block == NULL)
+        threadBlock.block = acquireBlock();
+}
+
+static inline int log2u(uint64_t v) {
+    return (v == 0) ? -1 : 63 - __builtin_clzll(v);
+}
+
+uint64_t I2Cstats::now() {
+    return I2Cclock::now();
+}
+
+void I2Cstats::record(I2Cbus *bus, uint8_t devAddr, int op, unsigned bytes, bool error, uint64_t startNs) {
+    SlotCounters *s = findSlot(bus, devAddr);
+    uint64_t ns = now() - startNs;
+    int bucket = log2u(ns) - I2CSTATS_BUCKET_SHIFT;
+
+    if (bucket < 0) bucket = 0;
+    if (bucket >= I2CSTATS_BUCKETS) bucket = I2CSTATS_BUCKETS - 1;
+
+    if (op == I2CSTATS_READ) {
+        inc(s->reads);
+        if (!error) inc(s->bytesRead, bytes);
+    } else {
+        inc(s->writes);
+        if (!error) inc(s->bytesWritten, bytes);
+    }
+    if (error) inc(s->errors);
+    if (bus->lastAddr != devAddr) {
+        inc(s->addrSwitches);
+        bus->lastAddr = devAddr;
+    }
+    inc(s->latencyNs[op], ns);
+    inc(s->latency[op][bucket]);
+}
+
+void I2Cstats::recordPolls(I2Cbus *bus, uint8_t devAddr, unsigned polls) {
+    SlotCounters *s;
+    int bucket = log2u(polls) + 1;
+
+    if (bus == NULL) return;
+    s = findSlot(bus, devAddr);
+    if (bucket >= I2CSTATS_POLL_BUCKETS) bucket = I2CSTATS_POLL_BUCKETS - 1;
+    inc(s->conversions);
+    inc(s->polls[bucket]);
+}
+
+static uint64_t get(Counter& c) {
+    return c.load(std::memory_order_relaxed);
+}
+
+int I2Cstats::snapshot(I2CdevStats *stats, int max) {
+    ThreadBlock *b;
+    SlotCounters *s;
+    I2CdevStats *d;
+    uint32_t key;
+    int count = 0, i, j, n, op;
+
+    for (b = blocks.load(std::memory_order_acquire); b != NULL; b = b->next) {
+        for (i = 0; i <= I2CSTATS_THREAD_SLOTS; i++) {
+            s = &b->slot[i];
+            key = s->key.load(std::memory_order_acquire);
+            if (key == 0) continue;
+            key--;
+            // find or add the (bus, device) entry
+            d = NULL;
+            for (j = 0; j < count; j++) {
+                if (stats[j].bus == (key >> 8) && stats[j].devAddr == (key & 0xFF)) {
+                    d = &stats[j];
+                    break;
+                }
+            }
+            if (d == NULL) {
+                if (count >= max) continue;
+                d = &stats[count++];
+                memset(d, 0, sizeof(*d));
+                d->bus = key >> 8;
+                d->devAddr = key & 0xFF;
+            }
+            d->reads += get(s->reads);
+            d->writes += get(s->writes);
+            d->bytesRead += get(s->bytesRead);
+            d->bytesWritten += get(s->bytesWritten);
+            d->errors += get(s->errors);
+            d->addrSwitches += get(s->addrSwitches);
+            for (op = 0; op < I2CSTATS_OPS; op++) {
+                d->latencyNs[op] += get(s->latencyNs[op]);
+                for (n = 0; n < I2CSTATS_BUCKETS; n++)
+                    d->latency[op][n] += get(s->latency[op][n]);
+            }
+            d->conversions += get(s->conversions);
+            for (n = 0; n < I2CSTATS_POLL_BUCKETS; n++)
+                d->polls[n] += get(s->polls[n]);
+        }
+    }
+    return count;
+}
+
+uint64_t I2Cstats::percentile(const uint64_t *buckets, double percent) {
+    uint64_t total = 0, sum = 0;
+    int n;
+
+    for (n = 0; n < I2CSTATS_BUCKETS; n++)
+        total += buckets[n];
+    if (total == 0) return 0;
+    for (n = 0; n < I2CSTATS_BUCKETS; n++) {
+        sum += buckets[n];
+        if (sum * 100.0 >= total * percent)
+            break;
+    }
+    if (n >= I2CSTATS_BUCKETS) n = I2CSTATS_BUCKETS - 1;
+    return 1ULL << (n + I2CSTATS_BUCKET_SHIFT + 1);
+}
+
+void I2Cstats::dump(FILE *f) {
+    I2CdevStats stats[I2CSTATS_MAX_DEVICES];
+    int count = snapshot(stats, I2CSTATS_MAX_DEVICES);
+    uint64_t reads, writes, errors, switches;
+    int i, j, n, bus;
+    char name[32];
+    bool seen;
+
+    fprintf(f, "I2C statistics\n");
+    // per bus totals, in order of first appearance
+    for (i = 0; i < count; i++) {
+        bus = stats[i].bus;
+        seen = (bus == I2CSTATS_OTHER_BUS);
+        for (j = 0; j < i; j++)
+            if (stats[j].bus == bus) seen = true;
+        if (seen) continue;
+        reads = writes = errors = switches = 0;
+        for (j = i; j < count; j++) {
+            if (stats[j].bus != bus) continue;
+            reads += stats[j].reads;
+            writes += stats[j].writes;
+            errors += stats[j].errors;
+            switches += stats[j].addrSwitches;
+        }
+        fprintf(f, "bus %d: reads %llu writes %llu errors %llu address switches %llu\n", bus,
+            (unsigned long long)reads, (unsigned long long)writes,
+            (unsigned long long)errors, (unsigned long long)switches);
+    }
+    for (i = 0; i < count; i++) {
+        I2CdevStats *d = &stats[i];
+        if (d->bus == I2CSTATS_OTHER_BUS)
+            snprintf(name, sizeof(name), "other devices");
+        else
+            snprintf(name, sizeof(name), "bus %d dev 0x%02x", d->bus, d->devAddr);
+        fprintf(f, " %s: reads %llu (%llu bytes, avg %llu us, p50 < %llu us, p99 < %llu us)"
+            " writes %llu (%llu bytes, avg %llu us, p99 < %llu us) errors %llu switches %llu\n",
+            name,
+            (unsigned long long)d->reads, (unsigned long long)d->bytesRead,
+            (unsigned long long)(d->reads ? d->latencyNs[I2CSTATS_READ] / d->reads / 1000 : 0),
+            (unsigned long long)(percentile(d->latency[I2CSTATS_READ], 50.0) / 1000),
+            (unsigned long long)(percentile(d->latency[I2CSTATS_READ], 99.0) / 1000),
+            (unsigned long long)d->writes, (unsigned long long)d->bytesWritten,
+            (unsigned long long)(d->writes ? d->latencyNs[I2CSTATS_WRITE] / d->writes / 1000 : 0),
+            (unsigned long long)(percentile(d->latency[I2CSTATS_WRITE], 99.0) / 1000),
+            (unsigned long long)d->errors, (unsigned long long)d->addrSwitches);
+        if (d->conversions == 0) continue;
+        fprintf(f, "  conversions %llu, polls per conversion:", (unsigned long long)d->conversions);
+        for (n = 0; n < I2CSTATS_POLL_BUCKETS; n++) {
+            if (d->polls[n] == 0) continue;
+            if (n == 0)
+                fprintf(f, " [0] %llu", (unsigned long long)d->polls[n]);
+            else
+                fprintf(f, " [%u-%u] %llu", 1u << (n - 1), (1u << n) - 1, (unsigned long long)d->polls[n]);
+        }
+        fprintf(f, "\n");
+    }
+    fflush(f);
+}
+
+static void sigusr1Handler(int sig) {
+    dumpRequest = 1;
+}
+
+void I2Cstats::installSignalHandler() {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigusr1Handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+}
+
+bool I2Cstats::pollSignal(FILE *f) {
+    if (!dumpRequest)
+        return false;
+    dumpRequest = 0;
+    dump(f);
+    return true;
+}
@@ -0,0 +1,88 @@
+// I2Cdev for Raspberry Pi library collection - transaction statistics
+//
+// Every transaction made through I2Cdev is counted per bus and device:
+// reads, writes, bytes, errors (NAK / failed transfer) and slave address
+// switches, plus log2 bucketed latency histograms per operation type.
+// ADS1115::waitBusy() adds the number of status polls per conversion.
+//
+// Counters live in per-thread blocks which only their owning thread
+// writes, so recording takes no locks and no atomic read-modify-write.
+// Readers aggregate all blocks through snapshot() or dump().
+//
+// A thread tracks I2CSTATS_THREAD_SLOTS (bus, device) pairs, transactions
+// with further devices are counted together in an I2CSTATS_OTHER_BUS entry.
+//
+
+#ifndef _I2CSTATS_H_
+#define _I2CSTATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+class I2Cbus;
+
+#define I2CSTATS_READ           0
+#define I2CSTATS_WRITE          1
+#define I2CSTATS_OPS            2
+
+#define I2CSTATS_BUCKETS        24      // latency bucket n covers [2^(n+8), 2^(n+9)) ns
+#define I2CSTATS_BUCKET_SHIFT   8       // bucket 0 includes everything below 512 ns
+#define I2CSTATS_POLL_BUCKETS   12      // poll bucket n covers [2^(n-1), 2^n), bucket 0 = no poll
+#define I2CSTATS_THREAD_SLOTS   16      // (bus, device) pairs tracked per thread
+#define I2CSTATS_MAX_DEVICES    64      // (bus, device) pairs reported by snapshot()
+#define I2CSTATS_OTHER_BUS      0xFFFF  // snapshot() entry of the devices beyond the slots, devAddr 0
+
+/** Aggregated statistics of one device on one bus.
+ */
+struct I2CdevStats {
+    uint16_t bus;                       // I2Cbus::getId()
+    uint8_t devAddr;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t bytesRead;
+    uint64_t bytesWritten;
+    uint64_t errors;
+    uint64_t addrSwitches;              // transactions which had to change the slave address
+    uint64_t latencyNs[I2CSTATS_OPS];   // total time per operation type
+    uint64_t latency[I2CSTATS_OPS][I2CSTATS_BUCKETS];
+    uint64_t conversions;               // conversions waited for
+    uint64_t polls[I2CSTATS_POLL_BUCKETS];
+};
+
+class I2Cstats {
+public:
+    static uint64_t now();
+
+    /** Claim the counter block of the calling thread.
+     * Otherwise done by its first transaction, a real-time thread calls it
+     * before its loop so no transaction allocates.
+     */
+    static void attachThread();
+
+    // record one transaction which started at "startNs"
+    static void record(I2Cbus *bus, uint8_t devAddr, int op, unsigned bytes, bool error, uint64_t startNs);
+    // record the number of status polls for one conversion
+    static void recordPolls(I2Cbus *bus, uint8_t devAddr, unsigned polls);
+
+    /** Aggregate the counters of all threads.
+     * @param stats Destination array
+     * @param max Size of the destination array
+     * @return Number of (bus, device) entries written
+     */
+    static int snapshot(I2CdevStats *stats, int max);
+
+    // print per bus totals and per device details
+    static void dump(FILE *f);
+
+    /** Dump on SIGUSR1.
+     * The signal handler only raises a flag, the dump is written by the
+     * next call to pollSignal() from the application's main loop.
+     */
+    static void installSignalHandler();
+    static bool pollSignal(FILE *f);
+
+    // latency [ns] below which "percent" of the operations completed (bucket upper bound)
+    static uint64_t percentile(const uint64_t *buckets, double percent);
+};
+
+#endif /* _I2CSTATS_H_ */
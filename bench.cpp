@@ -0,0 +1,1366 @@
+/*
+ VI monitoring board - driver micro benchmarks
+
+ Runs the driver stack against the simulated ADS1115 (ADS1115sim.h)
+ and reports the results as a single JSON object on stdout:
+ - bus transactions per getConversion, readRaw and readAllChannels
+ - resolution of the inputs with and without auto-ranging
+ - wall time per scan (readRaw) and bus busy share at each data rate,
+   single ended and with the bipolar current scan plan
+ - mux settling on a slowly settling input: measured policy per channel,
+   error and scan time without and with it
+ - polls and CPU time spent in waitBusy at each data rate
+ - unit conversion and formatting cost per sample
+ - a multi-rate schedule (fast current, slow voltage and temperature):
+   planned and measured rates, and a combination which is infeasible
+ - adaptive rates (vimon_adapt.h) on a quiet current with a step:
+   conversions per second against the fixed schedule, time to detect
+   the step
+ - time skew between the channels of a sample, before and after the
+   time alignment (vimon_resample.h), grid points after a wall clock step
+ - shared memory publication (vimon_shm.h): cost per sample for the
+   publisher and per read, torn copies seen by a concurrent reader
+ - socket stream (vimon_stream.h): cost per sample for the acquisition
+   thread, samples received by a client which keeps up and lost by one
+   which does not read
+ - report by exception (vimon_deadband.h) on noisy codes with a ramp
+   and a step: samples and CSV bytes passed on, cost per check
+ - start-up: transactions and time to the first sample of a board after
+   a power cycle and after a restart, several buses probed one after the
+   other and concurrently
+ - I2C record and replay (I2Creplay.h): recording cost, transactions
+   of a sample, replay as fast as possible, divergences of the same and
+   of another scan plan
+ - real-time mode (vimon_rt.h): lateness of 1 ms periodic wake-ups while
+   every CPU is loaded, as a normal thread and under SCHED_FIFO pinned to
+   one CPU
+ - virtual time (I2Cclock.h): a day of 1 Hz samples with a daily current
+   cycle, wall time, integrated charge against the exact value, and
+   whether a second run gives the same totals
+ - Modbus/TCP (vimon_modbus.h): round trip per request of concurrent
+   masters on localhost while samples are updated, mixed snapshots seen
+   and bus transactions caused (none expected)
+ - heap use in the steady state: malloc and operator new are hooked and
+   count the calls of the scanning thread while it reads, checks,
+   aligns, integrates, filters, formats and publishes samples to every
+   sink. Any allocation makes the exit status a failure
+
+ No hardware or wiringPi is required, build with "make bench".
+ */
+
+#include <errno.h>
+#include <malloc.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <atomic>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "I2CdevPi.h"
+#include "ADS1115.h"
+#include "ADS1115sim.h"
+#include "I2Cclock.h"
+#include "I2Creplay.h"
+
+#include "vimon.h"
+#include "vimon_adapt.h"
+#include "vimon_deadband.h"
+#include "vimon_energy.h"
+#include "vimon_fmt.h"
+#include "vimon_modbus.h"
+#include "vimon_quality.h"
+#include "vimon_resample.h"
+#include "vimon_rt.h"
+#include "vimon_sched.h"
+#include "vimon_shm.h"
+#include "vimon_stream.h"
+#include "vimon_trace.h"
+
+using namespace std;
+
+#define BENCH_ADDRESS	ADS1115_ADDRESS_ADDR_SDA
+#define BENCH_LOOPS		200000		// iterations for CPU only measurements
+#define BENCH_RAMP		1.0			// alignment test ramp [mV/ms]
+#define BENCH_STEP		300.0		// adaptive rate test step [mV]
+#define BENCH_HOLD_MS	200			// adaptive rate test hold time
+#define BENCH_SETTLING	0.2			// share left by a switch to AIN1 (PT100 divider)
+#define BENCH_SHM_NAME	"/vimonbench"	// not the segment of a running vimontest
+#define BENCH_SOCKET	"/tmp/vimonbench.sock"
+#define BENCH_BURST		64			// stream samples between 1 ms pauses
+#define BENCH_BUSES		4			// start-up test buses, one board each
+#define BENCH_NOISE		8			// deadband test noise [codes]
+#define BENCH_MODBUS_PORT	15020	// unprivileged, not the port of a running vimontest
+#define BENCH_MASTERS	4
+#define BENCH_TRACE		"/tmp/vimonbench.i2c"
+#define BENCH_REPLAY	100			// samples recorded and replayed
+#define BENCH_RT_WAKES	1000		// periodic wake-ups per run
+#define BENCH_RT_PERIOD	1000000ULL	// [ns]
+#define BENCH_RT_PRIORITY	80
+#define BENCH_DAY_HOURS	24			// virtual time scenario
+#define BENCH_DAY_MV	100.0		// mean current input, 5 A at 50 mA/mV
+#define BENCH_ALLOC_SAMPLES	200		// scans counted for allocations
+
+static string execName;
+static uint32_t busClock = I2CSIM_DEFAULT_CLOCK;
+static bool quick = false;
+static const char *traceFile = NULL;
+
+/*
+ allocation hooks: the glibc entry points do the work, calls are counted
+ while the calling thread has countAllocs set
+ */
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *p, size_t size);
+void *__libc_memalign(size_t align, size_t size);
+}
+
+static thread_local bool countAllocs = false;
+static thread_local uint64_t allocCount = 0;
+static thread_local uint64_t allocBytes = 0;
+static bool allocFailed = false;
+
+static inline void countAlloc(size_t size) {
+	if (countAllocs) {
+		allocCount++;
+		allocBytes += size;
+	}
+}
+
+extern "C" void *malloc(size_t size) {
+	countAlloc(size);
+	return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size) {
+	countAlloc(n * size);
+	return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *p, size_t size) {
+	countAlloc(size);
+	return __libc_realloc(p, size);
+}
+
+extern "C" void *memalign(size_t align, size_t size) {
+	countAlloc(size);
+	return __libc_memalign(align, size);
+}
+
+extern "C" void *aligned_alloc(size_t align, size_t size) {
+	countAlloc(size);
+	return __libc_memalign(align, size);
+}
+
+extern "C" int posix_memalign(void **p, size_t align, size_t size) {
+	countAlloc(size);
+	*p = __libc_memalign(align, size);
+	return (*p != NULL) ? 0 : ENOMEM;
+}
+
+// also counted if the library's operator new does not end in malloc
+void *operator new(size_t size) {
+	void *p;
+
+	countAlloc(size);
+	p = __libc_malloc(size ? size : 1);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+	free(p);
+}
+
+void operator delete[](void *p) noexcept {
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+	free(p);
+}
+
+static const struct {
+	uint8_t rate;
+	unsigned sps;
+} rates[] = {
+	{ ADS1115_RATE_8, 8 },
+	{ ADS1115_RATE_16, 16 },
+	{ ADS1115_RATE_32, 32 },
+	{ ADS1115_RATE_64, 64 },
+	{ ADS1115_RATE_128, 128 },
+	{ ADS1115_RATE_250, 250 },
+	{ ADS1115_RATE_475, 475 },
+	{ ADS1115_RATE_860, 860 },
+};
+#define NUM_RATES (sizeof(rates) / sizeof(rates[0]))
+
+static uint64_t clockNs(clockid_t id) {
+	struct timespec ts;
+	clock_gettime(id, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// scans per data rate, roughly constant run time per rate
+static unsigned scanCount(unsigned sps) {
+	unsigned n = sps / 16;
+	if (quick) return 1;
+	if (n < 2) n = 2;
+	if (n > 50) n = 50;
+	return n;
+}
+
+static void benchTransactions(I2CbusSim& bus, VImon& vimon) {
+	ADS1115 adc(BENCH_ADDRESS);
+	string result;
+	I2CsimCounters c;
+
+	printf("\"transactions\":{");
+
+	// conversion on an already selected channel
+	adc.getConversionP0GND();
+	bus.resetCounters();
+	adc.getConversionP0GND();
+	printf("\"getConversion\":{\"reads\":%llu,\"writes\":%llu},",
+		(unsigned long long)bus.counters.reads, (unsigned long long)bus.counters.writes);
+
+	// conversion including a mux switch
+	bus.resetCounters();
+	adc.getConversionP1GND();
+	printf("\"getConversionMuxSwitch\":{\"reads\":%llu,\"writes\":%llu},",
+		(unsigned long long)bus.counters.reads, (unsigned long long)bus.counters.writes);
+
+	bus.resetCounters();
+	vimon.readRaw();
+	printf("\"readRaw\":{\"reads\":%llu,\"writes\":%llu},",
+		(unsigned long long)bus.counters.reads, (unsigned long long)bus.counters.writes);
+
+	vimon.setScanPlan(VIMON_SCAN_BIPOLAR);
+	vimon.readRaw();
+	bus.resetCounters();
+	vimon.readRaw();
+	printf("\"readRawBipolar\":{\"reads\":%llu,\"writes\":%llu},",
+		(unsigned long long)bus.counters.reads, (unsigned long long)bus.counters.writes);
+	vimon.setScanPlan(VIMON_SCAN_SINGLE);
+	vimon.readRaw();
+
+	// all channels auto-ranging, ranges settled
+	vimon.setAutoRange(VIMON_ERR_ALL);
+	vimon.readRaw();
+	vimon.readRaw();
+	bus.resetCounters();
+	vimon.readRaw();
+	printf("\"readRawAutoRange\":{\"reads\":%llu,\"writes\":%llu},",
+		(unsigned long long)bus.counters.reads, (unsigned long long)bus.counters.writes);
+	vimon.setAutoRange(0);
+	vimon.readRaw();
+
+	bus.resetCounters();
+	vimon.readAllChannels(result, true);
+	printf("\"readAllChannels\":{\"reads\":%llu,\"writes\":%llu},",
+		(unsigned long long)bus.counters.reads, (unsigned long long)bus.counters.writes);
+
+	bus.resetCounters();
+	vimon.readAllChannels(result, false);
+	c = bus.counters;
+	printf("\"readAllChannelsNoRaw\":{\"reads\":%llu,\"writes\":%llu}",
+		(unsigned long long)c.reads, (unsigned long long)c.writes);
+
+	printf("},\n");
+}
+
+/*
+ codes per mV of every input at the fixed and at the auto-ranged PGA
+ */
+static void benchAutoRange(VImon& vimon) {
+	int16_t fixed[VIMON_CHANNELS];
+	int i;
+
+	vimon.setAutoRange(0);
+	vimon.readRaw();
+	for (i=0; i<VIMON_CHANNELS; i++)
+		fixed[i] = vimon.rawValue[i];
+	vimon.setAutoRange(VIMON_ERR_ALL);
+	vimon.readRaw();
+	vimon.readRaw();
+	printf("\"autorange\":[");
+	for (i=0; i<VIMON_CHANNELS; i++)
+		printf("%s{\"channel\":%d,\"codes_fixed\":%d,\"codes_auto\":%d,\"mv_per_count\":%.6f}",
+			i ? "," : "", i, fixed[i], vimon.rawValue[i], ADS1115::getMvPerCount(vimon.rawPga[i]));
+	printf("],\n");
+	vimon.setAutoRange(0);
+	vimon.readRaw();
+}
+
+static void benchScan(I2CbusSim& bus, VImon& vimon) {
+	unsigned r, i, n;
+	uint64_t t0, t1, t2, busy;
+
+	printf("\"scan\":[");
+	for (r=0; r<NUM_RATES; r++) {
+		vimon.setRate(rates[r].rate);
+		vimon.readRaw();			// settle on the new rate
+		n = scanCount(rates[r].sps);
+		bus.resetCounters();
+		t0 = clockNs(CLOCK_MONOTONIC);
+		for (i=0; i<n; i++)
+			vimon.readRaw();
+		t1 = clockNs(CLOCK_MONOTONIC);
+		busy = bus.counters.busyNs;
+		// same scans with the differential current
+		vimon.setScanPlan(VIMON_SCAN_BIPOLAR);
+		vimon.readRaw();
+		bus.resetCounters();
+		t2 = clockNs(CLOCK_MONOTONIC);
+		for (i=0; i<n; i++)
+			vimon.readRaw();
+		t2 = clockNs(CLOCK_MONOTONIC) - t2;
+		vimon.setScanPlan(VIMON_SCAN_SINGLE);
+		printf("%s{\"sps\":%u,\"scans\":%u,\"us_per_scan\":%.1f,\"us_per_scan_bipolar\":%.1f,"
+			"\"bus_busy_pct\":%.1f,\"bus_busy_pct_bipolar\":%.1f}",
+			r ? "," : "", rates[r].sps, n, (double)(t1 - t0) / n / 1000.0, (double)t2 / n / 1000.0,
+			100.0 * busy / (double)(t1 - t0), 100.0 * bus.counters.busyNs / (double)t2);
+	}
+	printf("],\n");
+	vimon.setRate(ADS1115_RATE_128);
+}
+
+/*
+ AIN1 settles slowly behind the mux. Without a policy CH1 carries part of
+ CH0 into every scan, with the measured one the unsettled conversions are
+ discarded and the other channels pay nothing
+ */
+static void benchSettling(ADS1115sim& adc, VImon& vimon) {
+	VImonSettle settle;
+	VImonSample sample;
+	unsigned scans = quick ? 5 : 50, i;
+	double error[2], scanUs[2];
+	uint64_t t0;
+	int ch, n, pass;
+
+	adc.setSettling(1, BENCH_SETTLING);
+	printf("\"settling\":{\"channels\":[");
+	for (ch=0; ch<VIMON_CHANNELS; ch++) {
+		n = vimon.measureSettling(ch, &settle);
+		printf("%s{\"channel\":%d,\"discard\":%d,\"first_error_codes\":%d,\"noise_codes\":%d}",
+			ch ? "," : "", ch, n, settle.firstError, settle.noise);
+	}
+	for (pass=0; pass<2; pass++) {
+		// first without, then with the measured policy
+		if (pass == 0)
+			for (ch=0; ch<VIMON_CHANNELS; ch++)
+				vimon.setSettleDiscard(ch, 0);
+		else
+			vimon.autoSettle();
+		error[pass] = 0.0;
+		t0 = clockNs(CLOCK_MONOTONIC);
+		for (i=0; i<scans; i++) {
+			vimon.readSample(&sample);
+			error[pass] += fabs(sample.mv[1] - 512.0);
+		}
+		scanUs[pass] = (double)(clockNs(CLOCK_MONOTONIC) - t0) / scans / 1000.0;
+		error[pass] /= scans;
+	}
+	printf("],\"ch1_error_mv\":%.3f,\"ch1_error_mv_settled\":%.3f,\"us_per_scan\":%.1f,\"us_per_scan_settled\":%.1f},\n",
+		error[0], error[1], scanUs[0], scanUs[1]);
+
+	for (ch=0; ch<VIMON_CHANNELS; ch++)
+		vimon.setSettleDiscard(ch, 0);
+	adc.setSettling(1, 0.0);
+}
+
+static void benchWaitBusy(I2CbusSim& bus) {
+	ADS1115 adc(BENCH_ADDRESS);
+	unsigned r, i, n;
+	uint64_t cpu, wall, t0, c0;
+
+	printf("\"waitBusy\":[");
+	for (r=0; r<NUM_RATES; r++) {
+		adc.setRate(rates[r].rate);
+		adc.getConversionP0GND();
+		n = scanCount(rates[r].sps);
+		cpu = wall = 0;
+		bus.resetCounters();
+		for (i=0; i<n; i++) {
+			adc.setOpStatus(ADS1115_OS_ACTIVE);
+			t0 = clockNs(CLOCK_MONOTONIC);
+			c0 = clockNs(CLOCK_THREAD_CPUTIME_ID);
+			adc.waitBusy(I2CDEV_DEFAULT_READ_TIMEOUT);
+			cpu += clockNs(CLOCK_THREAD_CPUTIME_ID) - c0;
+			wall += clockNs(CLOCK_MONOTONIC) - t0;
+		}
+		// setOpStatus costs one read and one write, the remaining reads are polls
+		printf("%s{\"sps\":%u,\"conversions\":%u,\"polls_per_conversion\":%.1f,\"cpu_us\":%.1f,\"wall_us\":%.1f}",
+			r ? "," : "", rates[r].sps, n, (double)(bus.counters.reads - n) / n,
+			(double)cpu / n / 1000.0, (double)wall / n / 1000.0);
+	}
+	printf("],\n");
+}
+
+static double perSampleNs(uint64_t t0, uint64_t t1) {
+	return (double)(t1 - t0) / BENCH_LOOPS;
+}
+
+static void benchSample(VImon& vimon) {
+	VImonSample sample;
+	VImonFormatter fmt;
+	VImonWriter out(open("/dev/null", O_WRONLY));
+	VImonQuality quality;
+	VImonEnergy energy;
+	VImonResampler resampler(1000000);
+	VImonSample aligned[4];
+	float v;
+	uint64_t t0, t1;
+	volatile size_t sink = 0;
+	int i, f;
+	static const char *names[] = { "format_text", "format_csv", "format_json" };
+
+	vimon.readSample(&sample);
+
+	printf("\"per_sample_ns\":{");
+
+	// unit conversion from stored raw values, same set as readSample()
+	t0 = clockNs(CLOCK_THREAD_CPUTIME_ID);
+	for (i=0; i<BENCH_LOOPS; i++) {
+		vimon.getUnscaledMilliVolts(0, &v, true);
+		vimon.getUnscaledMilliVolts(1, &v, true);
+		vimon.getUnscaledMilliVolts(2, &v, true);
+		vimon.getUnscaledMilliVolts(3, &v, true);
+		vimon.getMilliVolts(0, &v, true);
+		vimon.getMilliVolts(1, &v, true);
+		vimon.getMilliAmps(2, &v, true);
+		vimon.getMilliAmps(3, &v, true);
+		sink += (size_t)v;
+	}
+	t1 = clockNs(CLOCK_THREAD_CPUTIME_ID);
+	printf("\"convert\":%.1f", perSampleNs(t0, t1));
+
+	// quality checks, no board attached so the watchdog can not reset
+	t0 = clockNs(CLOCK_THREAD_CPUTIME_ID);
+	for (i=0; i<BENCH_LOOPS; i++) {
+		sample.raw[0] ^= 1;
+		sink += quality.check(&sample);
+	}
+	t1 = clockNs(CLOCK_THREAD_CPUTIME_ID);
+	printf(",\"quality\":%.1f", perSampleNs(t0, t1));
+
+	// charge and energy integration, 1 ms sample interval
+	sample.quality = 0;
+	t0 = clockNs(CLOCK_THREAD_CPUTIME_ID);
+	for (i=0; i<BENCH_LOOPS; i++) {
+		sample.timestamp += 1000000;
+		sample.monotonic += 1000000;
+		sink += energy.add(sample);
+	}
+	t1 = clockNs(CLOCK_THREAD_CPUTIME_ID);
+	printf(",\"energy\":%.1f", perSampleNs(t0, t1));
+
+	// time alignment, one grid point per sample
+	t0 = clockNs(CLOCK_THREAD_CPUTIME_ID);
+	for (i=0; i<BENCH_LOOPS; i++) {
+		sample.timestamp += 1000000;
+		sample.monotonic += 1000000;
+		sink += resampler.push(sample, aligned, 4);
+	}
+	t1 = clockNs(CLOCK_THREAD_CPUTIME_ID);
+	printf(",\"resample\":%.1f", perSampleNs(t0, t1));
+
+	for (f=VIMON_FMT_TEXT; f<=VIMON_FMT_JSON; f++) {
+		fmt.setFormat((VImonFormat)f);
+		t0 = clockNs(CLOCK_THREAD_CPUTIME_ID);
+		for (i=0; i<BENCH_LOOPS; i++) {
+			sample.timestamp += 1000000;
+			sink += fmt.format(sample);
+		}
+		t1 = clockNs(CLOCK_THREAD_CPUTIME_ID);
+		printf(",\"%s\":%.1f", names[f], perSampleNs(t0, t1));
+	}
+
+	// buffered output of formatted lines to /dev/null
+	fmt.setFormat(VIMON_FMT_CSV);
+	fmt.format(sample);
+	t0 = clockNs(CLOCK_THREAD_CPUTIME_ID);
+	for (i=0; i<BENCH_LOOPS; i++)
+		out.write(fmt);
+	out.flush();
+	t1 = clockNs(CLOCK_THREAD_CPUTIME_ID);
+	printf(",\"write\":%.1f", perSampleNs(t0, t1));
+
+	printf("},\n");
+}
+
+// same ramp on AIN0 and AIN2, any difference between them is time skew
+static float rampSignal(int pin, uint64_t ns, void *context) {
+	uint64_t start = *(uint64_t *)context;
+
+	if (pin == 0 || pin == 2)
+		return 100.0f + (float)((double)(ns - start) / 1e6 * BENCH_RAMP);
+	return (pin == 1) ? 512.0f : 5.0f;
+}
+
+/*
+ V1 and I1 read from one sample are converted several milliseconds
+ apart, the resampled ones at the same instant. Half way the wall clock
+ steps back an hour, the grid goes on.
+ */
+static void benchAlignment(ADS1115sim& adc, VImon& vimon) {
+	VImonResampler resampler(10000000);
+	VImonSample sample, aligned[4];
+	uint64_t start = clockNs(CLOCK_MONOTONIC);
+	double rawSkew = 0.0, alignedSkew = 0.0;
+	unsigned scans = quick ? 10 : 40, samples = 0, stepped = 0, i;
+	int j, n;
+
+	adc.setNoise(0.0);
+	adc.setSignal(rampSignal, &start);
+	resampler.reset();
+	for (i=0; i<scans; i++) {
+		vimon.readSample(&sample);
+		rawSkew += fabs(sample.mv[2] - sample.mv[0]);
+		if (i >= scans / 2)
+			sample.timestamp -= 3600 * 1000000000ULL;
+		n = resampler.push(sample, aligned, 4);
+		if (i >= scans / 2)
+			stepped += n;
+		for (j=0; j<n; j++) {
+			if (aligned[j].error & (VIMON_ERR_CH0 | VIMON_ERR_CH2))
+				continue;
+			alignedSkew += fabs(aligned[j].mv[2] - aligned[j].mv[0]);
+			samples++;
+		}
+	}
+	adc.setSignal(NULL, NULL);
+	adc.setNoise(0.5);
+
+	printf("\"alignment\":{\"scans\":%u,\"aligned_samples\":%u,\"after_wall_step\":%u,"
+		"\"raw_skew_us\":%.1f,\"aligned_skew_us\":%.1f},\n",
+		scans, samples, stepped, rawSkew / scans / BENCH_RAMP * 1000.0,
+		samples ? alignedSkew / samples / BENCH_RAMP * 1000.0 : 0.0);
+}
+
+/*
+ the publisher writes samples whose fields all derive from their index,
+ a reader on another thread checks every copy for mixed fields
+ */
+static void benchShm() {
+	VImonPublisher pub;
+	VImonSubscriber sub;
+	VImonSample sample, copy[16];
+	std::atomic<bool> done(false);
+	uint64_t reads = 0, torn = 0, received = 0, cursor, t0, t1, t2;
+	unsigned loops = quick ? BENCH_LOOPS / 10 : BENCH_LOOPS, i;
+	int n, j;
+
+	if (!pub.open(BENCH_SHM_NAME) || !sub.open(BENCH_SHM_NAME)) {
+		printf("\"shm\":{\"error\":\"unable to map %s\"},\n", BENCH_SHM_NAME);
+		return;
+	}
+	memset(&sample, 0, sizeof(sample));
+
+	std::thread reader([&]() {
+		VImonSample s;
+		while (!done.load(std::memory_order_relaxed)) {
+			if (!sub.latest(&s))
+				continue;
+			reads++;
+			if (s.raw[0] != (int16_t)s.timestamp || s.raw[3] != (int16_t)s.timestamp ||
+					s.offsetUs[2] != (int32_t)s.timestamp)
+				torn++;
+		}
+	});
+	t0 = clockNs(CLOCK_THREAD_CPUTIME_ID);
+	for (i=0; i<loops; i++) {
+		sample.timestamp = i;
+		sample.raw[0] = sample.raw[1] = sample.raw[2] = sample.raw[3] = (int16_t)i;
+		sample.offsetUs[0] = sample.offsetUs[1] = sample.offsetUs[2] = sample.offsetUs[3] = (int32_t)i;
+		pub.publish(sample);
+	}
+	t1 = clockNs(CLOCK_THREAD_CPUTIME_ID);
+	done.store(true);
+	reader.join();
+
+	// the whole ring, in batches
+	t2 = clockNs(CLOCK_THREAD_CPUTIME_ID);
+	for (j=0; j<(int)(loops / VIMON_SHM_HISTORY); j++) {
+		cursor = sub.getPublished() - VIMON_SHM_HISTORY;
+		while ((n = sub.read(&cursor, copy, 16)) > 0)
+			received += n;
+	}
+	t2 = clockNs(CLOCK_THREAD_CPUTIME_ID) - t2;
+
+	printf("\"shm\":{\"publish_ns\":%.1f,\"concurrent_reads\":%llu,\"torn\":%llu,\"retries\":%llu,"
+		"\"ring_read_ns\":%.1f,\"ring_lost\":%llu},\n",
+		(double)(t1 - t0) / loops, (unsigned long long)reads,
+		(unsigned long long)torn, (unsigned long long)sub.getRetries(),
+		received ? (double)t2 / received : 0.0, (unsigned long long)sub.getLost());
+	sub.close();
+	pub.close();
+	shm_unlink(BENCH_SHM_NAME);
+}
+
+/*
+ bursts of samples far above any real scan rate, to one client reading
+ everything and one which never reads
+ */
+static void benchStream() {
+	VImonStreamServer server;
+	VImonStreamClient fast, stalled;
+	VImonSample sample;
+	std::atomic<uint64_t> received(0);
+	uint64_t t0, cpu = 0;
+	unsigned samples = quick ? 20 * BENCH_BURST : 200 * BENCH_BURST, i;
+	struct timespec pause = { 0, 1000000 };
+
+	if (!server.start(BENCH_SOCKET) || !fast.connect(BENCH_SOCKET) || !stalled.connect(BENCH_SOCKET) ||
+			!fast.subscribe(VIMON_ERR_ALL, 1, 32) || !stalled.subscribe(VIMON_ERR_ALL, 1, 1)) {
+		printf("\"stream\":{\"error\":\"unable to connect to %s\"},\n", BENCH_SOCKET);
+		return;
+	}
+	// let the I/O thread see the subscriptions
+	while (server.getClientCount() < 2)
+		nanosleep(&pause, NULL);
+	nanosleep(&pause, NULL);
+
+	std::thread reader([&]() {
+		VImonStreamRecord records[32];
+		int n;
+		while ((n = fast.receive(records, 32)) >= 0)
+			received += n;
+	});
+
+	memset(&sample, 0, sizeof(sample));
+	for (i=0; i<samples; i++) {
+		t0 = clockNs(CLOCK_THREAD_CPUTIME_ID);
+		sample.timestamp = i;
+		server.publish(sample);
+		cpu += clockNs(CLOCK_THREAD_CPUTIME_ID) - t0;
+		if (i % BENCH_BURST == BENCH_BURST - 1)
+			nanosleep(&pause, NULL);
+	}
+	// the last partial frame goes out after VIMON_STREAM_FLUSH_MS
+	pause.tv_nsec = 2 * VIMON_STREAM_FLUSH_MS * 1000000L;
+	nanosleep(&pause, NULL);
+
+	printf("\"stream\":{\"samples\":%u,\"publish_ns\":%.1f,\"received\":%llu,\"frames\":%llu,"
+		"\"stalled_client_dropped\":%llu,\"backlog_drops\":%llu},\n",
+		samples, (double)cpu / samples, (unsigned long long)received.load(),
+		(unsigned long long)server.getFrameCount(), (unsigned long long)server.getDroppedCount(),
+		(unsigned long long)server.getBacklogDrops());
+	server.stop();
+	reader.join();
+}
+
+/*
+ 1 ms samples, noise on every channel, CH0 ramps by a code per sample and
+ CH2 steps half way; deadbands well above the noise
+ */
+static void benchDeadband(VImon& vimon) {
+	VImonDeadband deadband(&vimon);
+	VImonFormatter fmt(VIMON_FMT_CSV);
+	VImonSample sample;
+	int16_t base[VIMON_CHANNELS];
+	uint64_t passed, t0, t1, allBytes = 0, passedBytes = 0;
+	volatile size_t sink = 0;
+	unsigned samples = quick ? BENCH_LOOPS / 20 : BENCH_LOOPS, i;
+	int ch;
+
+	vimon.readSample(&sample);
+	memcpy(base, sample.raw, sizeof(base));
+	sample.error = 0;
+	sample.quality = 0;
+	deadband.setDeadband(0, 50.0, 0.0);
+	deadband.setDeadband(1, 50.0, 0.0);
+	deadband.setDeadband(2, 200.0, 0.0);
+	deadband.setDeadband(3, 200.0, 0.0);
+	deadband.setHeartbeat(1000);
+	srand(1);
+
+	for (i=0; i<samples; i++) {
+		sample.timestamp += 1000000;
+		for (ch=0; ch<VIMON_CHANNELS; ch++) {
+			sample.raw[ch] = base[ch] + rand() % (2 * BENCH_NOISE + 1) - BENCH_NOISE;
+			if (ch == 0)
+				sample.raw[ch] += (i % 10000);
+			if (ch == 2 && i >= samples / 2)
+				sample.raw[ch] += 2000;
+			sample.mv[ch] = sample.raw[ch] * ADS1115::getMvPerCount(sample.pga[ch]);
+		}
+		ch = deadband.check(sample);
+		fmt.format(sample);
+		allBytes += fmt.length();
+		if (ch != 0)
+			passedBytes += fmt.length();
+	}
+	passed = deadband.getPassed();
+
+	// the common case, suppressed
+	t0 = clockNs(CLOCK_THREAD_CPUTIME_ID);
+	for (i=0; i<BENCH_LOOPS; i++) {
+		sample.raw[1] ^= 1;
+		sink += deadband.check(sample);
+	}
+	t1 = clockNs(CLOCK_THREAD_CPUTIME_ID);
+
+	printf("\"deadband\":{\"samples\":%u,\"passed\":%llu,\"heartbeats\":%llu,\"check_ns\":%.1f,"
+		"\"csv_bytes\":%llu,\"csv_bytes_passed\":%llu},\n",
+		samples, (unsigned long long)passed, (unsigned long long)deadband.getHeartbeats(),
+		perSampleNs(t0, t1), (unsigned long long)allBytes, (unsigned long long)passedBytes);
+}
+
+/*
+ masters reading the whole map while the samples change, every value of
+ a sample is its index so a mixed snapshot shows
+ */
+static void benchModbus(I2CbusSim& bus) {
+	VImonModbusServer server;
+	VImonSample sample;
+	std::atomic<bool> done(false);
+	std::atomic<uint64_t> requests(0), failed(0), mixed(0), totalNs(0), maxNs(0);
+	std::thread masters[BENCH_MASTERS];
+	unsigned polls = quick ? 500 : 5000, updates = 0, i;
+	struct timespec pause = { 0, 100000 };
+
+	if (!server.start(BENCH_MODBUS_PORT)) {
+		printf("\"modbus\":{\"error\":\"unable to listen on port %u\"},\n", BENCH_MODBUS_PORT);
+		return;
+	}
+	memset(&sample, 0, sizeof(sample));
+	bus.resetCounters();
+
+	for (i=0; i<BENCH_MASTERS; i++) {
+		masters[i] = std::thread([&]() {
+			VImonModbusMaster master;
+			uint16_t regs[VIMON_MB_REGISTERS];
+			uint64_t t0, dt, m;
+			unsigned j;
+
+			if (!master.connect("127.0.0.1", BENCH_MODBUS_PORT)) {
+				failed++;
+				return;
+			}
+			for (j=0; j<polls; j++) {
+				t0 = clockNs(CLOCK_MONOTONIC);
+				if (master.readInputRegisters(0, VIMON_MB_REGISTERS, regs) != 0) {
+					failed++;
+					return;
+				}
+				dt = clockNs(CLOCK_MONOTONIC) - t0;
+				requests++;
+				totalNs += dt;
+				m = maxNs.load();
+				while (dt > m && !maxNs.compare_exchange_weak(m, dt))
+					;
+				if (VImonModbusMaster::toFloat(&regs[VIMON_MB_V1]) != VImonModbusMaster::toFloat(&regs[VIMON_MB_I2]) ||
+						VImonModbusMaster::toFloat(&regs[VIMON_MB_V2]) != VImonModbusMaster::toFloat(&regs[VIMON_MB_I1]))
+					mixed++;
+			}
+		});
+	}
+	// the acquisition, every 100 us
+	std::thread acquisition([&]() {
+		while (!done.load()) {
+			updates++;
+			sample.timestamp = updates;
+			sample.v1_mv = sample.v2_mv = sample.i1_ma = sample.i2_ma = (float)updates;
+			server.update(sample);
+			nanosleep(&pause, NULL);
+		}
+	});
+	for (i=0; i<BENCH_MASTERS; i++)
+		masters[i].join();
+	done.store(true);
+	acquisition.join();
+
+	printf("\"modbus\":{\"masters\":%u,\"requests\":%llu,\"failed\":%llu,\"request_us\":%.1f,"
+		"\"max_request_us\":%.1f,\"updates\":%u,\"mixed\":%llu,\"exceptions\":%llu,"
+		"\"bus_reads\":%llu,\"bus_writes\":%llu},\n",
+		BENCH_MASTERS, (unsigned long long)requests.load(), (unsigned long long)failed.load(),
+		requests ? (double)totalNs / requests / 1000.0 : 0.0, (double)maxNs / 1000.0,
+		updates, (unsigned long long)mixed.load(), (unsigned long long)server.getExceptionCount(),
+		(unsigned long long)bus.counters.reads, (unsigned long long)bus.counters.writes);
+	server.stop();
+}
+
+// probe, configure and scan once, as a starting service does
+static uint64_t firstSampleNs(VImon& vimon) {
+	VImonSample sample;
+	uint64_t t0 = clockNs(CLOCK_MONOTONIC);
+
+	vimon.setRate(ADS1115_RATE_860);
+	vimon.initialize(BENCH_ADDRESS);
+	vimon.readSample(&sample);
+	return clockNs(CLOCK_MONOTONIC) - t0;
+}
+
+static void benchStartup(I2CbusSim& bus, ADS1115sim& adc, VImon& main) {
+	static const char *name[] = { "power_on", "restart", "reprobe" };
+	I2CbusSim buses[BENCH_BUSES];
+	ADS1115sim adcs[BENCH_BUSES];
+	std::thread probe[BENCH_BUSES];
+	uint64_t ns, init, serial, parallel;
+	VImonSample sample;
+	int i;
+
+	/* power-on defaults; a restart finds the mux where the last scan left
+	   it; a reprobe (after an error) finds the configuration it wrote */
+	printf("\"startup\":{");
+	for (i=0; i<3; i++) {
+		VImon vimon;
+		vimon.setRate(ADS1115_RATE_860);
+		if (i == 0)
+			adc.reset();
+		else if (i == 2)
+			vimon.initialize(BENCH_ADDRESS);
+		bus.resetCounters();
+		ns = clockNs(CLOCK_MONOTONIC);
+		vimon.initialize(BENCH_ADDRESS);
+		init = clockNs(CLOCK_MONOTONIC) - ns;
+		printf("\"%s\":{\"reads\":%llu,\"writes\":%llu,\"init_us\":%.1f,", name[i],
+			(unsigned long long)bus.counters.reads, (unsigned long long)bus.counters.writes,
+			(double)init / 1000.0);
+		vimon.readSample(&sample);
+		ns = clockNs(CLOCK_MONOTONIC) - ns;
+		printf("\"first_sample_us\":%.1f},", (double)ns / 1000.0);
+	}
+
+	for (i=0; i<BENCH_BUSES; i++) {
+		buses[i].setClock(busClock);
+		adcs[i].setInput(0, 1024.0);
+		buses[i].attach(BENCH_ADDRESS, &adcs[i]);
+	}
+	serial = clockNs(CLOCK_MONOTONIC);
+	for (i=0; i<BENCH_BUSES; i++) {
+		VImon vimon;
+		I2Cdev::setBus(&buses[i]);
+		firstSampleNs(vimon);
+		adcs[i].reset();
+	}
+	I2Cdev::setBus(NULL);
+	serial = clockNs(CLOCK_MONOTONIC) - serial;
+	parallel = clockNs(CLOCK_MONOTONIC);
+	for (i=0; i<BENCH_BUSES; i++) {
+		probe[i] = std::thread([&buses, i]() {
+			VImon vimon;
+			I2Cdev::setBus(&buses[i]);
+			firstSampleNs(vimon);
+		});
+	}
+	for (i=0; i<BENCH_BUSES; i++)
+		probe[i].join();
+	parallel = clockNs(CLOCK_MONOTONIC) - parallel;
+	printf("\"buses\":%d,\"serial_ms\":%.1f,\"parallel_ms\":%.1f},\n",
+		BENCH_BUSES, (double)serial / 1e6, (double)parallel / 1e6);
+
+	// the shared board is configured as before
+	main.reinitialize();
+}
+
+// the samples of a board behind "bus", as the recorded run makes them
+static uint64_t replaySamples(I2Cbus *bus, uint8_t plan) {
+	VImonSample sample;
+	VImon vimon;
+	uint64_t t0;
+	int i;
+
+	I2Cdev::setBus(bus);
+	t0 = clockNs(CLOCK_MONOTONIC);
+	vimon.setScanPlan(plan);
+	vimon.setRate(ADS1115_RATE_860);
+	vimon.initialize(BENCH_ADDRESS);
+	for (i=0; i<BENCH_REPLAY; i++)
+		vimon.readSample(&sample);
+	t0 = clockNs(CLOCK_MONOTONIC) - t0;
+	I2Cdev::setBus(NULL);
+	return t0;
+}
+
+static void benchReplay(I2CbusSim& bus) {
+	I2CbusRecorder recorder(&bus);
+	I2CbusReplay replay;
+	uint64_t record, fast, divergences;
+
+	if (!recorder.open(BENCH_TRACE)) {
+		printf("\"replay\":{\"error\":\"unable to create %s\"}\n", BENCH_TRACE);
+		return;
+	}
+	record = replaySamples(&recorder, VIMON_SCAN_SINGLE);
+	recorder.close();
+	if (!replay.load(BENCH_TRACE)) {
+		printf("\"replay\":{\"error\":\"unable to read %s\"}\n", BENCH_TRACE);
+		return;
+	}
+	fast = replaySamples(&replay, VIMON_SCAN_SINGLE);
+	divergences = replay.getDivergences();
+	if (!quick)
+		replay.report(stderr);
+	printf("\"replay\":{\"samples\":%d,\"transactions\":%zu,\"replayed\":%zu,\"bytes\":%zu,"
+		"\"record_ms\":%.1f,\"replay_ms\":%.2f,\"divergences\":%llu,",
+		BENCH_REPLAY, replay.getCount(), replay.getPosition(),
+		sizeof(I2CtraceHeader) + replay.getCount() * sizeof(I2CtraceRecord),
+		(double)record / 1e6, (double)fast / 1e6, (unsigned long long)divergences);
+	// a driver change: the bipolar plan converts other inputs
+	replay.rewind();
+	replaySamples(&replay, VIMON_SCAN_BIPOLAR);
+	printf("\"bipolar_divergences\":%llu}\n", (unsigned long long)replay.getDivergences());
+	unlink(BENCH_TRACE);
+}
+
+// wake-ups every BENCH_RT_PERIOD, optionally real-time first
+static void periodicWakes(VImonJitter *jitter, bool realtime, int cpu, int *error) {
+	char cpus[16];
+	uint64_t due;
+	int i;
+
+	*error = 0;
+	if (realtime) {
+		snprintf(cpus, sizeof(cpus), "%d", cpu);
+		if (!VImonRealtime::setAffinity(cpus) || !VImonRealtime::setPriority(BENCH_RT_PRIORITY)) {
+			*error = errno;
+			return;
+		}
+		VImonRealtime::prefaultStack(VIMON_RT_STACK);
+	}
+	due = I2Cclock::now();
+	for (i=0; i<BENCH_RT_WAKES; i++) {
+		due += BENCH_RT_PERIOD;
+		I2Cclock::sleepUntilNs(due);
+		jitter->record(due, I2Cclock::now());
+	}
+}
+
+static void printJitter(const char *name, VImonJitter& jitter, int error) {
+	if (error != 0)
+		printf("\"%s\":{\"error\":\"%s\"}", name, strerror(error));
+	else
+		printf("\"%s\":{\"mean_us\":%.1f,\"p99_us\":%.0f,\"max_us\":%.1f}", name,
+			jitter.getMeanNs() / 1000.0, jitter.percentile(99.0) / 1000.0, jitter.getMaxNs() / 1000.0);
+}
+
+static void benchRealtime() {
+	int cpus = (int)sysconf(_SC_NPROCESSORS_ONLN), error[2], run, i;
+	std::vector<std::thread> load;
+	std::atomic<bool> loading(true);
+	VImonJitter jitter[2];
+
+	// a busy thread per CPU, each making a system call now and then
+	for (i=0; i<cpus; i++)
+		load.push_back(std::thread([&loading]() {
+			volatile uint64_t n = 0;
+			while (loading.load(std::memory_order_relaxed))
+				if (++n % 100000 == 0)
+					sched_yield();
+		}));
+	for (run=0; run<2; run++) {
+		std::thread t(periodicWakes, &jitter[run], run == 1, cpus - 1, &error[run]);
+		t.join();
+	}
+	loading.store(false);
+	for (i=0; i<cpus; i++)
+		load[i].join();
+
+	printf("\"realtime\":{\"wakes\":%d,\"load_threads\":%d,", BENCH_RT_WAKES, cpus);
+	printJitter("normal", jitter[0], error[0]);
+	printf(",");
+	printJitter("fifo", jitter[1], error[1]);
+	printf("},\n");
+}
+
+// battery and PT100 steady, charging current one sine cycle per day
+// around its mean, no discharge
+static float daySignal(int pin, uint64_t ns, void *context) {
+	uint64_t start = *(uint64_t *)context;
+
+	if (pin == 0)
+		return 1024.0;
+	if (pin == 1)
+		return 512.0;
+	if (pin == 3)
+		return 0.0;
+	return BENCH_DAY_MV * (1.0 + sin(2.0 * M_PI * (double)(ns - start) / (BENCH_DAY_HOURS * 3600e9)));
+}
+
+// one day of samples on its own board, in virtual time
+static uint64_t runDay(VImonEnergyTotals *totals) {
+	I2CclockVirtual virtualTime;
+	I2CbusSim dayBus(busClock);
+	ADS1115sim dayAdc;
+	VImonEnergy energy;
+	VImonSample sample;
+	VImon vimon;
+	uint64_t wall, start, due;
+	unsigned i;
+
+	wall = clockNs(CLOCK_MONOTONIC);
+	I2Cclock::set(&virtualTime);
+	I2Cdev::setBus(&dayBus);
+	dayBus.attach(BENCH_ADDRESS, &dayAdc);
+	start = I2Cclock::now();
+	dayAdc.setSignal(daySignal, &start);
+	vimon.initialize(BENCH_ADDRESS);
+	due = start;
+	for (i=0; i<=BENCH_DAY_HOURS * 3600; i++) {
+		I2Cclock::sleepUntilNs(due);
+		vimon.readSample(&sample);
+		energy.add(sample);
+		due += 1000000000ULL;
+	}
+	energy.get(totals);
+	I2Cdev::setBus(NULL);
+	I2Cclock::set(NULL);
+	return clockNs(CLOCK_MONOTONIC) - wall;
+}
+
+static void benchVirtualTime() {
+	VImonEnergyTotals first, second;
+	VImonCalibration cal;
+	uint64_t wall;
+
+	VImon::getDefaultCalibration(&cal);
+	wall = runDay(&first);
+	runDay(&second);
+	printf("\"virtual\":{\"hours\":%d,\"samples\":%llu,\"wall_ms\":%.0f,\"speedup\":%.0f,"
+		"\"charge_ah\":%.4f,\"expected_ah\":%.4f,\"repeat_identical\":%s},\n",
+		BENCH_DAY_HOURS, (unsigned long long)first.samples, (double)wall / 1e6,
+		BENCH_DAY_HOURS * 3600e9 / wall, first.chargeAh,
+		BENCH_DAY_MV * cal.i1PerMv / 1000.0 * BENCH_DAY_HOURS,
+		(memcmp(&first, &second, sizeof(first)) == 0) ? "true" : "false");
+}
+
+/*
+ the path of a sample in the daemon, every sink open and a client on the
+ stream: the first scans may set things up, the following ones must not
+ allocate. A scheduled board and the text of readAllChannels as well.
+ */
+static void benchAllocations(VImon& vimon) {
+	VImonQuality quality;
+	VImonResampler resampler(10000000ULL);
+	VImonEnergy energy;
+	VImonDeadband deadband(&vimon);
+	VImonFormatter fmt(VIMON_FMT_CSV);
+	VImonPublisher pub;
+	VImonStreamServer server;
+	VImonStreamClient client;
+	VImonModbusServer modbus;
+	VImonScheduler sched(&vimon);
+	VImonSample sample, aligned[16];
+	char text[VIMON_FMT_LINE_SIZE];
+	volatile size_t sink = 0;
+	uint64_t count = 0, bytes = 0;
+	struct timespec pause = { 0, 1000000 };
+	unsigned samples = quick ? BENCH_ALLOC_SAMPLES / 10 : BENCH_ALLOC_SAMPLES, run, i;
+	int n, k;
+
+	quality.setBoard(&vimon);
+	modbus.setEnergy(&energy);
+	for (i=0; i<VIMON_CHANNELS; i++)
+		deadband.setDeadband(i, 1.0, 0.0);
+	deadband.setHeartbeat(1000);
+	if (!pub.open(BENCH_SHM_NAME) || !server.start(BENCH_SOCKET) || !client.connect(BENCH_SOCKET) ||
+			!client.subscribe(VIMON_ERR_ALL, 1, 32) || !modbus.start(BENCH_MODBUS_PORT)) {
+		printf("\"allocations\":{\"error\":\"unable to open the sinks\"},\n");
+		return;
+	}
+	while (server.getClientCount() < 1)
+		nanosleep(&pause, NULL);
+	vimon.setRate(ADS1115_RATE_860);
+	sched.setChannel(2, 250.0, ADS1115_RATE_860);
+	sched.setChannel(0, 25.0, ADS1115_RATE_860);
+	sched.build();
+
+	// run 0 warms up, run 1 is counted
+	for (run=0; run<2; run++) {
+		countAllocs = (run == 1);
+		for (i=0; i<samples; i++) {
+			vimon.readSample(&sample);
+			quality.check(&sample);
+			n = resampler.push(sample, aligned, 16);
+			for (k=0; k<n; k++) {
+				energy.add(aligned[k]);
+				if (deadband.check(aligned[k]) == 0)
+					continue;
+				pub.publish(aligned[k]);
+				server.publish(aligned[k]);
+				modbus.update(aligned[k]);
+				sink += fmt.format(aligned[k]);
+			}
+			sink += vimon.readAllChannels(text, sizeof(text), true);
+			sched.step(&sample);
+		}
+		countAllocs = false;
+		count = allocCount;
+		bytes = allocBytes;
+	}
+	if (count > 0)
+		allocFailed = true;
+
+	printf("\"allocations\":{\"samples\":%u,\"allocations\":%llu,\"bytes\":%llu},\n",
+		samples, (unsigned long long)count, (unsigned long long)bytes);
+	vimon.setRate(ADS1115_RATE_128);
+	modbus.stop();
+	server.stop();
+	pub.close();
+	shm_unlink(BENCH_SHM_NAME);
+}
+
+static void printSchedule(VImonScheduler& sched) {
+	int ch, n = 0;
+
+	printf("{\"feasible\":%s,\"base_ms\":%.3f,\"frame_ms\":%.3f,\"conversions\":%u,\"mux_switches\":%u,\"utilization_pct\":%.1f,\"channels\":[",
+		sched.isFeasible() ? "true" : "false", sched.getBaseNs() / 1e6, sched.getFrameNs() / 1e6,
+		sched.getEntryCount(), sched.getSwitchCount(), 100.0 * sched.getUtilization());
+	for (ch=0; ch<VIMON_CHANNELS; ch++) {
+		if (sched.getScheduledRate(ch) <= 0.0)
+			continue;
+		printf("%s{\"channel\":%d,\"target_hz\":%.3f,\"scheduled_hz\":%.3f,\"measured_hz\":%.3f,\"late\":%llu,\"feasible\":%s}",
+			n++ ? "," : "", ch, sched.getTargetRate(ch), sched.getScheduledRate(ch),
+			sched.getMeasuredRate(ch), (unsigned long long)sched.getLateCount(ch),
+			sched.isFeasible(ch) ? "true" : "false");
+	}
+	printf("]}");
+}
+
+/*
+ current at 50/s, battery voltage at 5/s and temperature every 5 s,
+ instead of all four channels at the rate of the fastest
+ */
+static void benchSchedule(VImon& vimon) {
+	VImonScheduler sched(&vimon);
+	VImonScheduler overload(&vimon);
+	VImonSample sample;
+	unsigned i, steps = quick ? 25 : 500;
+
+	sched.setChannel(2, 50.0, ADS1115_RATE_860);
+	sched.setChannel(0, 5.0, ADS1115_RATE_860);
+	sched.setChannel(1, 0.2, ADS1115_RATE_475);
+	if (sched.build())
+		for (i=0; i<steps; i++)
+			sched.step(&sample);
+	printf("\"schedule\":");
+	printSchedule(sched);
+
+	// a slow data rate on the voltage blocks the current for too long
+	overload.setChannel(2, 250.0, ADS1115_RATE_860);
+	overload.setChannel(0, 10.0, ADS1115_RATE_64);
+	overload.build();
+	printf(",\n\"schedule_infeasible\":");
+	printSchedule(overload);
+	printf(",\n");
+
+	vimon.setRate(ADS1115_RATE_128);
+}
+
+// current steps up at the time in "context", the other inputs are flat
+static float stepSignal(int pin, uint64_t ns, void *context) {
+	uint64_t stepNs = *(uint64_t *)context;
+
+	switch (pin) {
+		case 0: return 1024.0f;
+		case 1: return 512.0f;
+		case 2: return (ns < stepNs) ? 100.0f : 100.0f + BENCH_STEP;
+		default: return 5.0f;
+	}
+}
+
+/*
+ current at 50/s and battery voltage at 5/s when active, 1/16 of that
+ (1/4 in a quick run) when quiet. Both start active, slow down while the
+ inputs are flat and the current returns to 50/s after its step
+ */
+static void benchAdaptive(ADS1115sim& adc, VImon& vimon) {
+	VImonScheduler sched(&vimon);
+	VImonAdaptive adapt(&sched);
+	VImonSample sample;
+	uint64_t start, end, stepNs, now, detectNs = 0, idleNs = 0, t, last[VIMON_CHANNELS];
+	uint64_t conversions = 0, idleConversions = 0;
+	double fixedHz = 0.0, divisor = quick ? 4.0 : 16.0, idleHz = -1.0;
+	int ch;
+
+	adapt.setChannel(2, 50.0 / divisor, 50.0, ADS1115_RATE_860);
+	adapt.setChannel(0, 5.0 / divisor, 5.0, ADS1115_RATE_860);
+	adapt.setHold(BENCH_HOLD_MS);
+	if (!adapt.start()) {
+		printf("\"adaptive\":{\"feasible\":false},\n");
+		vimon.setRate(ADS1115_RATE_128);
+		return;
+	}
+	for (ch=0; ch<VIMON_CHANNELS; ch++)
+		fixedHz += sched.getScheduledRate(ch);
+
+	// long enough to get down to the idle rates before the step
+	start = clockNs(CLOCK_MONOTONIC);
+	stepNs = start + (quick ? 1500 : 3000) * 1000000ULL;
+	end = stepNs + (quick ? 400 : 1000) * 1000000ULL;
+	adc.setNoise(0.2);
+	adc.setSignal(stepSignal, &stepNs);
+	memset(last, 0, sizeof(last));
+	do {
+		sched.step(&sample);
+		adapt.update(sample);
+		now = clockNs(CLOCK_MONOTONIC);
+		// new conversions in the sample
+		for (ch=0; ch<VIMON_CHANNELS; ch++) {
+			t = sample.monotonic + (int64_t)sample.offsetUs[ch] * 1000;
+			if (t > last[ch] + VIMON_SAME_CONVERSION_NS) {
+				if (ch == 0 || ch == 2)
+					conversions++;
+				last[ch] = t;
+			}
+		}
+		// conversions at the idle rates, up to the step
+		if (idleNs == 0 && now < stepNs && adapt.getRate(2) <= 50.0 / divisor &&
+				adapt.getRate(0) <= 5.0 / divisor) {
+			idleNs = now;
+			idleConversions = conversions;
+		}
+		if (idleNs != 0 && idleHz < 0.0 && now >= stepNs)
+			idleHz = (conversions - idleConversions) * 1e9 / (double)(now - idleNs);
+		if (detectNs == 0 && now >= stepNs && adapt.isActive(2))
+			detectNs = now;
+	} while (now < end);
+	adc.setSignal(NULL, NULL);
+	adc.setNoise(0.5);
+
+	printf("\"adaptive\":{\"seconds\":%.3f,\"conversions_per_s\":%.1f,\"idle_conversions_per_s\":%.1f,"
+		"\"fixed_conversions_per_s\":%.1f,\"rate_changes\":%u,\"detect_ms\":%.1f,\"current_hz\":%.3f,\"voltage_hz\":%.3f},\n",
+		(now - start) / 1e9, conversions * 1e9 / (double)(now - start), idleHz, fixedHz,
+		adapt.getChangeCount(), detectNs ? (detectNs - stepNs) / 1e6 : -1.0,
+		adapt.getRate(2), adapt.getRate(0));
+	vimon.setRate(ADS1115_RATE_128);
+}
+
+/*
+ timeline of complete scans: acquisition, conversion, formatting, output
+ */
+static void traceScans(VImon& vimon, const char *fileName) {
+	VImonSample sample;
+	VImonQuality quality(&vimon);
+	VImonFormatter fmt(VIMON_FMT_CSV);
+	VImonWriter out(open("/dev/null", O_WRONLY));
+	int i;
+
+	VImonTrace::setThreadName("bench");
+	VImonTrace::clear();
+	VImonTrace::enable(true);
+	for (i=0; i<10; i++) {
+		vimon.readSample(&sample);
+		quality.check(&sample);
+		fmt.format(sample);
+		out.write(fmt);
+		out.flush();
+	}
+	VImonTrace::enable(false);
+	if (VImonTrace::write(fileName) < 0)
+		std::cerr << "unable to write trace file " << fileName << endl;
+}
+
+static void showUsage(void) {
+	cout << "usage:" << endl;
+	cout << execName << " -bXXXX -q -TFILE -h" << endl;
+	cout << "b = simulated I2C bus clock [kHz] (default 100, 0 = no bus time)" << endl;
+	cout << "q = quick run, one scan per data rate" << endl;
+	cout << "T = write a timeline trace of ten scans to FILE (needs \"make TRACE=1\")" << endl;
+	cout << "h = show help" << endl;
+}
+
+static bool parseArguments(int argc, char *argv[]) {
+	int i;
+	execName = std::string(basename(argv[0]));
+
+	for (i = 1; i < argc; i++) {
+		if ((argv[i][0] != '-') || (strlen(argv[i]) < 2))
+			continue;
+		switch (argv[i][1]) {
+			case 'b':
+				busClock = (uint32_t)atol(&argv[i][2]) * 1000;
+				break;
+			case 'q':
+				quick = true;
+				break;
+			case 'T':
+				traceFile = &argv[i][2];
+				break;
+			case 'h':
+				showUsage();
+				return false;
+			default:
+				std::cerr << "unknown parameter <" << &argv[i][1] << ">" << endl;
+				showUsage();
+				return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	I2CbusSim bus(busClock);
+	ADS1115sim adc;
+	VImon vimon;
+
+	if (!parseArguments(argc, argv))
+		exit(EXIT_FAILURE);
+
+	bus.setClock(busClock);
+	// mid-scale inputs, a little noise to exercise the formatter
+	adc.setInput(0, 1024.0);
+	adc.setInput(1, 512.0);
+	adc.setInput(2, 100.0);
+	adc.setInput(3, 5.0);
+	adc.setNoise(0.5);
+	bus.attach(BENCH_ADDRESS, &adc);
+	I2Cdev::setDefaultBus(&bus);
+
+	if (!vimon.initialize(BENCH_ADDRESS)) {
+		std::cerr << "simulated ADS1115 not found" << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	printf("{\"bus_clock_hz\":%u,\n", busClock);
+	benchTransactions(bus, vimon);
+	benchAutoRange(vimon);
+	benchScan(bus, vimon);
+	benchSettling(adc, vimon);
+	benchWaitBusy(bus);
+	benchSchedule(vimon);
+	benchAdaptive(adc, vimon);
+	benchSample(vimon);
+	benchDeadband(vimon);
+	benchShm();
+	benchStream();
+	benchModbus(bus);
+	benchAlignment(adc, vimon);
+	benchStartup(bus, adc, vimon);
+	benchRealtime();
+	benchVirtualTime();
+	benchAllocations(vimon);
+	benchReplay(bus);
+	printf("}\n");
+
+	if (traceFile != NULL) {
+#ifndef VIMON_TRACE
+		std::cerr << "tracing not compiled in, rebuild with \"make TRACE=1\"" << endl;
+#endif
+		traceScans(vimon, traceFile);
+	}
+
+	exit(allocFailed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,769 @@
+/*
+ VI monitoring board - scalability soak test
+
+ Simulates N ADS1115 boards spread over M I2C buses (ADS1115sim.h).
+ Every bus is driven by its own acquisition thread which scans its boards
+ at a fixed scan rate and hands the samples through a lock-free queue to
+ the processing thread (format + log).
+
+ Reported per run:
+ - sustained throughput [samples/s]
+ - queue high-water mark and samples dropped on a full queue
+ - missed deadlines (scan overran its slot) and lost samples (slot skipped)
+ - CPU utilisation per core and resident set size
+ - samples flagged by the quality checks and watchdog resets
+ - charge and energy integrated over all boards, from the time-aligned
+   samples (vimon_resample.h)
+ - with -E: checkpoints written, and whether the totals restored from
+   the checkpoint file match the final totals, and whether a store
+   reopening the file without restoring (vimond reloaded with a new
+   energy path) writes checkpoints that win over the old ones
+
+ With -R the scan rate is doubled after every run until samples are lost,
+ the last rate without loss is reported as the saturation point.
+
+ With -D every sample passes a deadband filter (vimon_deadband.h) before
+ it is logged and published, -P publishes every board to shared memory
+ (vimon_shm.h), a socket stream (vimon_stream.h) read by a client, and a
+ Modbus/TCP server (vimon_modbus.h) from the acquisition threads, as
+ vimond does. The run then reports the samples passed and suppressed by
+ the filter and the records received by the stream clients.
+
+ With -F one board of bus 0 at a time is power cycled: it drops off the
+ bus for SOAK_FAULT_OUTAGE_MS and comes back with its power-on register
+ defaults. The run reports failed conversions, recoveries and the time
+ from the board's return to its first good sample, while the other boards
+ must keep their rate.
+
+ No hardware or wiringPi is required, build with "make soak".
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "I2CdevPi.h"
+#include "ADS1115.h"
+#include "ADS1115sim.h"
+#include "I2Cclock.h"
+#include "I2Cstats.h"
+
+#include "vimon.h"
+#include "vimon_deadband.h"
+#include "vimon_energy.h"
+#include "vimon_fmt.h"
+#include "vimon_modbus.h"
+#include "vimon_quality.h"
+#include "vimon_resample.h"
+#include "vimon_ring.h"
+#include "vimon_shm.h"
+#include "vimon_store.h"
+#include "vimon_stream.h"
+
+using namespace std;
+
+#define SOAK_MAX_BUSES		16
+#define SOAK_BOARDS_PER_BUS	4		// ADS1115 address range 0x48..0x4B
+#define SOAK_MAX_CPUS		64
+#define SOAK_QUEUE_SIZE		1024
+#define SOAK_FAULT_OUTAGE_MS	100
+#define SOAK_DEADBAND_PCT	1.0		// -D deadband of every channel [%]
+#define SOAK_HEARTBEAT_MS	1000
+#define SOAK_SHM_NAME		"/vimonsoak.%d"		// -P, per board
+#define SOAK_SOCKET			"/tmp/vimonsoak.%d.sock"
+#define SOAK_MODBUS_PORT	15100	// + board
+
+struct SoakRecord {
+	uint16_t board;
+	VImonSample sample;
+};
+
+struct SoakBus {
+	I2CbusSim *bus;
+	ADS1115sim adc[SOAK_BOARDS_PER_BUS];
+	VImon vimon[SOAK_BOARDS_PER_BUS];
+	VImonQuality quality[SOAK_BOARDS_PER_BUS];
+	VImonResampler resampler[SOAK_BOARDS_PER_BUS];
+	VImonEnergy energy[SOAK_BOARDS_PER_BUS];
+	uint16_t boardId[SOAK_BOARDS_PER_BUS];
+	// sinks, NULL when off
+	VImonDeadband *deadband[SOAK_BOARDS_PER_BUS];
+	VImonPublisher *shm[SOAK_BOARDS_PER_BUS];
+	VImonStreamServer *stream[SOAK_BOARDS_PER_BUS];
+	VImonModbusServer *modbus[SOAK_BOARDS_PER_BUS];
+	int boards;
+	bool initOk;
+	VImonRing<SoakRecord, SOAK_QUEUE_SIZE> queue;
+
+	// written by the acquisition thread only
+	std::atomic<uint64_t> scans;
+	std::atomic<uint64_t> missed;		// scans which overran their slot
+	std::atomic<uint64_t> lost;			// samples never taken (slot skipped)
+	std::atomic<uint64_t> scanNsMax;
+	std::atomic<uint64_t> scanNsSum;
+	std::atomic<uint64_t> suppressed;	// by the deadband
+
+	// fault injection (-F), acquisition thread only
+	uint64_t faultPeriod;				// 0 = off
+	uint64_t faultNext;
+	int faultBoard;						// board currently off the bus, -1 = none
+	int faultRecover;					// board back on the bus, not yet recovered
+	uint64_t faultReturnNs;
+	unsigned faults;
+	unsigned recovered;
+	uint64_t recoveryNsMax;
+	uint64_t recoveryNsSum;
+};
+
+struct SoakResult {
+	uint64_t expected;
+	uint64_t processed;
+	uint64_t suppressed;
+	uint64_t received;					// by the stream clients
+	uint64_t dropped;
+	uint64_t missed;
+	uint64_t lost;
+	unsigned highWater;
+	double seconds;
+	double scanMsAvg;
+	double scanMsMax;
+	uint64_t errors;
+	uint64_t flagged;
+	uint32_t resets;
+	VImonEnergyTotals energy;
+	unsigned faults;
+	unsigned recovered;
+	double recoveryMsAvg;
+	double recoveryMsMax;
+};
+
+static string execName;
+static int numBoards = 4;
+static int numBuses = 1;
+static unsigned dataRate = 860;
+static double scanRate = 1.0;			// scans per second per board
+static unsigned runSeconds = 5;
+static bool ramp = false;
+static unsigned maxSteps = 12;
+static uint32_t busClock = I2CSIM_DEFAULT_CLOCK;
+static const char *logFile = "/dev/null";
+static bool showI2Cstats = false;
+static unsigned faultMs = 0;
+static const char *storeFile = NULL;
+static uint8_t scanPlan = VIMON_SCAN_SINGLE;
+static uint8_t autoRange = 0;
+static bool deadband = false;
+static bool publish = false;
+
+static std::atomic<bool> running;
+static std::atomic<bool> draining;
+static std::atomic<int> initDone;
+static std::atomic<uint64_t> startNs;		// set once all boards are initialised
+
+/*********************************************************************
+ per core CPU utilisation from /proc/stat
+ *********************************************************************/
+
+struct CpuTimes {
+	int cpus;
+	unsigned long long busy[SOAK_MAX_CPUS];
+	unsigned long long total[SOAK_MAX_CPUS];
+};
+
+static void readCpuTimes(CpuTimes *t) {
+	FILE *f = fopen("/proc/stat", "r");
+	char line[256];
+	unsigned long long v[8];
+	int cpu;
+
+	t->cpus = 0;
+	if (f == NULL) return;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (strncmp(line, "cpu", 3) != 0 || line[3] < '0' || line[3] > '9')
+			continue;
+		memset(v, 0, sizeof(v));
+		if (sscanf(line, "cpu%d %llu %llu %llu %llu %llu %llu %llu %llu", &cpu,
+				&v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) < 5)
+			continue;
+		if (cpu < 0 || cpu >= SOAK_MAX_CPUS) continue;
+		// idle + iowait are not busy
+		t->busy[cpu] = v[0] + v[1] + v[2] + v[5] + v[6] + v[7];
+		t->total[cpu] = t->busy[cpu] + v[3] + v[4];
+		if (cpu + 1 > t->cpus) t->cpus = cpu + 1;
+	}
+	fclose(f);
+}
+
+static long rssKb() {
+	FILE *f = fopen("/proc/self/statm", "r");
+	long pages = 0, resident = 0;
+	if (f == NULL) return 0;
+	if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+	fclose(f);
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/*********************************************************************
+ pipeline
+ *********************************************************************/
+
+/*
+ power cycle the boards of a bus in turn
+ - the board is detached, its registers reset, and attached again after
+   SOAK_FAULT_OUTAGE_MS
+ */
+static void injectFault(SoakBus *sb, uint64_t now) {
+	int b;
+	if (sb->faultBoard < 0) {
+		b = sb->faults++ % sb->boards;
+		sb->bus->detach(ADS1115_ADDRESS_ADDR_GND + b);
+		sb->adc[b].reset();
+		sb->faultBoard = b;
+		sb->faultNext = now + SOAK_FAULT_OUTAGE_MS * 1000000ULL;
+	} else {
+		b = sb->faultBoard;
+		sb->bus->attach(ADS1115_ADDRESS_ADDR_GND + b, &sb->adc[b]);
+		sb->faultBoard = -1;
+		sb->faultRecover = b;
+		sb->faultReturnNs = now;
+		sb->faultNext = now + sb->faultPeriod;
+	}
+}
+
+static void acquisitionThread(SoakBus *sb, uint64_t period) {
+	VImonSample sample, aligned[4];
+	SoakRecord rec;
+	uint64_t next, t0, now, ns, late;
+	int b, i, n;
+
+	I2Cdev::setBus(sb->bus);
+
+	sb->initOk = true;
+	for (b=0; b<sb->boards; b++) {
+		if (!sb->vimon[b].initialize(ADS1115_ADDRESS_ADDR_GND + b)) {
+			sb->initOk = false;
+			break;
+		}
+		sb->vimon[b].setRate(ADS1115::getRateSetting(dataRate));
+		sb->vimon[b].setScanPlan(scanPlan);
+		sb->vimon[b].setAutoRange(autoRange);
+		sb->quality[b].setBoard(&sb->vimon[b]);
+		sb->resampler[b].setPeriod(period);
+	}
+	initDone++;
+	if (!sb->initOk)
+		return;
+
+	while ((next = startNs.load()) == 0)
+		usleep(1000);
+
+	sb->faultNext = next + sb->faultPeriod;
+
+	while (running.load(std::memory_order_relaxed)) {
+		I2Cclock::sleepUntilNs(next);
+		t0 = I2Cclock::now();
+		if (sb->faultPeriod != 0 && t0 >= sb->faultNext)
+			injectFault(sb, t0);
+		for (b=0; b<sb->boards; b++) {
+			if (sb->vimon[b].readSample(&sample) == 0 && b == sb->faultRecover) {
+				// first good sample after the board came back
+				ns = I2Cclock::now() - sb->faultReturnNs;
+				sb->recovered++;
+				sb->recoveryNsSum += ns;
+				if (ns > sb->recoveryNsMax) sb->recoveryNsMax = ns;
+				sb->faultRecover = -1;
+			}
+			sb->quality[b].check(&sample);
+			// integrate V and I taken at the same instant
+			n = sb->resampler[b].push(sample, aligned, 4);
+			for (i=0; i<n; i++)
+				sb->energy[b].add(aligned[i]);
+			if (sb->deadband[b] != NULL && sb->deadband[b]->check(sample) == 0) {
+				sb->suppressed.store(sb->suppressed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				continue;
+			}
+			if (sb->shm[b] != NULL)
+				sb->shm[b]->publish(sample);
+			if (sb->stream[b] != NULL)
+				sb->stream[b]->publish(sample);
+			if (sb->modbus[b] != NULL)
+				sb->modbus[b]->update(sample);
+			rec.board = sb->boardId[b];
+			rec.sample = sample;
+			sb->queue.push(rec);
+		}
+		now = I2Cclock::now();
+		ns = now - t0;
+		sb->scans.store(sb->scans.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		sb->scanNsSum.store(sb->scanNsSum.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+		if (ns > sb->scanNsMax.load(std::memory_order_relaxed))
+			sb->scanNsMax.store(ns, std::memory_order_relaxed);
+
+		next += period;
+		if (now > next) {
+			// overran into the next slot, skip slots which have fully passed
+			sb->missed.store(sb->missed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			late = (now - next) / period;
+			if (late > 0) {
+				sb->lost.store(sb->lost.load(std::memory_order_relaxed) + late * sb->boards, std::memory_order_relaxed);
+				next += late * period;
+			}
+		}
+	}
+}
+
+static void processingThread(SoakBus *buses, int count, uint64_t *processed) {
+	SoakRecord rec;
+	VImonFormatter fmt(VIMON_FMT_CSV);
+	int fd = open(logFile, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	VImonWriter out(fd);
+	bool idle;
+	int i;
+
+	*processed = 0;
+	for (;;) {
+		idle = true;
+		for (i=0; i<count; i++) {
+			while (buses[i].queue.pop(&rec)) {
+				fmt.format(rec.sample);
+				out.write(fmt);
+				(*processed)++;
+				idle = false;
+			}
+		}
+		if (idle) {
+			if (draining.load(std::memory_order_acquire))
+				break;
+			out.poll();
+			usleep(500);
+		}
+	}
+	out.flush();
+	if (fd >= 0) close(fd);
+}
+
+/*
+ deadband and publishing sinks of a board as selected by -D and -P
+ - returns false if a sink can not be opened
+ */
+static bool openSinks(SoakBus *sb, int n) {
+	int id = sb->boardId[n], ch;
+	char name[64];
+
+	sb->deadband[n] = NULL;
+	sb->shm[n] = NULL;
+	sb->stream[n] = NULL;
+	sb->modbus[n] = NULL;
+	if (deadband) {
+		sb->deadband[n] = new VImonDeadband(&sb->vimon[n]);
+		for (ch=0; ch<VIMON_CHANNELS; ch++)
+			sb->deadband[n]->setDeadband(ch, 0.0, SOAK_DEADBAND_PCT);
+		sb->deadband[n]->setHeartbeat(SOAK_HEARTBEAT_MS);
+	}
+	if (!publish)
+		return true;
+	snprintf(name, sizeof(name), SOAK_SHM_NAME, id);
+	sb->shm[n] = new VImonPublisher();
+	if (!sb->shm[n]->open(name)) {
+		fprintf(stderr, "unable to create shared memory %s\n", name);
+		return false;
+	}
+	snprintf(name, sizeof(name), SOAK_SOCKET, id);
+	sb->stream[n] = new VImonStreamServer();
+	if (!sb->stream[n]->start(name)) {
+		fprintf(stderr, "unable to create socket %s\n", name);
+		return false;
+	}
+	sb->modbus[n] = new VImonModbusServer();
+	sb->modbus[n]->setEnergy(&sb->energy[n]);
+	if (!sb->modbus[n]->start(SOAK_MODBUS_PORT + id)) {
+		fprintf(stderr, "unable to listen on Modbus port %d\n", SOAK_MODBUS_PORT + id);
+		return false;
+	}
+	return true;
+}
+
+static void closeSinks(SoakBus *sb, int n) {
+	char name[64];
+
+	delete sb->deadband[n];
+	if (sb->shm[n] != NULL) {
+		sb->shm[n]->close();
+		snprintf(name, sizeof(name), SOAK_SHM_NAME, sb->boardId[n]);
+		shm_unlink(name);
+		delete sb->shm[n];
+	}
+	if (sb->stream[n] != NULL) {
+		sb->stream[n]->stop();
+		delete sb->stream[n];
+	}
+	if (sb->modbus[n] != NULL) {
+		sb->modbus[n]->stop();
+		delete sb->modbus[n];
+	}
+}
+
+// a client reading every record of the stream of board "id"
+static void streamClient(int id, std::atomic<uint64_t> *received) {
+	VImonStreamClient client;
+	VImonStreamRecord records[32];
+	char path[64];
+	int n;
+
+	snprintf(path, sizeof(path), SOAK_SOCKET, id);
+	if (!client.connect(path) || !client.subscribe(VIMON_ERR_ALL, 1, 32))
+		return;
+	while ((n = client.receive(records, 32)) >= 0)
+		*received += n;
+}
+
+/*
+ read the checkpoint file back and compare with the final totals
+ */
+static bool verifyStore(SoakBus *buses) {
+	VImonStore check(storeFile);
+	VImonEnergyTotals saved[VIMON_STORE_MAX_COUNT], now;
+	int n, b;
+
+	n = check.restore(saved, VIMON_STORE_MAX_COUNT);
+	if (n != numBoards && n != VIMON_STORE_MAX_COUNT)
+		return false;
+	for (b=0; b<n; b++) {
+		buses[b % numBuses].energy[b / numBuses].get(&now);
+		if (memcmp(&now, &saved[b], sizeof(now)) != 0)
+			return false;
+	}
+	return true;
+}
+
+/*
+ reopen the checkpoint file without restoring and write one checkpoint,
+ the other slot still holds an old record: a restore must return the new one
+ */
+static bool verifyReopen() {
+	VImonStore reopened(storeFile), check(storeFile);
+	VImonEnergyTotals totals, saved;
+
+	memset(&totals, 0, sizeof(totals));
+	totals.seconds = -1;
+	if (reopened.write(&totals, 1) != 0)
+		return false;
+	return check.restore(&saved, 1) == 1 && saved.seconds == -1;
+}
+
+static bool runStep(double rate, SoakResult *res) {
+	SoakBus *buses = new SoakBus[numBuses];
+	std::thread acq[SOAK_MAX_BUSES];
+	std::thread proc;
+	std::thread clients[SOAK_MAX_BUSES * SOAK_BOARDS_PER_BUS];
+	std::atomic<uint64_t> received(0);
+	uint64_t period = (uint64_t)(1e9 / rate);
+	uint64_t start, end, processed = 0, scans = 0, scanNs = 0, recoveryNs = 0;
+	CpuTimes cpu0, cpu1;
+	VImonEnergyTotals energy;
+	VImonStore *store = NULL;
+	int i, b;
+	bool ok = true;
+
+	for (i=0; i<numBuses; i++) {
+		buses[i].bus = new I2CbusSim(busClock);
+		buses[i].boards = 0;
+		buses[i].scans = buses[i].missed = buses[i].lost = 0;
+		buses[i].scanNsMax = buses[i].scanNsSum = 0;
+		buses[i].suppressed = 0;
+		// faults are injected on the first bus only
+		buses[i].faultPeriod = (i == 0) ? (uint64_t)faultMs * 1000000ULL : 0;
+		buses[i].faultBoard = buses[i].faultRecover = -1;
+		buses[i].faults = buses[i].recovered = 0;
+		buses[i].recoveryNsMax = buses[i].recoveryNsSum = 0;
+	}
+	// distribute boards round robin over the buses
+	for (b=0; b<numBoards; b++) {
+		SoakBus *sb = &buses[b % numBuses];
+		int n = sb->boards++;
+		sb->boardId[n] = b;
+		sb->adc[n].setInput(0, 900.0 + b);
+		sb->adc[n].setInput(1, 1000.0);
+		sb->adc[n].setInput(2, 150.0);
+		sb->adc[n].setInput(3, 2.0);
+		sb->adc[n].setNoise(1.0);
+		sb->bus->attach(ADS1115_ADDRESS_ADDR_GND + n, &sb->adc[n]);
+		if (!openSinks(sb, n))
+			ok = false;
+	}
+	if (!ok) {
+		for (b=0; b<numBoards; b++)
+			closeSinks(&buses[b % numBuses], b / numBuses);
+		for (i=0; i<numBuses; i++)
+			delete buses[i].bus;
+		delete[] buses;
+		return false;
+	}
+	if (publish)
+		for (b=0; b<numBoards; b++)
+			clients[b] = std::thread(streamClient, b, &received);
+
+	running = true;
+	draining = false;
+	initDone = 0;
+	startNs = 0;
+	// checkpoint the first boards every second
+	if (storeFile != NULL) {
+		unlink(storeFile);
+		store = new VImonStore(storeFile);
+		store->setPolicy(1000, 0.0, 0);
+		for (b=0; b<numBoards && b<VIMON_STORE_MAX_COUNT; b++)
+			store->add(&buses[b % numBuses].energy[b / numBuses]);
+		store->start();
+	}
+	proc = std::thread(processingThread, buses, numBuses, &processed);
+	for (i=0; i<numBuses; i++)
+		acq[i] = std::thread(acquisitionThread, &buses[i], period);
+	while (initDone < numBuses)
+		usleep(1000);
+	readCpuTimes(&cpu0);
+	start = I2Cclock::now() + 1000000ULL;
+	startNs = start;
+
+	I2Cclock::sleepUntilNs(start + (uint64_t)runSeconds * 1000000000ULL);
+	running = false;
+	for (i=0; i<numBuses; i++)
+		acq[i].join();
+	end = I2Cclock::now();
+	draining = true;
+	proc.join();
+	readCpuTimes(&cpu1);
+	// the servers stop, the clients see the end of their streams
+	for (b=0; b<numBoards; b++)
+		closeSinks(&buses[b % numBuses], b / numBuses);
+	for (b=0; b<numBoards; b++)
+		if (clients[b].joinable())
+			clients[b].join();
+
+	memset(res, 0, sizeof(*res));
+	res->seconds = (double)(end - start) / 1e9;
+	res->processed = processed;
+	res->received = received;
+	for (i=0; i<numBuses; i++) {
+		if (!buses[i].initOk) ok = false;
+		res->dropped += buses[i].queue.drops();
+		res->missed += buses[i].missed;
+		res->lost += buses[i].lost;
+		res->suppressed += buses[i].suppressed;
+		if (buses[i].queue.highWater() > res->highWater)
+			res->highWater = buses[i].queue.highWater();
+		scans += buses[i].scans;
+		// every slot either scanned all boards of the bus or was lost
+		res->expected += buses[i].scans * buses[i].boards + buses[i].lost;
+		scanNs += buses[i].scanNsSum;
+		if (buses[i].scanNsMax / 1e6 > res->scanMsMax)
+			res->scanMsMax = buses[i].scanNsMax / 1e6;
+		for (b=0; b<buses[i].boards; b++) {
+			res->errors += buses[i].vimon[b].getErrorCount();
+			res->flagged += buses[i].quality[b].getFlaggedCount();
+			res->resets += buses[i].quality[b].getResetCount();
+			buses[i].energy[b].get(&energy);
+			res->energy.chargeAh += energy.chargeAh;
+			res->energy.chargeWh += energy.chargeWh;
+			res->energy.dischargeAh += energy.dischargeAh;
+			res->energy.dischargeWh += energy.dischargeWh;
+			res->energy.seconds += energy.seconds;
+			res->energy.gapSeconds += energy.gapSeconds;
+		}
+		res->faults += buses[i].faults;
+		res->recovered += buses[i].recovered;
+		recoveryNs += buses[i].recoveryNsSum;
+		if (buses[i].recoveryNsMax / 1e6 > res->recoveryMsMax)
+			res->recoveryMsMax = buses[i].recoveryNsMax / 1e6;
+	}
+	res->scanMsAvg = scans ? (double)scanNs / scans / 1e6 : 0.0;
+	res->recoveryMsAvg = res->recovered ? (double)recoveryNs / res->recovered / 1e6 : 0.0;
+
+	printf("rate %.2f scans/s/board: %.1f samples/s sustained (%llu of %llu), queue hwm %u/%u, dropped %llu, "
+		"missed deadlines %llu, lost %llu, scan %.1f ms avg %.1f ms max, cpu [",
+		// suppressed samples were taken and checked, they count
+		rate, (res->processed + res->suppressed) / res->seconds, (unsigned long long)(res->processed + res->suppressed),
+		(unsigned long long)res->expected, res->highWater, SOAK_QUEUE_SIZE,
+		(unsigned long long)res->dropped, (unsigned long long)res->missed,
+		(unsigned long long)res->lost, res->scanMsAvg, res->scanMsMax);
+	for (i=0; i<cpu1.cpus && i<cpu0.cpus; i++) {
+		unsigned long long total = cpu1.total[i] - cpu0.total[i];
+		printf("%s%.0f%%", i ? " " : "", total ? 100.0 * (cpu1.busy[i] - cpu0.busy[i]) / total : 0.0);
+	}
+	printf("], rss %ld kB\n", rssKb());
+	printf("quality: %llu samples flagged, %u watchdog resets\n",
+		(unsigned long long)res->flagged, res->resets);
+	if (deadband || publish)
+		printf("sinks: %llu samples suppressed by the deadband, %llu stream records received\n",
+			(unsigned long long)res->suppressed, (unsigned long long)res->received);
+	printf("energy: charge %.6f Ah %.6f Wh, discharge %.6f Ah %.6f Wh, integrated %.1f s, gaps %.1f s (all boards)\n",
+		res->energy.chargeAh, res->energy.chargeWh, res->energy.dischargeAh, res->energy.dischargeWh,
+		res->energy.seconds, res->energy.gapSeconds);
+	if (store != NULL) {
+		store->stop();
+		printf("checkpoints: %llu written, %llu failed, restore %s\n",
+			(unsigned long long)store->getWriteCount(), (unsigned long long)store->getErrorCount(),
+			verifyStore(buses) ? "matches" : "does NOT match");
+		printf("checkpoints: reopened without restore %s\n",
+			verifyReopen() ? "continues the sequence" : "is shadowed by the old records");
+		delete store;
+	}
+	if (faultMs > 0)
+		printf("faults: %u power cycles, %llu failed conversions, %u recovered, "
+			"recovery %.1f ms avg %.1f ms max after the board returned\n",
+			res->faults, (unsigned long long)res->errors, res->recovered,
+			res->recoveryMsAvg, res->recoveryMsMax);
+	fflush(stdout);
+
+	for (i=0; i<numBuses; i++)
+		delete buses[i].bus;
+	delete[] buses;
+
+	if (!ok) {
+		std::cerr << "simulated board initialisation failed" << endl;
+		return false;
+	}
+	return true;
+}
+
+static void showUsage(void) {
+	cout << "usage:" << endl;
+	cout << execName << " -nX -mX -sXXX -rX.X -tX -R -bXXX -oFILE -S -FXXX -EFILE -B -A[X] -D -P -h" << endl;
+	cout << "n = number of boards (default 4)" << endl;
+	cout << "m = number of I2C buses (default 1, max 4 boards per bus)" << endl;
+	cout << "s = ADC data rate [SPS] (default 860)" << endl;
+	cout << "r = scan rate per board [1/s] (default 1.0, start rate with -R)" << endl;
+	cout << "t = duration of each run [s] (default 5)" << endl;
+	cout << "R = ramp the scan rate until samples are lost" << endl;
+	cout << "b = simulated I2C bus clock [kHz] (default 100)" << endl;
+	cout << "o = log file for the processed samples (default /dev/null)" << endl;
+	cout << "S = print I2C statistics at the end" << endl;
+	cout << "F = power cycle a board of bus 0 every XXX ms" << endl;
+	cout << "E = checkpoint the totals of the first 8 boards to FILE every second" << endl;
+	cout << "B = bipolar current as one differential conversion AIN2-AIN3" << endl;
+	cout << "A = auto-range the PGA of the channels in mask X (default 0xF, all)" << endl;
+	cout << "D = deadband filter of " << SOAK_DEADBAND_PCT << " % on every channel" << endl;
+	cout << "P = publish to shared memory, a socket stream with a client and Modbus/TCP" << endl;
+	cout << "h = show help" << endl;
+}
+
+static bool parseArguments(int argc, char *argv[]) {
+	int i;
+	execName = std::string(basename(argv[0]));
+
+	for (i = 1; i < argc; i++) {
+		if ((argv[i][0] != '-') || (strlen(argv[i]) < 2))
+			continue;
+		switch (argv[i][1]) {
+			case 'n':
+				numBoards = atoi(&argv[i][2]);
+				break;
+			case 'm':
+				numBuses = atoi(&argv[i][2]);
+				break;
+			case 's':
+				dataRate = atoi(&argv[i][2]);
+				break;
+			case 'r':
+				scanRate = atof(&argv[i][2]);
+				break;
+			case 't':
+				runSeconds = atoi(&argv[i][2]);
+				break;
+			case 'R':
+				ramp = true;
+				break;
+			case 'b':
+				busClock = (uint32_t)atol(&argv[i][2]) * 1000;
+				break;
+			case 'o':
+				logFile = &argv[i][2];
+				break;
+			case 'S':
+				showI2Cstats = true;
+				break;
+			case 'F':
+				faultMs = atoi(&argv[i][2]);
+				break;
+			case 'E':
+				storeFile = &argv[i][2];
+				break;
+			case 'B':
+				scanPlan = VIMON_SCAN_BIPOLAR;
+				break;
+			case 'A':
+				autoRange = argv[i][2] ? (uint8_t)strtol(&argv[i][2], NULL, 0) : VIMON_ERR_ALL;
+				break;
+			case 'D':
+				deadband = true;
+				break;
+			case 'P':
+				publish = true;
+				break;
+			case 'h':
+				showUsage();
+				return false;
+			default:
+				std::cerr << "unknown parameter <" << &argv[i][1] << ">" << endl;
+				showUsage();
+				return false;
+		}
+	}
+	if (numBuses < 1 || numBuses > SOAK_MAX_BUSES || numBoards < 1 ||
+			numBoards > numBuses * SOAK_BOARDS_PER_BUS || scanRate <= 0.0 || runSeconds < 1 ||
+			(faultMs > 0 && faultMs <= SOAK_FAULT_OUTAGE_MS)) {
+		std::cerr << "invalid configuration" << endl;
+		showUsage();
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	SoakResult res;
+	double rate, lastGood = 0.0;
+	unsigned step;
+	struct rusage ru;
+
+	if (!parseArguments(argc, argv))
+		exit(EXIT_FAILURE);
+
+	printf("soak: %d boards on %d buses, %u SPS, bus clock %u Hz, %u s per run%s\n",
+		numBoards, numBuses, dataRate, busClock, runSeconds,
+		(scanPlan == VIMON_SCAN_BIPOLAR) ? ", bipolar current" : "");
+
+	rate = scanRate;
+	for (step = 0; step < (ramp ? maxSteps : 1); step++) {
+		if (!runStep(rate, &res))
+			exit(EXIT_FAILURE);
+		if (res.dropped + res.lost > 0)
+			break;
+		lastGood = rate;
+		rate *= 2.0;
+	}
+
+	if (showI2Cstats)
+		I2Cstats::dump(stdout);
+
+	getrusage(RUSAGE_SELF, &ru);
+	printf("peak rss %ld kB\n", ru.ru_maxrss);
+	if (ramp) {
+		if (lastGood == 0.0)
+			printf("saturated at the start rate %.2f scans/s per board\n", scanRate);
+		else if (step < maxSteps)
+			printf("saturation point: %.2f scans/s per board (%.1f samples/s total), samples lost at %.2f\n",
+				lastGood, lastGood * numBoards, rate);
+		else
+			printf("no saturation up to %.2f scans/s per board\n", lastGood);
+	}
+	exit(EXIT_SUCCESS);
+}
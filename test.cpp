@@ -9,68 +9,189 @@
 
 #include <wiringPi.h>
 
+#include "I2CdevPi.h"
+#include "I2Cstats.h"
 #include "ADS1115.h"
 
 #include "vimon.h"
+#include "vimon_adapt.h"
+#include "vimon_deadband.h"
+#include "vimon_energy.h"
+#include "vimon_fmt.h"
+#include "vimon_modbus.h"
+#include "vimon_quality.h"
+#include "vimon_resample.h"
+#include "vimon_sched.h"
+#include "vimon_shm.h"
+#include "vimon_store.h"
+#include "vimon_stream.h"
+#include "vimon_trace.h"
+#include "I2Creplay.h"
 
 using namespace std;
 
+I2CbusPi i2cbus;
 VImon vimon;
+VImonQuality quality(&vimon);
+VImonEnergy energy;
 
 static string execName;
 bool detectTempProblem = false;
+bool measureSettling = false;
 long intervalTime = 1000000;		// in usec
 #define MIN_INTERVAL_TIME 100000
+VImonFormat outputFormat = VIMON_FMT_TEXT;
+string traceFile;
+string energyFile;
+string shmName;
+string streamPath;
+VImonStore *store = NULL;
+VImonPublisher *publisher = NULL;
+VImonStreamServer *streamServer = NULL;
+VImonModbusServer *modbusServer = NULL;
+uint16_t modbusPort = VIMON_MODBUS_PORT;
+VImonResampler *resampler = NULL;
+VImonScheduler *scheduler = NULL;
+// per channel rates for the scheduler (-s), 0 = not set
+double channelHz[VIMON_CHANNELS];
+unsigned channelSps[VIMON_CHANNELS];
+// adaptive rates (-a): idle at 1/ADAPT_IDLE_DIVISOR of the -s rate
+VImonAdaptive *adaptive = NULL;
+long adaptHoldMs = -1;
+#define ADAPT_IDLE_DIVISOR 16
+// report by exception (-D, -H), all sinks get changes only
+VImonDeadband *deadband = NULL;
+// I2C transactions recorded to (-R) or replayed from (-r) a trace file
+string recordFile;
+string replayFile;
+I2CbusRecorder *recorder = NULL;
+I2CbusReplay *replay = NULL;
 
-void printTimeNow() {
-    struct tm *time_now ;
-    time_t tim ;
-
-	tim = time (NULL);
-	time_now = localtime (&tim);
-	printf ("%02u:%02u:%02u", time_now->tm_hour, time_now->tm_min, time_now->tm_sec );
+static void printEnergy(FILE *f) {
+	VImonEnergyTotals t;
+	energy.get(&t);
+	fprintf(f, "energy: charge %.6f Ah %.6f Wh, discharge %.6f Ah %.6f Wh, "
+		"integrated %.1f s, gaps %.1f s, samples %llu used %llu rejected\n",
+		t.chargeAh, t.chargeWh, t.dischargeAh, t.dischargeWh, t.seconds, t.gapSeconds,
+		(unsigned long long)t.samples, (unsigned long long)t.rejected);
+	fflush(f);
 }
 
 void mainLoop() {
 	int16_t lastValue = 0, newValue, tolerance = 500;;
-	string result;
+	VImonSample sample, aligned[4], *batch;
+	int count, i;
+	VImonFormatter fmt(outputFormat);
+	VImonWriter out(STDOUT_FILENO);
+	// a terminal gets every line as it is produced
+	bool interactive = isatty(STDOUT_FILENO);
 
 	if(detectTempProblem)
 		printf("detecting Temp Problem .....\n");
+	fflush(stdout);
+
+	if (fmt.header() > 0)
+		out.write(fmt);
 
 	while(1) {
-		vimon.readAllChannels(result, TRUE);
-		if (detectTempProblem) {
-			newValue = vimon.rawValue[1];
-			if ( (newValue > (lastValue+tolerance)) || (newValue < (lastValue-tolerance)) ) {
-				printTimeNow();
-				cout << ": " << result << endl;
-			}
-			lastValue = newValue;
+		// the scheduler paces itself
+		if (scheduler != NULL) {
+			scheduler->step(&sample);
+			if (adaptive != NULL && adaptive->update(sample))
+				scheduler->report(stderr);
+		} else
+			vimon.readSample(&sample);
+		quality.check(&sample);
+		// optionally aligned onto a common time grid
+		if (resampler != NULL) {
+			count = resampler->push(sample, aligned, 4);
+			batch = aligned;
 		} else {
-			printTimeNow();
-			cout << ": " << result << endl;
+			count = 1;
+			batch = &sample;
+		}
+		for (i=0; i<count; i++) {
+			energy.add(batch[i]);
+			if (deadband != NULL && deadband->check(batch[i]) == 0)
+				continue;
+			if (publisher != NULL)
+				publisher->publish(batch[i]);
+			if (streamServer != NULL)
+				streamServer->publish(batch[i]);
+			if (modbusServer != NULL)
+				modbusServer->update(batch[i]);
+			if (detectTempProblem) {
+				newValue = batch[i].raw[1];
+				if ( (newValue > (lastValue+tolerance)) || (newValue < (lastValue-tolerance)) ) {
+					fmt.format(batch[i]);
+					out.write(fmt);
+				}
+				lastValue = newValue;
+			} else {
+				fmt.format(batch[i]);
+				out.write(fmt);
+			}
+		}
+		if (interactive)
+			out.flush();
+		else
+			out.poll();
+		// "kill -USR1" dumps the I2C statistics and the energy totals
+		if (I2Cstats::pollSignal(stderr)) {
+			printEnergy(stderr);
+			if (deadband != NULL)
+				fprintf(stderr, "deadband: %llu passed %llu suppressed %llu heartbeats\n",
+					(unsigned long long)deadband->getPassed(), (unsigned long long)deadband->getSuppressed(),
+					(unsigned long long)deadband->getHeartbeats());
+			if (scheduler != NULL)
+				scheduler->report(stderr);
 		}
+		// "kill -USR2" writes the trace file
+		VImonTrace::pollSignal();
+		if (replay != NULL && replay->finished())
+			break;
 		//vimon.readRaw();
 		//printf ("%5d %5d %5d %5d\n", vimon.rawValue[0], vimon.rawValue[1], vimon.rawValue[2], vimon.rawValue[3]);
 		//if (vimon.rawValue[1] < 9000) printf ("!!!!! ^^^^^ !!!!!\n");
 
-		usleep(intervalTime);		//micro seconds
+		if (scheduler == NULL)
+			I2Cdev::delay(intervalTime / 1000);	// on the clock of the process (I2Cclock.h)
 	}
 }
 
 static void showUsage(void) {
     cout << "usage:" << endl;
-    cout << execName <<" -d -tXXXX -h" << endl;
+    cout << execName <<" -d -iXXXX -sCH:HZ[:SPS] -a[XXXX] -gXXXX -DCH:ABS[:PCT] -HXXXX -B -A[X] -S -f[t|c|j] -TFILE -EFILE -P[NAME] -U[PATH] -M[PORT] -RFILE -rFILE -h" << endl;
     cout << "d = detect temp transient" << endl;
 	cout << "i = read interval [ms] (min=100)" << endl; 
+	cout << "s = convert channel CH at HZ per second and SPS data rate (default 860),"  << endl;
+	cout << "    one option per channel, replaces -i (see vimon_sched.h)" << endl;
+	cout << "a = adapt the -s rates to the activity, down to 1/16 after XXXX ms quiet"  << endl;
+	cout << "    (default 10000, see vimon_adapt.h)" << endl;
+	cout << "g = align all channels onto a time grid of XXXX ms" << endl;
+	cout << "D = pass a sample on only when channel CH moved by more than ABS mV (V1, V2)"  << endl;
+	cout << "    or mA (I1, I2) or PCT percent, one option per channel (see vimon_deadband.h)" << endl;
+	cout << "H = pass a sample at least every XXXX ms with -D (default 60000, 0 = never)" << endl;
+	cout << "B = bipolar current as one differential conversion AIN2-AIN3" << endl;
+	cout << "A = auto-range the PGA of the channels in mask X (default 0xF, all)" << endl;
+	cout << "S = measure the mux settling of every channel at start and discard"  << endl;
+	cout << "    the conversions which have not settled (see vimon.h)" << endl;
+	cout << "f = output format: t=text (default), c=CSV, j=JSON lines" << endl;
+	cout << "T = record a timeline trace, written to file on SIGUSR2" << endl;
+	cout << "P = publish the samples in shared memory NAME (default /vimon, see vimon_shm.h)" << endl;
+	cout << "U = stream the samples on Unix socket PATH (default /tmp/vimon.sock, see vimon_stream.h)" << endl;
+	cout << "M = serve the readings to Modbus/TCP masters on PORT (default 502, see vimon_modbus.h)" << endl;
+	cout << "E = keep the charge and energy totals in FILE across restarts" << endl;
+	cout << "R = record the I2C transactions to FILE (see I2Creplay.h)" << endl;
+	cout << "r = replay the I2C transactions of FILE at their original timing instead of"  << endl;
+	cout << "    the board, stop at its end and fail if the driver diverged" << endl;
     cout << "h = show help" << endl;
 }
 
 static bool parseArguments (int argc, char *argv[])
 {
     char buffer[64];
-    int i, buflen;
+    int i, ch, buflen;
 	long lValue;
     int retval = true;
 	string str;
@@ -94,6 +215,98 @@ static bool parseArguments (int argc, char *argv[])
 						intervalTime = lValue * 1000;
 						if (intervalTime < MIN_INTERVAL_TIME) intervalTime = MIN_INTERVAL_TIME;
 						break;
+					case 's':
+						ch = atoi(&buffer[2]);
+						if (ch < 0 || ch >= VIMON_CHANNELS || strchr(buffer, ':') == NULL) {
+							std::cerr << "invalid channel rate <" << &buffer[2] << ">" << endl;
+							retval = false;
+							break;
+						}
+						channelHz[ch] = atof(strchr(buffer, ':') + 1);
+						channelSps[ch] = (strchr(strchr(buffer, ':') + 1, ':') != NULL) ?
+							atoi(strchr(strchr(buffer, ':') + 1, ':') + 1) : 860;
+						break;
+					case 'a':
+						adaptHoldMs = buffer[2] ? atol(&buffer[2]) : VIMON_ADAPT_HOLD_MS;
+						break;
+					case 'g':
+						lValue = atol(&buffer[2]);
+						if (lValue > 0)
+							resampler = new VImonResampler((uint64_t)lValue * 1000000ULL);
+						break;
+					case 'D':
+						ch = atoi(&buffer[2]);
+						if (ch < 0 || ch >= VIMON_CHANNELS || strchr(buffer, ':') == NULL) {
+							std::cerr << "invalid channel deadband <" << &buffer[2] << ">" << endl;
+							retval = false;
+							break;
+						}
+						if (deadband == NULL)
+							deadband = new VImonDeadband(&vimon);
+						deadband->setDeadband(ch, atof(strchr(buffer, ':') + 1),
+							(strchr(strchr(buffer, ':') + 1, ':') != NULL) ?
+							atof(strchr(strchr(buffer, ':') + 1, ':') + 1) : 0.0);
+						break;
+					case 'H':
+						if (deadband == NULL)
+							deadband = new VImonDeadband(&vimon);
+						deadband->setHeartbeat(atol(&buffer[2]));
+						break;
+					case 'B':
+						vimon.setScanPlan(VIMON_SCAN_BIPOLAR);
+						break;
+					case 'A':
+						vimon.setAutoRange(buffer[2] ? (uint8_t)strtol(&buffer[2], NULL, 0) : VIMON_ERR_ALL);
+						break;
+					case 'S':
+						measureSettling = true;
+						break;
+					case 'f':
+						switch (buffer[2]) {
+							case 't':
+								outputFormat = VIMON_FMT_TEXT;
+								break;
+							case 'c':
+								outputFormat = VIMON_FMT_CSV;
+								break;
+							case 'j':
+								outputFormat = VIMON_FMT_JSON;
+								break;
+							default:
+								std::cerr << "unknown output format <" << &buffer[2] << ">" << endl;
+								retval = false;
+								break;
+						}
+						break;
+					case 'T':
+						traceFile = std::string(&buffer[2]);
+						break;
+					case 'E':
+						energyFile = std::string(&buffer[2]);
+						break;
+					case 'U':
+						streamServer = new VImonStreamServer();
+						streamPath = buffer[2] ? std::string(&buffer[2]) : VIMON_STREAM_PATH;
+						break;
+					case 'M':
+						modbusServer = new VImonModbusServer();
+						lValue = buffer[2] ? atol(&buffer[2]) : VIMON_MODBUS_PORT;
+						if (lValue < 1 || lValue > 65535) {
+							std::cerr << "invalid Modbus port <" << &buffer[2] << ">" << endl;
+							retval = false;
+						}
+						modbusPort = (uint16_t)lValue;
+						break;
+					case 'R':
+						recordFile = std::string(&buffer[2]);
+						break;
+					case 'r':
+						replayFile = std::string(&buffer[2]);
+						break;
+					case 'P':
+						publisher = new VImonPublisher();
+						shmName = buffer[2] ? std::string(&buffer[2]) : VIMON_SHM_NAME;
+						break;
                     case 'h':
                         showUsage();
                         retval = false;
@@ -113,16 +326,122 @@ static bool parseArguments (int argc, char *argv[])
 
 int main (int argc, char *argv[])
 {
+	VImonEnergyTotals totals;
+	bool feasible;
+	int i;
+
     if (! parseArguments(argc, argv) ){
 		goto exit_fail;
 	}
 
+	if (!replayFile.empty()) {
+		replay = new I2CbusReplay();
+		if (!replay->load(replayFile.c_str())) {
+			std::cerr << "unable to read I2C trace " << replayFile << endl;
+			goto exit_fail;
+		}
+		replay->setRealTime(true);
+		I2Cdev::setDefaultBus(replay);
+	} else if (!recordFile.empty()) {
+		recorder = new I2CbusRecorder(&i2cbus);
+		if (!recorder->open(recordFile.c_str())) {
+			std::cerr << "unable to create I2C trace " << recordFile << endl;
+			goto exit_fail;
+		}
+		I2Cdev::setDefaultBus(recorder);
+	} else
+		I2Cdev::setDefaultBus(&i2cbus);
+	I2Cstats::installSignalHandler();
+	if (!traceFile.empty()) {
+#ifndef VIMON_TRACE
+		std::cerr << "tracing not compiled in, rebuild with \"make TRACE=1\"" << endl;
+#endif
+		VImonTrace::setThreadName("acquisition");
+		VImonTrace::installSignalHandler(traceFile.c_str());
+		VImonTrace::enable(true);
+	}
+
 	if (!vimon.initialize( ADS1115_ADDRESS_ADDR_SDA )) {
 		goto exit_fail;
 	}
 
+	if (publisher != NULL && !publisher->open(shmName.c_str())) {
+		std::cerr << "unable to create shared memory " << shmName << endl;
+		goto exit_fail;
+	}
+
+	if (streamServer != NULL && !streamServer->start(streamPath.c_str())) {
+		std::cerr << "unable to create socket " << streamPath << endl;
+		goto exit_fail;
+	}
+
+	if (modbusServer != NULL) {
+		modbusServer->setEnergy(&energy);
+		if (!modbusServer->start(modbusPort)) {
+			std::cerr << "unable to listen on Modbus port " << modbusPort << endl;
+			goto exit_fail;
+		}
+	}
+
+	// continue the totals of the last run, checkpointed in the background
+	if (!energyFile.empty()) {
+		store = new VImonStore(energyFile.c_str());
+		if (store->restore(&totals, 1) == 1)
+			energy.set(totals);
+		store->add(&energy);
+		if (!store->start()) {
+			std::cerr << "unable to open energy file " << energyFile << endl;
+			goto exit_fail;
+		}
+	}
+
+	// before the schedule, which times the conversions with the policy
+	if (measureSettling) {
+		VImonSettle settle = { 0, 0, 0 };
+		for (i=0; i<VIMON_CHANNELS; i++) {
+			if (i == 3 && vimon.getScanPlan() == VIMON_SCAN_BIPOLAR)
+				continue;
+			if (vimon.measureSettling(i, &settle) < 0) {
+				fprintf(stderr, "settling: ch%d did not settle (first error %d, noise %d codes)\n",
+					i, settle.firstError, settle.noise);
+				continue;
+			}
+			vimon.setSettleDiscard(i, settle.discard);
+			fprintf(stderr, "settling: ch%d discards %u conversions (first error %d, noise %d codes)\n",
+				i, settle.discard, settle.firstError, settle.noise);
+		}
+	}
+
+	// multi-rate schedule instead of scanning all channels every interval
+	for (i=0; i<VIMON_CHANNELS; i++) {
+		if (channelHz[i] <= 0.0)
+			continue;
+		if (scheduler == NULL)
+			scheduler = new VImonScheduler(&vimon);
+		scheduler->setChannel(i, channelHz[i], ADS1115::getRateSetting(channelSps[i]));
+	}
+	if (scheduler != NULL && adaptHoldMs >= 0) {
+		adaptive = new VImonAdaptive(scheduler);
+		adaptive->setHold((unsigned)adaptHoldMs);
+		for (i=0; i<VIMON_CHANNELS; i++)
+			if (channelHz[i] > 0.0)
+				adaptive->setChannel(i, channelHz[i] / ADAPT_IDLE_DIVISOR, channelHz[i],
+					ADS1115::getRateSetting(channelSps[i]));
+	}
+	if (scheduler != NULL) {
+		// adaptive: built with every channel active, the worst case
+		feasible = (adaptive != NULL) ? adaptive->start() : scheduler->build();
+		scheduler->report(stderr);
+		if (!feasible)
+			goto exit_fail;
+	}
+
 	mainLoop();
 
+	// the end of a replay
+	replay->report(stderr);
+	if (replay->getDivergences() > 0)
+		goto exit_fail;
 	exit(EXIT_SUCCESS);
 
 exit_fail:
@@ -14,116 +14,444 @@
  */
 
 
+#include <new>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "ADS1115.h"
+#include "I2Cclock.h"
 
 #include "vimon_cal.h"
 #include "vimon.h"
+#include "vimon_fmt.h"
+#include "vimon_trace.h"
 
 using namespace std;
 
+#define VIMON_MUX_UNKNOWN	0xFF
 
 VImon::VImon() {
 	_adc = NULL;
+	_rate = ADS1115_RATE_128;
+	_plan = VIMON_SCAN_SINGLE;
+	_autoRange = 0;
+	_online = false;
+	_errorRun = 0;
+	_backoffMs = VIMON_RETRY_MIN_MS;
+	_retryNs = 0;
+	_failNs = 0;
+	_errors = 0;
+	_recoveries = 0;
+	_lastOutageNs = 0;
+	_mux = VIMON_MUX_UNKNOWN;
+	getDefaultCalibration(&_cal);
+	rawError = VIMON_ERR_ALL;
+	for (int i=0; i<VIMON_CHANNELS; i++) {
+		rawValue[i] = 0;
+		rawPga[i] = VIMON_PGA_WIDE;
+		rawTimestamp[i] = 0;
+		_pga[i] = VIMON_PGA_WIDE;
+		_chanRate[i] = _rate;
+		_discard[i] = 0;
+	}
 }
 
 VImon::~VImon() {
 	if (_adc != NULL)
-		delete _adc;
+		_adc->~ADS1115();
 }
 
 bool VImon::initialize(uint8_t address) {
 	if (_adc != NULL) {
-		return false;		// fail if already initialized (can only initialize once)
+		return reinitialize();		// already created, probe again
 	}
 
-	_adc = new ADS1115(address);
-	_adc->initialize();
+	// in the object, a board in an arena brings its ADC along
+	_adc = new (_adcMem) ADS1115(address);
 
-	if (!this->testConnection()) {
-		delete _adc;
-		_adc = NULL;
+	if (!reinitialize()) {
+		perror("ADS1115 not found \n");
 		return false;
 	}
+	// the first scan is made by the first read
+	return true;
+}
+
+/*
+ probe and write the complete configuration in one transaction, the
+ ADS1115 may have lost it in a power cycle. A written configuration
+ leaves the mux on the first channel of a scan, which then needs no
+ switch; a restart finds it where the last scan left it.
+ */
+bool VImon::configure() {
+	_adc->clearError();
+	_mux = VIMON_MUX_UNKNOWN;
+	return _adc->configure(ADS1115_MUX_P0_NG, _pga[0], _chanRate[0]) && !_adc->hasError();
+}
+
+bool VImon::powerDown() {
+	if (_adc == NULL || !_online)
+		return false;
+	_adc->clearError();
+	_adc->setMode(ADS1115_MODE_SINGLESHOT);
+	_mux = VIMON_MUX_UNKNOWN;
+	return !_adc->hasError();
+}
 
-    // set gain
-    _adc->setGain(ADS1115_PGA_2P048);
+void VImon::getDefaultCalibration(VImonCalibration *cal) {
+	cal->v1PerMv = V1_MV_PER_MV;
+	cal->v1Offset = V1_OFFSET;
+	cal->v2PerMv = V2_MV_PER_MV;
+	cal->v2Offset = V2_OFFSET;
+	cal->ptOhmPerMv = PT_OHM_PER_MV;
+	cal->ptOffsetOhm = PT_OFFSET_OHM;
+	cal->ptReferenceOhm = PT_REFERENCE_OHM;
+	cal->ptSlope = PT_SLOPE;
+	cal->ptOffsetTemp = PT_OFFSET_TEMP;
+	cal->i1PerMv = I1_MA_PER_MV;
+	cal->i2PerMv = I2_MA_PER_MV;
+	cal->ibiPerMv = IBI_MA_PER_MV;
+	cal->ibiOffset = IBI_OFFSET_MA;
+}
+
+bool VImon::reinitialize() {
+	uint64_t now;
 
-    //_adc->showConfigRegister();
-	readRaw();	// read all channels once
+	if (_adc == NULL)
+		return false;
+
+	if (configure()) {
+		now = I2Cclock::now();
+		if (_failNs != 0) {
+			_recoveries++;
+			_lastOutageNs = now - _failNs;
+			_failNs = 0;
+		}
+		_online = true;
+		_errorRun = 0;
+		_backoffMs = VIMON_RETRY_MIN_MS;
+		return true;
+	}
 
-    return true;
+	// not there (yet), back off before the next probe
+	now = I2Cclock::now();
+	if (_failNs == 0)
+		_failNs = now;
+	_online = false;
+	_retryNs = now + (uint64_t)_backoffMs * 1000000ULL;
+	_backoffMs *= 2;
+	if (_backoffMs > VIMON_RETRY_MAX_MS)
+		_backoffMs = VIMON_RETRY_MAX_MS;
+	return false;
+}
+
+/*
+ offline board: re-probe when the retry interval has passed
+ - returns true when the board is online
+ */
+bool VImon::probeDue() {
+	if (_adc == NULL)
+		return false;
+	if (I2Cclock::now() < _retryNs)
+		return false;
+	return reinitialize();
+}
+
+void VImon::conversionFailed() {
+	_mux = VIMON_MUX_UNKNOWN;
+	_errors++;
+	if (_errorRun++ == 0)
+		_failNs = I2Cclock::now();
+	if (_errorRun >= VIMON_OFFLINE_ERRORS) {
+		// first probe after the minimum interval
+		_online = false;
+		_backoffMs = VIMON_RETRY_MIN_MS;
+		_retryNs = I2Cclock::now() + (uint64_t)_backoffMs * 1000000ULL;
+	}
 }
 
 bool VImon::testConnection() {
-	if (!_adc->testConnection()) {
+	if (_adc == NULL || !_adc->testConnection()) {
         perror("ADS1115 not found \n");
         return false;
     }
 	return true;
 }
 
-void VImon::readRaw() {
-	rawValue[0] = _adc->getConversionP0GND();
-	rawValue[1] = _adc->getConversionP1GND();
-	rawValue[2] = _adc->getConversionP2GND();
-	rawValue[3] = _adc->getConversionP3GND();
+void VImon::setRate(uint8_t rate) {
+	int i;
+
+	_rate = rate;
+	for (i=0; i<VIMON_CHANNELS; i++)
+		_chanRate[i] = rate;
+	if (_adc != NULL && _online)
+		_adc->setRate(rate);
 }
 
-int VImon::getRawValue(int channel, int16_t *value) {
-	switch (channel) {
-		case 0:
-			*value = _adc->getConversionP0GND();
-			break;
-		case 1:
-			*value = _adc->getConversionP1GND();
-			break;
-		case 2:
-			*value = _adc->getConversionP2GND();
-			break;
-		case 3:
-			*value = _adc->getConversionP3GND();
-			break;
-		default:
-			return -1;
+void VImon::setChannelRate(int channel, uint8_t rate) {
+	if (channel >= 0 && channel < VIMON_CHANNELS)
+		_chanRate[channel] = rate;
+}
+
+/*
+ estimated time of one conversion of "channel", including the conversions
+ discarded when the previous conversion was on another input
+ */
+uint64_t VImon::getConversionCostNs(int channel, bool muxSwitch) {
+	int range;
+
+	if (channel < 0 || channel >= VIMON_CHANNELS)
+		return 0;
+	inputOf(channel, &range);
+	return ((uint64_t)ADS1115::getConversionNs(_chanRate[range]) + VIMON_BUS_OVERHEAD_NS) *
+		(1 + (muxSwitch ? _discard[range] : 0));
+}
+
+void VImon::setSettleDiscard(int channel, uint8_t conversions) {
+	if (channel >= 0 && channel < VIMON_CHANNELS)
+		_discard[channel] = conversions;
+}
+
+void VImon::setScanPlan(uint8_t plan) {
+	_plan = plan;
+}
+
+/*
+ mux setting of a channel, single ended or AIN2-AIN3 for the current
+ channels of the bipolar scan plan
+ - "range" receives the channel holding the PGA, data rate and settling
+   settings (the bipolar current has one for both channels)
+ */
+uint8_t VImon::inputOf(int channel, int *range) {
+	static const uint8_t muxSingle[VIMON_CHANNELS] = {
+		ADS1115_MUX_P0_NG, ADS1115_MUX_P1_NG, ADS1115_MUX_P2_NG, ADS1115_MUX_P3_NG
+	};
+
+	if (_plan == VIMON_SCAN_BIPOLAR && channel >= 2) {
+		*range = 2;
+		return ADS1115_MUX_P2_N3;
 	}
+	*range = channel;
+	return muxSingle[channel];
+}
+
+/*
+ conversion of one channel, single ended or AIN2-AIN3 for the current
+ channels of the bipolar scan plan, at the channel's PGA setting
+ - "pga" receives the gain the value was converted with
+ - returns 0 on success, -1 on failure
+ */
+int VImon::convert(int channel, int16_t *value, uint8_t *pga) {
+	int16_t reading;
+	uint8_t mux, n;
+	int range;
+
+	if (_adc == NULL || channel < 0 || channel >= VIMON_CHANNELS)
+		return -1;
+	if (!_online && !probeDue())
+		return -1;
+	mux = inputOf(channel, &range);
+
+	_adc->clearError();
+	// a slowly settling input still carries the previous one
+	if (mux != _mux)
+		for (n=0; n<_discard[range] && !_adc->hasError(); n++)
+			_adc->getConversion(mux, _pga[range], _chanRate[range]);
+	reading = _adc->getConversion(mux, _pga[range], _chanRate[range]);
+	if (_adc->hasError()) {
+		conversionFailed();
+		return -1;
+	}
+	_mux = mux;
+	_errorRun = 0;
+	_failNs = 0;
+	*value = reading;
+	*pga = _pga[range];
+	if (_autoRange & (1 << range))
+		_pga[range] = nextRange(_pga[range], reading);
 	return 0;
+}
+
+int VImon::measureSettling(int channel, VImonSettle *result) {
+	int16_t code[VIMON_SETTLE_PROBES][VIMON_SETTLE_CONVERSIONS];
+	int32_t settled[VIMON_SETTLE_PROBES], sum, error, firstError = 0, noise = 0;
+	uint8_t mux, other[VIMON_CHANNELS];
+	int range, otherRange[VIMON_CHANNELS], others = 0, discard = 0;
+	int ch, probe, i, j;
+
+	if (_adc == NULL || channel < 0 || channel >= VIMON_CHANNELS)
+		return -1;
+	if (!_online && !probeDue())
+		return -1;
+	mux = inputOf(channel, &range);
+	// the other inputs of the scan plan, switched from in turn
+	for (ch=0; ch<VIMON_CHANNELS; ch++) {
+		other[others] = inputOf(ch, &otherRange[others]);
+		for (j=0; j<others && other[j] != other[others]; j++)
+			;
+		if (other[others] != mux && j == others)
+			others++;
+	}
+	if (others == 0)
+		return -1;
 
+	for (probe=0; probe<VIMON_SETTLE_PROBES; probe++) {
+		j = probe % others;
+		_adc->clearError();
+		_adc->getConversion(other[j], _pga[otherRange[j]], _chanRate[otherRange[j]]);
+		for (i=0; i<VIMON_SETTLE_CONVERSIONS && !_adc->hasError(); i++)
+			code[probe][i] = _adc->getConversion(mux, _pga[range], _chanRate[range]);
+		if (_adc->hasError()) {
+			conversionFailed();
+			return -1;
+		}
+	}
+	_mux = mux;
+	_errorRun = 0;
+
+	// settled values, the noise over all probes
+	for (probe=0; probe<VIMON_SETTLE_PROBES; probe++) {
+		sum = 0;
+		for (i=VIMON_SETTLE_CONVERSIONS-VIMON_SETTLE_REFERENCE; i<VIMON_SETTLE_CONVERSIONS; i++)
+			sum += code[probe][i];
+		settled[probe] = sum / VIMON_SETTLE_REFERENCE;
+		for (i=VIMON_SETTLE_CONVERSIONS-VIMON_SETTLE_REFERENCE; i<VIMON_SETTLE_CONVERSIONS; i++)
+			if (abs(code[probe][i] - settled[probe]) > noise)
+				noise = abs(code[probe][i] - settled[probe]);
+	}
+	// last conversion off the settled value, in the worst probe
+	for (probe=0; probe<VIMON_SETTLE_PROBES; probe++) {
+		for (i=0; i<VIMON_SETTLE_CONVERSIONS-VIMON_SETTLE_REFERENCE; i++) {
+			error = abs(code[probe][i] - settled[probe]);
+			if (error > 2 * noise + VIMON_SETTLE_TOLERANCE && i + 1 > discard)
+				discard = i + 1;
+		}
+		if (abs(code[probe][0] - settled[probe]) > firstError)
+			firstError = abs(code[probe][0] - settled[probe]);
+	}
+
+	if (result != NULL) {
+		result->discard = (uint8_t)discard;
+		result->firstError = (firstError > INT16_MAX) ? INT16_MAX : (int16_t)firstError;
+		result->noise = (int16_t)noise;
+	}
+	// not settled before the reference conversions
+	if (discard >= VIMON_SETTLE_CONVERSIONS - VIMON_SETTLE_REFERENCE)
+		return -1;
+	return discard;
 }
 
-int VImon::getUnscaledMilliVolts(int channel, float *value, bool useRaw) {
-	float reading;
-	switch (channel) {
-		case 0:
-			if (useRaw)
-				reading = (float)rawValue[0] * ADS1115_MV_2P048;
-			else
-				reading = (float)_adc->getConversionP0GND() * ADS1115_MV_2P048;
-			break;
-		case 1:
-			if (useRaw)
-				reading = (float)rawValue[1] * ADS1115_MV_2P048;
-			else
-				reading = (float)_adc->getConversionP1GND() * ADS1115_MV_2P048;
-			break;
-		case 2:
-			if (useRaw)
-				reading = (float)rawValue[2] * ADS1115_MV_2P048;
-			else
-				reading = (float)_adc->getConversionP2GND() * ADS1115_MV_2P048;
-			break;
-		case 3:
-			if (useRaw)
-				reading = (float)rawValue[3] * ADS1115_MV_2P048;
-			else
-				reading = (float)_adc->getConversionP3GND() * ADS1115_MV_2P048;
+int VImon::autoSettle() {
+	int ch, n, ret = 0;
+
+	for (ch=0; ch<VIMON_CHANNELS; ch++) {
+		// CH3 of the bipolar plan is the same conversion as CH2
+		if (_plan == VIMON_SCAN_BIPOLAR && ch == 3)
+			continue;
+		n = measureSettling(ch);
+		if (n < 0)
+			ret = -1;
+		else
+			_discard[ch] = (uint8_t)n;
+	}
+	return ret;
+}
+
+/*
+ range for the next conversion from the last reading
+ - a saturated reading goes straight back to the widest range
+ - up one range above VIMON_RANGE_HIGH of full scale, down to the
+   narrowest range where the value stays below VIMON_RANGE_LOW of its
+   full scale; the gap between the two is the hysteresis
+ */
+uint8_t VImon::nextRange(uint8_t pga, int16_t reading) {
+	int32_t code = (reading < 0) ? -(int32_t)reading : reading;
+
+	if (code >= 32767)
+		return VIMON_PGA_WIDE;
+	if (code > 32768 * VIMON_RANGE_HIGH / 100)
+		return (pga > VIMON_PGA_WIDE) ? pga - 1 : pga;
+	// each step down doubles the code
+	while (pga < VIMON_PGA_NARROW && code * 2 < 32768 * VIMON_RANGE_LOW / 100) {
+		code *= 2;
+		pga++;
+	}
+	return pga;
+}
+
+void VImon::setAutoRange(uint8_t mask) {
+	int i;
+
+	_autoRange = mask & VIMON_ERR_ALL;
+	// channels without auto-ranging convert at the default range
+	for (i=0; i<VIMON_CHANNELS; i++)
+		if (!(_autoRange & (1 << i)))
+			_pga[i] = VIMON_PGA_WIDE;
+}
+
+int VImon::readChannel(int channel) {
+	uint8_t bit;
+
+	if (channel < 0 || channel >= VIMON_CHANNELS)
+		return -1;
+	// CH3 shares the differential conversion of CH2
+	if (_plan == VIMON_SCAN_BIPOLAR && channel == 3)
+		channel = 2;
+	bit = 1 << channel;
+	if (convert(channel, &rawValue[channel], &rawPga[channel]) < 0) {
+		rawValue[channel] = 0;
+		rawTimestamp[channel] = 0;
+		rawError |= bit;
+	} else {
+		rawTimestamp[channel] = _adc->getConversionTimestamp();
+		rawError &= ~bit;
+	}
+	if (_plan == VIMON_SCAN_BIPOLAR && channel == 2) {
+		rawValue[3] = rawValue[2];
+		rawPga[3] = rawPga[2];
+		rawTimestamp[3] = rawTimestamp[2];
+		rawError = (rawError & ~VIMON_ERR_CH3) | ((rawError & VIMON_ERR_CH2) << 1);
+	}
+	return (rawError & bit) ? -1 : 0;
+}
+
+void VImon::readRaw() {
+	int i;
+
+	for (i=0; i<VIMON_CHANNELS; i++) {
+		// bipolar: CH3 was read with CH2
+		if (i == 3 && _plan == VIMON_SCAN_BIPOLAR)
 			break;
-		default:
+		readChannel(i);
+	}
+}
+
+int VImon::getRawValue(int channel, int16_t *value) {
+	uint8_t pga;
+
+	if (channel < 0 || channel >= VIMON_CHANNELS)
+		return -1;
+	return convert(channel, value, &pga);
+}
+
+int VImon::getUnscaledMilliVolts(int channel, float *value, bool useRaw) {
+	int16_t reading;
+	uint8_t pga;
+
+	if (channel < 0 || channel >= VIMON_CHANNELS)
+		return -1;
+	if (useRaw) {
+		if (rawError & (1 << channel))
 			return -1;
+		reading = rawValue[channel];
+		pga = rawPga[channel];
+	} else if (convert(channel, &reading, &pga) < 0) {
+		return -1;
 	}
-	*value = reading;
+	*value = (float)reading * ADS1115::getMvPerCount(pga);
 	return 0;
 }
 
@@ -136,10 +464,10 @@ int VImon::getMilliVolts(int channel, float *value, bool useRaw) {
 
 	switch(channel) {
 		case 0:
-			mVscaled = (mVunscaled * V1_MV_PER_MV) + V1_OFFSET;
+			mVscaled = (mVunscaled * _cal.v1PerMv) + _cal.v1Offset;
 			break;
 		case 1:
-			mVscaled = (mVunscaled * V2_MV_PER_MV) + V2_OFFSET;
+			mVscaled = (mVunscaled * _cal.v2PerMv) + _cal.v2Offset;
 			break;
 		default:
 			return -1;
@@ -149,35 +477,47 @@ int VImon::getMilliVolts(int channel, float *value, bool useRaw) {
 }
 
 int VImon::getPT100temp(float *value, bool useRaw) {
-	float ohm;
-	if (getPT100ohm(&ohm, useRaw) < 0) {
+	float mVunscaled;
+	if (getUnscaledMilliVolts(1, &mVunscaled, useRaw) < 0) {
 		return -1;
 	}
-    *value = (ohm/PT_REFERENCE_OHM-1.0)/PT_SLOPE;
-	*value += (float)PT_OFFSET_TEMP;
+	*value = getPT100temp(mVunscaled, _cal);
 	return 0;
 }
 
+float VImon::getPT100temp(float mvUnscaled, const VImonCalibration& cal) {
+	float ohm = (mvUnscaled * cal.ptOhmPerMv) + cal.ptOffsetOhm;
+	return (ohm/cal.ptReferenceOhm-1.0)/cal.ptSlope + cal.ptOffsetTemp;
+}
+
 int VImon::getPT100ohm(float *value, bool useRaw) {
 	float mVunscaled;
 	if (getUnscaledMilliVolts(1, &mVunscaled, useRaw) < 0) {
 		return -1;
 	}
-	*value = (mVunscaled * PT_OHM_PER_MV) + PT_OFFSET_OHM;
+	*value = (mVunscaled * _cal.ptOhmPerMv) + _cal.ptOffsetOhm;
 	return 0;
 }
 
 int VImon::getMilliAmps(int channel, float *value, bool useRaw) {
-	float mVunscaled;
+	float mVunscaled, ma;
 	if (getUnscaledMilliVolts(channel, &mVunscaled, useRaw) < 0) {
 		return -1;
 	}
+	if (_plan == VIMON_SCAN_BIPOLAR && (channel == 2 || channel == 3)) {
+		// charging part on CH2, discharging part on CH3
+		ma = (mVunscaled * _cal.ibiPerMv) + _cal.ibiOffset;
+		if (channel == 3)
+			ma = 0.0 - ma;
+		*value = (ma > 0.0) ? ma : 0.0;
+		return 0;
+	}
 	switch (channel) {
 		case 2:
-			*value = mVunscaled * I1_MA_PER_MV;
+			*value = mVunscaled * _cal.i1PerMv;
 			break;
 		case 3:
-			*value = mVunscaled * I2_MA_PER_MV;
+			*value = mVunscaled * _cal.i2PerMv;
 			break;
 		default:
 			return -1;
@@ -187,11 +527,17 @@ int VImon::getMilliAmps(int channel, float *value, bool useRaw) {
 
 int VImon::getBipolarMilliAmps(float *value, bool useRaw) {
 	float mVunscaled, i1, i2;
+	if (_plan == VIMON_SCAN_BIPOLAR) {
+		// one differential conversion
+		if (getUnscaledMilliVolts(2, &mVunscaled, useRaw) < 0) return -1;
+		*value = (mVunscaled * _cal.ibiPerMv) + _cal.ibiOffset;
+		return 0;
+	}
 	// read both current channels
 	if (getUnscaledMilliVolts(2, &mVunscaled, useRaw) < 0) return -1;
-	i1 = mVunscaled * I1_MA_PER_MV;
+	i1 = mVunscaled * _cal.i1PerMv;
 	if (getUnscaledMilliVolts(3, &mVunscaled, useRaw) < 0) return -1;
-	i2 = mVunscaled * I2_MA_PER_MV;
+	i2 = mVunscaled * _cal.i2PerMv;
 	// positive value on i1 (charging)
 	if (i1 > i2) {
 		*value = i1;
@@ -201,78 +547,83 @@ int VImon::getBipolarMilliAmps(float *value, bool useRaw) {
 	return 0;
 }
 
-void VImon::readAllChannels(std::string& retStr, bool useRaw) {
-	float mVunscaled;
-	float voltage_mv;
-	float current1_ma, current2_ma;
-	float pt100ohm, pt100temp;
+void VImon::fillSample(VImonSample *sample, bool useRaw) {
 	int i;
-	char buf[64];
-
-	if (useRaw)
-		readRaw();
-
-	retStr = "";
-	// show raw values
-	for (i=0; i<4; i++) {
-		sprintf(buf, "%5d ",rawValue[i]);
-		retStr += buf;
+	VIMON_TRACE_SPAN("convert");
+
+	sample->error = 0;
+	sample->quality = 0;
+	for (i=0; i<VIMON_CHANNELS; i++) {
+		sample->offsetUs[i] = 0;
+		sample->raw[i] = rawValue[i];
+		sample->pga[i] = rawPga[i];
+		if (getUnscaledMilliVolts(i, &sample->mv[i], useRaw) < 0)
+			sample->error |= (1 << i);
 	}
+	if (getMilliVolts(0, &sample->v1_mv, useRaw) < 0)
+		sample->error |= VIMON_ERR_CH0;
+	if (getMilliVolts(1, &sample->v2_mv, useRaw) < 0)
+		sample->error |= VIMON_ERR_CH1;
+	if (getMilliAmps(2, &sample->i1_ma, useRaw) < 0)
+		sample->error |= VIMON_ERR_CH2;
+	if (getMilliAmps(3, &sample->i2_ma, useRaw) < 0)
+		sample->error |= VIMON_ERR_CH3;
+}
 
-	//printf(" : ");
-	retStr += " : ";
+int VImon::readSample(VImonSample *sample) {
+	VIMON_TRACE_SPAN("scan");
 
-	// show unscaled mV reading
-	for (i=0; i<4; i++) {
-		if (getUnscaledMilliVolts(i, &mVunscaled, useRaw) == 0) {
-			sprintf(buf, "%5.1f ", mVunscaled);
-		} else {
-			sprintf(buf, "-err- ");
-		}
-		retStr += buf;
-	}
+	readRaw();
+	return makeSample(sample);
+}
 
-	// show Voltage (CH0)
-	if (getMilliVolts(0, &voltage_mv, useRaw) == 0) {
-		sprintf(buf, " : %5.1f mV", voltage_mv);
-	} else {
-		sprintf(buf, " : -err- mV");
-	}
-	retStr += buf;
+int VImon::makeSample(VImonSample *sample) {
+	uint64_t now;
+	int64_t offset;
+	int i;
 
-	// show Voltage (CH1)
-	if (getMilliVolts(1, &voltage_mv, useRaw) == 0) {
-		sprintf(buf, " : %5.1f mV", voltage_mv);
-	} else {
-		sprintf(buf, " : -err- mV");
+	now = I2Cclock::now();
+	sample->timestamp = I2Cclock::wallNs();
+	sample->monotonic = now;
+	fillSample(sample, true);
+	// conversion mid-points relative to the timestamp
+	for (i=0; i<VIMON_CHANNELS; i++) {
+		if (rawTimestamp[i] == 0)
+			continue;
+		// a channel left out of a schedule (vimon_sched.h) ages without limit
+		offset = ((int64_t)rawTimestamp[i] - (int64_t)now) / 1000;
+		sample->offsetUs[i] = (offset < INT32_MIN) ? INT32_MIN : (int32_t)offset;
 	}
-	retStr += buf;
+	return (sample->error == 0) ? 0 : -1;
+}
 
-	// show PT100 (CH1)
-/*	if (getPT100ohm(&pt100ohm, useRaw) == 0) {
-		getPT100temp(&pt100temp, useRaw);
-		sprintf(buf, " : %6.2f Ohm : %5.2f DegC", pt100ohm, pt100temp);
-	} else {
-		sprintf(buf, " : -err-  Ohm : -err- DegC");
-	}
-	retStr += buf;
-*/
+size_t VImon::readAllChannels(char *buf, size_t size, bool useRaw) {
+	VImonSample sample;
+	VImonFormatter fmt(VIMON_FMT_TEXT);
+	size_t len;
 
+	if (useRaw)
+		readRaw();
 
-	// show Current 1 (CH2)
-	if (getMilliAmps(2, &current1_ma, useRaw) == 0) {
-		sprintf(buf, " : %6.1f mA", current1_ma);
-	} else {
-		sprintf(buf, " : -err-  mA");
-	}
-	retStr += buf;
+	sample.timestamp = 0;
+	sample.monotonic = 0;
+	fillSample(&sample, useRaw);
+
+	fmt.setTextTimestamp(false);
+	len = fmt.format(sample);
+	// strip the line terminator
+	len = (len > 0) ? len - 1 : 0;
+	if (size == 0)
+		return len;
+	if (len >= size)
+		len = size - 1;
+	memcpy(buf, fmt.data(), len);
+	buf[len] = 0;
+	return len;
+}
 
-	// show Current 2 (CH3)
-	if (getMilliAmps(3, &current2_ma, useRaw) == 0) {
-		sprintf(buf, " : %6.1f mA", current2_ma);
-	} else {
-		sprintf(buf, " : -err-  mA");
-	}
-	retStr += buf;
+void VImon::readAllChannels(std::string& retStr, bool useRaw) {
+	char buf[VIMON_FMT_LINE_SIZE];
 
+	retStr.assign(buf, readAllChannels(buf, sizeof(buf), useRaw));
 }
@@ -27,6 +27,144 @@
 
 #include "ADS1115.h"
 
+#define VIMON_CHANNELS 4
+
+/*
+ error mask bits in VImonSample.error
+ */
+#define VIMON_ERR_CH0	0x01
+#define VIMON_ERR_CH1	0x02
+#define VIMON_ERR_CH2	0x04
+#define VIMON_ERR_CH3	0x08
+#define VIMON_ERR_ALL	0x0F
+
+/*
+ error handling and recovery
+ - a conversion which fails on the bus (after I2Cdev::retries) is flagged,
+   the remaining channels are still read
+ - after VIMON_OFFLINE_ERRORS consecutive failed conversions the board is
+   taken offline: reads fail at once without bus traffic, so the other
+   boards on the bus keep their scan rate
+ - an offline board is re-probed from the next read which is due, first
+   after VIMON_RETRY_MIN_MS, the interval doubles up to VIMON_RETRY_MAX_MS.
+   When the ADS1115 answers it is configured again (initialize, gain, rate)
+ */
+#define VIMON_OFFLINE_ERRORS	4
+#define VIMON_RETRY_MIN_MS		5
+#define VIMON_RETRY_MAX_MS		50
+
+// bus time of a conversion: trigger, first status poll, result read
+#define VIMON_BUS_OVERHEAD_NS	1000000
+
+/*
+ scan plans (setScanPlan)
+ - VIMON_SCAN_SINGLE: all four channels single ended against GND, the
+   bipolar current is the larger of CH2 and CH3
+ - VIMON_SCAN_BIPOLAR: CH0, CH1 single ended and the current as one
+   differential conversion AIN2-AIN3 (calibration IBI_xxx in vimon_cal.h).
+   Three conversions per scan; CH2 and CH3 both hold the differential
+   code, i1_ma carries the positive (charging) and i2_ma the negative
+   (discharging) part of the current
+ */
+#define VIMON_SCAN_SINGLE	0
+#define VIMON_SCAN_BIPOLAR	1
+
+/*
+ automatic range selection (setAutoRange)
+ The inputs span 0 to 2.048 V, VIMON_PGA_WIDE. A channel with auto-ranging
+ selects its PGA for the next conversion from the previous reading, up
+ to VIMON_PGA_NARROW (0.256 V, 8x the resolution):
+ - a reading above VIMON_RANGE_HIGH % of full scale switches one range up,
+   a saturated one straight to VIMON_PGA_WIDE
+ - the narrowest range in which the reading stays below VIMON_RANGE_LOW %
+   of full scale is selected otherwise
+ The gain is written together with the mux setting, it costs no extra
+ transaction. Raw codes are at the gain in VImonSample.pga / rawPga, the
+ mV values are scaled accordingly.
+ */
+#define VIMON_PGA_WIDE		ADS1115_PGA_2P048
+#define VIMON_PGA_NARROW	ADS1115_PGA_0P256
+#define VIMON_RANGE_HIGH	90
+#define VIMON_RANGE_LOW		40
+
+/*
+ mux settling (measureSettling, setSettleDiscard)
+ In single-shot mode a mux switch costs no wait, the ADS1115 converts the
+ new input with the next trigger. A source with a high impedance (the
+ PT100 divider, an RC filter) may still carry part of the previous input
+ on the sampling capacitor for a few conversions. measureSettling()
+ switches to a channel from the other inputs VIMON_SETTLE_PROBES times
+ and converts it VIMON_SETTLE_CONVERSIONS times after each switch:
+ - the mean of the last VIMON_SETTLE_REFERENCE conversions is the settled
+   value, their largest spread in all probes the noise
+ - a conversion off the settled value by more than twice the noise plus
+   VIMON_SETTLE_TOLERANCE codes has not settled
+ - the policy is the number of conversions up to the last one which had
+   not settled, in the worst probe. They are discarded after every switch
+   to the input, an input which settles at once (0) pays nothing
+ */
+#define VIMON_SETTLE_PROBES		4
+#define VIMON_SETTLE_CONVERSIONS	10
+#define VIMON_SETTLE_REFERENCE	4
+#define VIMON_SETTLE_TOLERANCE	2
+
+// result of measureSettling()
+struct VImonSettle {
+	uint8_t discard;				// conversions to discard after a switch
+	int16_t firstError;				// worst first conversion after a switch [codes]
+	int16_t noise;					// spread of the settled conversions [codes]
+};
+
+/*
+ calibration of the conversions from mV at the ADC input, the defaults
+ are the values of vimon_cal.h (getDefaultCalibration). A new calibration
+ (setCalibration) applies from the next conversion on.
+ */
+struct VImonCalibration {
+	float v1PerMv;					// V1_MV_PER_MV
+	float v1Offset;					// V1_OFFSET [mV]
+	float v2PerMv;
+	float v2Offset;
+	float ptOhmPerMv;				// PT100 on CH1
+	float ptOffsetOhm;
+	float ptReferenceOhm;
+	float ptSlope;
+	float ptOffsetTemp;
+	float i1PerMv;					// I1_MA_PER_MV
+	float i2PerMv;
+	float ibiPerMv;					// bipolar scan plan
+	float ibiOffset;				// [mA]
+};
+
+/*
+ one complete reading of all channels
+ - values derived from a channel flagged in "error" are not valid
+ - the conversion of channel n took place at timestamp + offsetUs[n]
+   (estimated mid-point of the conversion, 0 if unknown), that is at
+   monotonic + offsetUs[n] on the monotonic clock. Intervals and the
+   order of conversions are taken from the monotonic time, a wall clock
+   step only moves the timestamp
+ - a channel not converted again since the previous sample repeats its
+   conversion time, give or take VIMON_SAME_CONVERSION_NS (the offset is
+   rounded and taken against a new timestamp)
+ */
+#define VIMON_SAME_CONVERSION_NS	100000
+
+struct VImonSample {
+	uint64_t timestamp;				// wall clock [ns since epoch], I2Cclock::wallNs()
+	uint64_t monotonic;				// the same instant [ns], I2Cclock::now()
+	int32_t offsetUs[VIMON_CHANNELS];	// conversion mid-points [us]
+	int16_t raw[VIMON_CHANNELS];	// ADC codes
+	uint8_t pga[VIMON_CHANNELS];	// ADS1115_PGA_xxx of the codes
+	float mv[VIMON_CHANNELS];		// unscaled mV at the ADC input
+	float v1_mv;					// CH0 voltage
+	float v2_mv;					// CH1 voltage
+	float i1_ma;					// CH2 current
+	float i2_ma;					// CH3 current
+	uint8_t error;					// VIMON_ERR_xxx mask
+	uint16_t quality;				// VIMON_Q_xxx flags (vimon_quality.h)
+};
+
 class VImon {
 public:
 	VImon();
@@ -35,11 +173,35 @@ public:
 /*
  initialise the VI board ADC
  - must be called before any other functions 
- - can only be called once 
+ - a board which is not found is kept offline and probed again by the
+   following reads (see above)
+ - calling it again re-probes and re-configures the board, "address"
+   is only used by the first call
+ - probing and configuring take one register read and at most one write,
+   no conversion: the first read makes the first scan, until then all
+   channels are flagged in rawError
  - returns true on success
 */
 	bool initialize(uint8_t address);
 
+/*
+ probe and configure the ADS1115 now, regardless of the retry interval
+ - returns true when the board is online
+ */
+	bool reinitialize();
+	bool isOnline() { return _online; }
+
+/*
+ error statistics
+ - getErrorCount(): failed conversions
+ - getRecoveryCount(): times the board came back after failing
+ - getLastOutageNs(): time from the first failed conversion to the
+   successful re-configuration of the last recovery
+ */
+	uint32_t getErrorCount() { return _errors; }
+	uint32_t getRecoveryCount() { return _recoveries; }
+	uint64_t getLastOutageNs() { return _lastOutageNs; }
+
 /*
  read and store raw analog value
  using this function can avoind rapid subsequent reading from
@@ -50,6 +212,13 @@ public:
  */
 	void readRaw();
 
+/*
+ read one channel into rawValue[] (bipolar scan plan: CH2 and CH3
+ are the same conversion)
+ - returns 0 on success, -1 on failure (flagged in rawError)
+ */
+	int readChannel(int channel);
+
 /*
  get function read various analog values
  - valid channels: 0-1 for Voltage, 2-3 for Current
@@ -72,6 +241,73 @@ public:
 	int getPT100ohm(float* value, bool useRaw =0);
 	int getPT100temp(float *value, bool useRaw =0);
 	int getTemperature(float *value, bool useRaw =0);
+	// PT100 temperature of the unscaled mV of CH1
+	static float getPT100temp(float mvUnscaled, const VImonCalibration& cal);
+
+	void setCalibration(const VImonCalibration& cal) { _cal = cal; }
+	const VImonCalibration& getCalibration() { return _cal; }
+	static void getDefaultCalibration(VImonCalibration *cal);
+
+/*
+ leave the ADS1115 in single-shot mode, it powers down after the
+ conversion in progress, e.g. before the program exits
+ - returns false if it could not be written
+ */
+	bool powerDown();
+
+/*
+ set the ADC data rate (ADS1115_RATE_xxx) used for all channels
+ */
+	void setRate(uint8_t rate);
+
+/*
+ data rate of one channel, changed together with the mux setting
+ (see vimon_sched.h for running channels at different rates)
+ */
+	void setChannelRate(int channel, uint8_t rate);
+	uint8_t getChannelRate(int channel) { return _chanRate[channel & 3]; }
+
+/*
+ estimated duration of one conversion of a channel at its data rate
+ - muxSwitch: the previous conversion was on another input
+ */
+	uint64_t getConversionCostNs(int channel, bool muxSwitch);
+
+/*
+ conversions discarded after a mux switch to a channel's input, 0 = none
+ (the default). A running VImonScheduler keeps its measured conversion
+ times until VImonScheduler::clearCosts()
+ */
+	void setSettleDiscard(int channel, uint8_t conversions);
+	uint8_t getSettleDiscard(int channel) { return _discard[channel & 3]; }
+
+/*
+ characterise the settling of a channel after a mux switch at its
+ current gain and data rate (see VIMON_SETTLE_xxx above)
+ - the bipolar current is measured on CH2
+ - returns the conversions to discard, -1 if a conversion failed or the
+   input did not settle within VIMON_SETTLE_CONVERSIONS
+ */
+	int measureSettling(int channel, VImonSettle *result = NULL);
+
+/*
+ measure every channel of the scan plan and use the results
+ - returns 0, -1 if a channel failed (its setting is kept)
+ */
+	int autoSettle();
+
+/*
+ select the channels converted by a scan (VIMON_SCAN_xxx)
+ */
+	void setScanPlan(uint8_t plan);
+	uint8_t getScanPlan() { return _plan; }
+
+/*
+ enable auto-ranging for the channels in "mask" (1 << channel), 0 = off
+ - in the bipolar scan plan bit 2 selects it for the current
+ */
+	void setAutoRange(uint8_t mask);
+	uint8_t getAutoRange() { return _autoRange; }
 
 /*
  returns true when the ADS1115 is present on the I2C bus
@@ -84,15 +320,63 @@ public:
    details come from a single reading.
  */
 	void readAllChannels(std::string& retStr, bool useRaw =0);
+/*
+ same into "buf", nothing allocated
+ - returns the length of the text, it is cut to size - 1
+ */
+	size_t readAllChannels(char *buf, size_t size, bool useRaw =0);
+
+/*
+ read all channels once and convert them into a sample
+ - the sample is timestamped when the last channel has been read, the
+   offsets to the mid-points of the conversions are stored in offsetUs
+ - returns 0 on success, -1 if any channel failed (see sample->error)
+ */
+	int readSample(VImonSample *sample);
+
+/*
+ timestamp and convert the stored raw values without reading
+ - returns 0 if no channel is flagged in rawError, -1 otherwise
+ */
+	int makeSample(VImonSample *sample);
 
 /*
  storage for raw readings
+ - channels which failed in the last readRaw() are 0 and flagged in rawError
  */
 	int16_t rawValue[4];
+	uint8_t rawPga[4];				// ADS1115_PGA_xxx of rawValue
+	uint8_t rawError;
+	uint64_t rawTimestamp[4];		// conversion mid-points [I2Cclock::now() ns]
 
 private:
-	ADS1115 *_adc;
-	bool _init_done;
+	int convert(int channel, int16_t *value, uint8_t *pga);
+	uint8_t inputOf(int channel, int *range);
+	static uint8_t nextRange(uint8_t pga, int16_t reading);
+	bool configure();
+	void conversionFailed();
+	bool probeDue();
+	void fillSample(VImonSample *sample, bool useRaw);
+
+	ADS1115 *_adc;				// in _adcMem once initialised
+	alignas(ADS1115) unsigned char _adcMem[sizeof(ADS1115)];
+	VImonCalibration _cal;
+	uint8_t _rate;
+	uint8_t _plan;
+	uint8_t _autoRange;			// channel mask
+	uint8_t _pga[VIMON_CHANNELS];	// range of the next conversion
+	uint8_t _chanRate[VIMON_CHANNELS];	// ADS1115_RATE_xxx per channel
+	uint8_t _discard[VIMON_CHANNELS];	// after a mux switch
+	uint8_t _mux;				// input of the last conversion, 0xFF = unknown
+
+	bool _online;
+	unsigned _errorRun;			// consecutive failed conversions
+	unsigned _backoffMs;		// next re-probe interval
+	uint64_t _retryNs;			// next re-probe [monotonic ns]
+	uint64_t _failNs;			// first failed conversion of the outage
+	uint32_t _errors;
+	uint32_t _recoveries;
+	uint64_t _lastOutageNs;
 };
 
 #endif /* _VIMON_H_ */
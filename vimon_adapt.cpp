@@ -0,0 +1,185 @@
+/*
+ VI monitoring board - adaptive sampling rate
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "vimon_adapt.h"
+
+#define NS_PER_SEC		1000000000ULL
+
+VImonAdaptive::VImonAdaptive(VImonScheduler *sched) {
+	_sched = sched;
+	memset(_chan, 0, sizeof(_chan));
+	_holdNs = (uint64_t)VIMON_ADAPT_HOLD_MS * 1000000ULL;
+	_changes = 0;
+}
+
+void VImonAdaptive::setChannel(int channel, double idleHz, double activeHz, uint8_t activeAdcRate) {
+	if (channel < 0 || channel >= VIMON_CHANNELS || activeHz <= 0.0)
+		return;
+	Channel& c = _chan[channel];
+	c.activeHz = activeHz;
+	c.idleHz = (idleHz > 0.0 && idleHz < activeHz) ? idleHz : activeHz;
+	c.activeAdcRate = activeAdcRate;
+	if (c.slopeLimit == 0.0f && c.noiseLimit == 0.0f) {
+		c.slopeLimit = VIMON_ADAPT_SLOPE;
+		c.noiseLimit = VIMON_ADAPT_NOISE;
+	}
+}
+
+void VImonAdaptive::setThresholds(int channel, float slopeMvPerS, float noiseMv) {
+	if (channel < 0 || channel >= VIMON_CHANNELS)
+		return;
+	_chan[channel].slopeLimit = slopeMvPerS;
+	_chan[channel].noiseLimit = noiseMv;
+}
+
+bool VImonAdaptive::start() {
+	bool lower = true;
+	int ch;
+
+	for (ch=0; ch<VIMON_CHANNELS; ch++) {
+		Channel& c = _chan[ch];
+		c.rateHz = c.activeHz;
+		c.lastNs = 0;
+		c.quietNs = 0;
+	}
+	/*
+	 time the data rates of every step down to the idle rates now, a
+	 rebuild while running then does not stall the acquisition
+	 */
+	while (lower) {
+		lower = false;
+		for (ch=0; ch<VIMON_CHANNELS; ch++) {
+			Channel& c = _chan[ch];
+			if (c.rateHz > c.idleHz) {
+				c.rateHz = (c.rateHz / 2.0 > c.idleHz) ? c.rateHz / 2.0 : c.idleHz;
+				lower = true;
+			}
+		}
+		if (lower)
+			apply();
+	}
+
+	for (ch=0; ch<VIMON_CHANNELS; ch++) {
+		Channel& c = _chan[ch];
+		c.rateHz = c.activeHz;
+		if (c.activeHz > 0.0)
+			_sched->setChannel(ch, c.activeHz, c.activeAdcRate);
+	}
+	_changes = 0;
+	return _sched->build();
+}
+
+/*
+ slowest data rate with a conversion of at most VIMON_ADAPT_DUTY_PCT of
+ the sample period, not faster than the active one
+ */
+static uint8_t idleAdcRate(double rateHz, uint8_t activeAdcRate) {
+	uint8_t rate;
+
+	for (rate=ADS1115_RATE_8; rate<activeAdcRate; rate++)
+		if ((double)ADS1115::getConversionNs(rate) * 100.0 <= VIMON_ADAPT_DUTY_PCT * 1e9 / rateHz)
+			break;
+	return rate;
+}
+
+/*
+ rebuild the schedule with the current rates
+ */
+bool VImonAdaptive::apply() {
+	int ch;
+
+	for (ch=0; ch<VIMON_CHANNELS; ch++) {
+		Channel& c = _chan[ch];
+		if (c.rateHz > 0.0)
+			_sched->setChannel(ch, c.rateHz, (c.rateHz >= c.activeHz) ?
+				c.activeAdcRate : idleAdcRate(c.rateHz, c.activeAdcRate));
+	}
+	_changes++;
+	if (_sched->build())
+		return true;
+
+	// the longer idle conversions do not fit
+	for (ch=0; ch<VIMON_CHANNELS; ch++)
+		if (_chan[ch].rateHz > 0.0)
+			_sched->setChannel(ch, _chan[ch].rateHz, _chan[ch].activeAdcRate);
+	if (_sched->build())
+		return true;
+
+	// back to the worst case checked by start()
+	for (ch=0; ch<VIMON_CHANNELS; ch++) {
+		Channel& c = _chan[ch];
+		if (c.rateHz > 0.0) {
+			c.rateHz = c.activeHz;
+			_sched->setChannel(ch, c.activeHz, c.activeAdcRate);
+		}
+	}
+	return _sched->build();
+}
+
+bool VImonAdaptive::update(const VImonSample& sample) {
+	bool changed = false, active, quiet;
+	uint64_t t;
+	float mv, d, sd, slope;
+	int ch;
+
+	for (ch=0; ch<VIMON_CHANNELS; ch++) {
+		Channel& c = _chan[ch];
+		if (c.rateHz <= 0.0 || (sample.error & (1 << ch)))
+			continue;
+		t = sample.monotonic + (int64_t)sample.offsetUs[ch] * 1000;
+		mv = sample.mv[ch];
+		if (c.lastNs != 0 && t + VIMON_SAME_CONVERSION_NS >= c.lastNs &&
+				t <= c.lastNs + VIMON_SAME_CONVERSION_NS)
+			continue;				// not converted again
+		if (c.lastNs == 0 || t < c.lastNs) {
+			// first conversion, or one out of order: start over
+			c.lastNs = c.refNs = t;
+			c.refMv = c.mean = mv;
+			c.var = 0.0f;
+			continue;
+		}
+		c.lastNs = t;
+
+		// exponentially weighted mean and variance
+		d = mv - c.mean;
+		c.mean += VIMON_ADAPT_ALPHA * d;
+		c.var = (1.0f - VIMON_ADAPT_ALPHA) * (c.var + VIMON_ADAPT_ALPHA * d * d);
+		sd = sqrtf(c.var);
+		// slope over the window, or since the previous slow conversion
+		slope = 0.0f;
+		if (t - c.refNs >= (uint64_t)VIMON_ADAPT_WINDOW_MS * 1000000ULL) {
+			slope = fabsf(mv - c.refMv) * (float)NS_PER_SEC / (float)(t - c.refNs);
+			c.refNs = t;
+			c.refMv = mv;
+		}
+
+		active = (c.noiseLimit > 0.0f && sd > c.noiseLimit) ||
+			(c.slopeLimit > 0.0f && slope > c.slopeLimit);
+		quiet = !(c.noiseLimit > 0.0f && sd > c.noiseLimit * VIMON_ADAPT_QUIET_PCT / 100) &&
+			!(c.slopeLimit > 0.0f && slope > c.slopeLimit * VIMON_ADAPT_QUIET_PCT / 100);
+
+		if (active) {
+			c.quietNs = 0;
+			if (c.rateHz < c.activeHz) {
+				c.rateHz = c.activeHz;
+				changed = true;
+			}
+		} else if (!quiet) {
+			c.quietNs = 0;			// between the thresholds: hold the rate
+		} else if (c.quietNs == 0) {
+			c.quietNs = t;
+		} else if (t - c.quietNs >= _holdNs && c.rateHz > c.idleHz) {
+			c.rateHz = (c.rateHz / 2.0 > c.idleHz) ? c.rateHz / 2.0 : c.idleHz;
+			c.quietNs = t;
+			changed = true;
+		}
+	}
+	if (!changed)
+		return false;
+	apply();
+	return true;
+}
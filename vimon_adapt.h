@@ -0,0 +1,106 @@
+/*
+ VI monitoring board - adaptive sampling rate
+
+ Sampling a flat battery voltage at full rate all night wastes bus time,
+ CPU and storage, load transients need the highest rate. VImonAdaptive
+ drives the channel rates of a VImonScheduler (vimon_sched.h) from the
+ activity of every channel, measured on VImonSample.mv (mV at the ADC
+ input, independent of the scaling):
+ - slope:	change over at least VIMON_ADAPT_WINDOW_MS [mV/s]
+ - noise:	running standard deviation, exponentially weighted over
+			about 1 / VIMON_ADAPT_ALPHA conversions [mV]
+
+ A channel goes to its active rate (and active data rate) as soon as
+ either measure crosses its threshold. It stays there until both have
+ been below VIMON_ADAPT_QUIET_PCT percent of their thresholds for "holdMs",
+ then the rate halves every "holdMs" of quiet down to the idle rate. The
+ gap between the two thresholds and the hold time are the hysteresis.
+
+ Below the active rate a channel converts at the slowest data rate whose
+ conversion takes at most VIMON_ADAPT_DUTY_PCT percent of its period
+ (slower data rates filter more noise). If the schedule does not fit
+ with those, the active data rates are used.
+
+ Usage:
+	VImonAdaptive adapt(&sched);
+	adapt.setChannel(2, 2.0, 250.0, ADS1115_RATE_860);
+	adapt.setChannel(0, 0.5, 10.0, ADS1115_RATE_860);
+	if (!adapt.start())			// checks the all-active schedule
+		...
+	while (...) {
+		sched.step(&sample);
+		adapt.update(sample);
+	}
+ */
+
+#ifndef _VIMON_ADAPT_H_
+#define _VIMON_ADAPT_H_
+
+#include <stdint.h>
+
+#include "vimon.h"
+#include "vimon_sched.h"
+
+#define VIMON_ADAPT_WINDOW_MS	100		// shortest interval for the slope
+#define VIMON_ADAPT_ALPHA		0.125	// weight of a new conversion in the noise
+#define VIMON_ADAPT_QUIET_PCT	50		// quiet below this share of the thresholds
+#define VIMON_ADAPT_DUTY_PCT	10		// conversion time share below the active rate
+#define VIMON_ADAPT_HOLD_MS		10000	// default hold time
+#define VIMON_ADAPT_SLOPE		20.0	// default thresholds, mV/s and mV
+#define VIMON_ADAPT_NOISE		2.0
+
+class VImonAdaptive {
+public:
+	VImonAdaptive(VImonScheduler *sched);
+
+/*
+ rate bounds of a channel, idleHz <= activeHz
+ - the active data rate (ADS1115_RATE_xxx) is used at the active rate
+ */
+	void setChannel(int channel, double idleHz, double activeHz, uint8_t activeAdcRate);
+	// thresholds in mV at the ADC input, 0 disables a measure
+	void setThresholds(int channel, float slopeMvPerS, float noiseMv);
+	void setHold(unsigned ms) { _holdNs = (uint64_t)ms * 1000000ULL; }
+
+/*
+ build the schedule with every channel active, as that is the worst
+ case, and start there
+ - returns false if it is infeasible (see VImonScheduler::report())
+ */
+	bool start();
+
+/*
+ follow the activity seen in a sample from VImonScheduler::step()
+ - returns true when the schedule has been rebuilt with new rates
+ */
+	bool update(const VImonSample& sample);
+
+	double getRate(int channel) { return _chan[channel & 3].rateHz; }
+	bool isActive(int channel) { return _chan[channel & 3].rateHz >= _chan[channel & 3].activeHz; }
+	uint32_t getChangeCount() { return _changes; }
+
+private:
+	struct Channel {
+		double idleHz;
+		double activeHz;
+		uint8_t activeAdcRate;
+		float slopeLimit;			// mV/s
+		float noiseLimit;			// mV
+		double rateHz;				// current rate, 0 = not controlled
+		uint64_t lastNs;			// newest conversion seen, monotonic [ns]
+		uint64_t refNs;				// start of the slope window
+		float refMv;
+		float mean;
+		float var;
+		uint64_t quietNs;			// quiet since, 0 = active
+	};
+
+	bool apply();
+
+	VImonScheduler *_sched;
+	Channel _chan[VIMON_CHANNELS];
+	uint64_t _holdNs;
+	uint32_t _changes;
+};
+
+#endif /* _VIMON_ADAPT_H_ */
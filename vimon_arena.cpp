@@ -0,0 +1,41 @@
+/*
+ VI monitoring board - startup arena
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vimon_arena.h"
+
+VImonArena::VImonArena() {
+	_base = NULL;
+	_size = 0;
+	_used = 0;
+}
+
+VImonArena::~VImonArena() {
+	free(_base);
+}
+
+bool VImonArena::reserve(size_t bytes) {
+	if (_base != NULL || bytes == 0)
+		return false;
+	// zeroed: every page is faulted in now, not by the first scan
+	_base = (unsigned char *)malloc(bytes);
+	if (_base == NULL)
+		return false;
+	memset(_base, 0, bytes);
+	_size = bytes;
+	_used = 0;
+	return true;
+}
+
+void *VImonArena::alloc(size_t bytes, size_t align) {
+	uintptr_t p = ((uintptr_t)_base + _used + align - 1) & ~(uintptr_t)(align - 1);
+	size_t end = (size_t)(p - (uintptr_t)_base) + bytes;
+
+	if (_base == NULL || end > _size)
+		return NULL;
+	_used = end;
+	return (void *)p;
+}
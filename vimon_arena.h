@@ -0,0 +1,66 @@
+/*
+ VI monitoring board - startup arena
+
+ VImonArena hands out the long-lived objects of a process from one block
+ which is allocated, and touched page by page, before the acquisition
+ starts. The size comes from the configuration (boards and their
+ filters), nothing is returned to the arena: the objects live until the
+ process exits, destructors are not run. Once the threads run the heap
+ is not used by the acquisition path, so allocation spikes and heap
+ fragmentation can not delay a scan after weeks of uptime.
+
+ Not thread safe, objects are made by the thread setting up.
+
+ Usage:
+	VImonArena arena;
+	if (!arena.reserve(boards * sizeof(Board) + VIMON_ARENA_SLACK))
+		perror("arena");
+	Board *b = arena.make<Board>();
+	if (b == NULL)
+		...						// arena too small
+ */
+
+#ifndef _VIMON_ARENA_H_
+#define _VIMON_ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <new>
+#include <utility>
+
+#define VIMON_ARENA_SLACK		4096	// alignment padding per reservation [bytes]
+
+class VImonArena {
+public:
+	VImonArena();
+	~VImonArena();
+
+/*
+ allocate and prefault "bytes", once
+ - returns false if the block can not be allocated or is already there
+ */
+	bool reserve(size_t bytes);
+
+/*
+ "bytes" aligned to "align" (a power of two)
+ - returns NULL if the arena is exhausted
+ */
+	void *alloc(size_t bytes, size_t align);
+
+	// construct a T in the arena, NULL if it does not fit
+	template <typename T, typename... Args>
+	T *make(Args&&... args) {
+		void *p = alloc(sizeof(T), alignof(T));
+		return (p != NULL) ? new (p) T(std::forward<Args>(args)...) : NULL;
+	}
+
+	size_t getSize() { return _size; }
+	size_t getUsed() { return _used; }
+
+private:
+	unsigned char *_base;
+	size_t _size;
+	size_t _used;
+};
+
+#endif /* _VIMON_ARENA_H_ */
@@ -35,6 +35,12 @@
 #define PT_SLOPE 0.003851		// PT slope factor
 #define PT_OFFSET_TEMP -1.8		// Compensation for low quality PT100
 
+// Plausible input ranges, samples outside are flagged (vimon_quality.h)
+#define V1_MIN_MV 10000.0		// mV
+#define V1_MAX_MV 16000.0		// mV
+#define PT_MIN_OHM 90.0			// Ohm
+#define PT_MAX_OHM 134.0		// Ohm
+
 // Current measurement Details
 // INA180A1 provides voltage gain of 20, between input terminals and ADC
 // example: shunt 50mV/500A, 50mV * 20 = 1000mV @ ADC
@@ -48,4 +54,9 @@
 // Current measurement CH 4
 #define I2_MA_PER_MV 50		// mA/mV @ADC
 
+// Bipolar current, differential AIN2-AIN3 (VIMON_SCAN_BIPOLAR)
+// positive = charging, calibrate gain and zero on the differential path
+#define IBI_MA_PER_MV 50		// mA/mV @ADC
+#define IBI_OFFSET_MA 0.0		// mA
+
 #endif	// VIMON_CAL_H
@@ -0,0 +1,347 @@
+/*
+ VI monitoring board - daemon configuration file
+ */
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ADS1115.h"
+#include "vimon_config.h"
+#include "vimon_deadband.h"
+
+#define CONFIG_LINE_SIZE	256
+
+static void setDefaults(VImonBoardConfig& b, const char *name) {
+	int i;
+
+	b.name = name;
+	b.bus = -1;
+	b.address = ADS1115_ADDRESS_ADDR_SDA;
+	b.plan = VIMON_SCAN_SINGLE;
+	b.autoRange = 0;
+	b.settle = false;
+	b.rate = ADS1115_RATE_128;
+	b.intervalMs = 1000;
+	b.gridMs = 0;
+	b.realtime = 0;
+	b.cpus.clear();
+	b.deadband = false;
+	for (i=0; i<VIMON_CHANNELS; i++) {
+		b.channelHz[i] = 0.0;
+		b.channelRate[i] = ADS1115_RATE_860;
+		b.deadbandAbs[i] = 0.0;
+		b.deadbandPct[i] = 0.0;
+	}
+	b.heartbeatMs = VIMON_DB_HEARTBEAT_MS;
+	VImon::getDefaultCalibration(&b.cal);
+	b.output.clear();
+	b.format = VIMON_FMT_TEXT;
+	b.shm.clear();
+	b.socket.clear();
+	b.modbus = 0;
+	b.energy.clear();
+}
+
+bool VImonBoardConfig::isScheduled() const {
+	int i;
+	for (i=0; i<VIMON_CHANNELS; i++)
+		if (channelHz[i] > 0.0)
+			return true;
+	return false;
+}
+
+bool VImonBoardConfig::sameAcquisition(const VImonBoardConfig& o) const {
+	int i;
+
+	if (bus != o.bus || address != o.address || plan != o.plan || autoRange != o.autoRange ||
+			settle != o.settle || rate != o.rate || intervalMs != o.intervalMs || gridMs != o.gridMs ||
+			realtime != o.realtime || cpus != o.cpus)
+		return false;
+	for (i=0; i<VIMON_CHANNELS; i++)
+		if (channelHz[i] != o.channelHz[i] || channelRate[i] != o.channelRate[i])
+			return false;
+	return true;
+}
+
+VImonConfig::VImonConfig() {
+	_count = 0;
+}
+
+int VImonConfig::find(const std::string& name) const {
+	int i;
+	for (i=0; i<_count; i++)
+		if (_boards[i].name == name)
+			return i;
+	return -1;
+}
+
+static bool parseLong(const char *value, long *out) {
+	char *end;
+	*out = strtol(value, &end, 0);
+	return end != value && *end == 0;
+}
+
+static bool parseFloat(const char *value, float *out) {
+	char *end;
+	*out = strtof(value, &end);
+	return end != value && *end == 0;
+}
+
+static bool parseBool(const char *value, bool *out) {
+	if (!strcmp(value, "yes") || !strcmp(value, "on") || !strcmp(value, "1"))
+		*out = true;
+	else if (!strcmp(value, "no") || !strcmp(value, "off") || !strcmp(value, "0"))
+		*out = false;
+	else
+		return false;
+	return true;
+}
+
+/*
+ one "key = value" of a board section
+ - returns false if the key is unknown or the value invalid
+ */
+bool VImonConfig::set(VImonBoardConfig& b, const char *key, const char *value) {
+	static const struct {
+		const char *key;
+		size_t offset;
+	} cal[] = {
+		{ "v1_per_mv", offsetof(VImonCalibration, v1PerMv) },
+		{ "v1_offset", offsetof(VImonCalibration, v1Offset) },
+		{ "v2_per_mv", offsetof(VImonCalibration, v2PerMv) },
+		{ "v2_offset", offsetof(VImonCalibration, v2Offset) },
+		{ "pt_ohm_per_mv", offsetof(VImonCalibration, ptOhmPerMv) },
+		{ "pt_offset_ohm", offsetof(VImonCalibration, ptOffsetOhm) },
+		{ "pt_reference_ohm", offsetof(VImonCalibration, ptReferenceOhm) },
+		{ "pt_slope", offsetof(VImonCalibration, ptSlope) },
+		{ "pt_offset_temp", offsetof(VImonCalibration, ptOffsetTemp) },
+		{ "i1_per_mv", offsetof(VImonCalibration, i1PerMv) },
+		{ "i2_per_mv", offsetof(VImonCalibration, i2PerMv) },
+		{ "ibi_per_mv", offsetof(VImonCalibration, ibiPerMv) },
+		{ "ibi_offset", offsetof(VImonCalibration, ibiOffset) },
+	};
+	char pair[64], *colon;
+	float f, pct, *factor;
+	long l;
+	int ch;
+	unsigned i;
+
+	for (i=0; i<sizeof(cal) / sizeof(cal[0]); i++)
+		if (!strcmp(key, cal[i].key)) {
+			factor = (float *)((char *)&b.cal + cal[i].offset);
+			// a factor of 0 reads every input as 0 and has no deadband
+			return parseFloat(value, factor) && (strstr(key, "_per_mv") == NULL || *factor != 0.0f);
+		}
+
+	// per channel keys, "rateN" and "deadbandN"
+	if ((!strncmp(key, "rate", 4) || !strncmp(key, "deadband", 8)) && isdigit(key[strlen(key) - 1])) {
+		ch = key[strlen(key) - 1] - '0';
+		if (ch >= VIMON_CHANNELS || strlen(key) != (key[0] == 'r' ? 5 : 9))
+			return false;
+		// "first[:second]"
+		if (strlen(value) >= sizeof(pair))
+			return false;
+		strcpy(pair, value);
+		colon = strchr(pair, ':');
+		if (colon != NULL)
+			*colon++ = 0;
+		if (key[0] == 'r') {
+			l = 860;
+			if (!parseFloat(pair, &f) || f < 0.0 ||
+					(colon != NULL && (!parseLong(colon, &l) || l < 8 || l > 860)))
+				return false;
+			b.channelHz[ch] = f;
+			b.channelRate[ch] = ADS1115::getRateSetting((unsigned)l);
+			return true;
+		}
+		pct = 0.0;
+		if (!parseFloat(pair, &f) || f < 0.0 || (colon != NULL && (!parseFloat(colon, &pct) || pct < 0.0)))
+			return false;
+		b.deadband = true;
+		b.deadbandAbs[ch] = f;
+		b.deadbandPct[ch] = pct;
+		return true;
+	}
+
+	if (!strcmp(key, "bus")) {
+		if (!parseLong(value, &l) || l < -1)
+			return false;
+		b.bus = (int)l;
+	} else if (!strcmp(key, "address")) {
+		if (!parseLong(value, &l) || l < 0x48 || l > 0x4B)
+			return false;
+		b.address = (uint8_t)l;
+	} else if (!strcmp(key, "plan")) {
+		if (!strcmp(value, "single"))
+			b.plan = VIMON_SCAN_SINGLE;
+		else if (!strcmp(value, "bipolar"))
+			b.plan = VIMON_SCAN_BIPOLAR;
+		else
+			return false;
+	} else if (!strcmp(key, "autorange")) {
+		if (!parseLong(value, &l) || l < 0 || l > VIMON_ERR_ALL)
+			return false;
+		b.autoRange = (uint8_t)l;
+	} else if (!strcmp(key, "settle")) {
+		return parseBool(value, &b.settle);
+	} else if (!strcmp(key, "sps")) {
+		if (!parseLong(value, &l) || l < 8 || l > 860)
+			return false;
+		b.rate = ADS1115::getRateSetting((unsigned)l);
+	} else if (!strcmp(key, "interval")) {
+		if (!parseLong(value, &l) || l < 1)
+			return false;
+		b.intervalMs = (unsigned)l;
+	} else if (!strcmp(key, "grid")) {
+		if (!parseLong(value, &l) || l < 0)
+			return false;
+		b.gridMs = (unsigned)l;
+	} else if (!strcmp(key, "realtime")) {
+		if (!parseLong(value, &l) || l < 0 || l > 99)
+			return false;
+		b.realtime = (int)l;
+	} else if (!strcmp(key, "cpus")) {
+		if (strspn(value, "0123456789,-") != strlen(value) || !isdigit((unsigned char)value[0]))
+			return false;
+		b.cpus = value;
+	} else if (!strcmp(key, "heartbeat")) {
+		if (!parseLong(value, &l) || l < 0)
+			return false;
+		b.deadband = true;
+		b.heartbeatMs = (unsigned)l;
+	} else if (!strcmp(key, "output")) {
+		b.output = value;
+	} else if (!strcmp(key, "format")) {
+		if (!strcmp(value, "text"))
+			b.format = VIMON_FMT_TEXT;
+		else if (!strcmp(value, "csv"))
+			b.format = VIMON_FMT_CSV;
+		else if (!strcmp(value, "json"))
+			b.format = VIMON_FMT_JSON;
+		else
+			return false;
+	} else if (!strcmp(key, "shm")) {
+		b.shm = value;
+	} else if (!strcmp(key, "socket")) {
+		b.socket = value;
+	} else if (!strcmp(key, "modbus")) {
+		if (!parseLong(value, &l) || l < 0 || l > 65535)
+			return false;
+		b.modbus = (uint16_t)l;
+	} else if (!strcmp(key, "energy")) {
+		b.energy = value;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+/*
+ longest time by which one sample moves the aligned output on [ms]: the
+ interval, or the period of the slowest scheduled channel
+ */
+static double advanceMs(const VImonBoardConfig& b) {
+	double ms = 0.0;
+	int i;
+
+	if (!b.isScheduled())
+		return b.intervalMs;
+	for (i=0; i<VIMON_CHANNELS; i++)
+		if (b.channelHz[i] > 0.0 && 1000.0 / b.channelHz[i] > ms)
+			ms = 1000.0 / b.channelHz[i];
+	return ms;
+}
+
+// strip leading and trailing blanks in place
+static char *trim(char *s) {
+	char *end;
+
+	while (isspace((unsigned char)*s))
+		s++;
+	end = s + strlen(s);
+	while (end > s && isspace((unsigned char)end[-1]))
+		end--;
+	*end = 0;
+	return s;
+}
+
+bool VImonConfig::load(const char *path) {
+	char line[CONFIG_LINE_SIZE], msg[CONFIG_LINE_SIZE + 64], *p, *eq, *key;
+	VImonBoardConfig *board = NULL;
+	bool failed = true;
+	FILE *f;
+	int n = 0;
+
+	_count = 0;
+	_error.clear();
+	f = fopen(path, "r");
+	if (f == NULL) {
+		snprintf(msg, sizeof(msg), "%s: unable to open", path);
+		_error = msg;
+		return false;
+	}
+	for (;;) {
+		if (fgets(line, sizeof(line), f) == NULL) {
+			failed = false;
+			break;
+		}
+		n++;
+		if ((p = strchr(line, '#')) != NULL)
+			*p = 0;
+		p = trim(line);
+		if (*p == 0)
+			continue;
+
+		if (*p == '[') {
+			if (strncmp(p, "[board", 6) != 0 || (!isblank((unsigned char)p[6]) && p[6] != ']') ||
+					p[strlen(p) - 1] != ']') {
+				snprintf(msg, sizeof(msg), "%s:%d: unknown section %s", path, n, p);
+				break;
+			}
+			p[strlen(p) - 1] = 0;
+			key = trim(p + 6);
+			if (*key == 0 || find(key) >= 0 || _count >= VIMON_CONFIG_MAX_BOARDS) {
+				snprintf(msg, sizeof(msg), "%s:%d: board name missing, not unique or too many boards", path, n);
+				break;
+			}
+			board = &_boards[_count++];
+			setDefaults(*board, key);
+			continue;
+		}
+
+		eq = strchr(p, '=');
+		if (eq == NULL || board == NULL) {
+			snprintf(msg, sizeof(msg), "%s:%d: \"key = value\" in a [board NAME] section expected", path, n);
+			break;
+		}
+		*eq = 0;
+		key = trim(p);
+		if (!set(*board, key, trim(eq + 1))) {
+			snprintf(msg, sizeof(msg), "%s:%d: invalid %s", path, n, key);
+			break;
+		}
+	}
+	fclose(f);
+
+	if (!failed && _count == 0) {
+		snprintf(msg, sizeof(msg), "%s: no board", path);
+		failed = true;
+	}
+	// vimond takes at most VIMON_CONFIG_GRID_POINTS grid points from a sample
+	for (n=0; !failed && n<_count; n++)
+		if (_boards[n].gridMs > 0 &&
+				(double)_boards[n].gridMs * VIMON_CONFIG_GRID_POINTS < advanceMs(_boards[n])) {
+			snprintf(msg, sizeof(msg), "%s: [board %s]: grid below 1/%d of the sample interval",
+				path, _boards[n].name.c_str(), VIMON_CONFIG_GRID_POINTS);
+			failed = true;
+		}
+	if (failed) {
+		_error = msg;
+		_count = 0;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,117 @@
+/*
+ VI monitoring board - daemon configuration file
+
+ VImonConfig reads the configuration of vimond: one section per board,
+ "key = value" lines, '#' starts a comment. Numbers may be decimal or
+ 0x hexadecimal. A key which is not given keeps its default.
+
+	[board main]				# name, unique
+	bus = 1						# I2C adapter /dev/i2c-N, default by board revision
+	address = 0x49				# ADS1115 address
+	plan = single				# scan plan: single, bipolar
+	autorange = 0x0F			# channel mask, 0 = fixed range
+	settle = no					# yes: measure the mux settling at start
+	sps = 128					# data rate [samples/s]
+	interval = 1000				# ms between samples
+	rate2 = 100:860				# CH2 at 100 Hz, 860 SPS: multi-rate schedule
+								# instead of "interval" (vimon_sched.h), the
+								# board must be alone on its bus
+	grid = 0					# align onto a time grid of ms, 0 = off, at least
+								# interval / VIMON_CONFIG_GRID_POINTS (or the
+								# period of the slowest scheduled channel)
+	realtime = 0				# SCHED_FIFO priority of the bus thread, 0 = off
+	cpus = 3					# CPUs of the bus thread, e.g. "3", "2-3" (vimon_rt.h)
+	deadband0 = 50:0			# CH0 absolute [mV/mA] : percent, >= 0 (vimon_deadband.h)
+	heartbeat = 60000			# ms, with a deadband
+	# calibration, defaults from vimon_cal.h (VImonCalibration), the
+	# _per_mv factors must not be 0
+	v1_per_mv = 2.92368682
+	v1_offset = 9977.0
+	v2_per_mv, v2_offset, pt_ohm_per_mv, pt_offset_ohm, pt_reference_ohm,
+	pt_slope, pt_offset_temp, i1_per_mv, i2_per_mv, ibi_per_mv, ibi_offset
+	# sinks, all optional
+	output = /var/log/vimon.log	# "-" = stdout
+	format = csv				# text, csv, json
+	shm = /vimon				# vimon_shm.h
+	socket = /tmp/vimon.sock	# vimon_stream.h
+	modbus = 502				# vimon_modbus.h
+	energy = /var/lib/vimon/energy.dat	# vimon_store.h
+
+ Usage:
+	VImonConfig config;
+	if (!config.load("/etc/vimond.conf"))
+		fprintf(stderr, "%s\n", config.getError());
+ */
+
+#ifndef _VIMON_CONFIG_H_
+#define _VIMON_CONFIG_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "vimon.h"
+#include "vimon_fmt.h"
+
+#define VIMON_CONFIG_PATH		"/etc/vimond.conf"
+#define VIMON_CONFIG_MAX_BOARDS	16
+#define VIMON_CONFIG_GRID_POINTS	4		// grid points per sample at most
+
+struct VImonBoardConfig {
+	std::string name;
+	// acquisition, applied at start only
+	int bus;						// -1 = default
+	uint8_t address;
+	uint8_t plan;					// VIMON_SCAN_xxx
+	uint8_t autoRange;
+	bool settle;
+	uint8_t rate;					// ADS1115_RATE_xxx
+	unsigned intervalMs;
+	double channelHz[VIMON_CHANNELS];	// 0 = not scheduled
+	uint8_t channelRate[VIMON_CHANNELS];
+	unsigned gridMs;
+	int realtime;					// SCHED_FIFO priority, 0 = off
+	std::string cpus;				// empty = any
+	// filter and calibration, reloaded
+	bool deadband;					// any deadbandN or heartbeat given
+	float deadbandAbs[VIMON_CHANNELS];
+	float deadbandPct[VIMON_CHANNELS];
+	unsigned heartbeatMs;
+	VImonCalibration cal;
+	// sinks, reloaded
+	std::string output;
+	VImonFormat format;
+	std::string shm;
+	std::string socket;
+	uint16_t modbus;				// 0 = off
+	std::string energy;
+
+	bool isScheduled() const;
+	bool sameAcquisition(const VImonBoardConfig& other) const;
+};
+
+class VImonConfig {
+public:
+	VImonConfig();
+
+/*
+ read a configuration file, replacing the boards read before
+ - returns false on a syntax error or a file without boards, see getError()
+ */
+	bool load(const char *path);
+	const char *getError() { return _error.c_str(); }
+
+	int getBoardCount() const { return _count; }
+	const VImonBoardConfig& getBoard(int i) const { return _boards[i]; }
+	// index of the board "name", -1 if there is none
+	int find(const std::string& name) const;
+
+private:
+	bool set(VImonBoardConfig& b, const char *key, const char *value);
+
+	VImonBoardConfig _boards[VIMON_CONFIG_MAX_BOARDS];
+	int _count;
+	std::string _error;
+};
+
+#endif /* _VIMON_CONFIG_H_ */
@@ -0,0 +1,102 @@
+/*
+ VI monitoring board - report by exception
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "ADS1115.h"
+#include "vimon_deadband.h"
+
+VImonDeadband::VImonDeadband(VImon *board) {
+	int i;
+
+	_board = board;
+	for (i=0; i<VIMON_CHANNELS; i++) {
+		_absolute[i] = 0.0;
+		_percent[i] = 0.0;
+		_limit[i] = 0;
+		_limitMv[i] = 0.0;
+	}
+	setHeartbeat(VIMON_DB_HEARTBEAT_MS);
+	_valid = false;
+	_passed = 0;
+	_suppressed = 0;
+	_heartbeats = 0;
+}
+
+void VImonDeadband::setDeadband(int channel, float absolute, float percent) {
+	if (channel < 0 || channel >= VIMON_CHANNELS)
+		return;
+	_absolute[channel] = fabsf(absolute);
+	_percent[channel] = fabsf(percent);
+	_valid = false;
+}
+
+/*
+ the sample passed: its codes are the new references, the deadbands are
+ scaled to codes of their PGA
+ */
+void VImonDeadband::reference(const VImonSample& sample) {
+	bool bipolar = _board != NULL && _board->getScanPlan() == VIMON_SCAN_BIPOLAR;
+	VImonCalibration cal;
+	float band;
+	int i;
+
+	if (_board != NULL)
+		cal = _board->getCalibration();
+	else
+		VImon::getDefaultCalibration(&cal);
+	const float value[VIMON_CHANNELS] = { sample.v1_mv, sample.v2_mv, sample.i1_ma, sample.i2_ma };
+	const float perMv[VIMON_CHANNELS] = { cal.v1PerMv, cal.v2PerMv,
+		bipolar ? cal.ibiPerMv : cal.i1PerMv, bipolar ? cal.ibiPerMv : cal.i2PerMv };
+
+	_refTime = sample.timestamp;
+	_refError = sample.error;
+	_refQuality = sample.quality;
+	for (i=0; i<VIMON_CHANNELS; i++) {
+		_ref[i] = sample.raw[i];
+		_refPga[i] = sample.pga[i];
+		band = fmaxf(_absolute[i], _percent[i] / 100.0f * fabsf(value[i]));
+		// a reversed shunt has a negative factor, the band stays positive,
+		// a factor of 0 has none: every change passes
+		_limitMv[i] = (perMv[i] != 0.0f) ? band / fabsf(perMv[i]) : 0.0f;
+		// codes differ by 65535 at most, a wider band suppresses every change
+		_limit[i] = (int32_t)fminf(_limitMv[i] / ADS1115::getMvPerCount(sample.pga[i]), 65536.0f);
+	}
+	_valid = true;
+}
+
+uint8_t VImonDeadband::check(const VImonSample& sample) {
+	uint8_t reasons = 0;
+	int i;
+
+	if (!_valid || sample.error != _refError || sample.quality != _refQuality)
+		reasons |= VIMON_DB_STATUS;
+	else {
+		for (i=0; i<VIMON_CHANNELS; i++) {
+			if (sample.error & (1 << i))
+				continue;
+			if (sample.pga[i] == _refPga[i]) {
+				if (abs((int32_t)sample.raw[i] - (int32_t)_ref[i]) > _limit[i])
+					reasons |= 1 << i;
+			} else if (fabsf(sample.mv[i] - _ref[i] * ADS1115::getMvPerCount(_refPga[i])) > _limitMv[i]) {
+				reasons |= 1 << i;
+			}
+		}
+		// a clock stepped back counts as expired
+		if (reasons == 0 && _heartbeatNs > 0 &&
+				(sample.timestamp < _refTime || sample.timestamp - _refTime >= _heartbeatNs)) {
+			reasons |= VIMON_DB_HEARTBEAT;
+			_heartbeats++;
+		}
+	}
+
+	if (reasons == 0) {
+		_suppressed++;
+		return 0;
+	}
+	reference(sample);
+	_passed++;
+	return reasons;
+}
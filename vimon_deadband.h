@@ -0,0 +1,97 @@
+/*
+ VI monitoring board - report by exception
+
+ VImonDeadband passes a sample on to the sinks (output, shared memory,
+ socket, Modbus) only when it carries news:
+ - a channel moved by more than its deadband since the last sample passed
+ - the error mask or the quality flags changed
+ - nothing passed for the heartbeat interval, so a silent sink can tell
+   a steady reading from a dead link
+ The first sample always passes. When a sample passes all channels take
+ its values as their new reference, the sinks always hold the values the
+ deadbands are measured from. Deadbands are 0 by default (any change of
+ the ADC code passes).
+
+ A deadband is given in the units of the channel (V1, V2 [mV], I1, I2
+ [mA]), absolute and as a percentage of the reference value, the larger
+ one applies. It is converted to ADC codes through the calibration of
+ the board (VImon::getCalibration()) and the PGA of the reference once
+ per passed sample, the check itself is an integer compare per channel.
+ A channel whose range changed (auto-ranging) is compared in mV.
+ Channels flagged in VImonSample.error are not compared.
+
+ Energy totals must still see every sample, filter after them.
+
+ Usage:
+	VImonDeadband deadband(&vimon);
+	deadband.setDeadband(0, 50.0, 0.0);		// V1, 50 mV
+	deadband.setDeadband(2, 100.0, 1.0);	// I1, 100 mA or 1 %
+	deadband.setHeartbeat(60000);
+	...
+	if (deadband.check(sample))
+		publish(sample);
+ */
+
+#ifndef _VIMON_DEADBAND_H_
+#define _VIMON_DEADBAND_H_
+
+#include <stdint.h>
+
+#include "vimon.h"
+
+// check() reasons besides the VIMON_ERR_CHx bits of the moved channels
+#define VIMON_DB_STATUS			0x10	// first sample, error or quality changed
+#define VIMON_DB_HEARTBEAT		0x20
+
+#define VIMON_DB_HEARTBEAT_MS	60000	// default heartbeat
+
+class VImonDeadband {
+public:
+	// "board" tells the scan plan and calibration, NULL = vimon_cal.h
+	VImonDeadband(VImon *board = NULL);
+
+/*
+ deadband of a channel, in mV (V1, V2) or mA (I1, I2), and in percent of
+ the reference value
+ */
+	void setDeadband(int channel, float absolute, float percent);
+	// longest time without a passed sample, 0 = none
+	void setHeartbeat(unsigned ms) { _heartbeatNs = (uint64_t)ms * 1000000ULL; }
+
+/*
+ check a sample
+ - returns 0 if it carries no news, else the reasons: VIMON_ERR_CHx of
+   the channels which moved, VIMON_DB_STATUS, VIMON_DB_HEARTBEAT
+ */
+	uint8_t check(const VImonSample& sample);
+
+	// the next sample passes
+	void restart() { _valid = false; }
+
+	uint64_t getPassed() { return _passed; }
+	uint64_t getSuppressed() { return _suppressed; }
+	uint64_t getHeartbeats() { return _heartbeats; }
+
+private:
+	void reference(const VImonSample& sample);
+
+	VImon *_board;
+	float _absolute[VIMON_CHANNELS];
+	float _percent[VIMON_CHANNELS];
+	uint64_t _heartbeatNs;
+
+	bool _valid;
+	uint64_t _refTime;
+	uint8_t _refError;
+	uint16_t _refQuality;
+	int16_t _ref[VIMON_CHANNELS];
+	uint8_t _refPga[VIMON_CHANNELS];
+	int32_t _limit[VIMON_CHANNELS];	// deadband [codes] at _refPga
+	float _limitMv[VIMON_CHANNELS];	// and [mV] at the ADC
+
+	uint64_t _passed;
+	uint64_t _suppressed;
+	uint64_t _heartbeats;
+};
+
+#endif /* _VIMON_DEADBAND_H_ */
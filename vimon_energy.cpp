@@ -0,0 +1,130 @@
+/*
+ VI monitoring board - charge and energy integration
+ */
+
+#include <string.h>
+
+#include "vimon_energy.h"
+#include "vimon_quality.h"
+#include "vimon_trace.h"
+
+// channels and quality flags which make a sample unusable
+#define ENERGY_ERRORS	(VIMON_ERR_CH0 | VIMON_ERR_CH2 | VIMON_ERR_CH3)
+#define ENERGY_BAD_Q	(VIMON_Q_SATURATED | VIMON_Q_RANGE | VIMON_Q_STUCK)
+#define ENERGY_QUALITY	(VIMON_Q(0, ENERGY_BAD_Q) | VIMON_Q(2, ENERGY_BAD_Q) | VIMON_Q(3, ENERGY_BAD_Q))
+
+#define NS_PER_HOUR		3600e9
+
+/*
+ trapezoid of a linear segment from a to b over "dt", split into the
+ positive and the negative part at the zero crossing
+ */
+static void trapezoid(double a, double b, double dt, double *pos, double *neg) {
+	double t0;
+
+	if (a >= 0.0 && b >= 0.0) {
+		*pos += 0.5 * (a + b) * dt;
+	} else if (a <= 0.0 && b <= 0.0) {
+		*neg -= 0.5 * (a + b) * dt;
+	} else {
+		// sign change, zero crossing at t0
+		t0 = dt * a / (a - b);
+		if (a > 0.0) {
+			*pos += 0.5 * a * t0;
+			*neg -= 0.5 * b * (dt - t0);
+		} else {
+			*neg -= 0.5 * a * t0;
+			*pos += 0.5 * b * (dt - t0);
+		}
+	}
+}
+
+VImonEnergy::VImonEnergy(unsigned maxGapMs) {
+	setMaxGap(maxGapMs);
+	_seq = 0;
+	reset();
+}
+
+float VImonEnergy::current(const VImonSample& sample) {
+	// positive value on i1 (charging)
+	if (sample.i1_ma > sample.i2_ma)
+		return sample.i1_ma;
+	return 0.0f - sample.i2_ma;
+}
+
+bool VImonEnergy::add(const VImonSample& sample) {
+	double dt;
+	float ma, mw;
+	VIMON_TRACE_SPAN("energy");
+
+	if ((sample.error & ENERGY_ERRORS) || (sample.quality & ENERGY_QUALITY)) {
+		// end the segment, the time until the next good sample is a gap
+		_havePrev = false;
+		_acc.rejected++;
+		publish();
+		return false;
+	}
+
+	ma = current(sample);
+	mw = sample.v1_mv * ma / 1000.0f;
+
+	if (_havePrev && sample.monotonic > _prevNs && sample.monotonic - _prevNs <= _maxGapNs) {
+		dt = (double)(sample.monotonic - _prevNs);
+		// mA * ns -> Ah, mW * ns -> Wh
+		trapezoid(_prevMa, ma, dt / NS_PER_HOUR / 1000.0, &_acc.chargeAh, &_acc.dischargeAh);
+		trapezoid(_prevMw, mw, dt / NS_PER_HOUR / 1000.0, &_acc.chargeWh, &_acc.dischargeWh);
+		_acc.seconds += dt / 1e9;
+	} else if (_prevNs != 0 && sample.monotonic > _prevNs) {
+		// not integrated since the last usable sample
+		_acc.gapSeconds += (double)(sample.monotonic - _prevNs) / 1e9;
+	} else if (_prevNs == 0 && _acc.timestamp != 0 && sample.timestamp > _acc.timestamp) {
+		// since the restored totals, the monotonic clock is not comparable
+		_acc.gapSeconds += (double)(sample.timestamp - _acc.timestamp) / 1e9;
+	}
+
+	_havePrev = true;
+	_prevNs = sample.monotonic;
+	_prevMa = ma;
+	_prevMw = mw;
+	_acc.samples++;
+	_acc.timestamp = sample.timestamp;
+	publish();
+	return true;
+}
+
+/*
+ sequence counter: odd while the published copy is being written
+ */
+void VImonEnergy::publish() {
+	uint32_t seq = _seq.load(std::memory_order_relaxed);
+	_seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	_pub = _acc;
+	_seq.store(seq + 2, std::memory_order_release);
+}
+
+void VImonEnergy::get(VImonEnergyTotals *totals) const {
+	uint32_t seq;
+	do {
+		while ((seq = _seq.load(std::memory_order_acquire)) & 1)
+			;
+		*totals = _pub;
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while (_seq.load(std::memory_order_relaxed) != seq);
+}
+
+void VImonEnergy::set(const VImonEnergyTotals& totals) {
+	_acc = totals;
+	_havePrev = false;
+	_prevNs = 0;
+	publish();
+}
+
+void VImonEnergy::reset() {
+	memset(&_acc, 0, sizeof(_acc));
+	_havePrev = false;
+	_prevNs = 0;
+	_prevMa = 0.0f;
+	_prevMw = 0.0f;
+	publish();
+}
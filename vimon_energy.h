@@ -0,0 +1,94 @@
+/*
+ VI monitoring board - charge and energy integration
+
+ Integrates the bidirectional battery current (same convention as
+ VImon::getBipolarMilliAmps(): CH2 charging positive, CH3 discharging
+ negative) and the power V1 x I over time, with the trapezoidal rule on
+ the actual interval between two samples (VImonSample.monotonic, a wall
+ clock step does not change it).
+
+ - charge and discharge are accumulated separately, an interval in which
+   the current changes sign is split at the (linearly interpolated) zero
+   crossing
+ - a sample is only used when CH0, CH2 and CH3 are neither flagged in
+   VImonSample.error nor carry a saturation, range or stuck quality flag
+   (vimon_quality.h). An unusable sample ends the current segment
+ - an interval longer than "maxGapNs" is not integrated but accounted
+   as gap time, so is the wall clock time from restored totals (set())
+   to the first sample
+ - totals are kept in double precision
+
+ add() is called by the acquisition thread right after the sample has
+ been read and checked. get() may be called from any thread at any time,
+ it never blocks the producer: the totals are published through a
+ sequence counter and the reader retries while an update is in progress.
+ */
+
+#ifndef _VIMON_ENERGY_H_
+#define _VIMON_ENERGY_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "vimon.h"
+
+#define VIMON_ENERGY_MAX_GAP_MS		5000	// default longest integrated interval
+
+struct VImonEnergyTotals {
+	double chargeAh;			// charge into the battery
+	double dischargeAh;			// charge taken out of the battery
+	double chargeWh;
+	double dischargeWh;
+	double seconds;				// integrated time
+	double gapSeconds;			// time not integrated (gaps, unusable samples)
+	uint64_t samples;			// samples used
+	uint64_t rejected;			// samples not used (error or quality flags)
+	uint64_t timestamp;			// last sample used [ns], 0 = none
+};
+
+class VImonEnergy {
+public:
+	VImonEnergy(unsigned maxGapMs = VIMON_ENERGY_MAX_GAP_MS);
+
+	void setMaxGap(unsigned maxGapMs) { _maxGapNs = (uint64_t)maxGapMs * 1000000ULL; }
+
+/*
+ producer: integrate the interval since the previous sample
+ - returns true if the sample was used
+ */
+	bool add(const VImonSample& sample);
+
+/*
+ consistent copy of the running totals, callable from any thread
+ */
+	void get(VImonEnergyTotals *totals) const;
+
+/*
+ replace the totals, e.g. with values restored at start-up
+ - producer thread only, the next sample starts a new segment
+ */
+	void set(const VImonEnergyTotals& totals);
+	void reset();
+
+	// signed battery current [mA] of a sample, charging positive
+	static float current(const VImonSample& sample);
+
+private:
+	void publish();
+
+	uint64_t _maxGapNs;
+
+	// producer state
+	VImonEnergyTotals _acc;
+	bool _havePrev;
+	uint64_t _prevNs;			// monotonic time of the last sample used, 0 = none
+	float _prevMa;
+	float _prevMw;
+
+	// published copy
+	std::atomic<uint32_t> _seq;
+	VImonEnergyTotals _pub;
+};
+
+#endif /* _VIMON_ENERGY_H_ */
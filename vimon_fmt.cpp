@@ -0,0 +1,324 @@
+/*
+ VI monitoring board - sample formatting and buffered output
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <charconv>
+
+#include "I2Cclock.h"
+#include "vimon_fmt.h"
+#include "vimon_trace.h"
+
+using namespace std;
+
+static const char *csvHeader =
+	"timestamp_ns,raw0,raw1,raw2,raw3,mv0,mv1,mv2,mv3,v1_mv,v2_mv,i1_ma,i2_ma,err,quality\n";
+
+/*********************************************************************
+ VImonFormatter
+ *********************************************************************/
+
+VImonFormatter::VImonFormatter(VImonFormat format) {
+	_format = format;
+	_textTime = true;
+	_len = 0;
+	_buf[0] = 0;
+	_timeSec = 0;
+	_timeStr[0] = 0;
+}
+
+void VImonFormatter::setFormat(VImonFormat format) {
+	_format = format;
+}
+
+size_t VImonFormatter::header() {
+	_len = 0;
+	if (_format == VIMON_FMT_CSV)
+		put(csvHeader);
+	_buf[_len] = 0;
+	return _len;
+}
+
+size_t VImonFormatter::format(const VImonSample& s) {
+	VIMON_TRACE_SPAN("format");
+	_len = 0;
+	switch (_format) {
+		case VIMON_FMT_CSV:
+			formatCsv(s);
+			break;
+		case VIMON_FMT_JSON:
+			formatJson(s);
+			break;
+		default:
+			formatText(s);
+			break;
+	}
+	put('\n');
+	_buf[_len] = 0;
+	return _len;
+}
+
+void VImonFormatter::put(const char *str) {
+	size_t n = strlen(str);
+	if (n > sizeof(_buf) - 1 - _len)
+		n = sizeof(_buf) - 1 - _len;
+	memcpy(&_buf[_len], str, n);
+	_len += n;
+}
+
+void VImonFormatter::put(char c) {
+	if (_len < sizeof(_buf) - 1)
+		_buf[_len++] = c;
+}
+
+/*
+ append a right aligned integer, padded with spaces to "width"
+ */
+void VImonFormatter::putInt(long long value, int width) {
+	char tmp[24];
+	to_chars_result r = to_chars(tmp, tmp + sizeof(tmp), value);
+	int n = r.ptr - tmp;
+	while (width-- > n)
+		put(' ');
+	if (n > (int)(sizeof(_buf) - 1 - _len))
+		n = sizeof(_buf) - 1 - _len;
+	memcpy(&_buf[_len], tmp, n);
+	_len += n;
+}
+
+/*
+ append a right aligned fixed point value, same as printf("%*.*f")
+ */
+void VImonFormatter::putFixed(float value, int precision, int width) {
+	char tmp[48];
+	to_chars_result r = to_chars(tmp, tmp + sizeof(tmp), value, chars_format::fixed, precision);
+	int n = (r.ec == errc()) ? r.ptr - tmp : 0;
+	while (width-- > n)
+		put(' ');
+	if (n > (int)(sizeof(_buf) - 1 - _len))
+		n = sizeof(_buf) - 1 - _len;
+	memcpy(&_buf[_len], tmp, n);
+	_len += n;
+}
+
+/*
+ append local time as HH:MM:SS.mmm
+ */
+void VImonFormatter::putTime(uint64_t timestamp) {
+	time_t sec = (time_t)(timestamp / 1000000000ULL);
+	unsigned ms = (unsigned)((timestamp / 1000000ULL) % 1000);
+	struct tm tm_now;
+
+	if (sec != _timeSec || _timeStr[0] == 0) {
+		localtime_r(&sec, &tm_now);
+		_timeStr[0] = '0' + tm_now.tm_hour / 10;
+		_timeStr[1] = '0' + tm_now.tm_hour % 10;
+		_timeStr[2] = ':';
+		_timeStr[3] = '0' + tm_now.tm_min / 10;
+		_timeStr[4] = '0' + tm_now.tm_min % 10;
+		_timeStr[5] = ':';
+		_timeStr[6] = '0' + tm_now.tm_sec / 10;
+		_timeStr[7] = '0' + tm_now.tm_sec % 10;
+		_timeStr[8] = 0;
+		_timeSec = sec;
+	}
+	put(_timeStr);
+	put('.');
+	put((char)('0' + ms / 100));
+	put((char)('0' + (ms / 10) % 10));
+	put((char)('0' + ms % 10));
+}
+
+void VImonFormatter::formatText(const VImonSample& s) {
+	int i;
+
+	if (_textTime && s.timestamp != 0) {
+		putTime(s.timestamp);
+		put(": ");
+	}
+
+	// raw values
+	for (i=0; i<VIMON_CHANNELS; i++) {
+		putInt(s.raw[i], 5);
+		put(' ');
+	}
+	put(" : ");
+
+	// unscaled mV reading
+	for (i=0; i<VIMON_CHANNELS; i++) {
+		if (s.error & (1 << i))
+			put("-err-");
+		else
+			putFixed(s.mv[i], 1, 5);
+		put(' ');
+	}
+
+	// Voltage (CH0, CH1)
+	put(" : ");
+	if (s.error & VIMON_ERR_CH0)
+		put("-err-");
+	else
+		putFixed(s.v1_mv, 1, 5);
+	put(" mV : ");
+	if (s.error & VIMON_ERR_CH1)
+		put("-err-");
+	else
+		putFixed(s.v2_mv, 1, 5);
+	put(" mV");
+
+	// Current (CH2, CH3)
+	put(" : ");
+	if (s.error & VIMON_ERR_CH2)
+		put("-err- ");
+	else
+		putFixed(s.i1_ma, 1, 6);
+	put(" mA : ");
+	if (s.error & VIMON_ERR_CH3)
+		put("-err- ");
+	else
+		putFixed(s.i2_ma, 1, 6);
+	put(" mA");
+
+	// quality flags, only when raised
+	if (s.quality != 0) {
+		put(" : quality ");
+		putInt(s.quality);
+	}
+}
+
+void VImonFormatter::formatCsv(const VImonSample& s) {
+	int i;
+
+	putInt((long long)s.timestamp);
+	for (i=0; i<VIMON_CHANNELS; i++) {
+		put(',');
+		if (!(s.error & (1 << i)))
+			putInt(s.raw[i]);
+	}
+	for (i=0; i<VIMON_CHANNELS; i++) {
+		put(',');
+		if (!(s.error & (1 << i)))
+			putFixed(s.mv[i], 3);
+	}
+	put(',');
+	if (!(s.error & VIMON_ERR_CH0)) putFixed(s.v1_mv, 1);
+	put(',');
+	if (!(s.error & VIMON_ERR_CH1)) putFixed(s.v2_mv, 1);
+	put(',');
+	if (!(s.error & VIMON_ERR_CH2)) putFixed(s.i1_ma, 1);
+	put(',');
+	if (!(s.error & VIMON_ERR_CH3)) putFixed(s.i2_ma, 1);
+	put(',');
+	putInt(s.error);
+	put(',');
+	putInt(s.quality);
+}
+
+void VImonFormatter::formatJson(const VImonSample& s) {
+	int i;
+
+	put("{\"ts\":");
+	putInt((long long)s.timestamp);
+	put(",\"raw\":[");
+	for (i=0; i<VIMON_CHANNELS; i++) {
+		if (i) put(',');
+		if (s.error & (1 << i))
+			put("null");
+		else
+			putInt(s.raw[i]);
+	}
+	put("],\"mv\":[");
+	for (i=0; i<VIMON_CHANNELS; i++) {
+		if (i) put(',');
+		if (s.error & (1 << i))
+			put("null");
+		else
+			putFixed(s.mv[i], 3);
+	}
+	put("],\"v1_mv\":");
+	if (s.error & VIMON_ERR_CH0) put("null"); else putFixed(s.v1_mv, 1);
+	put(",\"v2_mv\":");
+	if (s.error & VIMON_ERR_CH1) put("null"); else putFixed(s.v2_mv, 1);
+	put(",\"i1_ma\":");
+	if (s.error & VIMON_ERR_CH2) put("null"); else putFixed(s.i1_ma, 1);
+	put(",\"i2_ma\":");
+	if (s.error & VIMON_ERR_CH3) put("null"); else putFixed(s.i2_ma, 1);
+	put(",\"err\":");
+	putInt(s.error);
+	put(",\"quality\":");
+	putInt(s.quality);
+	put('}');
+}
+
+/*********************************************************************
+ VImonWriter
+ *********************************************************************/
+
+VImonWriter::VImonWriter(int fd, size_t flushSize, unsigned flushMs) {
+	_fd = fd;
+	if (flushSize == 0 || flushSize > sizeof(_buf))
+		flushSize = sizeof(_buf);
+	_flushSize = flushSize;
+	_flushNs = (uint64_t)flushMs * 1000000ULL;
+	_firstNs = 0;
+	_len = 0;
+}
+
+VImonWriter::~VImonWriter() {
+	flush();
+}
+
+int VImonWriter::writeOut(const char *data, size_t len) {
+	ssize_t n;
+	VIMON_TRACE_SPAN("output");
+	while (len > 0) {
+		n = ::write(_fd, data, len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int VImonWriter::flush() {
+	int ret = 0;
+	if (_len > 0)
+		ret = writeOut(_buf, _len);
+	_len = 0;
+	return ret;
+}
+
+int VImonWriter::write(const char *data, size_t len) {
+	int ret = 0;
+
+	if (len > sizeof(_buf) - _len) {
+		if (flush() < 0) ret = -1;
+		// does not fit in an empty buffer either, write directly
+		if (len > sizeof(_buf))
+			return (writeOut(data, len) < 0) ? -1 : ret;
+	}
+	if (_len == 0 && _flushNs > 0)
+		_firstNs = I2Cclock::systemNs();
+	memcpy(&_buf[_len], data, len);
+	_len += len;
+
+	if (_len >= _flushSize) {
+		if (flush() < 0) ret = -1;
+	} else if (_flushNs > 0) {
+		if (poll() < 0) ret = -1;
+	}
+	return ret;
+}
+
+int VImonWriter::poll() {
+	if (_len > 0 && _flushNs > 0 && (I2Cclock::systemNs() - _firstNs) >= _flushNs)
+		return flush();
+	return 0;
+}
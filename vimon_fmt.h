@@ -0,0 +1,132 @@
+/*
+ VI monitoring board - sample formatting and buffered output
+
+ VImonFormatter renders a VImonSample into a fixed, reusable line buffer
+ using std::to_chars. No heap allocation takes place after construction.
+
+ Formats:
+ - VIMON_FMT_TEXT  human readable, same layout as VImon::readAllChannels
+ - VIMON_FMT_CSV   one record per line, see header() for the column list
+ - VIMON_FMT_JSON  JSON-lines, one object per line
+
+ Channels which failed to read are reported explicitly: the "err" field
+ carries the channel error mask and the affected values are left empty
+ (CSV) or set to null (JSON). The "quality" field carries the data quality
+ flags (vimon_quality.h), the text format shows them only when raised.
+
+ VImonWriter collects formatted lines in a fixed buffer and writes them
+ to a file descriptor when either the fill level or the age of the oldest
+ unflushed line exceeds the configured limit.
+ */
+
+#ifndef _VIMON_FMT_H_
+#define _VIMON_FMT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "vimon.h"
+
+#define VIMON_FMT_LINE_SIZE		512		// max length of one formatted line
+
+#define VIMON_WRITER_BUF_SIZE	65536	// output buffer size [bytes]
+#define VIMON_WRITER_FLUSH_SIZE	32768	// default flush threshold [bytes]
+#define VIMON_WRITER_FLUSH_MS	1000	// default flush interval [ms]
+
+enum VImonFormat {
+	VIMON_FMT_TEXT = 0,
+	VIMON_FMT_CSV,
+	VIMON_FMT_JSON
+};
+
+class VImonFormatter {
+public:
+	VImonFormatter(VImonFormat format = VIMON_FMT_TEXT);
+
+	void setFormat(VImonFormat format);
+	VImonFormat getFormat() { return _format; }
+
+/*
+ include the wall clock time in text mode (default on)
+ */
+	void setTextTimestamp(bool enable) { _textTime = enable; }
+
+/*
+ format a sample, the result is terminated by a newline
+ - returns the length of the formatted line
+ - the result is valid until the next call to format() or header()
+ */
+	size_t format(const VImonSample& s);
+
+/*
+ column header line for the current format
+ - returns 0 if the format has no header (TEXT, JSON)
+ */
+	size_t header();
+
+	const char *data() { return _buf; }
+	size_t length() { return _len; }
+
+private:
+	void put(const char *str);
+	void put(char c);
+	void putInt(long long value, int width =0);
+	void putFixed(float value, int precision, int width =0);
+	void putTime(uint64_t timestamp);
+
+	void formatText(const VImonSample& s);
+	void formatCsv(const VImonSample& s);
+	void formatJson(const VImonSample& s);
+
+	VImonFormat _format;
+	bool _textTime;
+	char _buf[VIMON_FMT_LINE_SIZE];
+	size_t _len;
+
+	// cached "HH:MM:SS" for text mode, localtime() runs once per second
+	time_t _timeSec;
+	char _timeStr[12];
+};
+
+class VImonWriter {
+public:
+/*
+ - fd: destination file descriptor (not closed by the writer)
+ - flushSize: flush when at least this many bytes are buffered
+ - flushMs: flush when buffered data is older than this (0 = size only)
+ */
+	VImonWriter(int fd, size_t flushSize = VIMON_WRITER_FLUSH_SIZE, unsigned flushMs = VIMON_WRITER_FLUSH_MS);
+	~VImonWriter();
+
+/*
+ append data, flushing as required by the policy
+ - returns 0 on success, -1 on write error
+ */
+	int write(const char *data, size_t len);
+	int write(VImonFormatter& fmt) { return write(fmt.data(), fmt.length()); }
+
+/*
+ write all buffered data
+ - returns 0 on success, -1 on write error
+ */
+	int flush();
+
+/*
+ flush if the buffered data is older than the flush interval,
+ for use by idle loops which have no new data to write
+ */
+	int poll();
+
+private:
+	int writeOut(const char *data, size_t len);
+
+	int _fd;
+	size_t _flushSize;
+	uint64_t _flushNs;
+	uint64_t _firstNs;		// time the oldest unflushed byte was added
+	size_t _len;
+	char _buf[VIMON_WRITER_BUF_SIZE];
+};
+
+#endif /* _VIMON_FMT_H_ */
@@ -0,0 +1,457 @@
+/*
+ VI monitoring board - Modbus/TCP server
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "I2Cclock.h"
+#include "vimon_modbus.h"
+
+#define MBAP_LEN		7			// transaction, protocol, length, unit
+#define SNAPSHOT_RETRIES	100
+
+static inline uint16_t getWord(const uint8_t *p) {
+	return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline void putWord(uint8_t *p, uint16_t v) {
+	p[0] = v >> 8;
+	p[1] = v & 0xFF;
+}
+
+static void putFloat(uint16_t *regs, float v) {
+	uint32_t u;
+	memcpy(&u, &v, 4);
+	regs[0] = u >> 16;
+	regs[1] = u & 0xFFFF;
+}
+
+VImonModbusServer::VImonModbusServer() : _running(false), _seq(0),
+		_clientCount(0), _requests(0), _exceptions(0) {
+	_listenFd = -1;
+	_epollFd = -1;
+	_wakeFd = -1;
+	_energy = NULL;
+	VImon::getDefaultCalibration(&_cal);
+	memset(&_snap, 0, sizeof(_snap));
+	_snap.error = VIMON_MB_NO_SAMPLE;
+	_clients = NULL;
+}
+
+VImonModbusServer::~VImonModbusServer() {
+	stop();
+}
+
+bool VImonModbusServer::start(uint16_t port) {
+	struct sockaddr_in addr;
+	struct epoll_event ev;
+	int one = 1, i;
+
+	if (_thread.joinable())
+		return false;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	_listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	_epollFd = epoll_create1(EPOLL_CLOEXEC);
+	_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (_listenFd >= 0)
+		setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (_listenFd < 0 || _epollFd < 0 || _wakeFd < 0 ||
+			bind(_listenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+			listen(_listenFd, VIMON_MODBUS_MAX_CLIENTS) < 0) {
+		stop();
+		return false;
+	}
+
+	_clients = new Client[VIMON_MODBUS_MAX_CLIENTS];
+	for (i=0; i<VIMON_MODBUS_MAX_CLIENTS; i++)
+		_clients[i].fd = -1;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;				// the listening socket
+	epoll_ctl(_epollFd, EPOLL_CTL_ADD, _listenFd, &ev);
+	ev.data.ptr = &_wakeFd;
+	epoll_ctl(_epollFd, EPOLL_CTL_ADD, _wakeFd, &ev);
+
+	_running.store(true);
+	_thread = std::thread(&VImonModbusServer::run, this);
+	return true;
+}
+
+void VImonModbusServer::stop() {
+	uint64_t one = 1;
+	int i;
+
+	if (_thread.joinable()) {
+		_running.store(false);
+		if (::write(_wakeFd, &one, sizeof(one)) < 0)
+			;
+		_thread.join();
+	}
+	if (_clients != NULL) {
+		for (i=0; i<VIMON_MODBUS_MAX_CLIENTS; i++)
+			if (_clients[i].fd >= 0)
+				drop(_clients[i]);
+		delete[] _clients;
+		_clients = NULL;
+	}
+	if (_listenFd >= 0)
+		close(_listenFd);
+	if (_epollFd >= 0)
+		close(_epollFd);
+	if (_wakeFd >= 0)
+		close(_wakeFd);
+	_listenFd = _epollFd = _wakeFd = -1;
+}
+
+/*
+ sequence lock write: odd, data, even
+ */
+void VImonModbusServer::update(const VImonSample& sample) {
+	uint32_t seq = _seq.load(std::memory_order_relaxed);
+
+	_seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	_snap.timestamp = sample.timestamp;
+	_snap.updateNs = I2Cclock::systemNs();
+	_snap.count++;
+	_snap.value[0] = sample.v1_mv;
+	_snap.value[1] = sample.v2_mv;
+	_snap.value[2] = sample.i1_ma;
+	_snap.value[3] = sample.i2_ma;
+	_snap.value[4] = VImon::getPT100temp(sample.mv[1], _cal);
+	_snap.error = sample.error;
+	_snap.quality = sample.quality;
+	_seq.store(seq + 2, std::memory_order_release);
+}
+
+bool VImonModbusServer::snapshot(Snapshot *s) {
+	uint32_t seq;
+	int i;
+
+	for (i=0; i<SNAPSHOT_RETRIES; i++) {
+		seq = _seq.load(std::memory_order_acquire);
+		if (seq & 1)
+			continue;
+		memcpy(s, &_snap, sizeof(*s));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (_seq.load(std::memory_order_relaxed) == seq)
+			return true;
+	}
+	return false;
+}
+
+/*
+ the complete register map
+ */
+void VImonModbusServer::fill(uint16_t *regs) {
+	VImonEnergyTotals t;
+	Snapshot s;
+	uint64_t ms, age;
+	int i;
+
+	memset(regs, 0, VIMON_MB_REGISTERS * sizeof(uint16_t));
+	if (!snapshot(&s)) {
+		regs[VIMON_MB_ERROR] = VIMON_MB_NO_SAMPLE;
+		return;
+	}
+	for (i=0; i<5; i++)
+		putFloat(&regs[VIMON_MB_V1 + 2 * i], s.value[i]);
+	if (_energy != NULL) {
+		_energy->get(&t);
+		putFloat(&regs[VIMON_MB_CHARGE_AH], (float)t.chargeAh);
+		putFloat(&regs[VIMON_MB_DISCHARGE_AH], (float)t.dischargeAh);
+		putFloat(&regs[VIMON_MB_CHARGE_WH], (float)t.chargeWh);
+		putFloat(&regs[VIMON_MB_DISCHARGE_WH], (float)t.dischargeWh);
+	}
+	regs[VIMON_MB_ERROR] = s.error;
+	regs[VIMON_MB_QUALITY] = s.quality;
+	ms = s.timestamp / 1000000ULL;
+	for (i=0; i<4; i++)
+		regs[VIMON_MB_TIMESTAMP + i] = (uint16_t)(ms >> (48 - 16 * i));
+	if (s.count > 0) {
+		age = (I2Cclock::systemNs() - s.updateNs) / 1000000ULL;
+		regs[VIMON_MB_AGE] = (age > 0xFFFF) ? 0xFFFF : (uint16_t)age;
+	}
+	regs[VIMON_MB_COUNT] = (uint16_t)s.count;
+}
+
+void VImonModbusServer::run() {
+	struct epoll_event events[VIMON_MODBUS_MAX_CLIENTS + 2];
+	uint64_t count, now;
+	int n, i;
+
+	while (_running.load()) {
+		n = epoll_wait(_epollFd, events, VIMON_MODBUS_MAX_CLIENTS + 2, 1000);
+		for (i=0; i<n; i++) {
+			if (events[i].data.ptr == NULL) {
+				accept();
+			} else if (events[i].data.ptr == &_wakeFd) {
+				if (::read(_wakeFd, &count, sizeof(count)) < 0)
+					;
+			} else {
+				Client& c = *(Client *)events[i].data.ptr;
+				if (c.fd < 0)
+					continue;
+				if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+					drop(c);
+					continue;
+				}
+				if (events[i].events & EPOLLIN)
+					receive(c);
+				if (c.fd >= 0 && (events[i].events & EPOLLOUT))
+					flush(c);
+			}
+		}
+		now = I2Cclock::systemNs();
+		for (i=0; i<VIMON_MODBUS_MAX_CLIENTS; i++)
+			if (_clients[i].fd >= 0 && now - _clients[i].activeNs >= VIMON_MODBUS_IDLE_MS * 1000000ULL)
+				drop(_clients[i]);
+	}
+}
+
+void VImonModbusServer::accept() {
+	struct epoll_event ev;
+	int fd, i, one = 1;
+
+	while ((fd = accept4(_listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		for (i=0; i<VIMON_MODBUS_MAX_CLIENTS && _clients[i].fd >= 0; i++)
+			;
+		if (i >= VIMON_MODBUS_MAX_CLIENTS) {
+			close(fd);
+			continue;
+		}
+		// small responses, send them at once
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		Client& c = _clients[i];
+		c.fd = fd;
+		c.inLen = 0;
+		c.outPos = c.outLen = 0;
+		c.waiting = false;
+		c.activeNs = I2Cclock::systemNs();
+		ev.events = EPOLLIN;
+		ev.data.ptr = &c;
+		epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &ev);
+		_clientCount.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void VImonModbusServer::drop(Client& c) {
+	epoll_ctl(_epollFd, EPOLL_CTL_DEL, c.fd, NULL);
+	close(c.fd);
+	c.fd = -1;
+	_clientCount.fetch_sub(1, std::memory_order_relaxed);
+}
+
+/*
+ read requests, every complete one is answered (masters may pipeline)
+ */
+void VImonModbusServer::receive(Client& c) {
+	unsigned len, pos;
+	ssize_t n;
+
+	for (;;) {
+		n = ::read(c.fd, c.in + c.inLen, sizeof(c.in) - c.inLen);
+		if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+			drop(c);
+			return;
+		}
+		if (n < 0)
+			break;
+		c.inLen += n;
+		c.activeNs = I2Cclock::systemNs();
+
+		pos = 0;
+		while (c.inLen - pos >= MBAP_LEN) {
+			len = getWord(c.in + pos + 4);
+			// protocol 0, unit id and at least the function code
+			if (getWord(c.in + pos + 2) != 0 || len < 2 || MBAP_LEN - 1 + len > sizeof(c.in)) {
+				drop(c);
+				return;
+			}
+			if (c.inLen - pos < MBAP_LEN - 1 + len)
+				break;
+			answer(c, c.in + pos, MBAP_LEN - 1 + len);
+			pos += MBAP_LEN - 1 + len;
+		}
+		memmove(c.in, c.in + pos, c.inLen - pos);
+		c.inLen -= pos;
+	}
+	flush(c);
+}
+
+void VImonModbusServer::answer(Client& c, const uint8_t *adu, unsigned len) {
+	uint16_t regs[VIMON_MB_REGISTERS];
+	uint8_t *out;
+	uint16_t start = 0, count = 0;
+	uint8_t function = adu[MBAP_LEN], exception = 0;
+	unsigned pdu, i;
+
+	_requests.fetch_add(1, std::memory_order_relaxed);
+	if (function != 0x03 && function != 0x04)
+		exception = 0x01;			// illegal function
+	else if (len < MBAP_LEN + 5)
+		exception = 0x03;			// illegal data value
+	else {
+		start = getWord(adu + MBAP_LEN + 1);
+		count = getWord(adu + MBAP_LEN + 3);
+		if (count < 1 || count > VIMON_MODBUS_MAX_READ)
+			exception = 0x03;
+		else if (start + count > VIMON_MB_REGISTERS)
+			exception = 0x02;		// illegal data address
+	}
+	pdu = exception ? 2 : 2 + 2 * count;
+	// a master which does not read its answers is not served further
+	if (c.outLen + MBAP_LEN + pdu > sizeof(c.out) - c.outPos) {
+		if (c.outPos > 0) {
+			memmove(c.out, c.out + c.outPos, c.outLen);
+			c.outPos = 0;
+		}
+		if (c.outLen + MBAP_LEN + pdu > sizeof(c.out))
+			return;
+	}
+
+	out = c.out + c.outPos + c.outLen;
+	memcpy(out, adu, 4);			// transaction and protocol id
+	putWord(out + 4, pdu + 1);
+	out[6] = adu[6];				// unit id
+	if (exception) {
+		out[7] = function | 0x80;
+		out[8] = exception;
+		_exceptions.fetch_add(1, std::memory_order_relaxed);
+	} else {
+		fill(regs);
+		out[7] = function;
+		out[8] = 2 * count;
+		for (i=0; i<count; i++)
+			putWord(out + 9 + 2 * i, regs[start + i]);
+	}
+	c.outLen += MBAP_LEN + pdu;
+}
+
+void VImonModbusServer::flush(Client& c) {
+	struct epoll_event ev;
+	ssize_t n;
+	bool out;
+
+	while (c.outLen > 0) {
+		n = send(c.fd, c.out + c.outPos, c.outLen, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			drop(c);
+			return;
+		}
+		c.outPos += n;
+		c.outLen -= n;
+	}
+	if (c.outLen == 0)
+		c.outPos = 0;
+	out = c.outLen > 0;
+	if (out != c.waiting) {
+		ev.events = EPOLLIN | (out ? EPOLLOUT : 0);
+		ev.data.ptr = &c;
+		epoll_ctl(_epollFd, EPOLL_CTL_MOD, c.fd, &ev);
+		c.waiting = out;
+	}
+}
+
+VImonModbusMaster::VImonModbusMaster() {
+	_fd = -1;
+	_transaction = 0;
+}
+
+VImonModbusMaster::~VImonModbusMaster() {
+	close();
+}
+
+bool VImonModbusMaster::connect(const char *host, uint16_t port) {
+	struct addrinfo hints, *res;
+	char service[8];
+	int one = 1;
+
+	if (_fd >= 0)
+		return false;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(service, sizeof(service), "%u", port);
+	if (getaddrinfo(host, service, &hints, &res) != 0)
+		return false;
+	_fd = socket(res->ai_family, res->ai_socktype | SOCK_CLOEXEC, 0);
+	if (_fd >= 0 && ::connect(_fd, res->ai_addr, res->ai_addrlen) < 0)
+		close();
+	freeaddrinfo(res);
+	if (_fd >= 0)
+		setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return _fd >= 0;
+}
+
+void VImonModbusMaster::close() {
+	if (_fd >= 0)
+		::close(_fd);
+	_fd = -1;
+}
+
+int VImonModbusMaster::readInputRegisters(uint16_t start, uint16_t count, uint16_t *regs) {
+	uint8_t req[MBAP_LEN + 5], resp[MBAP_LEN + 2 + 2 * VIMON_MODBUS_MAX_READ];
+	unsigned len, got = 0, i;
+	ssize_t n;
+
+	if (_fd < 0 || count < 1 || count > VIMON_MODBUS_MAX_READ)
+		return -1;
+	putWord(req, ++_transaction);
+	putWord(req + 2, 0);
+	putWord(req + 4, 6);
+	req[6] = 1;						// unit id
+	req[7] = 0x04;
+	putWord(req + 8, start);
+	putWord(req + 10, count);
+	if (send(_fd, req, sizeof(req), MSG_NOSIGNAL) != sizeof(req))
+		return -1;
+
+	// header, then the rest as announced
+	len = MBAP_LEN;
+	while (got < len) {
+		n = ::read(_fd, resp + got, len - got);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		got += n;
+		if (got == MBAP_LEN && len == MBAP_LEN) {
+			len = MBAP_LEN - 1 + getWord(resp + 4);
+			if (len > sizeof(resp) || len < MBAP_LEN + 1)
+				return -1;
+		}
+	}
+	if (getWord(resp) != _transaction)
+		return -1;
+	if (resp[7] & 0x80)
+		return resp[8];
+	if (resp[7] != 0x04 || resp[8] != 2 * count || len < MBAP_LEN + 2 + 2u * count)
+		return -1;
+	for (i=0; i<count; i++)
+		regs[i] = getWord(resp + 9 + 2 * i);
+	return 0;
+}
+
+float VImonModbusMaster::toFloat(const uint16_t *regs) {
+	uint32_t u = ((uint32_t)regs[0] << 16) | regs[1];
+	float v;
+	memcpy(&v, &u, 4);
+	return v;
+}
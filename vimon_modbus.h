@@ -0,0 +1,171 @@
+/*
+ VI monitoring board - Modbus/TCP server
+
+ VImonModbusServer answers Modbus/TCP masters (SCADA) from the newest
+ sample and the energy totals held in memory. A request never reaches the
+ I2C bus, so poll rates are independent of the ADC timing. The
+ acquisition thread hands every sample to update(), which stores the
+ register image under a sequence lock and never waits. One I/O thread
+ (epoll) serves up to VIMON_MODBUS_MAX_CLIENTS connections.
+
+ Functions: 03 (read holding registers) and 04 (read input registers),
+ both read the map below. Others get exception 01, addresses outside
+ the map exception 02, more than 125 registers exception 03. Any unit id
+ is answered.
+
+ Input register map, float32 as two registers, high word first:
+	0	V1 [mV]					float32
+	2	V2 [mV]					float32
+	4	I1 [mA]					float32
+	6	I2 [mA]					float32
+	8	PT100 temperature [C]	float32 (CH1 with the PT100 fitted)
+	10	charge [Ah]				float32 (setEnergy())
+	12	discharge [Ah]			float32
+	14	charge [Wh]				float32
+	16	discharge [Wh]			float32
+	18	error					VIMON_ERR_xxx mask, 0x10 = no sample yet
+	19	quality					VIMON_Q_xxx flags
+	20	timestamp [ms]			uint64, 4 registers, highest first
+	24	age [ms]				of the sample, up to 65535
+	25	sample counter			low 16 bits
+
+ VImonModbusMaster is a minimal master (function 04) for tests and tools.
+
+ Usage:
+	VImonModbusServer modbus;
+	modbus.setEnergy(&energy);
+	modbus.start(502);
+	...
+	modbus.update(sample);			// acquisition thread
+ */
+
+#ifndef _VIMON_MODBUS_H_
+#define _VIMON_MODBUS_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <thread>
+
+#include "vimon.h"
+#include "vimon_energy.h"
+
+#define VIMON_MODBUS_PORT			502
+#define VIMON_MODBUS_MAX_CLIENTS	32
+#define VIMON_MODBUS_IDLE_MS		60000	// connections without a request are closed
+#define VIMON_MODBUS_MAX_READ		125		// registers per request
+
+#define VIMON_MB_V1				0
+#define VIMON_MB_V2				2
+#define VIMON_MB_I1				4
+#define VIMON_MB_I2				6
+#define VIMON_MB_TEMP			8
+#define VIMON_MB_CHARGE_AH		10
+#define VIMON_MB_DISCHARGE_AH	12
+#define VIMON_MB_CHARGE_WH		14
+#define VIMON_MB_DISCHARGE_WH	16
+#define VIMON_MB_ERROR			18
+#define VIMON_MB_QUALITY		19
+#define VIMON_MB_TIMESTAMP		20
+#define VIMON_MB_AGE			24
+#define VIMON_MB_COUNT			25
+#define VIMON_MB_REGISTERS		26
+
+#define VIMON_MB_NO_SAMPLE		0x10	// in VIMON_MB_ERROR
+
+class VImonModbusServer {
+public:
+	VImonModbusServer();
+	~VImonModbusServer();
+
+	// energy totals to serve, read with VImonEnergy::get() per request
+	void setEnergy(const VImonEnergy *energy) { _energy = energy; }
+
+/*
+ listen on "port" (all interfaces) and start the I/O thread
+ - returns false if the port can not be bound
+ */
+	bool start(uint16_t port = VIMON_MODBUS_PORT);
+	void stop();
+
+	// new snapshot, wait-free
+	void update(const VImonSample& sample);
+	// PT100 calibration of the temperature, set from the thread calling update()
+	void setCalibration(const VImonCalibration& cal) { _cal = cal; }
+
+	// statistics, safe to read from any thread
+	unsigned getClientCount() { return _clientCount.load(std::memory_order_relaxed); }
+	uint64_t getRequestCount() { return _requests.load(std::memory_order_relaxed); }
+	uint64_t getExceptionCount() { return _exceptions.load(std::memory_order_relaxed); }
+
+private:
+	struct Snapshot {
+		uint64_t timestamp;			// [ns since epoch]
+		uint64_t updateNs;			// monotonic, for the age
+		uint32_t count;
+		float value[5];				// V1, V2, I1, I2, temperature
+		uint8_t error;
+		uint16_t quality;
+	};
+
+	struct Client {
+		int fd;
+		uint8_t in[260];			// MBAP header + PDU
+		unsigned inLen;
+		uint8_t out[4096];
+		unsigned outPos;
+		unsigned outLen;
+		bool waiting;				// EPOLLOUT armed
+		uint64_t activeNs;
+	};
+
+	void run();
+	void accept();
+	void drop(Client& c);
+	void receive(Client& c);
+	void answer(Client& c, const uint8_t *adu, unsigned len);
+	void flush(Client& c);
+	bool snapshot(Snapshot *s);
+	void fill(uint16_t *regs);
+
+	int _listenFd;
+	int _epollFd;
+	int _wakeFd;
+	std::thread _thread;
+	std::atomic<bool> _running;
+	const VImonEnergy *_energy;
+	VImonCalibration _cal;
+
+	std::atomic<uint32_t> _seq;		// odd while _snap is written
+	Snapshot _snap;
+
+	Client *_clients;
+	std::atomic<unsigned> _clientCount;
+	std::atomic<uint64_t> _requests;
+	std::atomic<uint64_t> _exceptions;
+};
+
+class VImonModbusMaster {
+public:
+	VImonModbusMaster();
+	~VImonModbusMaster();
+
+	bool connect(const char *host, uint16_t port = VIMON_MODBUS_PORT);
+	void close();
+
+/*
+ read "count" input registers from "start"
+ - returns 0, the exception code of an exception response, -1 on a
+   connection or protocol error
+ */
+	int readInputRegisters(uint16_t start, uint16_t count, uint16_t *regs);
+
+	// float32 from two registers, high word first
+	static float toFloat(const uint16_t *regs);
+
+private:
+	int _fd;
+	uint16_t _transaction;
+};
+
+#endif /* _VIMON_MODBUS_H_ */
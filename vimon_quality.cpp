@@ -0,0 +1,127 @@
+/*
+ VI monitoring board - data quality checks and watchdog
+ */
+
+#include <stdlib.h>
+
+#include "vimon_cal.h"
+#include "vimon_quality.h"
+#include "vimon_trace.h"
+
+VImonQuality::VImonQuality(VImon *board) {
+	int i;
+
+	_board = board;
+	for (i=0; i<VIMON_CHANNELS; i++) {
+		_loMv[i] = 1.0;		// disabled
+		_hiMv[i] = 0.0;
+		_maxStep[i] = 0;
+	}
+	// CH0 voltage and CH1 PT100, converted to mV at the ADC input
+	setRange(0, (V1_MIN_MV - V1_OFFSET) / V1_MV_PER_MV, (V1_MAX_MV - V1_OFFSET) / V1_MV_PER_MV);
+	setRange(1, (PT_MIN_OHM - PT_OFFSET_OHM) / PT_OHM_PER_MV, (PT_MAX_OHM - PT_OFFSET_OHM) / PT_OHM_PER_MV);
+	setStuckCheck(VIMON_Q_STUCK_CHANNELS, VIMON_Q_STUCK_SAMPLES);
+	setWatchdog(VIMON_Q_WATCHDOG_FLAGS, VIMON_Q_WATCHDOG_SAMPLES);
+	_flagged = 0;
+	_resets = 0;
+	restart();
+}
+
+void VImonQuality::setRange(int channel, float loMv, float hiMv) {
+	if (channel < 0 || channel >= VIMON_CHANNELS)
+		return;
+	_loMv[channel] = loMv;
+	_hiMv[channel] = hiMv;
+}
+
+void VImonQuality::setMaxStep(int channel, uint16_t codes) {
+	if (channel < 0 || channel >= VIMON_CHANNELS)
+		return;
+	_maxStep[channel] = codes;
+}
+
+void VImonQuality::setStuckCheck(uint8_t channels, unsigned samples) {
+	_stuckMask = channels & VIMON_ERR_ALL;
+	_stuckSamples = samples;
+}
+
+void VImonQuality::setWatchdog(uint8_t flags, unsigned samples) {
+	_watchdogMask = VIMON_Q_ALL(flags & 0x0F);
+	_watchdogSamples = samples;
+	_watchdogRun = 0;
+}
+
+void VImonQuality::restart() {
+	int i;
+	for (i=0; i<VIMON_CHANNELS; i++) {
+		_valid[i] = false;
+		_last[i] = 0;
+		_lastPga[i] = 0;
+		_lastNs[i] = 0;
+		_same[i] = 0;
+	}
+	_watchdogRun = 0;
+}
+
+uint16_t VImonQuality::check(VImonSample *sample) {
+	uint16_t quality = 0, flags;
+	uint64_t t;
+	int16_t raw;
+	int i;
+	VIMON_TRACE_SPAN("quality");
+
+	for (i=0; i<VIMON_CHANNELS; i++) {
+		if (sample->error & (1 << i)) {
+			_valid[i] = false;
+			continue;
+		}
+		raw = sample->raw[i];
+		t = sample->monotonic + (int64_t)sample->offsetUs[i] * 1000;
+		flags = 0;
+		if (raw == INT16_MAX || raw == INT16_MIN)
+			flags |= VIMON_Q_SATURATED;
+		// disabled when lo > hi
+		if (_loMv[i] <= _hiMv[i] && (sample->mv[i] < _loMv[i] || sample->mv[i] > _hiMv[i]))
+			flags |= VIMON_Q_RANGE;
+		// a repeated conversion is not a new code, a stuck channel stays stuck
+		if (_valid[i] && t + VIMON_SAME_CONVERSION_NS >= _lastNs[i] &&
+				t <= _lastNs[i] + VIMON_SAME_CONVERSION_NS) {
+			if (_same[i] >= _stuckSamples && _stuckSamples > 0 && (_stuckMask & (1 << i)))
+				flags |= VIMON_Q_STUCK;
+			quality |= VIMON_Q(i, flags);
+			continue;
+		}
+		// codes of different ranges (auto-ranging) are not compared
+		if (_valid[i] && sample->pga[i] != _lastPga[i]) {
+			_same[i] = 0;
+		} else if (_valid[i]) {
+			if (raw == _last[i]) {
+				if (++_same[i] >= _stuckSamples && _stuckSamples > 0 && (_stuckMask & (1 << i)))
+					flags |= VIMON_Q_STUCK;
+			} else {
+				_same[i] = 0;
+			}
+			if (_maxStep[i] > 0 && abs((int)raw - (int)_last[i]) > _maxStep[i])
+				flags |= VIMON_Q_STEP;
+		}
+		_last[i] = raw;
+		_lastPga[i] = sample->pga[i];
+		_lastNs[i] = t;
+		_valid[i] = true;
+		quality |= VIMON_Q(i, flags);
+	}
+	sample->quality = quality;
+	if (quality != 0)
+		_flagged++;
+
+	// watchdog
+	if (_watchdogSamples == 0 || (quality & _watchdogMask) == 0) {
+		_watchdogRun = 0;
+	} else if (++_watchdogRun >= _watchdogSamples) {
+		_resets++;
+		if (_board != NULL)
+			_board->reinitialize();
+		restart();
+	}
+	return quality;
+}
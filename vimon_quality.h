@@ -0,0 +1,116 @@
+/*
+ VI monitoring board - data quality checks and watchdog
+
+ Flags suspicious readings of every sample inline, in the acquisition
+ thread right after VImon::readSample():
+ - saturated:	the ADC returned its full scale code (0x7FFF / 0x8000)
+ - range:		the input is outside the plausible range of the channel,
+				by default the ranges documented in vimon.h / vimon_cal.h
+				(CH0 10-16 V, CH1 90-134 Ohm), CH2 and CH3 are not checked
+ - stuck:		the same code was returned for "stuckSamples" samples, on
+				the channels selected by setStuckCheck() only. Off by
+				default, a constant input (unused I2, no current) is not
+				a fault
+ - step:		the code changed by more than "maxStep" since the last sample
+ Stuck and step compare codes of the same range only, an auto-ranging
+ switch (VImonSample.pga) restarts them. A channel which was not converted
+ again (scheduled boards, same conversion time, see VImonSample) is not
+ compared.
+
+ The flags are packed four per channel into VImonSample.quality, use
+ VIMON_Q(channel, flag) to test them. Channels flagged in
+ VImonSample.error are not checked.
+
+ The watchdog re-initialises the board (VImon::reinitialize()) when a
+ sample carries any of the watchdog flags for "samples" samples in a row.
+ By default it acts on a stuck ADC only, so it is off until the stuck
+ check is enabled. A saturated input (overrange, overcurrent, an open
+ input reading full scale) is flagged but not fixed by a reset, which
+ would only cost the other channels their samples.
+
+ A check costs a few compares per channel, no floating point division
+ and no memory beyond the object.
+ */
+
+#ifndef _VIMON_QUALITY_H_
+#define _VIMON_QUALITY_H_
+
+#include <stdint.h>
+
+#include "vimon.h"
+
+#define VIMON_Q_SATURATED	0x1
+#define VIMON_Q_RANGE		0x2
+#define VIMON_Q_STUCK		0x4
+#define VIMON_Q_STEP		0x8
+
+// flag "flag" of channel "ch" in VImonSample.quality
+#define VIMON_Q(ch, flag)	((uint16_t)(flag) << ((ch) * 4))
+// flags of all channels
+#define VIMON_Q_ALL(flag)	(VIMON_Q(0, flag) | VIMON_Q(1, flag) | VIMON_Q(2, flag) | VIMON_Q(3, flag))
+
+#define VIMON_Q_STUCK_SAMPLES	64		// default identical codes to flag stuck
+#define VIMON_Q_STUCK_CHANNELS	0		// default stuck check channel mask, off
+#define VIMON_Q_WATCHDOG_FLAGS	VIMON_Q_STUCK
+#define VIMON_Q_WATCHDOG_SAMPLES	32	// default flagged samples to reset
+
+class VImonQuality {
+public:
+	VImonQuality(VImon *board = NULL);
+
+	// board reset by the watchdog, NULL only flags
+	void setBoard(VImon *board) { _board = board; }
+
+/*
+ plausible range of a channel in mV at the ADC input (VImonSample.mv)
+ - loMv > hiMv disables the check
+ */
+	void setRange(int channel, float loMv, float hiMv);
+/*
+ stuck check on the channels of "channels" (VIMON_ERR_CHx mask), flagged
+ after "samples" identical codes; 0 disables it
+ */
+	void setStuckCheck(uint8_t channels, unsigned samples = VIMON_Q_STUCK_SAMPLES);
+	// largest plausible change in ADC codes between samples, 0 disables
+	void setMaxStep(int channel, uint16_t codes);
+/*
+ reset the board when "samples" consecutive samples carry any of "flags"
+ (VIMON_Q_xxx, any channel), samples = 0 disables the watchdog
+ */
+	void setWatchdog(uint8_t flags, unsigned samples);
+
+/*
+ check a sample and store the flags in sample->quality
+ - returns the flags
+ */
+	uint16_t check(VImonSample *sample);
+
+	// forget the history, e.g. after the board has been re-initialised
+	void restart();
+
+	uint64_t getFlaggedCount() { return _flagged; }
+	uint32_t getResetCount() { return _resets; }
+
+private:
+	VImon *_board;
+
+	float _loMv[VIMON_CHANNELS];
+	float _hiMv[VIMON_CHANNELS];
+	uint16_t _maxStep[VIMON_CHANNELS];
+	unsigned _stuckSamples;
+	uint8_t _stuckMask;
+	uint16_t _watchdogMask;
+	unsigned _watchdogSamples;
+
+	bool _valid[VIMON_CHANNELS];
+	int16_t _last[VIMON_CHANNELS];
+	uint8_t _lastPga[VIMON_CHANNELS];
+	uint64_t _lastNs[VIMON_CHANNELS];	// conversion time of _last
+	unsigned _same[VIMON_CHANNELS];
+	unsigned _watchdogRun;
+
+	uint64_t _flagged;
+	uint32_t _resets;
+};
+
+#endif /* _VIMON_QUALITY_H_ */
@@ -0,0 +1,149 @@
+/*
+ VI monitoring board - time alignment of the channels
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "vimon_quality.h"
+#include "vimon_resample.h"
+#include "vimon_trace.h"
+
+// derived value of a channel
+static float *valueOf(VImonSample *s, int channel) {
+	switch (channel) {
+		case 0: return &s->v1_mv;
+		case 1: return &s->v2_mv;
+		case 2: return &s->i1_ma;
+		default: return &s->i2_ma;
+	}
+}
+
+static float valueOf(const VImonSample& s, int channel) {
+	switch (channel) {
+		case 0: return s.v1_mv;
+		case 1: return s.v2_mv;
+		case 2: return s.i1_ma;
+		default: return s.i2_ma;
+	}
+}
+
+static inline uint64_t alignUp(uint64_t t, uint64_t period) {
+	return ((t + period - 1) / period) * period;
+}
+
+VImonResampler::VImonResampler(uint64_t periodNs, uint64_t maxGapNs) {
+	setPeriod(periodNs, maxGapNs);
+}
+
+void VImonResampler::setPeriod(uint64_t periodNs, uint64_t maxGapNs) {
+	_periodNs = (periodNs > 0) ? periodNs : 1;
+	if (maxGapNs == 0)
+		maxGapNs = (4 * _periodNs > VIMON_RESAMPLE_MAX_GAP) ? 4 * _periodNs : VIMON_RESAMPLE_MAX_GAP;
+	_maxGapNs = maxGapNs;
+	reset();
+}
+
+void VImonResampler::reset() {
+	memset(_hist, 0, sizeof(_hist));
+	memset(_count, 0, sizeof(_count));
+	_next = 0;
+}
+
+/*
+ age 0 is the newest conversion of the channel
+ */
+const VImonResampler::Point& VImonResampler::point(int channel, unsigned age) const {
+	return _hist[channel][(_count[channel] - 1 - age) & (VIMON_RESAMPLE_HISTORY - 1)];
+}
+
+bool VImonResampler::interpolate(int channel, uint64_t t, VImonSample *out) const {
+	unsigned kept = (_count[channel] < VIMON_RESAMPLE_HISTORY) ? _count[channel] : VIMON_RESAMPLE_HISTORY;
+	unsigned age;
+	float f;
+
+	// newest conversion at or before t, "b" is the one after it
+	for (age = 0; age < kept; age++)
+		if (point(channel, age).t <= t)
+			break;
+	if (age >= kept)
+		return false;
+	const Point& a = point(channel, age);
+	if (a.t == t) {
+		f = 0.0f;
+	} else {
+		if (age == 0)
+			return false;
+		const Point& b = point(channel, age - 1);
+		if (b.t - a.t > _maxGapNs || b.error)
+			return false;
+		f = (float)(t - a.t) / (float)(b.t - a.t);
+		// codes of different ranges: those of the nearer conversion
+		if (a.pga == b.pga) {
+			out->raw[channel] = (int16_t)lrintf(a.raw + f * (b.raw - a.raw));
+			out->pga[channel] = a.pga;
+		} else {
+			out->raw[channel] = (f < 0.5f) ? a.raw : b.raw;
+			out->pga[channel] = (f < 0.5f) ? a.pga : b.pga;
+		}
+		out->mv[channel] = a.mv + f * (b.mv - a.mv);
+		*valueOf(out, channel) = a.value + f * (b.value - a.value);
+		out->quality |= VIMON_Q(channel, a.quality | b.quality);
+		return !a.error;
+	}
+	out->raw[channel] = a.raw;
+	out->pga[channel] = a.pga;
+	out->mv[channel] = a.mv;
+	*valueOf(out, channel) = a.value;
+	out->quality |= VIMON_Q(channel, a.quality);
+	return !a.error;
+}
+
+int VImonResampler::push(const VImonSample& in, VImonSample *out, int max) {
+	VImonSample *s;
+	uint64_t t, first = 0, limit = 0;
+	uint64_t wall = in.timestamp - in.monotonic;	// wall clock at monotonic 0, modulo 2^64
+	int ch, n = 0;
+	VIMON_TRACE_SPAN("resample");
+
+	for (ch=0; ch<VIMON_CHANNELS; ch++) {
+		t = in.monotonic + (int64_t)in.offsetUs[ch] * 1000;
+		// same conversion as before (channel not converted in this scan)
+		if (_count[ch] > 0 && t <= point(ch, 0).t + VIMON_SAME_CONVERSION_NS)
+			continue;
+		Point& p = _hist[ch][_count[ch] & (VIMON_RESAMPLE_HISTORY - 1)];
+		p.t = t;
+		p.raw = in.raw[ch];
+		p.pga = in.pga[ch];
+		p.mv = in.mv[ch];
+		p.value = valueOf(in, ch);
+		p.error = (in.error >> ch) & 1;
+		p.quality = (in.quality >> (ch * 4)) & 0x0F;
+		_count[ch]++;
+	}
+
+	// grid points up to the time every channel has reached
+	for (ch=0; ch<VIMON_CHANNELS; ch++) {
+		if (_count[ch] == 0)
+			return 0;
+		t = point(ch, (_count[ch] < VIMON_RESAMPLE_HISTORY) ? _count[ch] - 1 : VIMON_RESAMPLE_HISTORY - 1).t;
+		if (t > first) first = t;
+		t = point(ch, 0).t;
+		if (ch == 0 || t < limit) limit = t;
+	}
+	// start, or skip what fell out of the history, on the wall clock grid
+	if (_next < first)
+		_next = alignUp(first + wall, _periodNs) - wall;
+
+	while (_next <= limit && n < max) {
+		s = &out[n++];
+		memset(s, 0, sizeof(*s));
+		s->timestamp = _next + wall;
+		s->monotonic = _next;
+		for (ch=0; ch<VIMON_CHANNELS; ch++)
+			if (!interpolate(ch, _next, s))
+				s->error |= (1 << ch);
+		_next += _periodNs;
+	}
+	return n;
+}
@@ -0,0 +1,83 @@
+/*
+ VI monitoring board - time alignment of the channels
+
+ The four channels of a VImonSample are converted one after the other,
+ several milliseconds apart (see VImonSample.offsetUs). V1 x I computed
+ from one sample therefore multiplies values of different instants.
+
+ VImonResampler keeps the last conversions of every channel with their
+ mid-point times on the monotonic clock (VImonSample.monotonic) and
+ interpolates all channels linearly onto a common time grid of that
+ clock, started at a multiple of "periodNs" of the wall clock. The output
+ samples have all channels at the same instant, so power, resistance and
+ efficiency derived from them are consistent, and they come at a uniform
+ rate no matter how often each channel has been converted: a channel
+ whose conversion time did not change since the previous sample (not
+ converted in that scan) simply contributes no new point.
+
+ The output timestamp is the grid point mapped to the wall clock with
+ the offset between the clocks of the newest input sample: a wall clock
+ step moves the labels from then on, it neither stalls nor repeats grid
+ points.
+
+ - an output lags the input by up to one scan, a grid point is emitted
+   once every channel has a conversion at or after it
+ - a channel is flagged in the output error mask when one of the two
+   conversions around the grid point failed, they are more than
+   "maxGapNs" apart, or the grid point is older than the kept history
+ - the quality flags of both conversions are combined
+ */
+
+#ifndef _VIMON_RESAMPLE_H_
+#define _VIMON_RESAMPLE_H_
+
+#include <stdint.h>
+
+#include "vimon.h"
+
+#define VIMON_RESAMPLE_HISTORY	8		// conversions kept per channel, power of 2
+#define VIMON_RESAMPLE_PERIOD	1000000000ULL	// default grid period (ns)
+#define VIMON_RESAMPLE_MAX_GAP	1000000000ULL	// default interpolation limit (ns)
+
+class VImonResampler {
+public:
+	// maxGapNs = 0 selects the larger of VIMON_RESAMPLE_MAX_GAP and 4 periods
+	VImonResampler(uint64_t periodNs = VIMON_RESAMPLE_PERIOD, uint64_t maxGapNs = 0);
+
+	// change the grid, drops the history
+	void setPeriod(uint64_t periodNs, uint64_t maxGapNs = 0);
+
+/*
+ add a sample and produce the grid points which became complete
+ - at most "max" samples are written to "out"
+ - returns the number of samples written
+ */
+	int push(const VImonSample& in, VImonSample *out, int max);
+
+	// drop the history, the grid restarts with the next sample
+	void reset();
+
+	uint64_t getPeriod() { return _periodNs; }
+
+private:
+	struct Point {
+		uint64_t t;
+		float mv;
+		float value;			// v1_mv, v2_mv, i1_ma or i2_ma
+		int16_t raw;
+		uint8_t pga;
+		uint8_t error;
+		uint8_t quality;
+	};
+
+	const Point& point(int channel, unsigned age) const;
+	bool interpolate(int channel, uint64_t t, VImonSample *out) const;
+
+	uint64_t _periodNs;
+	uint64_t _maxGapNs;
+	uint64_t _next;				// next grid point, 0 = not started
+	Point _hist[VIMON_CHANNELS][VIMON_RESAMPLE_HISTORY];
+	unsigned _count[VIMON_CHANNELS];
+};
+
+#endif /* _VIMON_RESAMPLE_H_ */
@@ -0,0 +1,78 @@
+/*
+ VI monitoring board - single producer / single consumer queue
+
+ Lock-free ring buffer used to hand samples from an acquisition thread to
+ the processing thread. The producer never blocks: when the ring is full
+ the new element is dropped and counted.
+
+ SIZE must be a power of 2.
+ */
+
+#ifndef _VIMON_RING_H_
+#define _VIMON_RING_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+template <typename T, unsigned SIZE>
+class VImonRing {
+public:
+	VImonRing() : _head(0), _tail(0), _highWater(0), _drops(0) {
+		static_assert((SIZE & (SIZE - 1)) == 0, "SIZE must be a power of 2");
+	}
+
+/*
+ producer: append an element
+ - returns false and counts a drop if the ring is full
+ */
+	bool push(const T& item) {
+		uint32_t head = _head.load(std::memory_order_relaxed);
+		uint32_t used = head - _tail.load(std::memory_order_acquire);
+		if (used >= SIZE) {
+			_drops.store(_drops.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			return false;
+		}
+		_items[head & (SIZE - 1)] = item;
+		_head.store(head + 1, std::memory_order_release);
+		if (used + 1 > _highWater.load(std::memory_order_relaxed))
+			_highWater.store(used + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+/*
+ consumer: remove the oldest element
+ - returns false if the ring is empty
+ */
+	bool pop(T *item) {
+		uint32_t tail = _tail.load(std::memory_order_relaxed);
+		if (tail == _head.load(std::memory_order_acquire))
+			return false;
+		*item = _items[tail & (SIZE - 1)];
+		_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	unsigned size() {
+		return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+	}
+	unsigned capacity() { return SIZE; }
+
+	// statistics, safe to read from any thread
+	unsigned highWater() { return _highWater.load(std::memory_order_relaxed); }
+	uint64_t drops() { return _drops.load(std::memory_order_relaxed); }
+	void resetStats() {
+		_highWater.store(0, std::memory_order_relaxed);
+		_drops.store(0, std::memory_order_relaxed);
+	}
+
+private:
+	// producer and consumer indices on separate cache lines
+	alignas(64) std::atomic<uint32_t> _head;
+	alignas(64) std::atomic<uint32_t> _tail;
+	alignas(64) std::atomic<uint32_t> _highWater;
+	std::atomic<uint64_t> _drops;
+	T _items[SIZE];
+};
+
+#endif /* _VIMON_RING_H_ */
@@ -0,0 +1,174 @@
+/*
+ VI monitoring board - real-time acquisition
+ */
+
+#include <alloca.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "vimon_rt.h"
+
+bool VImonRealtime::lockMemory() {
+	int flags = MCL_CURRENT | MCL_FUTURE;
+
+	// freed memory stays mapped and locked, heap growth by brk only
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+#ifdef MCL_ONFAULT
+	// not the whole mapping at once: every thread stack would take megabytes
+	flags |= MCL_ONFAULT;
+#endif
+	return mlockall(flags) == 0;
+}
+
+bool VImonRealtime::setPriority(int priority) {
+	struct sched_param param;
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = priority;
+	errno = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	return errno == 0;
+}
+
+bool VImonRealtime::setAffinity(const char *list) {
+	cpu_set_t set;
+	const char *p = list;
+	char *end;
+	long first, last;
+
+	CPU_ZERO(&set);
+	while (*p != 0) {
+		first = strtol(p, &end, 10);
+		if (end == p || first < 0 || first >= CPU_SETSIZE)
+			goto invalid;
+		last = first;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first || last >= CPU_SETSIZE)
+				goto invalid;
+		}
+		for (; first <= last; first++)
+			CPU_SET(first, &set);
+		if (*end == ',')
+			end++;
+		else if (*end != 0)
+			goto invalid;
+		p = end;
+	}
+	if (CPU_COUNT(&set) == 0)
+		goto invalid;
+	errno = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	return errno == 0;
+
+invalid:
+	errno = EINVAL;
+	return false;
+}
+
+// not inlined, the array must be below the frame of the caller
+__attribute__((noinline)) void VImonRealtime::prefaultStack(size_t bytes) {
+	volatile char *stack = (volatile char *)alloca(bytes);
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t i;
+
+	for (i=0; i<bytes; i+=page)
+		stack[i] = 0;
+}
+
+void VImonRealtime::prefault(void *p, size_t bytes) {
+	volatile char *c = (volatile char *)p;
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t i;
+
+	// written back unchanged
+	for (i=0; i<bytes; i+=page)
+		c[i] = c[i];
+	if (bytes > 0)
+		c[bytes - 1] = c[bytes - 1];
+}
+
+/*********************************************************************
+ VImonMutex, VImonCondition
+ *********************************************************************/
+
+VImonMutex::VImonMutex() {
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+	pthread_mutex_init(&_mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+VImonMutex::~VImonMutex() {
+	pthread_mutex_destroy(&_mutex);
+}
+
+VImonCondition::VImonCondition() {
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&_cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+VImonCondition::~VImonCondition() {
+	pthread_cond_destroy(&_cond);
+}
+
+void VImonCondition::waitUntil(VImonMutex& mutex, uint64_t monotonicNs) {
+	struct timespec ts;
+
+	ts.tv_sec = monotonicNs / 1000000000ULL;
+	ts.tv_nsec = monotonicNs % 1000000000ULL;
+	pthread_cond_timedwait(&_cond, &mutex._mutex, &ts);
+}
+
+/*********************************************************************
+ VImonJitter
+ *********************************************************************/
+
+VImonJitter::VImonJitter() {
+	reset();
+}
+
+void VImonJitter::reset() {
+	_count = 0;
+	_sumNs = 0;
+	_maxNs = 0;
+	memset(_buckets, 0, sizeof(_buckets));
+}
+
+int VImonJitter::bucket(uint64_t ns) {
+	uint64_t us = ns / 1000;
+	int n = (us == 0) ? 0 : 64 - __builtin_clzll(us);
+	return (n < VIMON_JITTER_BUCKETS) ? n : VIMON_JITTER_BUCKETS - 1;
+}
+
+uint64_t VImonJitter::percentile(double percent) {
+	uint64_t limit = (uint64_t)(_count * percent / 100.0), sum = 0;
+	int i;
+
+	for (i=0; i<VIMON_JITTER_BUCKETS; i++) {
+		sum += _buckets[i];
+		if (sum > limit || sum == _count)
+			break;
+	}
+	if (i >= VIMON_JITTER_BUCKETS - 1 || (1ULL << i) * 1000ULL > _maxNs)
+		return _maxNs;
+	return (1ULL << i) * 1000ULL;
+}
+
+void VImonJitter::report(FILE *f, const char *name) {
+	fprintf(f, "%s: %llu wake-ups, late mean %.1f us, p99 < %.0f us, max %.1f us\n", name,
+		(unsigned long long)_count, getMeanNs() / 1000.0, percentile(99.0) / 1000.0, _maxNs / 1000.0);
+}
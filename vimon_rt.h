@@ -0,0 +1,144 @@
+/*
+ VI monitoring board - real-time acquisition
+
+ VImonRealtime puts the calling thread under SCHED_FIFO, pins it to a set
+ of CPUs and prefaults its stack, and locks the memory of the process, so
+ logging, network and UI processes can not pre-empt a scan and no page
+ fault delays it. A real-time thread must not allocate or do blocking I/O
+ once it runs, it hands its output to other threads through rings
+ (vimon_ring.h). Priority and affinity need CAP_SYS_NICE (root), locking
+ needs CAP_IPC_LOCK or a sufficient RLIMIT_MEMLOCK.
+
+ VImonMutex is a priority inheritance mutex for locks a real-time thread
+ shares with normal threads: while it waits, the holder runs at its
+ priority, a busy normal thread can not keep it waiting. It works with
+ std::lock_guard and std::unique_lock. VImonCondition waits on it, with
+ an absolute CLOCK_MONOTONIC deadline.
+
+ VImonJitter collects the lateness of periodic wake-ups: the time between
+ the moment a scan was due and the moment the thread ran, in log2
+ buckets. Recording takes no lock, the counters are written by the owning
+ thread only.
+
+ Usage:
+	VImonRealtime::lockMemory();				// once, before the threads
+	...
+	// in the acquisition thread
+	if (!VImonRealtime::setAffinity("3") || !VImonRealtime::setPriority(80))
+		perror("real-time");
+	VImonRealtime::prefaultStack(VIMON_RT_STACK);
+	for (;;) {
+		sleepUntil(due);
+		jitter.record(due, I2Cclock::now());
+		...
+	}
+ */
+
+#ifndef _VIMON_RT_H_
+#define _VIMON_RT_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define VIMON_RT_STACK			(64 * 1024)	// stack prefaulted by a real-time thread [bytes]
+
+#define VIMON_JITTER_BUCKETS	24		// bucket n covers [2^(n-1), 2^n) us, bucket 0 = below 1 us
+
+class VImonRealtime {
+public:
+/*
+ lock the pages of the process as they are touched, now and later, and
+ keep freed heap memory in the process
+ - returns false if the memory can not be locked, see errno
+ */
+	static bool lockMemory();
+
+/*
+ calling thread: SCHED_FIFO at "priority" (1..99)
+ - returns false if the policy can not be set, see errno
+ */
+	static bool setPriority(int priority);
+
+/*
+ calling thread: run on the CPUs of "list", e.g. "3" or "0,2-3"
+ - returns false on a syntax error (errno EINVAL) or if the set is refused
+ */
+	static bool setAffinity(const char *list);
+
+	// touch "bytes" of the stack of the calling thread
+	static void prefaultStack(size_t bytes);
+	// touch every page of an object which is not in use yet
+	static void prefault(void *p, size_t bytes);
+};
+
+class VImonMutex {
+public:
+	VImonMutex();
+	~VImonMutex();
+	VImonMutex(const VImonMutex&) = delete;
+	VImonMutex& operator=(const VImonMutex&) = delete;
+
+	void lock() { pthread_mutex_lock(&_mutex); }
+	void unlock() { pthread_mutex_unlock(&_mutex); }
+	bool try_lock() { return pthread_mutex_trylock(&_mutex) == 0; }
+
+private:
+	friend class VImonCondition;
+	pthread_mutex_t _mutex;
+};
+
+class VImonCondition {
+public:
+	VImonCondition();
+	~VImonCondition();
+	VImonCondition(const VImonCondition&) = delete;
+	VImonCondition& operator=(const VImonCondition&) = delete;
+
+/*
+ with "mutex" held: release it until notified or CLOCK_MONOTONIC reaches
+ "monotonicNs", then take it again
+ - may return early, the caller checks its condition
+ */
+	void waitUntil(VImonMutex& mutex, uint64_t monotonicNs);
+	void notifyAll() { pthread_cond_broadcast(&_cond); }
+
+private:
+	pthread_cond_t _cond;
+};
+
+class VImonJitter {
+public:
+	VImonJitter();
+
+	// the thread ran at "wakeNs" for a deadline at "dueNs"
+	void record(uint64_t dueNs, uint64_t wakeNs) {
+		uint64_t late = (wakeNs > dueNs) ? wakeNs - dueNs : 0;
+		_count++;
+		_sumNs += late;
+		if (late > _maxNs)
+			_maxNs = late;
+		_buckets[bucket(late)]++;
+	}
+	void reset();
+
+	uint64_t getCount() { return _count; }
+	uint64_t getMaxNs() { return _maxNs; }
+	uint64_t getMeanNs() { return (_count > 0) ? _sumNs / _count : 0; }
+	// lateness [ns] below which "percent" of the wake-ups ran (bucket upper bound, at most the maximum)
+	uint64_t percentile(double percent);
+
+	// "name: n wake-ups, late mean x us, p99 < y us, max z us"
+	void report(FILE *f, const char *name);
+
+private:
+	static int bucket(uint64_t ns);
+
+	uint64_t _count;
+	uint64_t _sumNs;
+	uint64_t _maxNs;
+	uint64_t _buckets[VIMON_JITTER_BUCKETS];
+};
+
+#endif /* _VIMON_RT_H_ */
@@ -0,0 +1,316 @@
+/*
+ VI monitoring board - multi-rate channel scheduler
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "I2Cclock.h"
+#include "vimon_sched.h"
+#include "vimon_trace.h"
+
+static unsigned gcd(unsigned a, unsigned b) {
+	unsigned t;
+	while (b != 0) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+VImonScheduler::VImonScheduler(VImon *board) {
+	_board = board;
+	memset(_chan, 0, sizeof(_chan));
+	memset(_cost, 0, sizeof(_cost));
+	_count = 0;
+	_switches = 0;
+	_baseNs = 0;
+	_frameNs = 0;
+	_utilization = 0.0;
+	_feasible = false;
+	_built = false;
+	_pos = 0;
+	_frameStartNs = 0;
+	_resyncs = 0;
+}
+
+void VImonScheduler::setChannel(int channel, double rateHz, uint8_t adcRate) {
+	if (channel < 0 || channel >= VIMON_CHANNELS)
+		return;
+	_chan[channel].targetHz = (rateHz > 0.0) ? rateHz : 0.0;
+	_chan[channel].adcRate = adcRate;
+	_built = false;
+}
+
+void VImonScheduler::clearCosts() {
+	memset(_cost, 0, sizeof(_cost));
+}
+
+double VImonScheduler::getScheduledRate(int channel) {
+	Channel& c = _chan[channel & 3];
+	if (c.every == 0 || _baseNs == 0)
+		return 0.0;
+	return 1e9 / ((double)c.every * _baseNs);
+}
+
+double VImonScheduler::getMeasuredRate(int channel) {
+	Channel& c = _chan[channel & 3];
+	if (c.conversions < 2 || c.lastNs <= c.firstNs)
+		return 0.0;
+	return (double)(c.conversions - 1) * 1e9 / (double)(c.lastNs - c.firstNs);
+}
+
+/*
+ time the conversions of the scheduled channels on the board, once per
+ channel and data rate
+ */
+void VImonScheduler::measure() {
+	uint64_t t0, t1, t2, cost[2];
+	int ch, other, i;
+	uint8_t rate;
+
+	for (ch=0; ch<VIMON_CHANNELS; ch++) {
+		if (_chan[ch].every == 0)
+			continue;
+		rate = _chan[ch].adcRate & 0x07;
+		if (_cost[ch][rate][0] == 0) {
+			cost[0] = cost[1] = 0;
+			other = (ch == 0) ? 1 : 0;
+			// longest of a few: mux switch from another input, then the same input again
+			for (i=0; i<VIMON_SCHED_PROBES; i++) {
+				_board->readChannel(other);
+				t0 = I2Cclock::now();
+				if (_board->readChannel(ch) < 0)
+					break;
+				t1 = I2Cclock::now();
+				if (_board->readChannel(ch) < 0)
+					break;
+				t2 = I2Cclock::now();
+				if (t1 - t0 > cost[1]) cost[1] = t1 - t0;
+				if (t2 - t1 > cost[0]) cost[0] = t2 - t1;
+			}
+			// kept only when every probe succeeded
+			if (i == VIMON_SCHED_PROBES) {
+				_cost[ch][rate][0] = cost[0] * (100 + VIMON_SCHED_MARGIN) / 100;
+				_cost[ch][rate][1] = cost[1] * (100 + VIMON_SCHED_MARGIN) / 100;
+			}
+		}
+		for (i=0; i<2; i++) {
+			if (_cost[ch][rate][0] != 0)
+				_chan[ch].costNs[i] = _cost[ch][rate][i];
+			else
+				_chan[ch].costNs[i] = _board->getConversionCostNs(ch, i != 0);
+		}
+	}
+}
+
+/*
+ place the conversions of one frame, earliest deadline first
+ - "prev" is the input selected before the frame starts, -1 = unknown
+ */
+bool VImonScheduler::place(int prev) {
+	unsigned job[VIMON_CHANNELS];
+	uint64_t t = 0, busy = 0, release, deadline, best, next, cost;
+	int ch, pick, lead = -1;
+	bool ok = true;
+
+	for (ch=0; ch<VIMON_CHANNELS; ch++) {
+		job[ch] = 0;
+		_chan[ch].feasible = true;
+		_chan[ch].lateNs = 0;
+		if (lead < 0 && _chan[ch].every == 1)
+			lead = ch;
+	}
+	_count = 0;
+	_switches = 0;
+
+	for (;;) {
+		// released conversion with the earliest deadline
+		pick = -1;
+		best = 0;
+		next = UINT64_MAX;
+		for (ch=0; ch<VIMON_CHANNELS; ch++) {
+			if (_chan[ch].every == 0 || job[ch] >= _frameNs / (_chan[ch].every * _baseNs))
+				continue;
+			release = (uint64_t)job[ch] * _chan[ch].every * _baseNs;
+			if (release > t) {
+				if (release < next) next = release;
+				continue;
+			}
+			deadline = release + _chan[ch].every * _baseNs;
+			// same deadline: stay on the selected input
+			if (pick < 0 || deadline < best || (deadline == best && ch == prev)) {
+				pick = ch;
+				best = deadline;
+			}
+		}
+		if (pick < 0) {
+			if (next == UINT64_MAX)
+				break;
+			t = next;				// idle until the next release
+			continue;
+		}
+		if (_count >= VIMON_SCHED_MAX_ENTRIES)
+			return false;
+
+		Entry& e = _entries[_count++];
+		e.startNs = t;
+		e.deadlineNs = best;
+		e.channel = pick;
+		e.lead = (pick == lead);
+		if (prev >= 0 && prev != pick)
+			_switches++;
+		cost = _chan[pick].costNs[prev != pick];
+		t += cost;
+		busy += cost;
+		if (t > best) {
+			_chan[pick].feasible = false;
+			if (t - best > _chan[pick].lateNs)
+				_chan[pick].lateNs = t - best;
+			ok = false;
+		}
+		job[pick]++;
+		prev = pick;
+	}
+	_utilization = (double)busy / (double)_frameNs;
+	// a frame spilling into the next delays its first conversions
+	return ok && t <= _frameNs;
+}
+
+bool VImonScheduler::build() {
+	double maxHz = 0.0;
+	unsigned frame = 1, largest = 1, entries;
+	int ch;
+
+	_built = false;
+	_feasible = false;
+	for (ch=0; ch<VIMON_CHANNELS; ch++) {
+		_chan[ch].every = 0;
+		_chan[ch].conversions = 0;
+		_chan[ch].late = 0;
+		// the differential current of the bipolar plan is read on CH2
+		if (ch == 3 && _board->getScanPlan() == VIMON_SCAN_BIPOLAR)
+			continue;
+		if (_chan[ch].targetHz > maxHz)
+			maxHz = _chan[ch].targetHz;
+	}
+	if (maxHz <= 0.0)
+		return false;
+	_baseNs = (uint64_t)llround(1e9 / maxHz);
+
+	for (ch=0; ch<VIMON_CHANNELS; ch++) {
+		if (_chan[ch].targetHz <= 0.0 || (ch == 3 && _board->getScanPlan() == VIMON_SCAN_BIPOLAR))
+			continue;
+		// rounded down: never slower than the target
+		_chan[ch].every = (unsigned)floor(maxHz / _chan[ch].targetHz + 1e-9);
+		if (_chan[ch].every < 1)
+			_chan[ch].every = 1;
+		if (_chan[ch].every > largest)
+			largest = _chan[ch].every;
+		_board->setChannelRate(ch, _chan[ch].adcRate);
+	}
+
+	// frame: least common multiple, or powers of two if that gets too long
+	for (ch=0; ch<VIMON_CHANNELS; ch++)
+		if (_chan[ch].every > 0 && frame <= VIMON_SCHED_MAX_ENTRIES)
+			frame = frame / gcd(frame, _chan[ch].every) * _chan[ch].every;
+	entries = 0;
+	for (ch=0; ch<VIMON_CHANNELS; ch++)
+		if (_chan[ch].every > 0 && frame <= VIMON_SCHED_MAX_ENTRIES)
+			entries += frame / _chan[ch].every;
+	if (frame > VIMON_SCHED_MAX_ENTRIES || entries > VIMON_SCHED_MAX_ENTRIES) {
+		for (frame=1; frame*2 <= largest; frame *= 2)
+			;
+		for (ch=0; ch<VIMON_CHANNELS; ch++) {
+			while (_chan[ch].every > 0 && frame % _chan[ch].every != 0)
+				_chan[ch].every--;
+		}
+	}
+	_frameNs = (uint64_t)frame * _baseNs;
+
+	measure();
+	// twice: the second pass starts on the input the frame ends with
+	if (!place(-1) && _count >= VIMON_SCHED_MAX_ENTRIES)
+		return false;
+	_feasible = place(_count > 0 ? _entries[_count - 1].channel : -1);
+
+	_built = true;
+	_pos = 0;
+	_frameStartNs = 0;
+	_resyncs = 0;
+	_jitter.reset();
+	return _feasible;
+}
+
+int VImonScheduler::step(VImonSample *sample) {
+	uint64_t now, due;
+	VIMON_TRACE_SPAN("schedule");
+
+	if (!_built || _count == 0)
+		return -1;
+	do {
+		Entry& e = _entries[_pos];
+		now = I2Cclock::now();
+		if (_frameStartNs == 0)
+			_frameStartNs = now - e.startNs;
+		due = _frameStartNs + e.startNs;
+		if (now > due + _frameNs) {
+			// more than a frame behind (stalled), restart the timing here
+			_frameStartNs = now - e.startNs;
+			due = now;
+			_resyncs++;
+		}
+		if (now < due) {
+			I2Cclock::sleepUntilNs(due);
+			now = I2Cclock::now();
+		}
+		_jitter.record(due, now);
+
+		_board->readChannel(e.channel);
+		now = I2Cclock::now();
+		Channel& c = _chan[e.channel];
+		if (c.conversions++ == 0)
+			c.firstNs = now;
+		c.lastNs = now;
+		if (now > _frameStartNs + e.deadlineNs)
+			c.late++;
+
+		if (++_pos >= _count) {
+			_pos = 0;
+			_frameStartNs += _frameNs;
+		}
+	} while (!_entries[_pos].lead);
+	return _board->makeSample(sample);
+}
+
+void VImonScheduler::report(FILE *f) {
+	int ch;
+
+	if (_baseNs == 0) {
+		fprintf(f, "schedule: no channel to convert\n");
+		return;
+	}
+	fprintf(f, "schedule: base period %.3f ms, frame %.3f ms, %u conversions, %u mux switches, utilization %.1f%%%s\n",
+		_baseNs / 1e6, _frameNs / 1e6, _count, _switches, 100.0 * _utilization,
+		_feasible ? "" : ", INFEASIBLE");
+	for (ch=0; ch<VIMON_CHANNELS; ch++) {
+		Channel& c = _chan[ch];
+		if (c.every == 0)
+			continue;
+		fprintf(f, "  ch%d: target %.3f Hz, scheduled %.3f Hz at %.0f SPS, conversion %.2f ms (%.2f ms after a mux switch)",
+			ch, c.targetHz, getScheduledRate(ch), 1e9 / ADS1115::getConversionNs(c.adcRate),
+			c.costNs[0] / 1e6, c.costNs[1] / 1e6);
+		if (c.conversions > 1)
+			fprintf(f, ", measured %.3f Hz, %llu late", getMeasuredRate(ch), (unsigned long long)c.late);
+		if (!c.feasible)
+			fprintf(f, ", misses its deadline by up to %.3f ms", c.lateNs / 1e6);
+		fprintf(f, "\n");
+	}
+	if (!_feasible && _utilization > 1.0)
+		fprintf(f, "  the conversions need %.1f%% of the ADC time\n", 100.0 * _utilization);
+	if (_resyncs > 0)
+		fprintf(f, "  %llu resyncs after stalls\n", (unsigned long long)_resyncs);
+	if (_jitter.getCount() > 0)
+		_jitter.report(f, "  start");
+}
@@ -0,0 +1,149 @@
+/*
+ VI monitoring board - multi-rate channel scheduler
+
+ The four channels share one multiplexed ADS1115. readRaw() converts
+ them all at the same rate, although the current is needed at hundreds of
+ samples per second, the battery voltage at a few Hz and the temperature
+ every few seconds.
+
+ VImonScheduler takes a target rate and an ADC data rate per channel and
+ builds a repeating conversion schedule (the frame):
+ - the fastest channel sets the base period, every other channel is
+   converted every k-th base period (k = base rate / target rate rounded
+   down, so no channel runs slower than asked for). The frame spans the
+   least common multiple of all k. When that would hold more than
+   VIMON_SCHED_MAX_ENTRIES conversions, every k is rounded down to a power
+   of two and the frame spans the largest
+ - the conversions of a frame are placed non-preemptively, earliest
+   deadline first, every conversion is due before the channel's next one
+   is released. Between conversions due at the same time the input the
+   mux is already on comes first, which saves mux switches
+ - the duration of a conversion, with and without a mux switch, is the
+   longest of VIMON_SCHED_PROBES measured on the board by build(), plus
+   VIMON_SCHED_MARGIN percent. After a switch it includes the conversions
+   discarded while the input settles (VImon::setSettleDiscard()). It is measured once per channel and data
+   rate, rebuilding with known settings does not touch the board.
+   A board which does not answer gets the nominal estimate of
+   VImon::getConversionCostNs()
+ - a conversion which would finish after its deadline makes the schedule
+   infeasible, build() returns false and report() names the channels
+
+ step() runs the frame in real time: it sleeps until the next conversion
+ is due, converts, and returns one sample per base period with the newest
+ value of every channel. Channels not converted in that period keep their
+ conversion timestamps (VImonSample.offsetUs), so VImonResampler
+ (vimon_resample.h) can turn the output into aligned samples.
+
+ Usage:
+	VImonScheduler sched(&vimon);
+	sched.setChannel(2, 250.0, ADS1115_RATE_860);	// current
+	sched.setChannel(0, 10.0, ADS1115_RATE_860);	// battery voltage
+	sched.setChannel(1, 0.2, ADS1115_RATE_128);		// PT100
+	if (!sched.build())
+		sched.report(stderr);
+	while (...)
+		sched.step(&sample);
+ */
+
+#ifndef _VIMON_SCHED_H_
+#define _VIMON_SCHED_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "vimon.h"
+#include "vimon_rt.h"
+
+#define VIMON_SCHED_MAX_ENTRIES	4096	// conversions per frame
+#define VIMON_SCHED_PROBES		3		// conversions timed per channel
+#define VIMON_SCHED_MARGIN		10		// added to the measured durations [%]
+
+class VImonScheduler {
+public:
+	VImonScheduler(VImon *board);
+
+/*
+ target rate [1/s] and data rate (ADS1115_RATE_xxx) of a channel
+ - rateHz <= 0 leaves the channel out of the schedule
+ - in the bipolar scan plan CH2 covers CH3, CH3 is ignored
+ */
+	void setChannel(int channel, double rateHz, uint8_t adcRate);
+
+/*
+ build the schedule from the channel settings
+ - sets the channel data rates on the board and times a few conversions
+   of every channel and data rate not timed before
+ - returns true if every channel meets its deadlines
+ */
+	bool build();
+
+	// measure the conversions again with the next build()
+	void clearCosts();
+
+	// schedule and, once running, measured rates and late conversions
+	void report(FILE *f);
+
+/*
+ run the schedule up to the end of the next base period
+ - returns the result of VImon::makeSample(), -1 if not built
+ */
+	int step(VImonSample *sample);
+
+	bool isFeasible() { return _feasible; }
+	bool isFeasible(int channel) { return _chan[channel & 3].feasible; }
+	double getTargetRate(int channel) { return _chan[channel & 3].targetHz; }
+	double getScheduledRate(int channel);
+	double getMeasuredRate(int channel);
+	uint64_t getLateCount(int channel) { return _chan[channel & 3].late; }
+	uint64_t getBaseNs() { return _baseNs; }
+	uint64_t getFrameNs() { return _frameNs; }
+	unsigned getEntryCount() { return _count; }
+	unsigned getSwitchCount() { return _switches; }
+	double getUtilization() { return _utilization; }
+	// lateness of the conversions against their start in the frame
+	VImonJitter& getJitter() { return _jitter; }
+
+private:
+	struct Entry {
+		uint64_t startNs;			// from the frame start
+		uint64_t deadlineNs;
+		uint8_t channel;
+		bool lead;					// first conversion of a base period
+	};
+
+	struct Channel {
+		double targetHz;
+		uint8_t adcRate;
+		unsigned every;				// base periods between conversions, 0 = off
+		bool feasible;
+		uint64_t lateNs;			// worst planned lateness
+		uint64_t costNs[2];			// conversion without / with mux switch
+		uint64_t conversions;		// at run time
+		uint64_t late;
+		uint64_t firstNs;
+		uint64_t lastNs;
+	};
+
+	bool place(int prev);
+	void measure();
+
+	VImon *_board;
+	Channel _chan[VIMON_CHANNELS];
+	uint64_t _cost[VIMON_CHANNELS][8][2];	// measured per data rate, 0 = unknown
+	Entry _entries[VIMON_SCHED_MAX_ENTRIES];	// in the object, nothing allocated by build()
+	unsigned _count;
+	unsigned _switches;
+	uint64_t _baseNs;
+	uint64_t _frameNs;
+	double _utilization;
+	bool _feasible;
+	bool _built;
+
+	// run time
+	unsigned _pos;
+	uint64_t _frameStartNs;
+	uint64_t _resyncs;
+	VImonJitter _jitter;
+};
+
+#endif /* _VIMON_SCHED_H_ */
@@ -0,0 +1,194 @@
+/*
+ VI monitoring board - live readings in shared memory
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vimon_shm.h"
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free &&
+	std::atomic<uint64_t>::is_always_lock_free, "shared atomics must be lock-free");
+
+VImonPublisher::VImonPublisher() {
+	_seg = NULL;
+}
+
+VImonPublisher::~VImonPublisher() {
+	close();
+}
+
+bool VImonPublisher::open(const char *name) {
+	void *map;
+	int fd, i;
+
+	if (_seg != NULL)
+		return true;
+	fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return false;
+	if (ftruncate(fd, sizeof(VImonShmSegment)) < 0) {
+		::close(fd);
+		return false;
+	}
+	map = mmap(NULL, sizeof(VImonShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED)
+		return false;
+	_seg = (VImonShmSegment *)map;
+
+	// a publisher which died in writeSlot() left its slot odd
+	_seg->latest.seq.fetch_and(~1U, std::memory_order_relaxed);
+	for (i=0; i<VIMON_SHM_HISTORY; i++)
+		_seg->ring[i].seq.fetch_and(~1U, std::memory_order_relaxed);
+	// a new run starts again at index 0, readers attached to the old one follow
+	_seg->published.store(0, std::memory_order_relaxed);
+	_seg->sampleSize = sizeof(VImonSample);
+	_seg->history = VIMON_SHM_HISTORY;
+	_seg->version = VIMON_SHM_VERSION;
+	_seg->pid.store(getpid(), std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	_seg->magic = VIMON_SHM_MAGIC;
+	return true;
+}
+
+void VImonPublisher::close() {
+	if (_seg == NULL)
+		return;
+	_seg->pid.store(0, std::memory_order_release);
+	munmap(_seg, sizeof(VImonShmSegment));
+	_seg = NULL;
+}
+
+// sequence lock write: odd, data, even, whatever the slot was left at
+static inline void writeSlot(VImonShmSlot& slot, uint64_t index, const VImonSample& sample) {
+	uint32_t seq = slot.seq.load(std::memory_order_relaxed) | 1;
+
+	slot.seq.store(seq, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.index = index;
+	memcpy(&slot.sample, &sample, sizeof(sample));
+	slot.seq.store(seq + 1, std::memory_order_release);
+}
+
+void VImonPublisher::publish(const VImonSample& sample) {
+	uint64_t index;
+
+	if (_seg == NULL)
+		return;
+	index = _seg->published.load(std::memory_order_relaxed);
+	writeSlot(_seg->ring[index & (VIMON_SHM_HISTORY - 1)], index, sample);
+	writeSlot(_seg->latest, index, sample);
+	_seg->published.store(index + 1, std::memory_order_release);
+}
+
+VImonSubscriber::VImonSubscriber() {
+	_seg = NULL;
+	_lost = 0;
+	_retries = 0;
+}
+
+VImonSubscriber::~VImonSubscriber() {
+	close();
+}
+
+bool VImonSubscriber::open(const char *name) {
+	const VImonShmSegment *seg;
+	struct stat st;
+	void *map;
+	int fd;
+
+	if (_seg != NULL)
+		return true;
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return false;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(VImonShmSegment)) {
+		::close(fd);
+		return false;
+	}
+	map = mmap(NULL, sizeof(VImonShmSegment), PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED)
+		return false;
+
+	seg = (const VImonShmSegment *)map;
+	if (seg->magic != VIMON_SHM_MAGIC || seg->version != VIMON_SHM_VERSION ||
+			seg->sampleSize != sizeof(VImonSample) || seg->history != VIMON_SHM_HISTORY) {
+		munmap(map, sizeof(VImonShmSegment));
+		return false;
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+	_seg = seg;
+	return true;
+}
+
+void VImonSubscriber::close() {
+	if (_seg == NULL)
+		return;
+	munmap((void *)_seg, sizeof(VImonShmSegment));
+	_seg = NULL;
+}
+
+/*
+ sequence lock read: retried while the writer is in the slot
+ */
+bool VImonSubscriber::copy(const VImonShmSlot& slot, VImonSample *sample, uint64_t *index) {
+	uint32_t seq;
+	int i;
+
+	for (i=0; i<VIMON_SHM_RETRIES; i++) {
+		seq = slot.seq.load(std::memory_order_acquire);
+		if ((seq & 1) == 0) {
+			*index = slot.index;
+			memcpy(sample, &slot.sample, sizeof(*sample));
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (slot.seq.load(std::memory_order_relaxed) == seq)
+				return true;
+		}
+		_retries++;
+	}
+	return false;
+}
+
+bool VImonSubscriber::latest(VImonSample *sample) {
+	uint64_t index;
+
+	if (_seg == NULL || _seg->published.load(std::memory_order_acquire) == 0)
+		return false;
+	return copy(_seg->latest, sample, &index);
+}
+
+int VImonSubscriber::read(uint64_t *cursor, VImonSample *out, int max) {
+	uint64_t published, index;
+	int n = 0;
+
+	if (_seg == NULL)
+		return 0;
+	published = _seg->published.load(std::memory_order_acquire);
+	// the publisher restarted
+	if (*cursor > published)
+		*cursor = 0;
+	while (n < max && *cursor < published) {
+		// fell behind, continue with the oldest sample kept
+		if (published - *cursor > VIMON_SHM_HISTORY) {
+			_lost += published - VIMON_SHM_HISTORY - *cursor;
+			*cursor = published - VIMON_SHM_HISTORY;
+		}
+		if (!copy(_seg->ring[*cursor & (VIMON_SHM_HISTORY - 1)], &out[n], &index))
+			break;
+		if (index != *cursor) {
+			// overwritten while we got here
+			published = _seg->published.load(std::memory_order_acquire);
+			if (index > *cursor)
+				continue;
+			break;
+		}
+		(*cursor)++;
+		n++;
+	}
+	return n;
+}
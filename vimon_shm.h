@@ -0,0 +1,131 @@
+/*
+ VI monitoring board - live readings in shared memory
+
+ The acquisition process publishes every sample into a POSIX shared
+ memory segment (shm_open, default VIMON_SHM_NAME): the latest snapshot
+ and a ring of the last VIMON_SHM_HISTORY samples. Any number of local
+ processes (UI, alarms, gateways) read it at their own rate, without bus
+ traffic and without a system call once the segment is mapped.
+
+ Each slot is guarded by a sequence lock: the writer makes the sequence
+ odd, copies the sample and makes it even again. It never waits, so a
+ reader can not slow down the acquisition. A reader copies the slot and
+ retries if the sequence was odd or changed meanwhile (a torn copy).
+ There must be one publisher per segment.
+
+ Ring slots also hold the index of their sample, a reader which fell
+ more than VIMON_SHM_HISTORY behind skips to the oldest sample kept and
+ counts the ones it lost. A publisher which restarts resets the index,
+ readers follow it.
+
+ Publisher:
+	VImonPublisher pub;
+	if (!pub.open())
+		...
+	pub.publish(sample);			// per sample, wait-free
+
+ Reader:
+	VImonSubscriber sub;
+	uint64_t cursor;
+	if (!sub.open())
+		...
+	cursor = sub.getPublished();	// from now on
+	sub.latest(&sample);			// newest sample
+	n = sub.read(&cursor, batch, 16);	// samples since the last call
+ */
+
+#ifndef _VIMON_SHM_H_
+#define _VIMON_SHM_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "vimon.h"
+
+#define VIMON_SHM_NAME		"/vimon"
+#define VIMON_SHM_MAGIC		0x564D4F4E	// "VMON"
+#define VIMON_SHM_VERSION	2
+#define VIMON_SHM_HISTORY	1024		// samples, power of 2
+#define VIMON_SHM_RETRIES	100			// torn copies before a read gives up
+
+struct VImonShmSlot {
+	std::atomic<uint32_t> seq;		// odd while written
+	uint64_t index;					// of the sample, from 0
+	VImonSample sample;
+};
+
+// layout of the segment, shared by all processes using it
+struct VImonShmSegment {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sampleSize;			// sizeof(VImonSample) of the publisher
+	uint32_t history;
+	std::atomic<int32_t> pid;		// of the publisher, 0 = stopped
+	alignas(64) std::atomic<uint64_t> published;	// samples so far
+	alignas(64) VImonShmSlot latest;
+	VImonShmSlot ring[VIMON_SHM_HISTORY];
+};
+
+class VImonPublisher {
+public:
+	VImonPublisher();
+	~VImonPublisher();
+
+/*
+ create (or take over) and map the segment
+ - returns false if it can not be created or mapped
+ */
+	bool open(const char *name = VIMON_SHM_NAME);
+	// marks the segment stopped and unmaps it, the readers keep it
+	void close();
+
+	// publish a sample, wait-free
+	void publish(const VImonSample& sample);
+
+	uint64_t getPublished() { return (_seg != NULL) ? _seg->published.load(std::memory_order_relaxed) : 0; }
+
+private:
+	VImonShmSegment *_seg;
+};
+
+class VImonSubscriber {
+public:
+	VImonSubscriber();
+	~VImonSubscriber();
+
+/*
+ map an existing segment read-only
+ - returns false if there is none or it has another layout
+ */
+	bool open(const char *name = VIMON_SHM_NAME);
+	void close();
+
+/*
+ copy the newest sample
+ - returns false if none was published yet or every copy was torn
+ */
+	bool latest(VImonSample *sample);
+
+/*
+ copy up to "max" samples from "*cursor" on and advance it
+ - samples overwritten before they were read are skipped and counted in
+   getLost()
+ - returns the number of samples copied
+ */
+	int read(uint64_t *cursor, VImonSample *out, int max);
+
+	bool isPublishing() { return _seg != NULL && _seg->pid.load(std::memory_order_relaxed) != 0; }
+	uint64_t getPublished() { return (_seg != NULL) ? _seg->published.load(std::memory_order_acquire) : 0; }
+	uint64_t getLost() { return _lost; }
+	uint64_t getRetries() { return _retries; }
+
+private:
+	bool copy(const VImonShmSlot& slot, VImonSample *sample, uint64_t *index);
+
+	const VImonShmSegment *_seg;
+	uint64_t _lost;
+	uint64_t _retries;
+};
+
+#endif /* _VIMON_SHM_H_ */
@@ -0,0 +1,230 @@
+/*
+ VI monitoring board - crash-safe checkpoints of the energy totals
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "I2Cclock.h"
+#include "vimon_store.h"
+
+#define STORE_MAGIC		0x534D4956		// "VIMS"
+#define STORE_VERSION	1
+
+struct StoreRecord {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t count;
+	uint64_t seq;
+	VImonEnergyTotals totals[VIMON_STORE_MAX_COUNT];
+	uint32_t crc;					// CRC-32 of all fields above
+};
+
+static_assert(sizeof(StoreRecord) <= VIMON_STORE_SLOT_SIZE, "record does not fit the slot");
+
+/*
+ CRC-32 (IEEE 802.3), bitwise: a record is checked a few times per hour
+ */
+static uint32_t crc32(const void *data, size_t len) {
+	const uint8_t *p = (const uint8_t *)data;
+	uint32_t crc = 0xFFFFFFFF;
+	int i;
+
+	while (len--) {
+		crc ^= *p++;
+		for (i=0; i<8; i++)
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+	}
+	return ~crc;
+}
+
+/*
+ newest valid record of the two slots
+ - returns false if there is none
+ */
+static bool readNewest(int fd, StoreRecord *best) {
+	StoreRecord rec;
+	bool found = false;
+	int slot;
+
+	for (slot=0; slot<2; slot++) {
+		if (pread(fd, &rec, sizeof(rec), (off_t)slot * VIMON_STORE_SLOT_SIZE) != (ssize_t)sizeof(rec))
+			continue;
+		if (rec.magic != STORE_MAGIC || rec.version != STORE_VERSION ||
+				rec.count > VIMON_STORE_MAX_COUNT ||
+				rec.crc != crc32(&rec, offsetof(StoreRecord, crc)))
+			continue;
+		if (!found || rec.seq > best->seq) {
+			*best = rec;
+			found = true;
+		}
+	}
+	return found;
+}
+
+VImonStore::VImonStore(const char *fileName) {
+	_fileName = fileName;
+	_fd = -1;
+	_seq = 0;
+	_count = 0;
+	_savedNs = 0;
+	_running = false;
+	_writes = 0;
+	_errors = 0;
+	setPolicy(VIMON_STORE_INTERVAL_MS, VIMON_STORE_DELTA_AH, VIMON_STORE_MAX_AGE_MS);
+}
+
+VImonStore::~VImonStore() {
+	stop();
+	if (_fd >= 0)
+		close(_fd);
+}
+
+void VImonStore::setPolicy(unsigned intervalMs, double deltaAh, unsigned maxAgeMs) {
+	_intervalMs = (intervalMs > 0) ? intervalMs : 1;
+	_deltaAh = deltaAh;
+	_maxAgeMs = maxAgeMs;
+}
+
+/*
+ open or create the file, a new file is made durable including its
+ directory entry. The sequence continues from the records in the file,
+ restored or not: a lower one would lose against them after a crash.
+ */
+bool VImonStore::open() {
+	StoreRecord rec;
+	char dir[256];
+	int dfd;
+	bool created;
+
+	if (_fd >= 0)
+		return true;
+	created = (access(_fileName, F_OK) != 0);
+	_fd = ::open(_fileName, O_RDWR | O_CREAT, 0644);
+	if (_fd < 0)
+		return false;
+	if (created) {
+		strncpy(dir, _fileName, sizeof(dir) - 1);
+		dir[sizeof(dir) - 1] = 0;
+		dfd = ::open(dirname(dir), O_RDONLY | O_DIRECTORY);
+		if (dfd >= 0) {
+			fsync(dfd);
+			close(dfd);
+		}
+	}
+	if (readNewest(_fd, &rec))
+		_seq = rec.seq;
+	return true;
+}
+
+int VImonStore::restore(VImonEnergyTotals *totals, int max) {
+	StoreRecord best;
+	int n;
+
+	if (!open() || !readNewest(_fd, &best))
+		return -1;
+
+	// continue the sequence, the next write goes to the other slot
+	_seq = best.seq;
+	n = (best.count < max) ? best.count : max;
+	memcpy(totals, best.totals, n * sizeof(VImonEnergyTotals));
+	return n;
+}
+
+int VImonStore::write(const VImonEnergyTotals *totals, int count) {
+	StoreRecord rec;
+
+	if (count < 0 || count > VIMON_STORE_MAX_COUNT || !open())
+		return -1;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.magic = STORE_MAGIC;
+	rec.version = STORE_VERSION;
+	rec.count = count;
+	rec.seq = _seq + 1;
+	memcpy(rec.totals, totals, count * sizeof(VImonEnergyTotals));
+	rec.crc = crc32(&rec, offsetof(StoreRecord, crc));
+
+	// slot of the older record, the newest stays intact until this one is durable
+	if (pwrite(_fd, &rec, sizeof(rec), (off_t)(rec.seq & 1) * VIMON_STORE_SLOT_SIZE) != (ssize_t)sizeof(rec) ||
+			fdatasync(_fd) != 0) {
+		_errors++;
+		return -1;
+	}
+	_seq = rec.seq;
+	_writes++;
+	return 0;
+}
+
+bool VImonStore::due(const VImonEnergyTotals *totals, uint64_t now, bool final) {
+	double delta = 0.0;
+	bool changed = false;
+	int i;
+
+	for (i=0; i<_count; i++) {
+		delta += (totals[i].chargeAh - _saved[i].chargeAh) + (totals[i].dischargeAh - _saved[i].dischargeAh);
+		if (totals[i].samples != _saved[i].samples || totals[i].rejected != _saved[i].rejected)
+			changed = true;
+	}
+	if (!changed)
+		return false;
+	if (final || delta >= _deltaAh)
+		return true;
+	return (now - _savedNs) >= (uint64_t)_maxAgeMs * 1000000ULL;
+}
+
+void VImonStore::run() {
+	VImonEnergyTotals totals[VIMON_STORE_MAX_COUNT];
+	std::unique_lock<std::mutex> lock(_mutex);
+	uint64_t now;
+	bool final;
+	int i;
+
+	do {
+		_wake.wait_for(lock, std::chrono::milliseconds(_intervalMs), [this] { return !_running; });
+		final = !_running;
+		for (i=0; i<_count; i++)
+			_energy[i]->get(&totals[i]);
+		now = I2Cclock::systemNs();
+		if (due(totals, now, final) && write(totals, _count) == 0) {
+			memcpy(_saved, totals, _count * sizeof(VImonEnergyTotals));
+			_savedNs = now;
+		}
+	} while (!final);
+}
+
+bool VImonStore::add(VImonEnergy *energy) {
+	if (_thread.joinable() || _count >= VIMON_STORE_MAX_COUNT)
+		return false;
+	_energy[_count++] = energy;
+	return true;
+}
+
+bool VImonStore::start() {
+	int i;
+
+	if (_thread.joinable() || _count < 1 || !open())
+		return false;
+	for (i=0; i<_count; i++)
+		_energy[i]->get(&_saved[i]);
+	_savedNs = I2Cclock::systemNs();
+	_running = true;
+	_thread = std::thread(&VImonStore::run, this);
+	return true;
+}
+
+void VImonStore::stop() {
+	if (!_thread.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_running = false;
+	}
+	_wake.notify_all();
+	_thread.join();
+}
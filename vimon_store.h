@@ -0,0 +1,107 @@
+/*
+ VI monitoring board - crash-safe checkpoints of the energy totals
+
+ The totals of up to VIMON_STORE_MAX_COUNT integrators (vimon_energy.h)
+ are kept in a small file holding two record slots (A/B). Each checkpoint
+ goes to the slot not holding the newest record, so a write torn by a
+ power loss can only damage the older copy. A record carries a sequence
+ number and a CRC-32, restore() picks the valid record with the highest
+ sequence number.
+
+ Checkpoints are written by a background thread which samples the totals
+ through VImonEnergy::get() and never blocks the acquisition thread.
+ Policy, checked every "intervalMs" (at most one write + fdatasync per
+ interval):
+ - the charge moved by at least "deltaAh" (sum over all integrators), or
+ - anything changed and the last checkpoint is older than "maxAgeMs"
+ stop() writes a final checkpoint if anything changed.
+
+ Usage:
+	VImonStore store("/var/lib/vimon/energy.dat");
+	VImonEnergyTotals t;
+	if (store.restore(&t, 1) == 1)
+		energy.set(t);				// before the acquisition starts
+	store.add(&energy);
+	store.start();
+	...
+	store.stop();
+ */
+
+#ifndef _VIMON_STORE_H_
+#define _VIMON_STORE_H_
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "vimon_energy.h"
+
+#define VIMON_STORE_MAX_COUNT		8		// integrators per record
+#define VIMON_STORE_SLOT_SIZE		1024	// bytes per A/B slot
+
+#define VIMON_STORE_INTERVAL_MS		60000	// default policy
+#define VIMON_STORE_DELTA_AH		0.01
+#define VIMON_STORE_MAX_AGE_MS		900000
+
+class VImonStore {
+public:
+	VImonStore(const char *fileName);
+	~VImonStore();
+
+/*
+ read the newest valid record
+ - returns the number of totals restored (<= max), -1 if no valid record
+ */
+	int restore(VImonEnergyTotals *totals, int max);
+
+/*
+ write a checkpoint now (caller's thread, includes fdatasync)
+ - returns 0 on success, -1 on failure
+ */
+	int write(const VImonEnergyTotals *totals, int count);
+
+	void setPolicy(unsigned intervalMs, double deltaAh, unsigned maxAgeMs);
+
+/*
+ checkpoint integrators from a background thread
+ - add() the integrators in the order used by restore(), then start()
+ - return false if the file can not be opened, the thread is running
+   or VIMON_STORE_MAX_COUNT is exceeded
+ */
+	bool add(VImonEnergy *energy);
+	bool start();
+	void stop();
+
+	uint64_t getWriteCount() { return _writes; }
+	uint64_t getErrorCount() { return _errors; }
+
+private:
+	bool open();
+	void run();
+	bool due(const VImonEnergyTotals *totals, uint64_t now, bool final);
+
+	const char *_fileName;
+	int _fd;
+	uint64_t _seq;
+
+	unsigned _intervalMs;
+	double _deltaAh;
+	unsigned _maxAgeMs;
+
+	VImonEnergy *_energy[VIMON_STORE_MAX_COUNT];
+	int _count;
+	VImonEnergyTotals _saved[VIMON_STORE_MAX_COUNT];
+	uint64_t _savedNs;
+
+	std::thread _thread;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	bool _running;
+
+	uint64_t _writes;
+	uint64_t _errors;
+};
+
+#endif /* _VIMON_STORE_H_ */
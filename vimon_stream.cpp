@@ -0,0 +1,482 @@
+/*
+ VI monitoring board - sample stream on a Unix domain socket
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "I2Cclock.h"
+#include "vimon_stream.h"
+
+#define RECORD_BASE		12			// timestamp, quality, error, reserved
+#define MAX_FRAME		(sizeof(VImonStreamHeader) + VIMON_STREAM_MAX_BATCH * (RECORD_BASE + 4 * VIMON_CHANNELS))
+
+static unsigned channelCount(uint8_t channels) {
+	unsigned n = 0;
+	for (; channels != 0; channels >>= 1)
+		n += channels & 1;
+	return n;
+}
+
+// value of a channel in the stream
+static float valueOf(const VImonSample& s, int channel) {
+	switch (channel) {
+		case 0: return s.v1_mv;
+		case 1: return s.v2_mv;
+		case 2: return s.i1_ma;
+		default: return s.i2_ma;
+	}
+}
+
+VImonStreamServer::VImonStreamServer() : _running(false), _wake(false),
+		_clientCount(0), _frames(0), _dropped(0), _disconnects(0) {
+	_path[0] = '\0';
+	_listenFd = -1;
+	_epollFd = -1;
+	_wakeFd = -1;
+	memset(_clients, 0, sizeof(_clients));
+	for (int i=0; i<VIMON_STREAM_MAX_CLIENTS; i++)
+		_clients[i].fd = -1;
+}
+
+VImonStreamServer::~VImonStreamServer() {
+	stop();
+}
+
+bool VImonStreamServer::start(const char *path) {
+	struct sockaddr_un addr;
+	struct epoll_event ev;
+	struct stat st;
+
+	if (_thread.joinable() || strlen(path) >= sizeof(addr.sun_path))
+		return false;
+	strcpy(_path, path);
+	// a socket left by a previous run, but never another kind of file
+	if (lstat(_path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(_path);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, _path);
+	_listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	_epollFd = epoll_create1(EPOLL_CLOEXEC);
+	_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (_listenFd < 0 || _epollFd < 0 || _wakeFd < 0 ||
+			bind(_listenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+			listen(_listenFd, VIMON_STREAM_MAX_CLIENTS) < 0) {
+		if (_listenFd >= 0)
+			close(_listenFd);
+		_listenFd = -1;
+		stop();
+		return false;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;				// the listening socket
+	epoll_ctl(_epollFd, EPOLL_CTL_ADD, _listenFd, &ev);
+	ev.data.ptr = &_wakeFd;
+	epoll_ctl(_epollFd, EPOLL_CTL_ADD, _wakeFd, &ev);
+
+	_running.store(true);
+	_thread = std::thread(&VImonStreamServer::run, this);
+	return true;
+}
+
+void VImonStreamServer::stop() {
+	uint64_t one = 1;
+	int i;
+
+	if (_thread.joinable()) {
+		_running.store(false);
+		if (::write(_wakeFd, &one, sizeof(one)) < 0)
+			;
+		_thread.join();
+	}
+	for (i=0; i<VIMON_STREAM_MAX_CLIENTS; i++)
+		if (_clients[i].fd >= 0)
+			drop(_clients[i]);
+	if (_listenFd >= 0) {
+		close(_listenFd);
+		unlink(_path);
+	}
+	if (_epollFd >= 0)
+		close(_epollFd);
+	if (_wakeFd >= 0)
+		close(_wakeFd);
+	_listenFd = _epollFd = _wakeFd = -1;
+}
+
+void VImonStreamServer::publish(const VImonSample& sample) {
+	uint64_t one = 1;
+
+	if (!_running.load(std::memory_order_relaxed))
+		return;
+	_backlog.push(sample);
+	// one wake-up until the I/O thread has drained the backlog
+	if (!_wake.exchange(true, std::memory_order_acq_rel))
+		if (::write(_wakeFd, &one, sizeof(one)) < 0)
+			;
+}
+
+void VImonStreamServer::run() {
+	struct epoll_event events[VIMON_STREAM_MAX_CLIENTS + 2];
+	VImonSample sample;
+	uint64_t count, now;
+	int n, i;
+
+	while (_running.load()) {
+		n = epoll_wait(_epollFd, events, VIMON_STREAM_MAX_CLIENTS + 2, VIMON_STREAM_FLUSH_MS);
+		for (i=0; i<n; i++) {
+			if (events[i].data.ptr == NULL) {
+				accept();
+			} else if (events[i].data.ptr == &_wakeFd) {
+				if (::read(_wakeFd, &count, sizeof(count)) < 0)
+					;
+			} else {
+				Client& c = *(Client *)events[i].data.ptr;
+				if (c.fd < 0)
+					continue;
+				if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+					drop(c);
+					continue;
+				}
+				if (events[i].events & EPOLLIN)
+					receive(c);
+				if (c.fd >= 0 && (events[i].events & EPOLLOUT))
+					flush(c);
+			}
+		}
+
+		// cleared first, a sample pushed meanwhile wakes us again
+		_wake.store(false, std::memory_order_release);
+		while (_backlog.pop(&sample))
+			for (i=0; i<VIMON_STREAM_MAX_CLIENTS; i++)
+				if (_clients[i].fd >= 0 && _clients[i].channels != 0)
+					add(_clients[i], sample);
+
+		// partial frames which waited long enough, stalled clients
+		now = I2Cclock::systemNs();
+		for (i=0; i<VIMON_STREAM_MAX_CLIENTS; i++) {
+			Client& c = _clients[i];
+			if (c.fd < 0)
+				continue;
+			if (c.count > 0 && now - c.frameNs >= VIMON_STREAM_FLUSH_MS * 1000000ULL)
+				finish(c);
+			// dropped by a failed write
+			if (c.fd < 0)
+				continue;
+			if (c.outLen > 0 && now - c.progressNs >= VIMON_STREAM_STALL_MS * 1000000ULL)
+				drop(c);
+		}
+	}
+}
+
+void VImonStreamServer::accept() {
+	struct epoll_event ev;
+	int fd, i;
+
+	while ((fd = accept4(_listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		for (i=0; i<VIMON_STREAM_MAX_CLIENTS && _clients[i].fd >= 0; i++)
+			;
+		if (i >= VIMON_STREAM_MAX_CLIENTS) {
+			close(fd);
+			continue;
+		}
+		Client& c = _clients[i];
+		memset(&c, 0, sizeof(c));
+		c.fd = fd;
+		c.frame = new uint8_t[MAX_FRAME];
+		c.out = new uint8_t[VIMON_STREAM_QUEUE];
+		c.progressNs = I2Cclock::systemNs();
+		ev.events = EPOLLIN;
+		ev.data.ptr = &c;
+		epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &ev);
+		_clientCount.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void VImonStreamServer::drop(Client& c) {
+	if (c.fd < 0)
+		return;
+	epoll_ctl(_epollFd, EPOLL_CTL_DEL, c.fd, NULL);
+	close(c.fd);
+	c.fd = -1;
+	delete[] c.frame;
+	delete[] c.out;
+	c.frame = c.out = NULL;
+	// nothing left to send or parse
+	c.channels = 0;
+	c.count = 0;
+	c.inLen = 0;
+	c.outLen = 0;
+	c.outPos = 0;
+	c.waiting = false;
+	_clientCount.fetch_sub(1, std::memory_order_relaxed);
+	_disconnects.fetch_add(1, std::memory_order_relaxed);
+}
+
+/*
+ read subscription requests, the newest one counts
+ */
+void VImonStreamServer::receive(Client& c) {
+	VImonStreamRequest req;
+	ssize_t len;
+
+	for (;;) {
+		len = ::read(c.fd, c.in + c.inLen, sizeof(c.in) - c.inLen);
+		if (len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR)) {
+			drop(c);
+			return;
+		}
+		if (len < 0)
+			return;
+		c.inLen += len;
+		if (c.inLen < sizeof(req))
+			continue;
+		memcpy(&req, c.in, sizeof(req));
+		c.inLen = 0;
+		if (req.magic != VIMON_STREAM_REQUEST_MAGIC) {
+			drop(c);
+			return;
+		}
+		// a frame of the old layout is finished first
+		if (c.count > 0) {
+			finish(c);
+			if (c.fd < 0)
+				return;
+		}
+		c.channels = req.channels & VIMON_ERR_ALL;
+		c.decimate = (req.decimate > 0) ? req.decimate : 1;
+		c.batch = (req.batch > 0) ? req.batch : 1;
+		if (c.batch > VIMON_STREAM_MAX_BATCH)
+			c.batch = VIMON_STREAM_MAX_BATCH;
+		c.shift = 0;
+		c.skip = 0;
+	}
+}
+
+/*
+ add a sample to the frame being filled, if the decimation takes it
+ */
+void VImonStreamServer::add(Client& c, const VImonSample& sample) {
+	unsigned decimate;
+	uint8_t *p;
+	int ch;
+
+	if (c.skip > 0) {
+		c.skip--;
+		return;
+	}
+	decimate = (unsigned)c.decimate << c.shift;
+	c.skip = ((decimate < VIMON_STREAM_MAX_DECIMATE) ? decimate : VIMON_STREAM_MAX_DECIMATE) - 1;
+
+	if (c.count == 0)
+		c.frameNs = I2Cclock::systemNs();
+	p = c.frame + sizeof(VImonStreamHeader) + c.count * (RECORD_BASE + 4 * channelCount(c.channels));
+	memcpy(p, &sample.timestamp, 8);
+	memcpy(p + 8, &sample.quality, 2);
+	p[10] = sample.error;
+	p[11] = 0;
+	p += RECORD_BASE;
+	for (ch=0; ch<VIMON_CHANNELS; ch++) {
+		if (c.channels & (1 << ch)) {
+			float v = valueOf(sample, ch);
+			memcpy(p, &v, 4);
+			p += 4;
+		}
+	}
+	if (++c.count >= c.batch)
+		finish(c);
+}
+
+/*
+ queue the frame, or drop it and slow the client down if it does not fit
+ */
+void VImonStreamServer::finish(Client& c) {
+	VImonStreamHeader h;
+	unsigned decimate, len;
+
+	len = sizeof(h) + c.count * (RECORD_BASE + 4 * channelCount(c.channels));
+	if (c.outLen + len > VIMON_STREAM_QUEUE) {
+		c.dropped += c.count;
+		_dropped.fetch_add(c.count, std::memory_order_relaxed);
+		if (((unsigned)c.decimate << c.shift) < VIMON_STREAM_MAX_DECIMATE)
+			c.shift++;
+		c.count = 0;
+		return;
+	}
+	decimate = (unsigned)c.decimate << c.shift;
+	h.magic = VIMON_STREAM_MAGIC;
+	h.count = (uint16_t)c.count;
+	h.channels = c.channels;
+	h.reserved = 0;
+	h.decimate = (uint16_t)((decimate < VIMON_STREAM_MAX_DECIMATE) ? decimate : VIMON_STREAM_MAX_DECIMATE);
+	h.reserved2 = 0;
+	h.dropped = c.dropped;
+	memcpy(c.frame, &h, sizeof(h));
+
+	// compact the queue before appending
+	if (c.outPos > 0) {
+		memmove(c.out, c.out + c.outPos, c.outLen);
+		c.outPos = 0;
+	}
+	memcpy(c.out + c.outLen, c.frame, len);
+	c.outLen += len;
+	c.dropped = 0;
+	c.count = 0;
+	_frames.fetch_add(1, std::memory_order_relaxed);
+	flush(c);
+}
+
+/*
+ write as much of the queue as the socket takes
+ */
+void VImonStreamServer::flush(Client& c) {
+	ssize_t len;
+
+	while (c.outLen > 0) {
+		len = send(c.fd, c.out + c.outPos, c.outLen, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			drop(c);
+			return;
+		}
+		c.outPos += len;
+		c.outLen -= len;
+		c.progressNs = I2Cclock::systemNs();
+	}
+	if (c.outLen == 0) {
+		c.outPos = 0;
+		c.progressNs = I2Cclock::systemNs();
+		// caught up, back towards the decimation asked for
+		if (c.shift > 0)
+			c.shift--;
+	}
+	wait(c, c.outLen > 0);
+}
+
+void VImonStreamServer::wait(Client& c, bool out) {
+	struct epoll_event ev;
+
+	if (c.waiting == out)
+		return;
+	ev.events = EPOLLIN | (out ? EPOLLOUT : 0);
+	ev.data.ptr = &c;
+	epoll_ctl(_epollFd, EPOLL_CTL_MOD, c.fd, &ev);
+	c.waiting = out;
+}
+
+VImonStreamClient::VImonStreamClient() {
+	_fd = -1;
+	memset(&_header, 0, sizeof(_header));
+	_next = 0;
+	_dropped = 0;
+	_decimate = 0;
+}
+
+VImonStreamClient::~VImonStreamClient() {
+	close();
+}
+
+bool VImonStreamClient::connect(const char *path) {
+	struct sockaddr_un addr;
+
+	if (_fd >= 0 || strlen(path) >= sizeof(addr.sun_path))
+		return false;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (_fd < 0)
+		return false;
+	if (::connect(_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void VImonStreamClient::close() {
+	if (_fd >= 0)
+		::close(_fd);
+	_fd = -1;
+	_header.count = 0;
+	_next = 0;
+}
+
+bool VImonStreamClient::subscribe(uint8_t channels, uint16_t decimate, uint16_t batch) {
+	VImonStreamRequest req;
+
+	memset(&req, 0, sizeof(req));
+	req.magic = VIMON_STREAM_REQUEST_MAGIC;
+	req.channels = channels;
+	req.decimate = decimate;
+	req.batch = batch;
+	return _fd >= 0 && send(_fd, &req, sizeof(req), MSG_NOSIGNAL) == sizeof(req);
+}
+
+bool VImonStreamClient::readAll(void *buf, size_t len) {
+	uint8_t *p = (uint8_t *)buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = ::read(_fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+int VImonStreamClient::receive(VImonStreamRecord *out, int max) {
+	unsigned size;
+	uint8_t *p;
+	int n = 0, ch;
+
+	if (_fd < 0)
+		return -1;
+	if (_next >= _header.count) {
+		if (!readAll(&_header, sizeof(_header)) || _header.magic != VIMON_STREAM_MAGIC ||
+				_header.count > VIMON_STREAM_MAX_BATCH) {
+			close();
+			return -1;
+		}
+		_dropped += _header.dropped;
+		_decimate = _header.decimate;
+		if (!readAll(_frame, _header.count * (RECORD_BASE + 4 * channelCount(_header.channels)))) {
+			close();
+			return -1;
+		}
+		_next = 0;
+	}
+
+	size = RECORD_BASE + 4 * channelCount(_header.channels);
+	for (; n < max && _next < _header.count; n++, _next++) {
+		p = _frame + _next * size;
+		memcpy(&out[n].timestamp, p, 8);
+		memcpy(&out[n].quality, p + 8, 2);
+		out[n].error = p[10];
+		p += RECORD_BASE;
+		for (ch=0; ch<VIMON_CHANNELS; ch++) {
+			out[n].value[ch] = 0.0f;
+			if (_header.channels & (1 << ch)) {
+				memcpy(&out[n].value[ch], p, 4);
+				p += 4;
+			}
+		}
+	}
+	return n;
+}
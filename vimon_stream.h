@@ -0,0 +1,191 @@
+/*
+ VI monitoring board - sample stream on a Unix domain socket
+
+ VImonStreamServer pushes the samples of the acquisition to local clients
+ as binary frames. A client connects to the socket (default
+ VIMON_STREAM_PATH) and sends a VImonStreamRequest: the channels it wants,
+ a decimation factor (every n-th sample) and the samples per frame. It
+ may send a new request at any time.
+
+ The acquisition thread only hands the sample to a queue (VImonRing) and
+ wakes the I/O thread, it never waits for a client. The I/O thread
+ (epoll) builds the frames and writes them without blocking. Every client
+ has its own output queue of VIMON_STREAM_QUEUE bytes; a slow client:
+ - loses the frame which does not fit, the loss is reported in its next
+   frame, and its decimation doubles (up to VIMON_STREAM_MAX_DECIMATE)
+ - gets back to its own decimation step by step once its queue is empty
+ - is disconnected when it has taken nothing for VIMON_STREAM_STALL_MS
+ A partial frame is sent after VIMON_STREAM_FLUSH_MS.
+
+ Frame, in host byte order (the socket is local):
+	VImonStreamHeader
+	"count" records of
+		uint64_t timestamp		// wall clock [ns since epoch]
+		uint16_t quality		// VImonSample.quality
+		uint8_t error			// VImonSample.error
+		uint8_t reserved
+		float value[]			// per channel in "channels", lowest first:
+								// v1_mv, v2_mv, i1_ma, i2_ma
+
+ VImonStreamClient decodes the frames into VImonStreamRecord.
+
+ Usage:
+	VImonStreamServer server;
+	server.start();
+	...
+	server.publish(sample);			// acquisition thread, never blocks
+
+	VImonStreamClient client;
+	client.connect();
+	client.subscribe(VIMON_ERR_CH0 | VIMON_ERR_CH2, 10, 32);
+	n = client.receive(records, 32);
+ */
+
+#ifndef _VIMON_STREAM_H_
+#define _VIMON_STREAM_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <thread>
+
+#include "vimon.h"
+#include "vimon_ring.h"
+
+#define VIMON_STREAM_PATH			"/tmp/vimon.sock"
+#define VIMON_STREAM_MAGIC			0x52545356	// "VSTR", frame
+#define VIMON_STREAM_REQUEST_MAGIC	0x42555356	// "VSUB", request
+#define VIMON_STREAM_MAX_CLIENTS	16
+#define VIMON_STREAM_MAX_BATCH		256		// samples per frame
+#define VIMON_STREAM_MAX_DECIMATE	1024
+#define VIMON_STREAM_QUEUE			65536	// bytes queued per client
+#define VIMON_STREAM_BACKLOG		256		// samples waiting for the I/O thread, power of 2
+#define VIMON_STREAM_FLUSH_MS		100
+#define VIMON_STREAM_STALL_MS		5000
+
+struct VImonStreamRequest {
+	uint32_t magic;					// VIMON_STREAM_REQUEST_MAGIC
+	uint8_t channels;				// mask, 1 << channel
+	uint8_t reserved;
+	uint16_t decimate;				// every n-th sample, 0 = 1
+	uint16_t batch;					// samples per frame, 0 = 1
+	uint16_t reserved2;
+};
+
+struct VImonStreamHeader {
+	uint32_t magic;					// VIMON_STREAM_MAGIC
+	uint16_t count;					// records
+	uint8_t channels;				// values per record
+	uint8_t reserved;
+	uint16_t decimate;				// in effect, more than asked when too slow
+	uint16_t reserved2;
+	uint32_t dropped;				// samples lost since the previous frame
+};
+
+struct VImonStreamRecord {
+	uint64_t timestamp;
+	uint16_t quality;
+	uint8_t error;
+	float value[VIMON_CHANNELS];	// channels not subscribed are 0
+};
+
+class VImonStreamServer {
+public:
+	VImonStreamServer();
+	~VImonStreamServer();
+
+/*
+ create the socket (a stale one is replaced) and start the I/O thread
+ - returns false if the socket can not be created
+ */
+	bool start(const char *path = VIMON_STREAM_PATH);
+	void stop();
+
+	// hand a sample to the clients, wait-free
+	void publish(const VImonSample& sample);
+
+	// statistics, safe to read from any thread
+	unsigned getClientCount() { return _clientCount.load(std::memory_order_relaxed); }
+	uint64_t getFrameCount() { return _frames.load(std::memory_order_relaxed); }
+	uint64_t getDroppedCount() { return _dropped.load(std::memory_order_relaxed); }
+	uint64_t getDisconnectCount() { return _disconnects.load(std::memory_order_relaxed); }
+	uint64_t getBacklogDrops() { return _backlog.drops(); }
+
+private:
+	struct Client {
+		int fd;
+		uint8_t channels;
+		uint16_t decimate;			// asked for
+		unsigned shift;				// doublings for backpressure
+		unsigned skip;				// samples until the next one is taken
+		unsigned batch;
+		uint8_t in[sizeof(VImonStreamRequest)];
+		unsigned inLen;
+		uint8_t *frame;				// frame being filled
+		unsigned count;
+		uint64_t frameNs;			// first record of the frame
+		uint32_t dropped;
+		uint8_t *out;				// queued bytes
+		unsigned outPos;
+		unsigned outLen;
+		bool waiting;				// EPOLLOUT armed
+		uint64_t progressNs;		// last write or empty queue
+	};
+
+	void run();
+	void accept();
+	void drop(Client& c);
+	void receive(Client& c);
+	void add(Client& c, const VImonSample& sample);
+	void finish(Client& c);
+	void flush(Client& c);
+	void wait(Client& c, bool out);
+
+	char _path[108];
+	int _listenFd;
+	int _epollFd;
+	int _wakeFd;
+	std::thread _thread;
+	std::atomic<bool> _running;
+	std::atomic<bool> _wake;
+	VImonRing<VImonSample, VIMON_STREAM_BACKLOG> _backlog;
+	Client _clients[VIMON_STREAM_MAX_CLIENTS];
+
+	std::atomic<unsigned> _clientCount;
+	std::atomic<uint64_t> _frames;
+	std::atomic<uint64_t> _dropped;
+	std::atomic<uint64_t> _disconnects;
+};
+
+class VImonStreamClient {
+public:
+	VImonStreamClient();
+	~VImonStreamClient();
+
+	bool connect(const char *path = VIMON_STREAM_PATH);
+	void close();
+	bool subscribe(uint8_t channels, uint16_t decimate, uint16_t batch);
+
+/*
+ wait for samples, the records of a frame larger than "max" are kept for
+ the next call
+ - returns the number of records, -1 when the connection is closed
+ */
+	int receive(VImonStreamRecord *out, int max);
+
+	int getFd() { return _fd; }
+	uint64_t getDropped() { return _dropped; }
+	uint16_t getDecimate() { return _decimate; }
+
+private:
+	bool readAll(void *buf, size_t len);
+
+	int _fd;
+	uint8_t _frame[VIMON_STREAM_MAX_BATCH * (16 + 4 * VIMON_CHANNELS)];
+	VImonStreamHeader _header;
+	unsigned _next;					// record of _frame to return next
+	uint64_t _dropped;
+	uint16_t _decimate;
+};
+
+#endif /* _VIMON_STREAM_H_ */
@@ -0,0 +1,148 @@
+/*
+ VI monitoring board - acquisition timeline tracing
+ */
+
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <mutex>
+
+#include "vimon_trace.h"
+
+struct TraceEvent {
+	const char *name;
+	uint64_t start;
+	uint64_t end;
+};
+
+/*
+ ring of one thread, only the owning thread writes
+ rings are never freed, a thread which exits leaves its spans behind
+ */
+struct TraceRing {
+	TraceRing *next;
+	int tid;
+	char threadName[32];
+	std::atomic<uint64_t> head;		// total number of spans recorded
+	TraceEvent events[VIMON_TRACE_RING_SIZE];
+};
+
+volatile bool VImonTrace::_enabled = false;
+
+static std::atomic<TraceRing *> rings(NULL);
+static std::mutex ringsMutex;
+static int nextTid = 1;
+static thread_local TraceRing *threadRing = NULL;
+
+static const char *signalFile = NULL;
+static volatile sig_atomic_t writeRequest = 0;
+
+static TraceRing *getRing() {
+	TraceRing *r = threadRing;
+	if (r != NULL)
+		return r;
+	r = new TraceRing();
+	{
+		std::lock_guard<std::mutex> lock(ringsMutex);
+		r->tid = nextTid++;
+		snprintf(r->threadName, sizeof(r->threadName), "thread %d", r->tid);
+		r->next = rings.load();
+		rings.store(r, std::memory_order_release);
+	}
+	threadRing = r;
+	return r;
+}
+
+void VImonTrace::enable(bool on) {
+	_enabled = on;
+}
+
+void VImonTrace::setThreadName(const char *name) {
+	TraceRing *r = getRing();
+	strncpy(r->threadName, name, sizeof(r->threadName) - 1);
+	r->threadName[sizeof(r->threadName) - 1] = 0;
+}
+
+uint64_t VImonTrace::now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void VImonTrace::record(const char *name, uint64_t startNs, uint64_t endNs) {
+	TraceRing *r = getRing();
+	uint64_t head = r->head.load(std::memory_order_relaxed);
+	TraceEvent *e = &r->events[head & (VIMON_TRACE_RING_SIZE - 1)];
+
+	e->name = name;
+	e->start = startNs;
+	e->end = endNs;
+	r->head.store(head + 1, std::memory_order_release);
+}
+
+void VImonTrace::clear() {
+	TraceRing *r;
+	for (r = rings.load(std::memory_order_acquire); r != NULL; r = r->next)
+		r->head.store(0, std::memory_order_release);
+}
+
+int VImonTrace::write(FILE *f) {
+	TraceRing *r;
+	TraceEvent *e;
+	uint64_t head, i, first;
+	bool comma = false;
+
+	fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	for (r = rings.load(std::memory_order_acquire); r != NULL; r = r->next) {
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			comma ? ",\n" : "", (int)getpid(), r->tid, r->threadName);
+		comma = true;
+		head = r->head.load(std::memory_order_acquire);
+		first = (head > VIMON_TRACE_RING_SIZE) ? head - VIMON_TRACE_RING_SIZE : 0;
+		for (i = first; i < head; i++) {
+			e = &r->events[i & (VIMON_TRACE_RING_SIZE - 1)];
+			// complete event, timestamps in us
+			fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+				e->name, (int)getpid(), r->tid, e->start / 1000.0, (e->end - e->start) / 1000.0);
+		}
+	}
+	fprintf(f, "\n]}\n");
+	return ferror(f) ? -1 : 0;
+}
+
+int VImonTrace::write(const char *fileName) {
+	FILE *f = fopen(fileName, "w");
+	int ret;
+	if (f == NULL)
+		return -1;
+	ret = write(f);
+	if (fclose(f) != 0)
+		ret = -1;
+	return ret;
+}
+
+static void sigusr2Handler(int sig) {
+	writeRequest = 1;
+}
+
+void VImonTrace::installSignalHandler(const char *fileName) {
+	struct sigaction sa;
+	signalFile = fileName;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sigusr2Handler;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGUSR2, &sa, NULL);
+}
+
+bool VImonTrace::pollSignal() {
+	if (!writeRequest)
+		return false;
+	writeRequest = 0;
+	if (signalFile != NULL)
+		write(signalFile);
+	return true;
+}
@@ -0,0 +1,90 @@
+/*
+ VI monitoring board - acquisition timeline tracing
+
+ Records timed spans (mux switch, settle delay, conversion trigger, each
+ busy poll, conversion read, unit conversion, formatting, output) into a
+ per-thread ring buffer and exports them as Chrome trace-event JSON, which
+ can be opened in chrome://tracing or https://ui.perfetto.dev
+
+ Tracing is compiled in with -DVIMON_TRACE ("make TRACE=1"). Without it
+ VIMON_TRACE_SPAN() expands to nothing. When compiled in, recording is
+ switched on at run time with VImonTrace::enable(), a span then costs two
+ clock reads and one store into the ring.
+
+ Usage:
+	void foo() {
+		VIMON_TRACE_SPAN("foo");	// span ends when leaving the scope
+		...
+	}
+
+ Span names must be string literals (only the pointer is stored).
+ */
+
+#ifndef _VIMON_TRACE_H_
+#define _VIMON_TRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define VIMON_TRACE_RING_SIZE	65536		// spans per thread, power of 2
+
+class VImonTrace {
+public:
+	static void enable(bool on);
+	static bool enabled() { return _enabled; }
+
+	// name shown for the calling thread in the trace viewer
+	static void setThreadName(const char *name);
+
+	static uint64_t now();
+	static void record(const char *name, uint64_t startNs, uint64_t endNs);
+
+/*
+ write all recorded spans as Chrome trace-event JSON
+ - spans recorded concurrently with the export may be torn, stop the
+   acquisition or disable tracing first for an exact trace
+ - returns 0 on success, -1 if the file could not be written
+ */
+	static int write(FILE *f);
+	static int write(const char *fileName);
+
+	// discard all recorded spans
+	static void clear();
+
+/*
+ write the trace to "fileName" on SIGUSR2
+ - the handler only raises a flag, the file is written by the next call
+   to pollSignal() from the application's main loop
+ */
+	static void installSignalHandler(const char *fileName);
+	static bool pollSignal();
+
+private:
+	static volatile bool _enabled;
+};
+
+#ifdef VIMON_TRACE
+
+class VImonTraceSpan {
+public:
+	VImonTraceSpan(const char *name) : _name(name), _start(VImonTrace::enabled() ? VImonTrace::now() : 0) {}
+	~VImonTraceSpan() {
+		if (_start != 0)
+			VImonTrace::record(_name, _start, VImonTrace::now());
+	}
+private:
+	const char *_name;
+	uint64_t _start;
+};
+
+#define VIMON_TRACE_CONCAT2(a, b)	a##b
+#define VIMON_TRACE_CONCAT(a, b)	VIMON_TRACE_CONCAT2(a, b)
+#define VIMON_TRACE_SPAN(name)		VImonTraceSpan VIMON_TRACE_CONCAT(_traceSpan, __LINE__)(name)
+
+#else
+
+#define VIMON_TRACE_SPAN(name)		do {} while (0)
+
+#endif /* VIMON_TRACE */
+
+#endif /* _VIMON_TRACE_H_ */
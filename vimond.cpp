@@ -0,0 +1,728 @@
+/*
+ VI monitoring board - acquisition daemon
+
+ Runs the boards declared in a configuration file (vimon_config.h,
+ default VIMON_CONFIG_PATH) until it is told to stop. Boards on the same
+ I2C bus share one acquisition thread, which reads, checks (quality,
+ alignment, energy, deadband) and hands the samples to the sinks of the
+ board: output file, shared memory, socket stream, Modbus/TCP and the
+ energy checkpoint file. Output lines are formatted and written by an
+ output thread, an acquisition thread does no file I/O.
+
+ Buses, boards and their filters are built at startup in one block sized
+ from the configuration (vimon_arena.h), an acquisition thread does not
+ allocate once it runs.
+
+ A bus whose boards give "realtime" or "cpus" runs its thread under
+ SCHED_FIFO on those CPUs with its stack prefaulted, and the memory of the
+ daemon is locked (vimon_rt.h). The locks it shares with the other
+ threads inherit its priority. The lateness of the scans against their
+ schedule is part of the SIGUSR1 status.
+
+ Signals:
+ - SIGTERM, SIGINT: graceful shutdown. The threads finish the sample in
+   progress, the outputs are flushed, the energy totals checkpointed and
+   the ADCs left in power-down
+ - SIGHUP: read the configuration again and apply the calibration,
+   filters and sinks of every board while the acquisition keeps running.
+   The output files are reopened (log rotation), sinks whose settings did
+   not change are kept. Changed acquisition settings (bus, address, scan
+   plan, rates) and added or removed boards need a restart
+ - SIGUSR1: I2C statistics, energy totals, scan lateness and output drops
+   on stderr
+
+ Usage:
+	vimond [-cFILE] [-t] [-h]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "I2CdevPi.h"
+#include "I2Cclock.h"
+#include "I2Cstats.h"
+#include "ADS1115.h"
+
+#include "vimon.h"
+#include "vimon_arena.h"
+#include "vimon_config.h"
+#include "vimon_deadband.h"
+#include "vimon_energy.h"
+#include "vimon_fmt.h"
+#include "vimon_modbus.h"
+#include "vimon_quality.h"
+#include "vimon_resample.h"
+#include "vimon_ring.h"
+#include "vimon_rt.h"
+#include "vimon_sched.h"
+#include "vimon_shm.h"
+#include "vimon_store.h"
+#include "vimon_stream.h"
+
+using namespace std;
+
+#define DAEMON_MAX_BUSES	VIMON_CONFIG_MAX_BOARDS
+#define DAEMON_ALIGNED		(VIMON_CONFIG_GRID_POINTS + 1)	// aligned samples per sample, one to catch up
+#define DAEMON_OUTPUT_RING	1024	// samples per board waiting for the output thread
+#define DAEMON_OUTPUT_MS	100		// output thread period
+
+// everything a reload replaces, owned by the board
+struct Sinks {
+	VImonBoardConfig config;
+	VImonDeadband *deadband;
+	VImonFormatter fmt;
+	int fd;
+	VImonWriter *out;
+	VImonPublisher *shm;
+	VImonStreamServer *stream;
+	VImonModbusServer *modbus;
+	VImonStore *store;
+};
+
+struct Board {
+	VImonBoardConfig config;
+	VImon vimon;
+	VImonQuality quality;
+	VImonEnergy energy;
+	VImonResampler *resampler;
+	VImonScheduler *scheduler;
+	// held by the acquisition thread to process a sample, by a reload to
+	// swap; priority inheritance, a real-time thread may wait for it
+	VImonMutex lock;
+	Sinks *sinks;
+	VImonCalibration cal;			// of a reload, applied by the acquisition thread
+	bool calChanged;
+	uint64_t dueNs;					// next sample [monotonic ns]
+	// samples for the output file, written out with outLock held
+	VImonRing<VImonSample, DAEMON_OUTPUT_RING> output;
+	std::mutex outLock;
+};
+
+struct Bus {
+	int number;
+	I2CbusPi *i2c;
+	Board *boards[VIMON_CONFIG_MAX_BOARDS];
+	int count;
+	int realtime;					// SCHED_FIFO priority, 0 = off
+	std::string cpus;
+	VImonJitter jitter;				// scans against their interval
+	std::thread thread;
+};
+
+static string execName;
+static string configFile = VIMON_CONFIG_PATH;
+static bool checkOnly = false;
+
+static Board *boards[VIMON_CONFIG_MAX_BOARDS];
+static int numBoards = 0;
+static Bus buses[DAEMON_MAX_BUSES];
+static VImonArena arena;			// boards and their filters
+static int numBuses = 0;
+
+static std::thread outputThread;
+
+static std::atomic<bool> stopping(false);
+static VImonMutex stopMutex;		// shared with real-time threads
+static VImonCondition stopCv;
+
+// sleep until "deadlineNs" [monotonic] or the shutdown
+static void waitStop(uint64_t deadlineNs) {
+	std::lock_guard<VImonMutex> lock(stopMutex);
+
+	while (!stopping.load() && I2Cclock::systemNs() < deadlineNs)
+		stopCv.waitUntil(stopMutex, deadlineNs);
+}
+
+static void closeSinks(Sinks *s) {
+	if (s == NULL)
+		return;
+	if (s->out != NULL)
+		delete s->out;				// flushes
+	if (s->fd > STDERR_FILENO)
+		close(s->fd);
+	if (s->store != NULL)
+		delete s->store;			// final checkpoint
+	if (s->stream != NULL)
+		delete s->stream;
+	if (s->modbus != NULL)
+		delete s->modbus;
+	if (s->shm != NULL)
+		delete s->shm;
+	if (s->deadband != NULL)
+		delete s->deadband;
+	delete s;
+}
+
+/*
+ sinks of a board as configured, taking over the ones of "old" whose
+ settings did not change. The output file is always reopened.
+ - restore: continue the totals from the energy file (start only)
+ - returns NULL if a sink can not be opened, "old" is left as it was
+ */
+static Sinks *openSinks(Board& b, const VImonBoardConfig& c, Sinks *old, bool restore) {
+	Sinks *s = new Sinks();
+	VImonEnergyTotals totals;
+	const char *name = c.name.c_str();
+	int i;
+
+	s->config = c;
+	s->deadband = NULL;
+	s->fd = -1;
+	s->out = NULL;
+	s->shm = NULL;
+	s->stream = NULL;
+	s->modbus = NULL;
+	s->store = NULL;
+
+	if (c.deadband) {
+		s->deadband = new VImonDeadband(&b.vimon);
+		for (i=0; i<VIMON_CHANNELS; i++)
+			s->deadband->setDeadband(i, c.deadbandAbs[i], c.deadbandPct[i]);
+		s->deadband->setHeartbeat(c.heartbeatMs);
+	}
+
+	if (!c.output.empty()) {
+		s->fd = (c.output == "-") ? STDOUT_FILENO :
+			open(c.output.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		if (s->fd < 0) {
+			fprintf(stderr, "%s: unable to open output %s: %s\n", name, c.output.c_str(), strerror(errno));
+			goto fail;
+		}
+		s->out = new VImonWriter(s->fd);
+		s->fmt.setFormat(c.format);
+		// a new CSV file gets the column header
+		if (s->fmt.header() > 0 && (s->fd == STDOUT_FILENO || lseek(s->fd, 0, SEEK_END) == 0))
+			s->out->write(s->fmt);
+	}
+
+	if (old != NULL && old->shm != NULL && old->config.shm == c.shm) {
+		s->shm = old->shm;
+	} else if (!c.shm.empty()) {
+		s->shm = new VImonPublisher();
+		if (!s->shm->open(c.shm.c_str())) {
+			fprintf(stderr, "%s: unable to create shared memory %s\n", name, c.shm.c_str());
+			goto fail;
+		}
+	}
+
+	if (old != NULL && old->stream != NULL && old->config.socket == c.socket) {
+		s->stream = old->stream;
+	} else if (!c.socket.empty()) {
+		s->stream = new VImonStreamServer();
+		if (!s->stream->start(c.socket.c_str())) {
+			fprintf(stderr, "%s: unable to create socket %s\n", name, c.socket.c_str());
+			goto fail;
+		}
+	}
+
+	if (old != NULL && old->modbus != NULL && old->config.modbus == c.modbus) {
+		s->modbus = old->modbus;
+	} else if (c.modbus != 0) {
+		s->modbus = new VImonModbusServer();
+		s->modbus->setEnergy(&b.energy);
+		if (!s->modbus->start(c.modbus)) {
+			fprintf(stderr, "%s: unable to listen on Modbus port %u\n", name, c.modbus);
+			goto fail;
+		}
+	}
+
+	if (old != NULL && old->store != NULL && old->config.energy == c.energy) {
+		s->store = old->store;
+	} else if (!c.energy.empty()) {
+		s->store = new VImonStore(c.energy.c_str());
+		if (restore && s->store->restore(&totals, 1) == 1)
+			b.energy.set(totals);
+		s->store->add(&b.energy);
+		if (!s->store->start()) {
+			fprintf(stderr, "%s: unable to open energy file %s\n", name, c.energy.c_str());
+			goto fail;
+		}
+	}
+
+	// taken over, not closed with the old sinks
+	if (old != NULL) {
+		if (old->shm == s->shm) old->shm = NULL;
+		if (old->stream == s->stream) old->stream = NULL;
+		if (old->modbus == s->modbus) old->modbus = NULL;
+		if (old->store == s->store) old->store = NULL;
+	}
+	return s;
+
+fail:
+	if (old != NULL) {
+		if (old->shm == s->shm) s->shm = NULL;
+		if (old->stream == s->stream) s->stream = NULL;
+		if (old->modbus == s->modbus) s->modbus = NULL;
+		if (old->store == s->store) s->store = NULL;
+	}
+	closeSinks(s);
+	return NULL;
+}
+
+/*
+ quality, alignment, energy, deadband and sinks of one sample, with the
+ board lock held
+ */
+static void process(Board& b, VImonSample& sample) {
+	VImonSample aligned[DAEMON_ALIGNED], *batch;
+	Sinks *s = b.sinks;
+	int count, i;
+
+	// from the next sample on, the board is read without the lock
+	if (b.calChanged) {
+		b.vimon.setCalibration(b.cal);
+		b.calChanged = false;
+	}
+	b.quality.check(&sample);
+	if (b.resampler != NULL) {
+		count = b.resampler->push(sample, aligned, DAEMON_ALIGNED);
+		batch = aligned;
+	} else {
+		count = 1;
+		batch = &sample;
+	}
+	for (i=0; i<count; i++) {
+		b.energy.add(batch[i]);
+		if (s->deadband != NULL && s->deadband->check(batch[i]) == 0)
+			continue;
+		if (s->shm != NULL)
+			s->shm->publish(batch[i]);
+		if (s->stream != NULL)
+			s->stream->publish(batch[i]);
+		if (s->modbus != NULL)
+			s->modbus->update(batch[i]);
+		if (s->out != NULL)
+			b.output.push(batch[i]);
+	}
+}
+
+/*
+ write the samples a board queued for its output file, with outLock held
+ */
+static void writeOutput(Board& b) {
+	VImonSample sample;
+	Sinks *s = b.sinks;
+
+	while (b.output.pop(&sample)) {
+		if (s == NULL || s->out == NULL)
+			continue;
+		s->fmt.format(sample);
+		s->out->write(s->fmt);
+	}
+	if (s != NULL && s->out != NULL)
+		s->out->poll();
+}
+
+// output thread: formats and writes for all boards
+static void output() {
+	int i;
+
+	while (!stopping.load()) {
+		waitStop(I2Cclock::systemNs() + DAEMON_OUTPUT_MS * 1000000ULL);
+		for (i=0; i<numBoards; i++) {
+			std::lock_guard<std::mutex> lock(boards[i]->outLock);
+			writeOutput(*boards[i]);
+		}
+	}
+}
+
+/*
+ real-time settings of a bus thread, before its loop: nothing is
+ allocated or faulted in afterwards
+ */
+static void enterRealtime(Bus *bus) {
+	if (!bus->cpus.empty() && !VImonRealtime::setAffinity(bus->cpus.c_str()))
+		fprintf(stderr, "bus %d: unable to run on CPUs %s: %s\n", bus->number, bus->cpus.c_str(), strerror(errno));
+	if (bus->realtime > 0 && !VImonRealtime::setPriority(bus->realtime))
+		fprintf(stderr, "bus %d: unable to set SCHED_FIFO priority %d: %s\n", bus->number, bus->realtime, strerror(errno));
+	VImonRealtime::prefaultStack(VIMON_RT_STACK);
+	I2Cstats::attachThread();
+}
+
+/*
+ acquisition thread of a bus: a scheduled board paces itself, the others
+ are read every interval
+ */
+static void acquisition(Bus *bus) {
+	VImonSample sample;
+	uint64_t now, next;
+	int i;
+
+	I2Cdev::setBus(bus->i2c);
+	if (bus->realtime > 0 || !bus->cpus.empty())
+		enterRealtime(bus);
+	now = I2Cclock::systemNs();
+	for (i=0; i<bus->count; i++)
+		bus->boards[i]->dueNs = now;
+
+	while (!stopping.load()) {
+		next = UINT64_MAX;
+		for (i=0; i<bus->count && !stopping.load(); i++) {
+			Board& b = *bus->boards[i];
+			// the lock is not held while waiting for the board
+			if (b.scheduler != NULL) {
+				b.scheduler->step(&sample);
+				std::lock_guard<VImonMutex> lock(b.lock);
+				process(b, sample);
+				next = 0;
+				continue;
+			}
+			now = I2Cclock::systemNs();
+			if (now >= b.dueNs) {
+				bus->jitter.record(b.dueNs, now);
+				b.vimon.readSample(&sample);
+				{
+					std::lock_guard<VImonMutex> lock(b.lock);
+					process(b, sample);
+				}
+				// a late sample does not make the next ones early
+				b.dueNs += (uint64_t)b.config.intervalMs * 1000000ULL;
+				if (b.dueNs < now)
+					b.dueNs = now + (uint64_t)b.config.intervalMs * 1000000ULL;
+			}
+			if (b.dueNs < next)
+				next = b.dueNs;
+		}
+		now = I2Cclock::systemNs();
+		if (next > now && next != UINT64_MAX)
+			waitStop(next);
+	}
+}
+
+/*
+ probe and configure the boards of a bus, measure the settling and plan
+ the schedule
+ - returns false if a schedule can not be built
+ */
+static bool probe(Bus *bus) {
+	int i;
+
+	I2Cdev::setBus(bus->i2c);
+	for (i=0; i<bus->count; i++) {
+		Board& b = *bus->boards[i];
+		const VImonBoardConfig& c = b.config;
+		// an absent board is kept offline and probed again by the reads
+		if (!b.vimon.initialize(c.address))
+			fprintf(stderr, "%s: no ADS1115 at 0x%02x on bus %d, retrying\n", c.name.c_str(), c.address, c.bus);
+		if (c.settle && b.vimon.isOnline() && b.vimon.autoSettle() < 0)
+			fprintf(stderr, "%s: a channel did not settle\n", c.name.c_str());
+		if (b.scheduler != NULL && !b.scheduler->build()) {
+			b.scheduler->report(stderr);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ boards and buses of the configuration, every board initialised. The
+ buses are probed at the same time, a missing board costs its own bus
+ the timeouts only.
+ - returns false if the configuration can not be run
+ */
+static bool setup(const VImonConfig& config) {
+	std::thread probes[DAEMON_MAX_BUSES];
+	bool ok[DAEMON_MAX_BUSES];
+	size_t size = VIMON_ARENA_SLACK;
+	Bus *bus;
+	int i, j, ch;
+
+	// buses, boards and filters in one prefaulted block, the acquisition
+	// threads do not use the heap
+	for (i=0; i<config.getBoardCount(); i++) {
+		const VImonBoardConfig& c = config.getBoard(i);
+		size += sizeof(Board) + sizeof(I2CbusPi);	// a bus per board at most
+		if (c.gridMs > 0)
+			size += sizeof(VImonResampler);
+		if (c.isScheduled())
+			size += sizeof(VImonScheduler);
+	}
+	if (!arena.reserve(size)) {
+		fprintf(stderr, "unable to allocate %zu bytes for the boards\n", size);
+		return false;
+	}
+
+	for (i=0; i<config.getBoardCount(); i++) {
+		const VImonBoardConfig& c = config.getBoard(i);
+		for (j=0; j<numBuses && buses[j].number != c.bus; j++)
+			;
+		bus = &buses[j];
+		if (j == numBuses) {
+			bus->number = c.bus;
+			bus->i2c = arena.make<I2CbusPi>(c.bus);
+			bus->count = 0;
+			bus->realtime = 0;
+			numBuses++;
+		}
+		// the highest priority and the first CPU set of its boards
+		if (c.realtime > bus->realtime)
+			bus->realtime = c.realtime;
+		if (bus->cpus.empty())
+			bus->cpus = c.cpus;
+		if (c.isScheduled() && bus->count > 0) {
+			fprintf(stderr, "%s: a board with channel rates must be alone on its bus\n", c.name.c_str());
+			return false;
+		}
+		if (bus->count > 0 && bus->boards[0]->scheduler != NULL) {
+			fprintf(stderr, "%s: %s with channel rates must be alone on its bus\n",
+				c.name.c_str(), bus->boards[0]->config.name.c_str());
+			return false;
+		}
+
+		Board *b = arena.make<Board>();
+		boards[numBoards++] = b;
+		bus->boards[bus->count++] = b;
+		b->config = c;
+		b->resampler = NULL;
+		b->scheduler = NULL;
+		b->sinks = NULL;
+		b->calChanged = false;
+		b->quality.setBoard(&b->vimon);
+		b->vimon.setCalibration(c.cal);
+		b->vimon.setScanPlan(c.plan);
+		b->vimon.setAutoRange(c.autoRange);
+		b->vimon.setRate(c.rate);
+		if (c.gridMs > 0)
+			b->resampler = arena.make<VImonResampler>((uint64_t)c.gridMs * 1000000ULL);
+		if (c.isScheduled()) {
+			b->scheduler = arena.make<VImonScheduler>(&b->vimon);
+			for (ch=0; ch<VIMON_CHANNELS; ch++)
+				if (c.channelHz[ch] > 0.0)
+					b->scheduler->setChannel(ch, c.channelHz[ch], c.channelRate[ch]);
+		}
+	}
+	for (j=0; j<numBuses; j++)
+		probes[j] = std::thread([&ok, j]() { ok[j] = probe(&buses[j]); });
+	for (j=0; j<numBuses; j++)
+		probes[j].join();
+	for (j=0; j<numBuses; j++)
+		if (!ok[j])
+			return false;
+
+	for (i=0; i<numBoards; i++) {
+		Board *b = boards[i];
+		b->sinks = openSinks(*b, b->config, NULL, true);
+		if (b->sinks == NULL)
+			return false;
+		if (b->sinks->modbus != NULL)
+			b->sinks->modbus->setCalibration(b->config.cal);
+	}
+	return true;
+}
+
+/*
+ SIGHUP: calibration, filters and sinks of the new configuration
+ */
+static void reload() {
+	VImonConfig config;
+	Sinks *s, *old;
+	uint64_t t0 = I2Cclock::systemNs();
+	int i, j;
+
+	if (!config.load(configFile.c_str())) {
+		fprintf(stderr, "reload: %s, configuration kept\n", config.getError());
+		return;
+	}
+	for (i=0; i<config.getBoardCount(); i++) {
+		for (j=0; j<numBoards && boards[j]->config.name != config.getBoard(i).name; j++)
+			;
+		if (j == numBoards)
+			fprintf(stderr, "reload: new board %s needs a restart\n", config.getBoard(i).name.c_str());
+	}
+
+	for (i=0; i<numBoards; i++) {
+		Board& b = *boards[i];
+		j = config.find(b.config.name);
+		if (j < 0) {
+			fprintf(stderr, "reload: board %s removed, it runs until a restart\n", b.config.name.c_str());
+			continue;
+		}
+		const VImonBoardConfig& c = config.getBoard(j);
+		if (!c.sameAcquisition(b.config))
+			fprintf(stderr, "reload: %s: acquisition settings need a restart\n", c.name.c_str());
+
+		// opened aside, the acquisition only waits for the swap
+		s = openSinks(b, c, b.sinks, false);
+		if (s == NULL) {
+			fprintf(stderr, "reload: %s: sinks kept\n", c.name.c_str());
+			continue;
+		}
+		{
+			std::lock_guard<std::mutex> outLock(b.outLock);
+			// the queued samples go to the old file, lines in order when
+			// both write to the same file. The output is written under
+			// outLock only, the acquisition does not wait for the file
+			writeOutput(b);
+			old = b.sinks;
+			if (old->out != NULL)
+				old->out->flush();
+			std::lock_guard<VImonMutex> lock(b.lock);
+			b.sinks = s;
+			b.cal = c.cal;
+			b.calChanged = true;
+			if (s->modbus != NULL)
+				s->modbus->setCalibration(c.cal);
+		}
+		closeSinks(old);
+	}
+	fprintf(stderr, "reloaded %s in %.1f ms\n", configFile.c_str(), (double)(I2Cclock::systemNs() - t0) / 1e6);
+}
+
+static void printStatus(FILE *f) {
+	VImonEnergyTotals t;
+	char name[32];
+	int i;
+
+	for (i=0; i<numBoards; i++) {
+		Board& b = *boards[i];
+		b.energy.get(&t);
+		fprintf(f, "%s: %s, %u errors, %u recoveries, charge %.6f Ah %.6f Wh, discharge %.6f Ah %.6f Wh\n",
+			b.config.name.c_str(), b.vimon.isOnline() ? "online" : "offline",
+			b.vimon.getErrorCount(), b.vimon.getRecoveryCount(),
+			t.chargeAh, t.chargeWh, t.dischargeAh, t.dischargeWh);
+		if (b.output.drops() > 0)
+			fprintf(f, "%s: %llu samples not written, output too slow\n", b.config.name.c_str(),
+				(unsigned long long)b.output.drops());
+		if (b.scheduler != NULL)
+			b.scheduler->getJitter().report(f, b.config.name.c_str());
+	}
+	for (i=0; i<numBuses; i++) {
+		snprintf(name, sizeof(name), "bus %d", buses[i].number);
+		if (buses[i].jitter.getCount() > 0)
+			buses[i].jitter.report(f, name);
+	}
+	fflush(f);
+}
+
+static void shutdown() {
+	int i, j;
+
+	stopping.store(true);
+	{
+		std::lock_guard<VImonMutex> lock(stopMutex);
+	}
+	stopCv.notifyAll();
+	for (i=0; i<numBuses; i++)
+		if (buses[i].thread.joinable())
+			buses[i].thread.join();
+	if (outputThread.joinable())
+		outputThread.join();
+	for (i=0; i<numBuses; i++) {
+		I2Cdev::setBus(buses[i].i2c);
+		for (j=0; j<buses[i].count; j++) {
+			Board& b = *buses[i].boards[j];
+			if (b.sinks != NULL)
+				writeOutput(b);
+			closeSinks(b.sinks);
+			b.sinks = NULL;
+			b.vimon.powerDown();
+		}
+	}
+}
+
+static void showUsage(void) {
+	cout << "usage:" << endl;
+	cout << execName << " -cFILE -t -h" << endl;
+	cout << "c = configuration file (default " << VIMON_CONFIG_PATH << ", see vimon_config.h)" << endl;
+	cout << "t = check the configuration and exit" << endl;
+	cout << "h = show help" << endl;
+}
+
+static bool parseArguments(int argc, char *argv[]) {
+	int i;
+
+	execName = std::string(basename(argv[0]));
+	for (i=1; i<argc; i++) {
+		if (argv[i][0] != '-' || argv[i][1] == 0) {
+			showUsage();
+			return false;
+		}
+		switch (argv[i][1]) {
+			case 'c':
+				configFile = &argv[i][2];
+				break;
+			case 't':
+				checkOnly = true;
+				break;
+			case 'h':
+				showUsage();
+				return false;
+			default:
+				std::cerr << "unknown parameter <" << &argv[i][1] << ">" << endl;
+				showUsage();
+				return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	VImonConfig config;
+	struct timespec timeout = { 1, 0 };
+	sigset_t signals;
+	uint64_t t0 = I2Cclock::systemNs();
+	int i, sig;
+
+	if (!parseArguments(argc, argv))
+		exit(EXIT_FAILURE);
+	if (!config.load(configFile.c_str())) {
+		fprintf(stderr, "%s\n", config.getError());
+		exit(EXIT_FAILURE);
+	}
+	if (checkOnly) {
+		fprintf(stderr, "%s: %d boards\n", configFile.c_str(), config.getBoardCount());
+		exit(EXIT_SUCCESS);
+	}
+
+	// taken by sigtimedwait() below, every thread inherits the mask
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+	I2Cstats::installSignalHandler();
+
+	// everything touched from here on stays in memory
+	for (i=0; i<config.getBoardCount() && config.getBoard(i).realtime == 0; i++)
+		;
+	if (i < config.getBoardCount() && !VImonRealtime::lockMemory())
+		fprintf(stderr, "unable to lock the memory: %s\n", strerror(errno));
+
+	if (!setup(config)) {
+		shutdown();
+		exit(EXIT_FAILURE);
+	}
+	outputThread = std::thread(output);
+	for (i=0; i<numBuses; i++)
+		buses[i].thread = std::thread(acquisition, &buses[i]);
+	fprintf(stderr, "started %d boards on %d buses in %.1f ms\n", numBoards, numBuses,
+		(double)(I2Cclock::systemNs() - t0) / 1e6);
+
+	for (;;) {
+		sig = sigtimedwait(&signals, NULL, &timeout);
+		if (sig == SIGTERM || sig == SIGINT)
+			break;
+		if (sig == SIGHUP)
+			reload();
+		// "kill -USR1" dumps the I2C statistics and the energy totals
+		if (I2Cstats::pollSignal(stderr))
+			printStatus(stderr);
+	}
+
+	t0 = I2Cclock::systemNs();
+	shutdown();
+	fprintf(stderr, "stopped in %.1f ms\n", (double)(I2Cclock::systemNs() - t0) / 1e6);
+	exit(EXIT_SUCCESS);
+}